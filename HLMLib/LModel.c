@@ -1983,6 +1983,177 @@ float GetNGramProb(BackOffLM *lm, NameId *words, int nSize)
 }
 
 
+/*------------------ History-keyed probability cache ------------------*/
+
+/*
+   An NGramCache remembers, for recently seen histories, the FLEntry
+   reached for each suffix of the history so that repeated lookups
+   with the same context need only search the SMEntry arrays instead
+   of walking down the tree again for every back-off level.  The
+   cache is a direct-mapped table of nSlots entries and holds its own
+   access statistics so that a cache owned by a single thread can be
+   used concurrently with caches belonging to other threads on the
+   same (read-only) LM.  Class LMs and T_PROB tracing bypass the cache.
+*/
+
+struct _NGramCache {
+   BackOffLM *lm;           /* LM whose probabilities are cached */
+   int nSlots;              /* number of slots (power of 2) */
+   int hSize;               /* max history length held in a slot */
+   int *hLen;               /* [nSlots] history length, -1 if unused */
+   int *resolved;           /* [nSlots] bit k set if ctx[k] is known */
+   NameId *hist;            /* [nSlots*hSize] history of each slot */
+   FLEntry **ctx;           /* [nSlots*(hSize+1)] context of length k */
+   long nHits;              /* history found in cache */
+   long nMiss;              /* history not found in cache */
+   AccessInfo aInfo[LM_NSIZE];  /* access stats since last flush */
+};
+
+/* EXPORT->CreateNGramCache: create a probability cache for lm */
+NGramCache *CreateNGramCache(MemHeap *heap, BackOffLM *lm, int nSlots)
+{
+   NGramCache *c;
+   int i,n;
+
+   if (nSlots<1)
+      HError(15490,"CreateNGramCache: bad cache size %d",nSlots);
+   for (n=1; n<nSlots; n*=2);
+   c = (NGramCache *) New(heap,sizeof(NGramCache));
+   c->lm = lm; c->nSlots = n;
+   c->hSize = (lm->nSize>1) ? lm->nSize-1 : 1;
+   c->hLen = (int *) New(heap,n*sizeof(int));
+   c->resolved = (int *) New(heap,n*sizeof(int));
+   c->hist = (NameId *) New(heap,n*c->hSize*sizeof(NameId));
+   c->ctx = (FLEntry **) New(heap,n*(c->hSize+1)*sizeof(FLEntry *));
+   for (i=0; i<n; i++) {
+      c->hLen[i] = -1; c->resolved[i] = 0;
+   }
+   c->nHits = c->nMiss = 0;
+   for (i=0; i<LM_NSIZE; i++) {
+      c->aInfo[i].count = 0;
+      c->aInfo[i].nboff = c->aInfo[i].nmiss = c->aInfo[i].nhits = 0;
+      c->aInfo[i].prob = c->aInfo[i].prob2 = 0.0;
+   }
+   return c;
+}
+
+/* CachedLookup: as GetNGramProb but with the FLEntry for the context of
+   length k taken from (or resolved into) ctx[k] */
+static float CachedLookup(NGramCache *c, FLEntry **ctx, int *resolved,
+                          NameId *words, int nSize)
+{
+   int i;
+   float prob;
+   SMEntry *se;
+   FLEntry *fe;
+   AccessInfo *acs;
+   BackOffLM *lm = c->lm;
+   char *s, sbuf[256];
+
+   acs = c->aInfo+nSize; acs->count++;
+   if (nSize==1) {
+      if ((se = FindSE(lm->root.sea,0,lm->root.nse,LM_INDEX(words[0])))==NULL)
+	 HError(15490,"GetCachedNGramProb: Unable to find %s in unigrams",words[0]->name);
+#ifdef LM_COMPACT
+      prob = Shrt2Prob(se->prob) * lm->gScale;
+#else
+      prob = se->prob;
+#endif
+   } else {
+      if ((*resolved & (1<<(nSize-1))) == 0) {
+	 for (fe=&(lm->root), i=0; i<nSize-1; i++) {
+	    if ((fe=FindFE(fe->fea, 0, fe->nfe, LM_INDEX(words[i])))==NULL)
+	       break;
+	 }
+	 ctx[nSize-1] = fe; *resolved |= 1<<(nSize-1);
+      }
+      fe = ctx[nSize-1];
+      if ((fe == NULL) || (fe->nse == 0)) {
+	 prob = CachedLookup(c,ctx,resolved,words+1,nSize-1);
+	 acs->nmiss++;
+	 if ((trace&T_TOP) &&  (fe != NULL) && (fe->nse == 0)) {
+	    for (s = sbuf, i=0; i<nSize-1; i++) {
+	       sprintf(s,"%s ",words[i]->name); s+=strlen(s);
+	    }
+	    HError(-15492, "GetCachedNGramProb: FLEntry.nse==0; original ARPA LM?\n%s",sbuf);
+	 }
+      } else if ((se = FindSE(fe->sea, 0, fe->nse, LM_INDEX(words[nSize-1])))!=NULL) {
+#ifdef LM_COMPACT
+	 prob = Shrt2Prob(se->prob) * lm->gScale;
+#else
+	 prob = se->prob;
+#endif
+	 acs->nhits++;
+      } else {
+	 prob = CachedLookup(c,ctx,resolved,words+1,nSize-1);
+	 if (lm->probType==LMP_FLOAT)
+	    prob *= fe->bowt;
+	 else
+	    prob += fe->bowt;
+	 acs->nboff++;
+      }
+   }
+   acs->prob += prob; acs->prob2 += prob*prob;
+   return prob;
+}
+
+/* EXPORT->GetCachedNGramProb: cached version of GetNGramProb */
+float GetCachedNGramProb(NGramCache *c, NameId *words, int nSize)
+{
+   int i,h,slot;
+   unsigned long key;
+   NameId *hist;
+   BackOffLM *lm = c->lm;
+
+   if (lm->classLM || (trace&T_PROB))
+      return GetNGramProb(lm,words,nSize);
+   if (nSize > lm->nSize) {
+      words += nSize-lm->nSize; nSize = lm->nSize;
+   }
+   h = nSize-1;
+   for (key=h, i=0; i<h; i++)
+      key = key*31 + ((unsigned long) words[i] >> 3);
+   slot = key & (c->nSlots-1);
+   hist = c->hist + slot*c->hSize;
+   for (i=0; i<h && c->hLen[slot]==h; i++)
+      if (hist[i]!=words[i]) break;
+   if (c->hLen[slot]==h && i==h)
+      c->nHits++;
+   else {
+      c->nMiss++;
+      for (i=0; i<h; i++) hist[i] = words[i];
+      c->hLen[slot] = h; c->resolved[slot] = 0;
+   }
+   return CachedLookup(c, c->ctx+slot*(c->hSize+1), c->resolved+slot,
+                       words, nSize);
+}
+
+/* EXPORT->FlushNGramCacheStats: move cache access stats into the LM */
+void FlushNGramCacheStats(NGramCache *c)
+{
+   int i;
+   AccessInfo *ai,*ci;
+
+   for (i=1; i<=c->lm->nSize; i++) {
+      ci = c->aInfo+i;
+      if ((ai=c->lm->gInfo[i].aInfo)!=NULL) {
+	 ai->count += ci->count;
+	 ai->nboff += ci->nboff; ai->nmiss += ci->nmiss; ai->nhits += ci->nhits;
+	 ai->prob += ci->prob; ai->prob2 += ci->prob2;
+      }
+      ci->count = 0;
+      ci->nboff = ci->nmiss = ci->nhits = 0;
+      ci->prob = ci->prob2 = 0.0;
+   }
+}
+
+/* EXPORT->GetNGramCacheStats: return and reset cache hit/miss counts */
+void GetNGramCacheStats(NGramCache *c, long *nHits, long *nMiss)
+{
+   *nHits = c->nHits; *nMiss = c->nMiss;
+   c->nHits = c->nMiss = 0;
+}
+
 /* EXPORT-> LMTrans: calls GetNGramProb, but instead of taking a full
    n-gram of context we take a pointer to a context and a single word;
    we also return a langage model context state */
@@ -73,6 +73,7 @@ extern "C" {
 #define DEF_ENDWORD     "</s>"
 
 typedef struct _AccessInfo  AccessInfo; /* abstract type for access stats structure */
+typedef struct _NGramCache  NGramCache; /* abstract type for probability cache */
 
 typedef enum {       /* external file format definitions */
   LMF_TEXT, LMF_BINARY, LMF_ULTRA, LMF_OTHER
@@ -268,6 +269,33 @@ float *GetNGramProbVecSE(BackOffLM *lm, int *nId, int nSize, FLEntry *sfe);
 */
 
 
+/*------------------- Cached N-gram access -------------------*/
+
+NGramCache *CreateNGramCache(MemHeap *heap, BackOffLM *lm, int nSlots);
+/*
+   Create a history-keyed probability cache for lm with nSlots
+   (rounded up to a power of 2) entries.  A cache must only be
+   used by one thread at a time.
+*/
+
+float GetCachedNGramProb(NGramCache *cache, NameId *words, int G);
+/*
+   As GetNGramProb but using cache to avoid repeating the context
+   searches for recently seen histories.  Access statistics are
+   held in the cache until FlushNGramCacheStats is called.
+*/
+
+void FlushNGramCacheStats(NGramCache *cache);
+/*
+   Add the access statistics held in cache to those of its LM
+*/
+
+void GetNGramCacheStats(NGramCache *cache, long *nHits, long *nMiss);
+/*
+   Return and reset the number of cache hits and misses
+*/
+
+
 LogFloat LMTrans2(LModel *LM, LMState src, LabId wdid, LMState *dest);
 
 
@@ -38,6 +38,7 @@ char *Cluster_vc_id = "$Id: Cluster.c,v 1.1.1.1 2006/10/11 09:54:43 jal58 Exp $"
 #include "HMath.h"
 #include "HWave.h"
 #include "HLabel.h"
+#include "HThreads.h"
 #include "LUtil.h"
 #include "LWMap.h"
 #include "LGBase.h"
@@ -97,6 +98,28 @@ bigrams;
 
 typedef UInt unigram;   /* Occurrence count */
 
+/* Class counts which result from moving a word to a given class */
+typedef struct {
+   int *c1;                     /* Class counts C(G(w),*) */
+   int *c2;                     /* Class counts C(*,G(w)) */
+   int *c3;                     /* Class counts C(g,*) */
+   int *c4;                     /* Class counts C(*,g) */
+   int  GwGw, gGw, Gwg, gg;     /* Special-case class counts */
+}
+move_info;
+
+/* A word being considered for a move, and the effect of each move */
+typedef struct {
+   UInt    w;                   /* Word id */
+   Boolean valid;               /* Word may be moved */
+   int     from;                /* Class word is currently in */
+   int    *sum1;                /* Word-class bigram counts C(w,*) */
+   int    *sum2;                /* Word-class bigram counts C(*,w) */
+   double *change;              /* Change in ML value for each class */
+   double  best_change;         /* ...and for the chosen class */
+}
+word_info;
+
 
 /* ---------------------- Global Variables ----------------------- */
 /* DEFAULTS */
@@ -113,22 +136,16 @@ static Boolean     inCMapRaw = FALSE;       /* Input classes in raw mode */
 /* Used by core clusterer */
 static int       **clCnt=NULL;              /* Array of arrays; index with count[c1][c2]
                                                (clCnt = 'class count') */
-static int        *tmp_c1=NULL;             /* Temporary set of bigrams (1) */
-static int        *tmp_c2=NULL;             /* Temporary set of bigrams (2) */
-static int        *tmp_c3=NULL;             /* Temporary set of bigrams (3) */
-static int        *tmp_c4=NULL;             /* Temporary set of bigrams (4) */
-static int        *tmp_sum1=NULL;           /* Temporary word-class counts (1) */
-static int        *tmp_sum2=NULL;           /* Temporary word-class counts (2) */
+static move_info  *moves=NULL;              /* Move scratch space [threads] */
+static word_info  *winfo=NULL;              /* Words being considered [batch_size] */
 static int        *clSum=NULL;              /* Class unigram [classes]
                                                returns word unigram sum */
 static int	  *clMemb=NULL;             /* Class membership [words]
                                                returns class given a word */
-static int         GwGw, gGw, Gwg, gg;      /* Special-case class counts */
 static double     *mlv;                     /* ML values involving class [N] */
 static int        *bipair;                  /* Array of word bigrams (w,w) */
 static int         sum_of_all_bigram_counts;/* Sum of all bigram counts */
 static int         sum_of_all_uni_counts;   /* Sum of all unigram counts */
-static int         curr_class;              /* Temporary value, saves passing */
 static int         start_class = 2;         /* Which is the first 'real' class? */
 static double      curr_MLV=0;              /* ...and its current value */
 static int         W = 0;     		    /* Number of words */
@@ -171,6 +188,12 @@ static int          sort_order = SORT_WMAP; /* Order words are considered in */
 static int         *sort_uni;               /* Sort unigrams by count */
 static Boolean     outCMapRawTrap = FALSE;  /* Has this been changed by config file? */
 static Boolean     inCMapRawTrap = FALSE;   /* Has this been changed by config file? */
+/* Parallel clustering */
+static int          num_threads = 1;        /* Number of threads to use */
+static int          num_chunks = 1;         /* Number of class chunks per word */
+static int          batch_size = 1;         /* Number of words evaluated together */
+static Boolean      exact_batch = FALSE;    /* Batches give same result as serial? */
+static ThreadPool  *pool = NULL;            /* Worker threads */
 
 /* ---------------- Function Prototypes -------------------------- */
 
@@ -280,8 +303,11 @@ void ReportUsage(void)
 {
    printf("\nUSAGE: Cluster [options] mapfile gramfile ...\n\n");
    printf(" Option                                       Default\n");
+   printf(" -b n    evaluate words in batches of n       %d\n", batch_size);
    printf(" -c n    use n classes                        %d\n", classes_get_default());
+   printf(" -e      make batches match serial results    %s\n", exact_batch?"on":"off");
    printf(" -i n    perform n iterations                 1\n");
+   printf(" -j n    use n threads                        %d\n", num_threads);
    printf(" -k      put unknown word in a separate class off\n");
    printf(" -l f    start from existing classmap 'f'     off\n");
    printf(" -m      add running ML values to logfile     %s\n", show_MLV?"on":"off");
@@ -443,12 +469,19 @@ void classes_init(int numb_words)
    }
    class_sort = CNew(&global_stack, W * sizeof(UInt));
    clSum = CNew(&global_stack, N * sizeof(int));
-   tmp_c1 = CNew(&global_stack, N * sizeof(int));
-   tmp_c2 = CNew(&global_stack, N * sizeof(int));
-   tmp_c3 = CNew(&global_stack, N * sizeof(int));
-   tmp_c4 = CNew(&global_stack, N * sizeof(int));
-   tmp_sum1 = CNew(&global_stack, N * sizeof(int));
-   tmp_sum2 = CNew(&global_stack, N * sizeof(int));
+   moves = CNew(&global_stack, num_threads * sizeof(move_info));
+   for (i=0; i<num_threads; i++) {
+      moves[i].c1 = CNew(&global_stack, N * sizeof(int));
+      moves[i].c2 = CNew(&global_stack, N * sizeof(int));
+      moves[i].c3 = CNew(&global_stack, N * sizeof(int));
+      moves[i].c4 = CNew(&global_stack, N * sizeof(int));
+   }
+   winfo = CNew(&global_stack, batch_size * sizeof(word_info));
+   for (i=0; i<batch_size; i++) {
+      winfo[i].sum1 = CNew(&global_stack, N * sizeof(int));
+      winfo[i].sum2 = CNew(&global_stack, N * sizeof(int));
+      winfo[i].change = CNew(&global_stack, N * sizeof(double));
+   }
    mlv = CNew(&global_stack, N * sizeof(double));
    sort_uni = CNew(&global_stack, W * sizeof(int));
    if (!clMemb)
@@ -461,6 +494,11 @@ void classes_init(int numb_words)
       printf("Class memory allocated\n");
    }
 
+   /* Start worker threads; each word's candidate classes are split
+      into a few chunks per thread to balance the load */
+   pool = CreateThreadPool(&global_stack, num_threads);
+   num_chunks = (num_threads>1) ? 4*num_threads : 1;
+
    /* Create array of bigram (w,w) pair counts (ie. word followed by itself) */
    bipair = CNew(&global_stack, W * sizeof(int));
    for (i=0; i<W; i++) {
@@ -475,155 +513,227 @@ void classes_init(int numb_words)
 }
 
 
-/* See what change results when word 'w' moved to class 'g' */
-static void classes_change(UInt w, int g)
+/* See what change results when word wi->w is moved to class 'g' */
+static void classes_change(word_info *wi, int g, move_info *mv)
 {
    register int i;
-
-   /* tmp_c1[] stores the set of class counts C(G(w),*)
-      tmp_c2[] stores the set of class counts C(*,G(w))
-      tmp_c3[] stores the set of class counts C(g,*)
-      tmp_c4[] stores the set of class counts C(*,g)
-      tmp_sum1[] stores the bigram class counts C(w,*)
-      tmp_sum2[] stores the bigram class counts C(*,w) */
+   int from = wi->from;
+   int *sum1 = wi->sum1, *sum2 = wi->sum2;
+
+   /* mv->c1[] stores the set of class counts C(G(w),*)
+      mv->c2[] stores the set of class counts C(*,G(w))
+      mv->c3[] stores the set of class counts C(g,*)
+      mv->c4[] stores the set of class counts C(*,g)
+      sum1[] stores the bigram class counts C(w,*)
+      sum2[] stores the bigram class counts C(*,w) */
    
    /* Loop over all classes */
    for (i=0; i<N; i++) {
-      if (i!=curr_class && i!=g) {
-         if (tmp_sum1[i]) {
+      if (i!=from && i!=g) {
+         if (sum1[i]) {
             /* (G(w),gi) => -C(w,gi) */
-            tmp_c1[i] = clCnt[curr_class][i] - tmp_sum1[i];
+            mv->c1[i] = clCnt[from][i] - sum1[i];
             /* (g,gi)    => +C(w,gi) */
-            tmp_c3[i] = clCnt[g][i] + tmp_sum1[i];
+            mv->c3[i] = clCnt[g][i] + sum1[i];
          }
          else {
-            tmp_c1[i] = clCnt[curr_class][i];
-            tmp_c3[i] = clCnt[g][i];
+            mv->c1[i] = clCnt[from][i];
+            mv->c3[i] = clCnt[g][i];
          }
-         if (tmp_sum2[i]) {
+         if (sum2[i]) {
             /* (gi,G(w)) => -C(gi,w) */
-            tmp_c2[i] = clCnt[i][curr_class] - tmp_sum2[i];
+            mv->c2[i] = clCnt[i][from] - sum2[i];
             /* (gi,g)    => +C(gi,w) */
-            tmp_c4[i] = clCnt[i][g] + tmp_sum2[i];
+            mv->c4[i] = clCnt[i][g] + sum2[i];
          }
          else {
-            tmp_c2[i] = clCnt[i][curr_class];
-            tmp_c4[i] = clCnt[i][g];
+            mv->c2[i] = clCnt[i][from];
+            mv->c4[i] = clCnt[i][g];
          }
       }
    }
   
    /* Calculate correct values for class-to-or-from-only pairs */
    /* (G(w),G(w)) => -C(w,G(x)) - C(G(x),w) + C(w,w) */
-   GwGw =   clCnt[curr_class][curr_class]
-          - tmp_sum1[curr_class] - tmp_sum2[curr_class] + bipair[w];
+   mv->GwGw =   clCnt[from][from]
+              - sum1[from] - sum2[from] + bipair[wi->w];
    /* (G(w),g)    => -C(w,g) + C(G(x),w) - C(w,w) */
-   Gwg  =   clCnt[curr_class][g]
-          - tmp_sum1[g] + tmp_sum2[curr_class] - bipair[w];
+   mv->Gwg  =   clCnt[from][g]
+              - sum1[g] + sum2[from] - bipair[wi->w];
    /* (g,G(w))    => -C(g,w) + C(w,G(x)) - C(w,w) */
-   gGw  =   clCnt[g][curr_class]
-          - tmp_sum2[g] + tmp_sum1[curr_class] - bipair[w];
+   mv->gGw  =   clCnt[g][from]
+              - sum2[g] + sum1[from] - bipair[wi->w];
    /* (g,g)       => +C(w,g) + C(g,w) + C(w,w) */
-   gg   =   clCnt[g][g]
-          + tmp_sum1[g] + tmp_sum2[g] + bipair[w];
+   mv->gg   =   clCnt[g][g]
+              + sum1[g] + sum2[g] + bipair[wi->w];
 }
 
 
-/* Decide on a class to move word 'w' to. Returns class index. */
-static int choose_class(UInt w)
+/* Calculate the change in the optimisation value if word wi->w
+   is moved to class 'g', using mv for scratch space */
+static double move_change(word_info *wi, int g, move_info *mv)
 {
-   register int i;
    register int j;
    double d;             /* Change in optimisation value */
    int uniGx, unig;
-   int best_class;
-   double best_change;
    double start_value;
-   
-   best_class = curr_class;
-   best_change = 0;
+   UInt w = wi->w;
+   int from = wi->from;
+
+   d = 0;
+   classes_change(wi, g, mv);
+
+   /* Word has moved to class g, so see how this would change our
+      optimisation equation */
+   uniGx = clSum[from] - uni[w];
+   unig  = clSum[g] + uni[w];
+
+   /* Counts involving original class and a new class */
+   for (j=0; j<N; j++) {
+      if ((j!=from) && (j!=g)) {
+         if (mv->c1[j]) {
+            d += ((double)mv->c1[j]) * log(mv->c1[j]);
+         }
+         if (mv->c2[j]) {
+            d += ((double)mv->c2[j]) * log(mv->c2[j]);
+         }
+         if (mv->c3[j]) {
+            d += ((double)mv->c3[j]) * log(mv->c3[j]);
+         }
+         if (mv->c4[j]) {
+            d += ((double)mv->c4[j]) * log(mv->c4[j]);
+         }
+      }
+   }
+   /* Unigram part of summation */
+   if (uniGx) {
+      d -= 2*(((double)uniGx)*log(uniGx));
+   }
+   if (unig) {
+      d -= 2*(((double)unig)*log(unig));
+   }
+
+   /* Exceptions */
+   if (mv->GwGw) {
+      d += ((double)mv->GwGw) * log(mv->GwGw);
+   }
+   if (mv->Gwg) {
+      d += ((double)mv->Gwg) * log(mv->Gwg);
+   }
+   if (mv->gGw) {
+      d += ((double)mv->gGw) * log(mv->gGw);
+   }
+   if (mv->gg) {
+      d += ((double)mv->gg) * log(mv->gg);
+   }
+
+   /* Now make 'd' into a difference: */
+   start_value = mlv[from] + mlv[g];
+   /* Subtract off the two values we added twice by using mlv[] */
+   if (clCnt[from][g])
+      start_value -= clCnt[from][g]*log(clCnt[from][g]);
+   if (clCnt[g][from])
+      start_value -= clCnt[g][from]*log(clCnt[g][from]);
+   /* And calculate 'd': */
+   return d - start_value;
+}
+
+
+/* Create set of bigram class counts C(w,*) and C(*,w) for word wi->w
+   (for * = any class) */
+static void word_counts(word_info *wi)
+{
+   register int i;
+   UInt w = wi->w;
 
-   /* Create set of forward bigram class counts, C(w,*) and C(*,w)
-      (for * = any class) */
    for (i=0; i<N; i++) {
-      tmp_sum1[i] = 0;
-      tmp_sum2[i] = 0;
+      wi->sum1[i] = 0;
+      wi->sum2[i] = 0;
    }
    for (i=0; i<forward[w].size; i++) {
-      tmp_sum1[clMemb[forward[w].bi[i].id]] += forward[w].bi[i].count;
+      wi->sum1[clMemb[forward[w].bi[i].id]] += forward[w].bi[i].count;
    }
    for (i=0; i<backward[w].size; i++) {
-      tmp_sum2[clMemb[backward[w].bi[i].id]] += backward[w].bi[i].count;
+      wi->sum2[clMemb[backward[w].bi[i].id]] += backward[w].bi[i].count;
    }
+}
 
-  /* Try all classes */
-   for (i=start_class; i<N; i++) {
-      if (i==curr_class || uni[w]==0) {
-         /* If we have no information about this word, or its a self-move, don't
-            bother (self-move gives zero change) */
+
+/* Thread task: evaluate moving a word to one chunk of the classes */
+static void eval_classes_task(int thread, int task, Ptr arg)
+{
+   word_info *wi = (word_info *)arg;
+   int i, lo, hi, chunk;
+
+   chunk = (N - start_class + num_chunks - 1) / num_chunks;
+   lo = start_class + task*chunk;
+   hi = lo + chunk;
+   if (hi>N) hi = N;
+   for (i=lo; i<hi; i++) {
+      if (i==wi->from) {
+         wi->change[i] = 0;
          continue;
       }
+      wi->change[i] = move_change(wi, i, &moves[thread]);
+   }
+}
 
-      d = 0;
-      classes_change(w, i);
 
-      /* Word has moved to class i, so see how this would change our
-         optimisation equation */
-      uniGx = clSum[curr_class] - uni[w];
-      unig  = clSum[i] + uni[w];
+/* Thread task: evaluate moving one word of a batch to every class */
+static void eval_word_task(int thread, int task, Ptr arg)
+{
+   word_info *wi = ((word_info *)arg) + task;
+   int i;
 
-      /* Counts involving original class and a new class */
-      for (j=0; j<N; j++) {
-         if ((j!=curr_class) && (j!=i)) {
-            if (tmp_c1[j]) {
-               d += ((double)tmp_c1[j]) * log(tmp_c1[j]);
-            }
-            if (tmp_c2[j]) {
-               d += ((double)tmp_c2[j]) * log(tmp_c2[j]);
-            }
-            if (tmp_c3[j]) {
-               d += ((double)tmp_c3[j]) * log(tmp_c3[j]);
-            }
-            if (tmp_c4[j]) {
-               d += ((double)tmp_c4[j]) * log(tmp_c4[j]);
-            }
-         }
-      }
-      /* Unigram part of summation */
-      if (uniGx) {
-         d -= 2*(((double)uniGx)*log(uniGx));
-      }
-      if (unig) {
-         d -= 2*(((double)unig)*log(unig));
+   if (!wi->valid)
+      return;
+   wi->from = clMemb[wi->w];
+   word_counts(wi);
+   for (i=start_class; i<N; i++) {
+      if (i==wi->from) {
+         wi->change[i] = 0;
+         continue;
       }
+      wi->change[i] = move_change(wi, i, &moves[thread]);
+   }
+}
 
-      /* Exceptions */
-      if (GwGw) {
-         d += ((double)GwGw) * log(GwGw);
-      }
-      if (Gwg) {
-         d += ((double)Gwg) * log(Gwg);
-      }
-      if (gGw) {
-         d += ((double)gGw) * log(gGw);
-      }
-      if (gg) {
-         d += ((double)gg) * log(gg);
+
+/* Evaluate moving word wi->w to every class, spreading the
+   classes over the thread pool */
+static void eval_word(word_info *wi)
+{
+   word_counts(wi);
+   RunThreadTasks(pool, num_chunks, eval_classes_task, wi);
+}
+
+
+/* Decide on a class to move word wi->w to, given the changes
+   calculated by eval_word(). Returns class index. */
+static int choose_class(word_info *wi)
+{
+   register int i;
+   double d;             /* Change in optimisation value */
+   int best_class;
+   double best_change;
+   UInt w = wi->w;
+   
+   best_class = wi->from;
+   best_change = 0;
+
+  /* Try all classes */
+   for (i=start_class; i<N; i++) {
+      if (i==wi->from || uni[w]==0) {
+         /* If we have no information about this word, or its a self-move, don't
+            bother (self-move gives zero change) */
+         continue;
       }
 
-      /* Now make 'd' into a difference: */
-      start_value = mlv[curr_class] + mlv[i];
-      /* Subtract off the two values we added twice by using mlv[] */
-      if (clCnt[curr_class][i])
-         start_value -= clCnt[curr_class][i]*log(clCnt[curr_class][i]);
-      if (clCnt[i][curr_class])
-         start_value -= clCnt[i][curr_class]*log(clCnt[i][curr_class]);
-      /* And calculate 'd': */
-      d = d - start_value;
+      d = wi->change[i];
 
       if (verbose && logfile) {
          fprintf(logfile, "...moving word %d to class %d from class %d gives %f change\n",
-                 w, i, curr_class, d);
+                 w, i, wi->from, d);
       }
 
       if (d>best_change) {
@@ -644,10 +754,7 @@ static int choose_class(UInt w)
       }
    }
 
-   if (show_MLV) {
-      curr_MLV += best_change;
-   }
-
+   wi->best_change = best_change;
    return best_class;
 }
 
@@ -663,9 +770,12 @@ static int freq_sort_order(int *in1, int *in2)
 static void do_one_iteration(int w_period, int start_word)
 {
    UInt w, j, w_index;
-   int to;
+   int to, from, b, nb;
    FILE *file;
    Boolean pipe_status;
+   Boolean moved;
+   word_info *wi;
+   move_info *mv = &moves[0];
    int total_warnings=0;
 
    for (w=0; w<W; w++) {
@@ -675,167 +785,204 @@ static void do_one_iteration(int w_period, int start_word)
       qsort(sort_uni, W, sizeof(int), (int (*) (const void *, const void *)) &freq_sort_order);
    }
 
-   for (w_index=start_word; w_index<W; w_index++) {
-      w = sort_uni[w_index];
-
-      if (w_period && w%w_period==0) {
-         /* Write recovery file */
-         export_classes(1);
-         sprintf(tmp, "%.150s.recovery", export_prefix);
-         file = FOpen(tmp, NoOFilter, &pipe_status);
-         check_file(file, tmp, "do_one_iteration");
-         fprintf(file, "Clustering automatic recovery status file\n");
-         fprintf(file, "Clustered up to (excluding) word: %d\n", w_index);
-         fprintf(file, "Clusters are stored in: %.150s.recovery.cm\n", export_prefix);
-         fprintf(file, "Keep unknown word token separate: %d\n", unk_sep?1:0);
-         fprintf(file, "Sort order: %s\n", (sort_order==SORT_WMAP)?"WMAP":"FREQ");
-         FClose(file, pipe_status);
+   for (w_index=start_word; w_index<W; w_index+=nb) {
+      /* Evaluate a batch of words in parallel against the current
+         class counts; the moves are then made in word order below */
+      nb = (W-w_index < batch_size) ? W-w_index : batch_size;
+      for (b=0; b<nb; b++) {
+         w = winfo[b].w = sort_uni[w_index+b];
+         winfo[b].valid = !((w==start_id) || (w==end_id) || 
+                            (unk_sep && (w==unk_id)) || uni[w]==0);
       }
-
-      if ((w==start_id) || (w==end_id) || (unk_sep && (w==unk_id))) {
-         /* We don't want to move this special token, so skip it */
-         continue;
+      if (nb>1) {
+         RunThreadTasks(pool, nb, eval_word_task, winfo);
       }
-
-      if (uni[w]==0) {
-         /* Word is in wordlist but not used, so warn */
-         if (total_warnings<10) {
-            HError(-17053, "Word '%s' is in word map but not in any gram files", what_is_word(w));
+      moved = FALSE;
+      for (b=0; b<nb; b++) {
+         wi = winfo+b;
+         w = wi->w;
+
+         if (w_period && w%w_period==0) {
+            /* Write recovery file */
+            export_classes(1);
+            sprintf(tmp, "%.150s.recovery", export_prefix);
+            file = FOpen(tmp, NoOFilter, &pipe_status);
+            check_file(file, tmp, "do_one_iteration");
+            fprintf(file, "Clustering automatic recovery status file\n");
+            fprintf(file, "Clustered up to (excluding) word: %d\n", w_index+b);
+            fprintf(file, "Clusters are stored in: %.150s.recovery.cm\n", export_prefix);
+            fprintf(file, "Keep unknown word token separate: %d\n", unk_sep?1:0);
+            fprintf(file, "Sort order: %s\n", (sort_order==SORT_WMAP)?"WMAP":"FREQ");
+            FClose(file, pipe_status);
          }
-         else if (total_warnings==10) {
-            HError(-17053, "Suppressing further word 'x' not in gram file warnings");
-         }
-         total_warnings++;
-         continue;
-      }
 
-      if (logfile) {
-         if (verbose) {
-            fprintf(logfile, "...deciding whether/where to move word %d (of %d - %2.2f%% done) [id=%d]\n",
-                    w_index, W, ((float)w_index/(float)W)*100.0, w);
-         }
-         else {
-            fprintf(logfile, "%d [%d] (%2.2f%%):\t", w_index, w, ((float)w_index/(float)W)*100.0);
+         if ((w==start_id) || (w==end_id) || (unk_sep && (w==unk_id))) {
+            /* We don't want to move this special token, so skip it */
+            continue;
          }
-      }
 
-      curr_class = clMemb[w]; /* Find out what class word is currently in */
-      to = choose_class(w);   /* Work out where to move it to */
+         if (uni[w]==0) {
+            /* Word is in wordlist but not used, so warn */
+            if (total_warnings<10) {
+               HError(-17053, "Word '%s' is in word map but not in any gram files", what_is_word(w));
+            }
+            else if (total_warnings==10) {
+               HError(-17053, "Suppressing further word 'x' not in gram file warnings");
+            }
+            total_warnings++;
+            continue;
+         }
 
-      if (curr_class != to) {
          if (logfile) {
             if (verbose) {
-               fprintf(logfile, "...moving word id %d from class %d to class %d\n", w, curr_class, to);
+               fprintf(logfile, "...deciding whether/where to move word %d (of %d - %2.2f%% done) [id=%d]\n",
+                       w_index+b, W, ((float)(w_index+b)/(float)W)*100.0, w);
             }
             else {
-               fprintf(logfile, "-> %d\n", to);
+               fprintf(logfile, "%d [%d] (%2.2f%%):\t", w_index+b, w, ((float)(w_index+b)/(float)W)*100.0);
             }
-            fflush(logfile);
          }
 
-         classes_change(w, to); /* Calculate new unigram and bigram values */
-
-         /* Remove influence of these two classes from MLV values */
-         for (j=0; j<N; j++) {
-            if (j!=to && j!=curr_class) {
-               if (clCnt[to][j])
-                  mlv[j] -= ((double)clCnt[to][j]) * log(clCnt[to][j]);
-               if (clCnt[j][to])
-                  mlv[j] -= ((double)clCnt[j][to]) * log(clCnt[j][to]);
-               if (clCnt[curr_class][j])
-                  mlv[j] -= ((double)clCnt[curr_class][j]) * log(clCnt[curr_class][j]);
-               if (clCnt[j][curr_class])
-                  mlv[j] -= ((double)clCnt[j][curr_class]) * log(clCnt[j][curr_class]);
-            }
+         from = wi->from = clMemb[w]; /* Find out what class word is currently in */
+         if (nb==1 || (moved && exact_batch)) {
+            /* (Re-)evaluate against the current class counts */
+            eval_word(wi);
+            to = choose_class(wi);
          }
-
-         /* Make change permanent */
-         /* Class map */
-         clMemb[w] = to;
-         /* Class unigram counts */
-         clSum[curr_class] -= uni[w];
-         clSum[to] += uni[w];
-         /* Class bigram counts */
-         for (j=0; j<N; j++) {
-            if ((j!=curr_class) && (j!=to)) {
-               /* (Gw, *) */
-               clCnt[curr_class][j] = tmp_c1[j];
-               /* (*, Gw) */
-               clCnt[j][curr_class] = tmp_c2[j];
-               /* (g, *) */
-               clCnt[to][j] = tmp_c3[j];
-               /* (*, g) */
-               clCnt[j][to] = tmp_c4[j];
+         else {
+            to = choose_class(wi); /* Work out where to move it to */
+            if (moved && to != from) {
+               /* Counts have changed since the batch was evaluated, so
+                  only make the move if it is still an improvement,
+                  otherwise look again at all classes */
+               word_counts(wi);
+               wi->best_change = move_change(wi, to, mv);
+               if (wi->best_change <= 0) {
+                  eval_word(wi);
+                  to = choose_class(wi);
+               }
             }
          }
-         /* Exceptions */
-         clCnt[curr_class][curr_class] = GwGw;
-         clCnt[curr_class][to] = Gwg;
-         clCnt[to][curr_class] = gGw;
-         clCnt[to][to] = gg;
-
-         /* Recalculate maximum-likelihood values involving this class */
-         mlv[to] = 0;
-         for (j=0; j<N; j++) {
-            if (clCnt[to][j])
-               mlv[to] += ((double)clCnt[to][j]) * log(clCnt[to][j]);
-            if (to!=j) {
-               if (clCnt[j][to])
-                  mlv[to] += ((double)clCnt[j][to]) * log(clCnt[j][to]);
-            }
+         if (show_MLV) {
+            curr_MLV += wi->best_change;
          }
-         if (clSum[to])
-            mlv[to] -= 2*(((double)clSum[to]) * log(clSum[to]));
-
-         mlv[curr_class] = 0;
-         for (j=0; j<N; j++) {
-            if (clCnt[curr_class][j])
-               mlv[curr_class] += ((double)clCnt[curr_class][j]) * log(clCnt[curr_class][j]);
-            if (curr_class!=j) {
-               if (clCnt[j][curr_class])
-                  mlv[curr_class] += ((double)clCnt[j][curr_class]) * log(clCnt[j][curr_class]);
+
+         if (from != to) {
+            moved = TRUE;
+            if (logfile) {
+               if (verbose) {
+                  fprintf(logfile, "...moving word id %d from class %d to class %d\n", w, from, to);
+               }
+               else {
+                  fprintf(logfile, "-> %d\n", to);
+               }
+               fflush(logfile);
             }
-         }
-         if (clSum[curr_class])
-            mlv[curr_class] -= 2*(((double)clSum[curr_class]) * log(clSum[curr_class]));
 
-         /* Update MLV values for other classes */
-         for (j=0; j<N; j++)  {
-            if (j!=to && j!=curr_class) {
+            classes_change(wi, to, mv); /* Calculate new unigram and bigram values */
+
+            /* Remove influence of these two classes from MLV values */
+            for (j=0; j<N; j++) {
+               if (j!=to && j!=from) {
+                  if (clCnt[to][j])
+                     mlv[j] -= ((double)clCnt[to][j]) * log(clCnt[to][j]);
+                  if (clCnt[j][to])
+                     mlv[j] -= ((double)clCnt[j][to]) * log(clCnt[j][to]);
+                  if (clCnt[from][j])
+                     mlv[j] -= ((double)clCnt[from][j]) * log(clCnt[from][j]);
+                  if (clCnt[j][from])
+                     mlv[j] -= ((double)clCnt[j][from]) * log(clCnt[j][from]);
+               }
+            }
+
+            /* Make change permanent */
+            /* Class map */
+            clMemb[w] = to;
+            /* Class unigram counts */
+            clSum[from] -= uni[w];
+            clSum[to] += uni[w];
+            /* Class bigram counts */
+            for (j=0; j<N; j++) {
+               if ((j!=from) && (j!=to)) {
+                  /* (Gw, *) */
+                  clCnt[from][j] = mv->c1[j];
+                  /* (*, Gw) */
+                  clCnt[j][from] = mv->c2[j];
+                  /* (g, *) */
+                  clCnt[to][j] = mv->c3[j];
+                  /* (*, g) */
+                  clCnt[j][to] = mv->c4[j];
+               }
+            }
+            /* Exceptions */
+            clCnt[from][from] = mv->GwGw;
+            clCnt[from][to] = mv->Gwg;
+            clCnt[to][from] = mv->gGw;
+            clCnt[to][to] = mv->gg;
+
+            /* Recalculate maximum-likelihood values involving this class */
+            mlv[to] = 0;
+            for (j=0; j<N; j++) {
                if (clCnt[to][j])
-                  mlv[j] += ((double)clCnt[to][j]) * log(clCnt[to][j]);
-               if (clCnt[j][to])
-                  mlv[j] += ((double)clCnt[j][to]) * log(clCnt[j][to]);
-               if (clCnt[curr_class][j])
-                  mlv[j] += ((double)clCnt[curr_class][j]) * log(clCnt[curr_class][j]);
-               if (clCnt[j][curr_class])
-                  mlv[j] += ((double)clCnt[j][curr_class]) * log(clCnt[j][curr_class]);
+                  mlv[to] += ((double)clCnt[to][j]) * log(clCnt[to][j]);
+               if (to!=j) {
+                  if (clCnt[j][to])
+                     mlv[to] += ((double)clCnt[j][to]) * log(clCnt[j][to]);
+               }
             }
-         }
-      }
-      else {
-         if (logfile) {
-            if (verbose) {
-               fprintf(logfile, "...decided not to move word %d from class %d\n", w, curr_class);
+            if (clSum[to])
+               mlv[to] -= 2*(((double)clSum[to]) * log(clSum[to]));
+
+            mlv[from] = 0;
+            for (j=0; j<N; j++) {
+               if (clCnt[from][j])
+                  mlv[from] += ((double)clCnt[from][j]) * log(clCnt[from][j]);
+               if (from!=j) {
+                  if (clCnt[j][from])
+                     mlv[from] += ((double)clCnt[j][from]) * log(clCnt[j][from]);
+               }
             }
-            else {
-               fprintf(logfile, "--\n");
+            if (clSum[from])
+               mlv[from] -= 2*(((double)clSum[from]) * log(clSum[from]));
+
+            /* Update MLV values for other classes */
+            for (j=0; j<N; j++)  {
+               if (j!=to && j!=from) {
+                  if (clCnt[to][j])
+                     mlv[j] += ((double)clCnt[to][j]) * log(clCnt[to][j]);
+                  if (clCnt[j][to])
+                     mlv[j] += ((double)clCnt[j][to]) * log(clCnt[j][to]);
+                  if (clCnt[from][j])
+                     mlv[j] += ((double)clCnt[from][j]) * log(clCnt[from][j]);
+                  if (clCnt[j][from])
+                     mlv[j] += ((double)clCnt[j][from]) * log(clCnt[j][from]);
+               }
             }
          }
-         fflush(stdout);
-      }
+         else {
+            if (logfile) {
+               if (verbose) {
+                  fprintf(logfile, "...decided not to move word %d from class %d\n", w, from);
+               }
+               else {
+                  fprintf(logfile, "--\n");
+               }
+            }
+            fflush(stdout);
+         }
 
-      if (show_MLV && logfile) {
-         fprintf(logfile, "   MLV = %f\n", curr_MLV);
-      }
+         if (show_MLV && logfile) {
+            fprintf(logfile, "   MLV = %f\n", curr_MLV);
+         }
 
 #ifdef INTEGRITY_CHECK
-      /* Debug: Check our counts still sum correctly */
-      check_counts_sum();
+         /* Debug: Check our counts still sum correctly */
+         check_counts_sum();
 
-      /* Debug: Check our updated MLV counts */
-      max_likelihood_check();
+         /* Debug: Check our updated MLV counts */
+         max_likelihood_check();
 #endif
+      }
    }
 
    if (w_period) {
@@ -1024,6 +1171,7 @@ static void max_likelihood_check(void)
 void cluster_words(int iterations)
 {
    int i;
+   double start_time;
 
    for (i=0; i<iterations; i++) {
       /* Also keep a separate iteration count - we do this because it's
@@ -1042,13 +1190,14 @@ void cluster_words(int iterations)
          check_file(logfile, tmp, "cluster_words");
       }
 
+      start_time = WallTime();
       do_one_iteration(rec_freq, 0);
 
       if (logfile)
          FClose(logfile, pipe_logfile);
 
       if (trace & T_TOP) {
-         printf("Iteration complete\n");
+         printf("Iteration complete (%.2f seconds)\n", WallTime() - start_time);
       }
    }
 }
@@ -1464,23 +1613,23 @@ void write_word_probs(char *filename)
       if (uni[i]==0) uni[i]=1;
    }
 
-   /* Use tmp_sum1[] to save having to allocate a new array (so can't call
+   /* Use winfo[0].sum1[] to save having to allocate a new array (so can't call
       this from within a class change calculation, but this isn't a problem!)   */
    for (i=0; i<N; i++) {
-      tmp_sum1[i] = 0;
+      winfo[0].sum1[i] = 0;
    }
    for (i=0; i<W; i++) {
-      tmp_sum1[clMemb[i]] += uni[i];
+      winfo[0].sum1[clMemb[i]] += uni[i];
    }
 
    for (i=0; i<W; i++) {
-      probability = (double)uni[i]/((double)tmp_sum1[clMemb[i]]);
+      probability = (double)uni[i]/((double)winfo[0].sum1[clMemb[i]]);
 
       fprintf(out, "%-15s\tCLASS%-4d\t%f\n", what_is_word(i), clMemb[i]+1,
               LOG_NATURAL(probability));
 
       if (LOG_NATURAL(probability)<-90) {
-         printf("prob is %f, discount is %f, uni is %d\n", LOG_NATURAL((double)uni[i]/((double)tmp_sum1[clMemb[i]])), mlv[clMemb[i]], uni[i]);
+         printf("prob is %f, discount is %f, uni is %d\n", LOG_NATURAL((double)uni[i]/((double)winfo[0].sum1[clMemb[i]])), mlv[clMemb[i]], uni[i]);
       }
    }
    FClose(out, pipe_status);
@@ -1598,15 +1747,15 @@ static void *get_space(int size)
       return New(&global_stack, size);
 
    /* Use New() again if necessary to get a new block */
-   if (((int)block+(int)size) >= (int)block_end) {
+   if ((ByteP)block+size >= (ByteP)block_end) {
       block = New(&global_heap, block_grab_size);
-      block_end = (void *) ((int)block+(int)block_grab_size);
+      block_end = (void *) ((ByteP)block+block_grab_size);
    }
 
    /* Hand back the next free space */
    ptr = block;
-   block = (void*) ((int) block + (int) size);     /* Next free byte */
-   block = (void*) ((((int)block)+3) & (~(int)3)); /* Word-align */
+   block = (void*) ((ByteP)block + size);                 /* Next free byte */
+   block = (void*) ((ByteP)block + (((size_t)block)&3 ? 4-(((size_t)block)&3) : 0)); /* Word-align */
 
    return ptr;
 }
@@ -1753,7 +1902,9 @@ int main(int argc, char *argv[])
    InitLUtil();
    InitWMap();
    InitGBase();
+   InitThreads();
    SetConfParms();
+   num_threads = NumThreads();
 
    /* Default start, end and unknown words */
    strcpy(sent_start, DEF_STARTWORD);
@@ -1790,6 +1941,19 @@ int main(int argc, char *argv[])
                HError(17019,"Cluster: number of iterations expected for -i");
             iterations = GetIntArg();
             break;
+         case 'b':
+            if (NextArg()!=INTARG)
+               HError(17019,"Cluster: batch size expected for -b");
+            batch_size = GetChkedInt(1,100000,s);
+            break;
+         case 'e':
+            exact_batch = TRUE;
+            break;
+         case 'j':
+            if (NextArg()!=INTARG)
+               HError(17019,"Cluster: number of threads expected for -j");
+            num_threads = GetChkedInt(1,MAXTHREADS,s);
+            break;
           case 'r':
             if (NextArg()!=INTARG)
                HError(17019,"Cluster: recovery export frequency expected for -r");
@@ -44,6 +44,7 @@ char *lplex_vc_id = "$Id: LPlex.c,v 1.1.1.1 2006/10/11 09:54:44 jal58 Exp $";
 #include "HMath.h"
 #include "HWave.h"
 #include "HLabel.h"
+#include "HThreads.h"
 #include "LWMap.h"      /* LM toolkit libraries */
 #include "LCMap.h"
 #include "LGBase.h"
@@ -65,6 +66,7 @@ char *lplex_vc_id = "$Id: LPlex.c,v 1.1.1.1 2006/10/11 09:54:44 jal58 Exp $";
 #define MAX_TEST    16
 #define LBUF_SIZE   2048
 #define MAX_FILES   200000
+#define BATCH_SIZE  256         /* utterances per thread in a batch */
 
  typedef struct {
    LabId wdid;
@@ -82,6 +84,17 @@ typedef struct {
    OOVEntry oov[MAX_OOV];   /* array of OOVs */
 } PStats;
 
+typedef struct {
+   LabId *lab;              /* labels including context padding */
+   int numLabs;             /* number of labels */
+   LabId *sel;              /* labels printed for T_SEL */
+   int numSel;              /* number of labels in sel */
+   int nWrd;                /* number of words predicted */
+   double logpp;            /* accumulated LM score */
+   double logpp2;           /* accumulated logp^2 score */
+   float *prob;             /* log prob of each word predicted */
+} QueuedUtt;
+
 /* -------------------- Global variables ----------------------- */
 
 static int trace = 0;               /* trace level */
@@ -120,6 +133,16 @@ static float wdThresh[LM_NSIZE+1];  /* new wdThresh for COUNT-models */
 static char *outStreamFN = NULL;
 FILE *outStream;
 
+static int nThreads = 1;            /* number of threads */
+static int cacheSize = 16384;       /* n-gram cache slots, 0 to disable */
+static ThreadPool *pool = NULL;     /* worker threads */
+static NGramCache **lmCache = NULL; /* [nThreads*nLModel] n-gram caches */
+static QueuedUtt *batch = NULL;     /* utterances waiting to be scored */
+static int batchSize = 0;           /* max utterances in batch */
+static int numQueued = 0;           /* utterances in batch */
+static int batchN = 0;              /* n-gram size for batch */
+MemHeap batchHeap;                  /* Stores queued utterances */
+
 MemHeap tempHeap;                   /* Stores data valid only for file */
 MemHeap permHeap;                   /* Stores global stats */
 
@@ -150,6 +173,7 @@ void SetConfParms(void)
      if (GetConfStr(cParm,nParm,"STARTWORD",b))   sstId = GetLabId(b, TRUE);
       if (GetConfStr(cParm,nParm,"ENDWORD",b))     senId = GetLabId(b, TRUE);
       if (GetConfStr(cParm,nParm,"UNKNOWNNAME",b)) unkId = GetLabId(b, TRUE);
+      if (GetConfInt(cParm,nParm,"CACHESIZE",&i))  cacheSize = i;
    }
 
    if (!sstId) sstId = GetLabId(DEF_STARTWORD,TRUE);
@@ -166,6 +190,7 @@ void ReportUsage(void)
    printf(" -d n c  set weighted discount pruning to c   off\n");
    printf(" -e s t  Label t is equivalent to s           off\n");
    printf(" -i f s  interpolate with model s, weight f   off\n");
+   printf(" -j n    use n threads                        %d\n", nThreads);
    printf(" -n N    calculate N-gram perplexity          max in LM\n");
    printf(" -o      print OOV word statistics            off\n");
    printf(" -s fn   print prob stream to file fn         off\n");
@@ -193,7 +218,9 @@ int main(int argc, char *argv[])
    InitLModel();
    InitPCalc();
    InitPMerge();
+   InitThreads();
    SetConfParms();
+   nThreads = NumThreads();
 
    if (!InfoPrinted() && NumArgs() == 0)
       ReportUsage();
@@ -234,6 +261,8 @@ int main(int argc, char *argv[])
 	    lmInfo[nLModel].fn = GetStrArg();
 	    nLModel++;
 	    break;
+	 case 'j':
+	    nThreads = GetChkedInt(1,MAXTHREADS,s); break;
 	 case 'n':
 	    testInfo[numTests++] = GetChkedInt(1, 10, s); break;
 	 case 'o':
@@ -491,6 +520,33 @@ static void Initialise(void)
    /* link equivalence classes */
    LinkEquiv();
 
+   /* create n-gram caches and worker threads */
+   if (nThreads>1) {
+      if (cacheSize<=0 || (trace&(T_SENT|T_PROB))) {
+	 HError(-16660,"LPlex: using 1 thread with %s",(cacheSize<=0) ?
+		"n-gram cache disabled" : "sentence or probability tracing");
+	 nThreads = 1;
+      }
+      for (li=lmInfo, i=0; i<nLModel; i++, li++)
+	 if (li->lm->classLM && nThreads>1) {
+	    HError(-16660,"LPlex: using 1 thread with class LM %s",li->fn);
+	    nThreads = 1;
+	 }
+   }
+   if (cacheSize>0) {
+      lmCache = (NGramCache **) New(&permHeap,nThreads*nLModel*sizeof(NGramCache *));
+      for (i=0; i<nThreads*nLModel; i++)
+	 lmCache[i] = CreateNGramCache(&permHeap,lmInfo[i%nLModel].lm,cacheSize);
+   }
+   if (nThreads>1) {
+      pool = CreateThreadPool(&permHeap,nThreads);
+      batchSize = BATCH_SIZE*nThreads;
+      batch = (QueuedUtt *) New(&permHeap,batchSize*sizeof(QueuedUtt));
+      CreateHeap(&batchHeap, "batchHeap", MSTAK, 1, 1.0, 8000, 400000);
+      if (trace&T_TOP)
+	 printf("Scoring with %d threads\n",nThreads);
+   }
+
    /* open output stream */
    if (outStreamFN != NULL)
      if ((outStream = FOpen(outStreamFN,NoOFilter,&isPipe)) == NULL)
@@ -593,6 +649,9 @@ static void PrintInfo(PStats *ps, Boolean showOOV)
 	printf("%s \t%d\n", ove->wdid->name, ove->count);
       fflush(stdout);
    }
+   if (lmCache!=NULL)
+      for (i=0; i<nThreads*nLModel; i++)
+	 FlushNGramCacheStats(lmCache[i]);
    for (li=lmInfo, i=0; i<nLModel; i++, li++) {
 #ifndef HTK_TRANSCRIBER
       printf("\nAccess statistics for %s:\n", li->fn);
@@ -621,8 +680,16 @@ static LabId GetEQLab(LabId id)
    return cl;
 }
 
+/* LMProb: return probability from the i'th LM, using thread th's cache */
+static float LMProb(int th, int i, NameId *nGram, int nSize)
+{
+   if (lmCache==NULL)
+      return GetNGramProb(lmInfo[i].lm, nGram, nSize);
+   return GetCachedNGramProb(lmCache[th*nLModel+i], nGram, nSize);
+}
+
 /* GetProb: return nSize-gram probability for ngram in wlab */
-static double GetProb(LabId *wlab, int nSize)
+static double GetProb(int th, LabId *wlab, int nSize)
 {
    /*
       this routine will return the interpolated nSize-gram probability for
@@ -643,10 +710,10 @@ static double GetProb(LabId *wlab, int nSize)
 	    inThisLM = FALSE;
       }
       if (inThisLM) {
-         prob = GetNGramProb(lmInfo[0].lm, nGram, nSize);
+         prob = LMProb(th, 0, nGram, nSize);
       }
       else if (nSize > 1)
-         prob = GetProb(wlab+1,nSize-1);
+         prob = GetProb(th,wlab+1,nSize-1);
       else {
          prob = LZERO;
          HError(-16690,"GetProb: assigning zero probability");
@@ -661,7 +728,7 @@ static double GetProb(LabId *wlab, int nSize)
 	 }
 	 if (!inThisLM)
 	    continue;
-         x = GetNGramProb(li->lm, nGram, nSize);
+         x = LMProb(th, i, nGram, nSize);
 
 #ifdef INTERPOLATE_MAX
 	 if ((x = exp(x)) > psum)
@@ -674,7 +741,7 @@ static double GetProb(LabId *wlab, int nSize)
       if (inAnyLM)
 	 prob = log(psum);
       else if (nSize > 1)
-	 prob = GetProb(wlab+1,nSize-1);
+	 prob = GetProb(th,wlab+1,nSize-1);
       else {
 	 prob = LZERO;
 	 HError(-16690,"GetProb: assigning zero probability");
@@ -684,32 +751,36 @@ static double GetProb(LabId *wlab, int nSize)
 }
 
 
+/* Predictable: true if pLab[i] is to be scored */
+static Boolean Predictable(LabId *pLab, int i, int nSize)
+{
+   int j;
+
+   if (pLab[i]==unkId)
+      return FALSE;	           /* cannot predict OOVs */
+   if (skipOOV)
+   {
+      for (j=1; j<nSize; j++)
+      {
+	 if (pLab[i-j]==unkId)
+	    return FALSE; /* skip to next label since context contains OOV */
+      }
+   }
+   return TRUE;
+}
+
 /* CalcPerplexity: compute perplexity and other statistics */
 static void CalcPerplexity(PStats *sent, LabId *pLab, int numPLabs, int nSize)
 {
    int i,j;
    LabId *p;
    float prob;
-   Boolean hasOOV;
 
    for (p=pLab, i=nSize-1; i<numPLabs; i++, p++)
    {
-      if (pLab[i]==unkId)
-	 continue;	           /* cannot predict OOVs */
-      if (skipOOV)
-      {
-	 hasOOV = FALSE;
-	 for (j=1; j<nSize; j++)
-	 {
-	    if (pLab[i-j]==unkId)
-	    {
-	      hasOOV=TRUE;
-	      break;
-	    }
-	 }
-	 if (hasOOV) continue; /* skip to next label since context contains OOV */
-      }
-      prob = GetProb(p, nSize);
+      if (!Predictable(pLab, i, nSize))
+	 continue;
+      prob = GetProb(0, p, nSize);
       sent->nWrd++; sent->logpp += prob; sent->logpp2 += prob*prob;
 
       if (outStreamFN != NULL)
@@ -731,6 +802,81 @@ static void CalcPerplexity(PStats *sent, LabId *pLab, int numPLabs, int nSize)
       PrintInfo(sent,FALSE);
 }
 
+/* -------------------- Batch scoring ------------------------ */
+
+/* ScoreTask: thread task to score the utterance batch[task] */
+static void ScoreTask(int th, int task, Ptr arg)
+{
+   int i;
+   LabId *p;
+   float prob;
+   QueuedUtt *qu = batch+task;
+
+   qu->nWrd = 0; qu->logpp = qu->logpp2 = 0.0;
+   for (p=qu->lab, i=batchN-1; i<qu->numLabs; i++, p++) {
+      if (!Predictable(qu->lab, i, batchN))
+	 continue;
+      prob = GetProb(th, p, batchN);
+      qu->prob[qu->nWrd++] = prob;
+      qu->logpp += prob; qu->logpp2 += prob*prob;
+   }
+}
+
+/* FlushBatch: score queued utterances and add them to totl in order */
+static void FlushBatch(void)
+{
+   int i,j;
+   double ppl;
+   QueuedUtt *qu;
+
+   if (numQueued==0)
+      return;
+   RunThreadTasks(pool, numQueued, ScoreTask, NULL);
+   for (qu=batch, i=0; i<numQueued; i++, qu++) {
+      totl.nWrd += qu->nWrd;
+      totl.logpp += qu->logpp; totl.logpp2 += qu->logpp2;
+      if (outStreamFN != NULL)
+	 for (j=0; j<qu->nWrd; j++)
+	    fprintf(outStream,"%e\n",exp(qu->prob[j]));
+      if (trace&T_SEL) {     /* compact info for sentence selection */
+	 ppl = exp(-(qu->logpp)/(double) (qu->nWrd));
+	 printf("#! %.4f", ppl);
+	 for (j=0; j<qu->numSel; j++)
+	    printf(" %s", qu->sel[j]->name);
+	 printf("\n");
+      }
+   }
+   fflush(stdout);
+   numQueued = 0;
+   ResetHeap(&batchHeap);
+}
+
+/* QueueUtterance: add pLab to the batch, scoring the batch when full;
+   the T_SEL labels are taken from ref if given, else from pLab */
+static void QueueUtterance(LabId *pLab, int numPLabs, int nSize, LabList *ref)
+{
+   int i;
+   LLink ll;
+   QueuedUtt *qu;
+
+   qu = batch+numQueued++;
+   qu->lab = (LabId *) New(&batchHeap,numPLabs*sizeof(LabId));
+   for (i=0; i<numPLabs; i++) qu->lab[i] = pLab[i];
+   qu->numLabs = numPLabs;
+   qu->prob = (float *) New(&batchHeap,(numPLabs+1)*sizeof(float));
+   if (ref!=NULL) {
+      qu->numSel = CountLabs(ref);
+      qu->sel = (LabId *) New(&batchHeap,(qu->numSel+1)*sizeof(LabId));
+      for (i=0,ll=ref->head->succ; i<qu->numSel; i++,ll=ll->succ)
+	 qu->sel[i] = ll->labid;
+   } else {
+      qu->sel = qu->lab+nSize-1; qu->numSel = numPLabs-(nSize-1);
+   }
+   batchN = nSize;
+   if (numQueued==batchSize)
+      FlushBatch();
+}
+
 
 /* ProcessLabelFile: compute perplexity and related statistics from labels */
 static void ProcessLabelFile(char *fn, int nSize)
@@ -787,6 +933,11 @@ static void ProcessLabelFile(char *fn, int nSize)
    if (senId!=NULL)             /* add sentence end marker */
      pLab[numPLabs++] = senId;
 
+   if (pool!=NULL) {    /* score later, T_SEL info printed with batch */
+      QueueUtterance(pLab, numPLabs, nSize, (trace&T_SEL) ? ref : NULL);
+      AddStats(&sent, &totl);
+      return;
+   }
    CalcPerplexity(&sent, pLab, numPLabs, nSize);
    AddStats(&sent, &totl);
 
@@ -846,7 +997,12 @@ static void ProcessTextStream(char *fn, int nSize)
 	 CalcPerplexity(&sent,pLab,numPLabs,nSize);
 	 numPLabs = 0;
       }
-      if (IS_SEN(lab)) {
+      if (IS_SEN(lab) && pool!=NULL) {
+	 QueueUtterance(pLab, numPLabs, nSize, NULL);
+	 AddStats(&sent, &totl);
+	 ZeroStats(&sent);
+      }
+      else if (IS_SEN(lab)) {
 	 CalcPerplexity(&sent,pLab,numPLabs,nSize);
 	 AddStats(&sent, &totl);
 
@@ -875,6 +1031,7 @@ static void ProcessFiles()
    MLFEntry *me;
    char *inpfn[MAX_FILES];
    int i,t,numFiles,fidx;
+   long h,m,hits,miss;
 
    numFiles = 0;
    while (NumArgs()>0){
@@ -893,6 +1050,8 @@ static void ProcessFiles()
       printf("LPlex test #%d: %d-gram\n", t, nSize);
       if (numFiles==0) {
 	 ProcessTextStream(NULL, nSize);
+	 if (pool!=NULL)
+	    FlushBatch();
 	 continue;
       }
 
@@ -927,7 +1086,17 @@ static void ProcessFiles()
 	    }
 	 }
       }
+      if (pool!=NULL)
+	 FlushBatch();
       PrintInfo(&totl, printOOV);
+      if ((trace&T_TOP) && lmCache!=NULL) {
+	 for (hits=miss=0, i=0; i<nThreads*nLModel; i++) {
+	    GetNGramCacheStats(lmCache[i],&h,&m);
+	    hits += h; miss += m;
+	 }
+	 printf("\nN-gram cache: %ld hits, %ld misses (%.1f%% hit rate)\n",
+		hits, miss, (hits+miss>0) ? 100.0*hits/(double)(hits+miss) : 0.0);
+      }
    }
 }
 
@@ -94,6 +94,7 @@ char *hdecode_sccs_id = "$Id: HDecode.c,v 1.14 2012/12/22 07:01:28 uratec Exp $"
 #include "HAdapt.h"
 #include "HNet.h"       /* for Lattice */
 #include "HLat.h"       /* for Lattice */
+#include "HThreads.h"
 
 #include "config.h"
 
@@ -116,6 +117,8 @@ static int trace = 0;
 
 
 static char *langfn;		/* LM filename from commandline */
+static char *netfn = NULL;	/* static network filename from commandline */
+static char *netCacheFN = NULL;	/* LexNet cache file */
 static char *dictfn;		/* dict filename from commandline */
 static char *hmmListfn;		/* model list filename from commandline */
 static char *hmmDir = NULL;     /* directory to look for HMM def files */
@@ -174,6 +177,9 @@ static LogFloat fastlmlaBeam = - LZERO;  /* do fast LM la outside this beam */
 static int nTok = 32;           /* number of different LMStates per HMM state */
 static Boolean useHModel = FALSE; /* use standard HModel OutP functions */
 static int outpBlocksize = 1;   /* number of frames for which outP is calculated in one go */
+static int nThreads = 1;        /* number of threads for outP calculation */
+static int partialFreq = 0;     /* frames between partial tracebacks (0 = off) */
+static int partialLag = 0;      /* max frames before a stable word end is forced (0 = off) */
 static Observation *obs;        /* array of Observations */
 
 /* transforms/adaptatin */
@@ -198,6 +204,10 @@ void SetConfParms (void);
 void ReportUsage (void);
 DecoderInst *Initialise (void);
 void DoRecognition (DecoderInst *dec, char *fn);
+void MoveLabels (LabList *from, LabList *to);
+void PartialOutput (DecoderInst *dec, char *fn, LabList *partLab, int *nSeg);
+void WriteLatFile (Lattice *lat, char *latfn);
+char *LatSegFN (char *fn, int seg, char *latfn);
 Boolean UpdateSpkrModels (char *fn);
 
 /* ---------------- Configuration Parameters ---------------------------- */
@@ -244,6 +254,10 @@ SetConfParms (void)
       if (GetConfStr(cParm,nParm,"LATFILEMASK",buf)) {
          latFileMask = CopyString(&gstack, buf);
       }
+      if (GetConfInt (cParm, nParm, "PARTIALFREQ", &i)) partialFreq = i;
+      if (GetConfInt (cParm, nParm, "PARTIALLAG", &i)) partialLag = i;
+      if (GetConfStr (cParm, nParm, "LEXNETCACHE", buf))
+         netCacheFN = CopyString (&gstack, buf);
    }
 }
 
@@ -255,7 +269,9 @@ ReportUsage (void)
    printf (" -m      enable XForm and use inXForm        off\n");
 
    printf (" -d s    dir to find hmm definitions       current\n");
+   printf (" -g s    decode with static network s        none\n");
    printf (" -i s    Output transcriptions to MLF s      off\n");
+   printf (" -j i    threads for outP calculation        %d\n", nThreads);
    printf (" -k i    block size for outP calculation     1\n");
    printf (" -l s    dir to store label files	    current\n");
    printf (" -o s    output label formating NCSTWMX      none\n");
@@ -313,6 +329,8 @@ main (int argc, char *argv[])
    InitLVRec ();
    InitAdapt (&xfInfo, NULL);
    InitLat ();
+   InitThreads ();
+   nThreads = NumThreads ();
 
    if (!InfoPrinted () && NumArgs () == 0)
       ReportUsage ();
@@ -457,10 +475,20 @@ main (int argc, char *argv[])
             langfn = GetStrArg();
 	 break;
 
+      case 'g':
+	 if (NextArg() != STRINGARG)
+	    HError (4019, "HDecode: static network file name expected");
+	 netfn = GetStrArg();
+	 break;
+
       case 'n':
 	 nTok = GetChkedInt (0, 1024, s);
 	 break;
 
+      case 'j':
+	 nThreads = GetChkedInt (1, MAXTHREADS, s);
+	 break;
+
       case 'k':
 	 outpBlocksize = GetChkedInt (0, MAXBLOCKOBS, s);
 	 break;
@@ -681,7 +709,37 @@ DecoderInst *Initialise (void)
    }
    
 
-   if (!latRescore) {
+   if (netfn) {
+      FILE *netF;
+      Boolean isPipe;
+      Lattice *lat;
+
+      if (langfn || latRescore)
+         HError (9999, "HDecode: cannot use static network and -w together");
+      if (fastlmlaBeam < - LZERO)
+         HError (9999, "HDecode: fast LM lookahead not supported with static network");
+
+      /* read network compiled by HCompNet once for all utterances */
+      if (trace & T_TOP) {
+         printf ("Reading static network from %s\n", netfn);
+         fflush (stdout);
+      }
+      netF = FOpen (netfn, NetFilter, &isPipe);
+      if (!netF)
+         HError (9999, "HDecode: Cannot open network file %s", netfn);
+      lat = ReadLattice (netF, &lmHeap, &vocab, FALSE, FALSE);
+      FClose (netF, isPipe);
+      if (!lat)
+         HError (9999, "HDecode: cannot read network file %s", netfn);
+
+      /* only words in the network are included in Net */
+      UnMarkAllWords (&vocab);
+      MarkAllWordsfromLat (&vocab, lat, silDict);
+      net = CreateLexNetCached (&netHeap, &vocab, &hset, startWord, endWord, silDict,
+                                netCacheFN);
+      lm = CreateLMfromLat (&lmHeap, netfn, lat, &vocab);
+   }
+   else if (!latRescore) {
 
       if (!langfn)
          HError (9999, "HDecode: no LM or lattice specified");
@@ -690,7 +748,8 @@ DecoderInst *Initialise (void)
       MarkAllWords (&vocab);
 
       /* create network */
-      net = CreateLexNet (&netHeap, &vocab, &hset, startWord, endWord, silDict);
+      net = CreateLexNetCached (&netHeap, &vocab, &hset, startWord, endWord, silDict,
+                                netCacheFN);
       
       /* Read language model */
       if (trace & T_TOP) {
@@ -712,11 +771,16 @@ DecoderInst *Initialise (void)
       if (strchr (latOutForm, 'n'))
          HError (9999, "DoRecognition: likelihoods for model alignment not supported");
    }
+   if (modAlign && partialFreq > 0)
+      HError (9999, "HDecode: PARTIALFREQ not supported with model alignment");
 
    /* create Decoder instance */
    dec = CreateDecoderInst (&hset, lm, nTok, TRUE, useHModel, outpBlocksize,
                             bestAlignMLF ? TRUE : FALSE,
                             modAlign);
+   SetDecoderThreads (dec, nThreads);
+   if (netfn)
+      CreateLMLATable (dec, net, &lmHeap);
    
    /* create buffers for observations */
    SetStreamWidths (hset.pkind, hset.vecSize, hset.swidth, &eSep);
@@ -960,6 +1024,8 @@ void DoRecognition (DecoderInst *dec, char *fn)
    double cpuSec;
    Observation *obsBlock[MAXBLOCKOBS];
    BestInfo *bestAlignInfo = NULL;
+   LabList *partLab = NULL;
+   int nSeg = 0;
 
    /* This handles the initial input transform, parent transform setting
       and output transform creation */
@@ -1051,6 +1117,10 @@ void DoRecognition (DecoderInst *dec, char *fn)
    net->vocabFN = dictfn;
    dec->utterFN = fn;
 
+   /* stable words found by partial traceback */
+   if (partialFreq > 0)
+      partLab = CreateLabelList (&transHeap, 0);
+
    frameN = frameProc = 0;
    while (BufferStatus (parmBuf) != PB_CLEARED) {
       ReadAsBuffer (parmBuf, &obs[frameN % outpBlocksize]);
@@ -1079,6 +1149,8 @@ void DoRecognition (DecoderInst *dec, char *fn)
          ProcessFrame (dec, obsBlock, outpBlocksize, xfInfo.inXForm);
          if (bestAlignInfo)
             AnalyseSearchSpace (dec, bestAlignInfo);
+         if (partLab && dec->frame % partialFreq == 0)
+            PartialOutput (dec, fn, partLab, &nSeg);
          ++frameProc;
       }
       ++frameN;
@@ -1095,6 +1167,8 @@ void DoRecognition (DecoderInst *dec, char *fn)
       ProcessFrame (dec, obsBlock, bs, xfInfo.inXForm);
       if (bestAlignInfo)
          AnalyseSearchSpace (dec, bestAlignInfo);
+      if (partLab && dec->frame % partialFreq == 0)
+         PartialOutput (dec, fn, partLab, &nSeg);
       ++frameProc;
    }
    assert (frameProc == frameN);
@@ -1104,8 +1178,20 @@ void DoRecognition (DecoderInst *dec, char *fn)
    cpuSec = (endClock - startClock) / (double) CLOCKS_PER_SEC;
    printf ("CPU time %f  utterance length %f  RT factor %f\n",
            cpuSec, frameN*dec->frameDur, cpuSec / (frameN*dec->frameDur));
+   if (trace & T_TOP)
+      printf ("Scored %ld states in %.2f secs, propagation %.2f secs\n",
+              dec->nScored, dec->outPTime, dec->propTime);
+   if (trace & T_TOP)
+      printf ("Token set merges: %ld copy, %ld same id, %ld same LM states, %ld full\n"
+              "  %ld new ids, %ld pruned to %d tokens\n",
+              dec->mtsCopy, dec->mtsFast, dec->mtsAligned, dec->mtsSlow, 
+              dec->mtsNewId, dec->mtsNewIdNTok, dec->nTok);
 
    trans = TraceBack (&transHeap, dec);
+   if (partLab) {       /* prepend words output by partial traceback */
+      MoveLabels (trans->head, partLab);
+      MoveLabels (partLab, trans->head);
+   }
 
    /* save 1-best transcription */
    /* the following is from HVite.c */
@@ -1140,42 +1226,14 @@ void DoRecognition (DecoderInst *dec, char *fn)
          lat = LatPrune (&transHeap, lat, latPruneBeam, latPruneAPS);
       }
 
-      /* the following is from HVite.c */
       if (lat) {
          char latfn[MAXSTRLEN];
-         char *p;
-         Boolean isPipe;
-         FILE *file;
-         LatFormat form;
-         
-         MakeFN (fn, latOutDir, latOutExt, latfn);
-         file = FOpen (latfn, NetOFilter, &isPipe);
-         if (!file) 
-            HError (999, "DoRecognition: Could not open file %s for lattice output",latfn);
-         if (!latOutForm)
-            form = (HLAT_DEFAULT & ~HLAT_ALLIKE)|HLAT_PRLIKE;
-         else {
-            for (p = latOutForm, form=0; *p != 0; p++) {
-               switch (*p) {
-               case 'A': form|=HLAT_ALABS; break;
-               case 'B': form|=HLAT_LBIN; break;
-               case 't': form|=HLAT_TIMES; break;
-               case 'v': form|=HLAT_PRON; break;
-               case 'a': form|=HLAT_ACLIKE; break;
-               case 'l': form|=HLAT_LMLIKE; break;
-               case 'd': form|=HLAT_ALIGN; break;
-               case 'm': form|=HLAT_ALDUR; break;
-               case 'n': form|=HLAT_ALLIKE; 
-                  HError (9999, "DoRecognition: likelihoods for model alignment not supported");
-                  break;
-               case 'r': form|=HLAT_PRLIKE; break;
-               }
-            }
-         }
-         if (WriteLattice (lat, file, form) < SUCCESS)
-            HError(9999, "DoRecognition: WriteLattice failed");
-         
-         FClose (file,isPipe);
+
+         if (partLab)   /* last segment after partial traceback */
+            LatSegFN (fn, nSeg + 1, latfn);
+         else
+            MakeFN (fn, latOutDir, latOutExt, latfn);
+         WriteLatFile (lat, latfn);
          Dispose (&transHeap, lat);
       }
    }
@@ -1211,6 +1269,120 @@ void DoRecognition (DecoderInst *dec, char *fn)
    CleanDecoderInst (dec);
 }
 
+/* MoveLabels
+
+     append all labels in from to the end of to
+*/
+void MoveLabels (LabList *from, LabList *to)
+{
+   LLink first, last;
+
+   if (from->head->succ == from->tail)
+      return;
+   first = from->head->succ;
+   last = from->tail->pred;
+   first->pred = to->tail->pred;
+   first->pred->succ = first;
+   last->succ = to->tail;
+   to->tail->pred = last;
+   from->head->succ = from->tail;
+   from->tail->pred = from->head;
+}
+
+/* PartialOutput
+
+     print the words that can no longer change, keep them for the final 
+     transcription, write their lattice segment and free their paths
+*/
+void PartialOutput (DecoderInst *dec, char *fn, LabList *partLab, int *nSeg)
+{
+   Transcription *trans;
+   Lattice *lat, *segLat;
+   LLink lab;
+   char latfn[MAXSTRLEN];
+
+   if (!FindPartialPath (dec) &&
+       !(partialLag > 0 && ForcePartialPath (dec, partialLag)))
+      return;
+
+   trans = PartialTraceBack (&transHeap, dec);
+   lab = trans->head->head->succ;
+   if (lab != trans->head->tail) {
+      printf ("Partial %.2f %.2f:", lab->start / 1.0e7, trans->head->tail->pred->end / 1.0e7);
+      for (; lab != trans->head->tail; lab = lab->succ)
+         printf (" %s", lab->labid->name);
+      printf ("\n");
+      fflush (stdout);
+   }
+   MoveLabels (trans->head, partLab);
+
+   if (latGen) {
+      lat = segLat = PartialLatTraceBack (&transHeap, dec);
+      if (latPruneBeam < - LSMALL)
+         lat = LatPrune (&transHeap, lat, latPruneBeam, latPruneAPS);
+      ++(*nSeg);
+      LatSegFN (fn, *nSeg, latfn);
+      WriteLatFile (lat, latfn);
+      Dispose (&transHeap, segLat);
+   }
+
+   CommitPartialPath (dec);
+}
+
+/* LatSegFN
+
+     name of lattice file for segment seg of partial traceback output
+*/
+char *LatSegFN (char *fn, int seg, char *latfn)
+{
+   char base[MAXSTRLEN], path[MAXSTRLEN], name[MAXSTRLEN];
+
+   strcat (BaseOf (fn, base), "_");
+   CounterFN (base, ".", seg, 3, name);     /* extension replaced by MakeFN */
+   return MakeFN (name, latOutDir ? latOutDir : PathOf (fn, path), latOutExt, latfn);
+}
+
+/* WriteLatFile
+
+     write lat to latfn in the format selected by -q
+*/
+void WriteLatFile (Lattice *lat, char *latfn)
+{
+   /* the following is from HVite.c */
+   char *p;
+   Boolean isPipe;
+   FILE *file;
+   LatFormat form;
+         
+   file = FOpen (latfn, NetOFilter, &isPipe);
+   if (!file) 
+      HError (999, "DoRecognition: Could not open file %s for lattice output",latfn);
+   if (!latOutForm)
+      form = (HLAT_DEFAULT & ~HLAT_ALLIKE)|HLAT_PRLIKE;
+   else {
+      for (p = latOutForm, form=0; *p != 0; p++) {
+         switch (*p) {
+         case 'A': form|=HLAT_ALABS; break;
+         case 'B': form|=HLAT_LBIN; break;
+         case 't': form|=HLAT_TIMES; break;
+         case 'v': form|=HLAT_PRON; break;
+         case 'a': form|=HLAT_ACLIKE; break;
+         case 'l': form|=HLAT_LMLIKE; break;
+         case 'd': form|=HLAT_ALIGN; break;
+         case 'm': form|=HLAT_ALDUR; break;
+         case 'n': form|=HLAT_ALLIKE; 
+            HError (9999, "DoRecognition: likelihoods for model alignment not supported");
+            break;
+         case 'r': form|=HLAT_PRLIKE; break;
+         }
+      }
+   }
+   if (WriteLattice (lat, file, form) < SUCCESS)
+      HError(9999, "DoRecognition: WriteLattice failed");
+   
+   FClose (file,isPipe);
+}
+
 #ifdef LEGACY_CUHTK2_MLLR
 void ResetFVTrans (HMMSet *hset, BlockMatrix transMat)
 {
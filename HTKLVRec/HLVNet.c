@@ -48,6 +48,12 @@ char *hlvnet_vc_id = "$Id: HLVNet.c,v 1.1.1.1 2006/10/11 09:54:55 jal58 Exp $";
 #include "HLVNet.h"
 
 #include <assert.h>
+#ifdef WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 
 
 #define LIST_BLOCKSIZE 70
@@ -1546,6 +1552,513 @@ LexNet *CreateLexNet (MemHeap *heap, Vocab *voc, HMMSet *hset,
 }
 
 
+/* ------------------- LexNet cache files ---------------------- */
+
+/*
+   A LexNet cache file holds the network built by CreateLexNet so
+   that it can be reloaded without repeating the construction.  All
+   values are written in HTK binary (big-endian) form:
+
+     magic, version
+     dictionary hash, HMM list hash, silDict, startWord, endWord
+     numPhy x { name }                       physical model table
+     nprons x { word name, pnum }            PronId -> Pron mapping
+     startPron, endPron, wordEndLayerId, spSkipLayer
+     nLayers x { index of first node }
+     nNodes, start, end, lnSEsp, lnSEsil     (node indices, -1 = none)
+     LM lookahead tree: nNodes x { loWE, hiWE },
+                        nCompNodes x { n, lmlaIdx[n] }
+     nNodes x { type, flags, data, lmlaIdx, nfoll, foll[nfoll] }
+
+   The hashes cover everything CreateLexNet depends on: the words and
+   pronunciations in the dictionary including their marking, and the
+   mapping of logical to physical models.  A cache built from a
+   different dictionary or HMM list is ignored and rebuilt.
+*/
+
+#define LEXNETMAGIC 0x484c564e   /* "HLVN" */
+#define LEXNETVERSION 1
+
+/* LNHash: FNV-1a style hash of n bytes continuing from h */
+static unsigned int LNHash (unsigned int h, void *p, int n)
+{
+   unsigned char *s = (unsigned char *) p;
+
+   for (; n > 0; --n, ++s)
+      h = (h ^ *s) * 16777619U;
+   return h;
+}
+
+/* LNHashStr: hash string s including terminator */
+static unsigned int LNHashStr (unsigned int h, char *s)
+{
+   return LNHash (h, s, strlen (s) + 1);
+}
+
+/* DictHash: hash all words and pronunciations with their marks */
+static unsigned int DictHash (Vocab *voc)
+{
+   unsigned int h = 2166136261U;
+   Word word;
+   Pron pron;
+   int i, j, v;
+
+   for (i = 0; i < VHASHSIZE; ++i)
+      for (word = voc->wtab[i]; word; word = word->next) {
+         h = LNHashStr (h, word->wordName->name);
+         v = (int) (size_t) word->aux;
+         h = LNHash (h, &v, sizeof (int));
+         for (pron = word->pron; pron; pron = pron->next) {
+            v = (int) (size_t) pron->aux;
+            h = LNHash (h, &v, sizeof (int));
+            v = pron->pnum;
+            h = LNHash (h, &v, sizeof (int));
+            for (j = 0; j < pron->nphones; ++j)
+               h = LNHashStr (h, pron->phones[j]->name);
+         }
+      }
+   return h;
+}
+
+typedef struct {
+   HLink hmm;          /* physical model */
+   LabId id;           /* its macro name */
+} LNPhyModel;
+
+/* LNCmpPhyModel: order physical model table by address */
+static int LNCmpPhyModel (const void *v1, const void *v2)
+{
+   HLink h1 = ((LNPhyModel *) v1)->hmm, h2 = ((LNPhyModel *) v2)->hmm;
+
+   if (h1 < h2) return -1;
+   if (h1 > h2) return 1;
+   return 0;
+}
+
+/* LNFindPhyModel: return index of hmm in sorted table or -1 */
+static int LNFindPhyModel (LNPhyModel *tab, int n, HLink hmm)
+{
+   int l, r, m;
+
+   for (l = 0, r = n-1; l <= r; ) {
+      m = (l + r) / 2;
+      if (tab[m].hmm == hmm) return m;
+      if (tab[m].hmm < hmm) l = m + 1; else r = m - 1;
+   }
+   return -1;
+}
+
+/* MakePhyTable: collect physical models of hset sorted by address and
+   hash the logical to physical mapping */
+static LNPhyModel *MakePhyTable (MemHeap *heap, HMMSet *hset, int *np, unsigned int *hash)
+{
+   LNPhyModel *tab;
+   MLink q;
+   unsigned int h = 2166136261U;
+   int i, n;
+
+   tab = (LNPhyModel *) New (heap, (hset->numPhyHMM + 1) * sizeof (LNPhyModel));
+   for (i = n = 0; i < MACHASHSIZE; ++i)
+      for (q = hset->mtab[i]; q; q = q->next)
+         if (q->type == 'h') {
+            if (n >= hset->numPhyHMM)
+               HError (9999, "HLVNet: physical model count mismatch");
+            tab[n].hmm = (HLink) q->structure;
+            tab[n++].id = q->id;
+         }
+   qsort (tab, n, sizeof (LNPhyModel), LNCmpPhyModel);
+   for (i = 0; i < MACHASHSIZE; ++i)
+      for (q = hset->mtab[i]; q; q = q->next)
+         if (q->type == 'l') {
+            h = LNHashStr (h, q->id->name);
+            h = LNHashStr (h, tab[LNFindPhyModel (tab, n, (HLink) q->structure)].id->name);
+            h = LNHash (h, &((HLink) q->structure)->numStates, sizeof (int));
+         }
+   *np = n;
+   *hash = h;
+   return tab;
+}
+
+/* WriteLNString: write length prefixed string */
+static void WriteLNString (FILE *f, char *s)
+{
+   int n;
+
+   n = strlen (s);
+   WriteInt (f, &n, 1, TRUE);
+   fwrite (s, 1, n, f);
+}
+
+/* ReadLNString: read length prefixed string into buf, NULL if bad */
+static char *ReadLNString (Source *src, char *buf)
+{
+   int n, i, c;
+
+   if (!ReadInt (src, &n, 1, TRUE) || n < 0 || n >= MAXSTRLEN)
+      return NULL;
+   for (i = 0; i < n; ++i) {
+      if ((c = GetCh (src)) == EOF)
+         return NULL;
+      buf[i] = (char) c;
+   }
+   buf[n] = '\0';
+   return buf;
+}
+
+/* LNIndex: index of node ln in net or -1 for NULL */
+static int LNIndex (LexNet *net, LexNode *ln)
+{
+   return ln ? (int) (ln - net->node) : -1;
+}
+
+/* WriteLexNet: write net to cache file fn.  The net is written to a
+   temporary file which is then renamed to fn, so that an interrupted
+   run or another job sharing the cache never leaves a partial file */
+static ReturnStatus WriteLexNet (LexNet *net, char *fn, unsigned int dictHash,
+                                 char *startWord, char *endWord)
+{
+   FILE *f;
+   LNPhyModel *tab;
+   LexNode *ln;
+   LMlaTree *la;
+   int i, j, np, ival, rec[5];
+   unsigned int hmmHash;
+   Pron pron;
+   Boolean ok;
+   char tmpfn[MAXFNAMELEN+32];
+
+   sprintf (tmpfn, "%s.%d.tmp", fn, (int) getpid ());
+   if ((f = fopen (tmpfn, "wb")) == NULL) {
+      HRError (9999, "HLVNet: cannot create LexNet cache %s", tmpfn);
+      return FAIL;
+   }
+   tab = MakePhyTable (&gcheap, net->hset, &np, &hmmHash);
+
+   ival = LEXNETMAGIC; WriteInt (f, &ival, 1, TRUE);
+   ival = LEXNETVERSION; WriteInt (f, &ival, 1, TRUE);
+   ival = (int) dictHash; WriteInt (f, &ival, 1, TRUE);
+   ival = (int) hmmHash; WriteInt (f, &ival, 1, TRUE);
+   ival = net->silDict; WriteInt (f, &ival, 1, TRUE);
+   WriteLNString (f, startWord);
+   WriteLNString (f, endWord);
+
+   WriteInt (f, &np, 1, TRUE);
+   for (i = 0; i < np; ++i)
+      WriteLNString (f, tab[i].id->name);
+
+   WriteInt (f, &net->voc->nprons, 1, TRUE);
+   for (i = 1; i <= net->voc->nprons; ++i) {
+      pron = net->pronlist[i];
+      if (pron) {
+         WriteLNString (f, pron->word->wordName->name);
+         ival = pron->pnum;
+         WriteInt (f, &ival, 1, TRUE);
+      }
+      else {
+         WriteLNString (f, "");
+         ival = -1; WriteInt (f, &ival, 1, TRUE);
+      }
+   }
+   rec[0] = net->startPron; rec[1] = net->endPron;
+   rec[2] = net->wordEndLayerId; rec[3] = net->spSkipLayer;
+   WriteInt (f, rec, 4, TRUE);
+   WriteInt (f, &net->nLayers, 1, TRUE);
+   for (i = 0; i < net->nLayers; ++i) {
+      ival = LNIndex (net, net->layerStart[i]);
+      WriteInt (f, &ival, 1, TRUE);
+   }
+   rec[0] = net->nNodes;
+   rec[1] = LNIndex (net, net->start);
+   rec[2] = LNIndex (net, net->end);
+   rec[3] = net->silDict ? LNIndex (net, net->lnSEsp) : -1;
+   rec[4] = net->silDict ? LNIndex (net, net->lnSEsil) : -1;
+   WriteInt (f, rec, 5, TRUE);
+
+   la = net->laTree;
+   WriteInt (f, &la->nNodes, 1, TRUE);
+   for (i = 0; i < la->nNodes; ++i) {
+      rec[0] = la->node[i].loWE; rec[1] = la->node[i].hiWE;
+      WriteInt (f, rec, 2, TRUE);
+   }
+   WriteInt (f, &la->nCompNodes, 1, TRUE);
+   for (i = 0; i < la->nCompNodes; ++i) {
+      WriteInt (f, &la->compNode[i].n, 1, TRUE);
+      WriteInt (f, la->compNode[i].lmlaIdx, la->compNode[i].n, TRUE);
+   }
+
+   for (i = 0, ln = net->node; i < net->nNodes; ++i, ++ln) {
+      rec[0] = ln->type;
+      rec[1] = ln->flags;
+      switch (ln->type) {
+      case LN_MODEL:
+         if ((rec[2] = LNFindPhyModel (tab, np, ln->data.hmm)) < 0)
+            HError (9999, "HLVNet: model of node %d not in HMM set", i);
+         break;
+      case LN_WORDEND:
+         rec[2] = ln->data.pron;
+         break;
+      default:
+         rec[2] = -1;
+         break;
+      }
+      rec[3] = ln->lmlaIdx;
+      rec[4] = ln->nfoll;
+      WriteInt (f, rec, 5, TRUE);
+      for (j = 0; j < ln->nfoll; ++j) {
+         ival = LNIndex (net, ln->foll[j]);
+         WriteInt (f, &ival, 1, TRUE);
+      }
+   }
+
+   Dispose (&gcheap, tab);
+   ok = !ferror (f);
+   if (fclose (f) != 0) ok = FALSE;
+#ifdef WIN32
+   if (ok) remove (fn);        /* rename does not replace a file here */
+#endif
+   if (!ok || rename (tmpfn, fn) != 0) {
+      remove (tmpfn);
+      HRError (9999, "HLVNet: cannot write LexNet cache %s", fn);
+      return FAIL;
+   }
+   return SUCCESS;
+}
+
+/* ReadLexNetBody: read the models, PronIds, lookahead tree and nodes
+   of the cache in src into net, using map for the physical models.
+   Returns NULL on success, otherwise what is wrong with the data */
+static char *ReadLexNetBody (Source *src, MemHeap *heap, LexNet *net,
+                             HLink *map, int np)
+{
+   Vocab *voc = net->voc;
+   LexNode *ln;
+   LMlaTree *la;
+   MLink ml;
+   LabId id;
+   Word word;
+   Pron pron;
+   char buf[MAXSTRLEN];
+   int i, j, k, nprons, ival, rec[5];
+
+   /* physical models */
+   for (i = 0; i < np; ++i) {
+      if (ReadLNString (src, buf) == NULL)
+         return "bad model name";
+      if ((id = GetLabId (buf, FALSE)) == NULL ||
+          (ml = FindMacroName (net->hset, 'h', id)) == NULL)
+         return "unknown model";
+      map[i] = (HLink) ml->structure;
+   }
+
+   /* PronIds */
+   if (!ReadInt (src, &nprons, 1, TRUE) || nprons != voc->nprons)
+      return "pronunciation count mismatch";
+   net->pronlist = (Pron *) New (heap, (nprons + 1) * sizeof (Pron));
+   net->pronlist[0] = NULL;
+   for (i = 1; i <= nprons; ++i) {
+      if (ReadLNString (src, buf) == NULL || !ReadInt (src, &k, 1, TRUE))
+         return "bad pronunciation";
+      pron = NULL;
+      if (k >= 0) {
+         if ((id = GetLabId (buf, FALSE)) == NULL || (word = GetWord (voc, id, FALSE)) == NULL)
+            return "unknown word";
+         for (pron = word->pron; pron; pron = pron->next)
+            if (pron->pnum == k) break;
+         if (!pron)
+            return "unknown pronunciation";
+      }
+      net->pronlist[i] = pron;
+   }
+   if (!ReadInt (src, rec, 4, TRUE) || !ReadInt (src, &net->nLayers, 1, TRUE) ||
+       net->nLayers <= 0)
+      return "bad header";
+   net->startPron = rec[0]; net->endPron = rec[1];
+   net->wordEndLayerId = rec[2]; net->spSkipLayer = rec[3];
+   net->layerStart = (LexNode **) New (heap, net->nLayers * sizeof (LexNode *));
+   for (i = 0; i < net->nLayers; ++i) {
+      if (!ReadInt (src, &ival, 1, TRUE))
+         return "bad header";
+      net->layerStart[i] = (LexNode *) (size_t) ival;     /* resolved below */
+   }
+   if (!ReadInt (src, rec, 5, TRUE) || rec[0] <= 0)
+      return "bad header";
+   net->nNodes = rec[0];
+   net->node = (LexNode *) New (heap, net->nNodes * sizeof (LexNode));
+   for (i = 1; i < 5; ++i)
+      if (rec[i] < -1 || rec[i] >= net->nNodes)
+         return "bad node index";
+   net->start = net->node + rec[1];
+   net->end = net->node + rec[2];
+   net->lnSEsp = (rec[3] >= 0) ? net->node + rec[3] : NULL;
+   net->lnSEsil = (rec[4] >= 0) ? net->node + rec[4] : NULL;
+   for (i = 0; i < net->nLayers; ++i) {
+      ival = (int) (size_t) net->layerStart[i];
+      if (ival < 0 || ival > net->nNodes)
+         return "bad layer start";
+      net->layerStart[i] = net->node + ival;
+   }
+
+   /* LM lookahead tree */
+   la = (LMlaTree *) New (heap, sizeof (LMlaTree));
+   net->laTree = la;
+   if (!ReadInt (src, &la->nNodes, 1, TRUE) || la->nNodes <= 0)
+      return "bad lookahead tree";
+   la->node = (LMlaNode *) New (heap, la->nNodes * sizeof (LMlaNode));
+   for (i = 0; i < la->nNodes; ++i) {
+      if (!ReadInt (src, rec, 2, TRUE))
+         return "bad lookahead tree";
+      la->node[i].loWE = rec[0]; la->node[i].hiWE = rec[1];
+   }
+   if (!ReadInt (src, &la->nCompNodes, 1, TRUE) || la->nCompNodes < 0)
+      return "bad lookahead tree";
+   la->compNode = (CompLMlaNode *) New (heap, la->nCompNodes * sizeof (CompLMlaNode));
+   for (i = 0; i < la->nCompNodes; ++i) {
+      if (!ReadInt (src, &la->compNode[i].n, 1, TRUE) || la->compNode[i].n < 0)
+         return "bad lookahead tree";
+      la->compNode[i].lmlaIdx = (int *) New (heap, la->compNode[i].n * sizeof (int));
+      if (!ReadInt (src, la->compNode[i].lmlaIdx, la->compNode[i].n, TRUE))
+         return "bad lookahead tree";
+   }
+
+   /* nodes and links */
+   for (i = 0, ln = net->node; i < net->nNodes; ++i, ++ln) {
+      if (!ReadInt (src, rec, 5, TRUE) || rec[4] < 0 ||
+          rec[3] < 0 || rec[3] >= la->nNodes + la->nCompNodes)
+         return "bad node";
+      ln->inst = NULL;
+      ln->type = (unsigned char) rec[0];
+      ln->flags = (unsigned char) rec[1];
+      switch (ln->type) {
+      case LN_MODEL:
+         if (rec[2] < 0 || rec[2] >= np)
+            return "bad model index";
+         ln->data.hmm = map[rec[2]];
+         break;
+      case LN_WORDEND:
+         if (rec[2] <= 0 || rec[2] > nprons)
+            return "bad PronId";
+         ln->data.pron = rec[2];
+         break;
+      default:
+         ln->data.hmm = NULL;
+         break;
+      }
+      ln->lmlaIdx = rec[3];
+      ln->nfoll = rec[4];
+      ln->foll = (LexNode **) New (heap, ln->nfoll * sizeof (LexNode *));
+      for (j = 0; j < ln->nfoll; ++j) {
+         if (!ReadInt (src, &ival, 1, TRUE) || ival < 0 || ival >= net->nNodes)
+            return "bad link";
+         ln->foll[j] = net->node + ival;
+      }
+   }
+   return NULL;
+}
+
+/* ReadLexNet: load net from cache file fn.  Returns NULL if fn does
+   not exist, was built for a different dictionary or HMM list, or is
+   short or corrupt */
+static LexNet *ReadLexNet (MemHeap *heap, char *fn, Vocab *voc, HMMSet *hset,
+                           unsigned int dictHash, char *startWord, char *endWord,
+                           Boolean silDict)
+{
+   Source src;
+   LexNet *net;
+   LNPhyModel *tab;
+   HLink *map;
+   char buf[MAXSTRLEN], *bad;
+   int i, np, ival, rec[5];
+   unsigned int hmmHash;
+   FILE *f;
+
+   if ((f = fopen (fn, "rb")) == NULL)      /* no cache yet */
+      return NULL;
+   fclose (f);
+   if (InitSource (fn, &src, NoFilter) < SUCCESS)
+      return NULL;
+   if (!ReadInt (&src, rec, 5, TRUE) || rec[0] != LEXNETMAGIC || rec[1] != LEXNETVERSION) {
+      CloseSource (&src);
+      if (trace & T_TOP)
+         printf ("LexNet cache %s has wrong format, rebuilding\n", fn);
+      return NULL;
+   }
+   tab = MakePhyTable (&gcheap, hset, &np, &hmmHash);
+   if ((unsigned int) rec[2] != dictHash || (unsigned int) rec[3] != hmmHash ||
+       rec[4] != silDict ||
+       ReadLNString (&src, buf) == NULL || strcmp (buf, startWord) != 0 ||
+       ReadLNString (&src, buf) == NULL || strcmp (buf, endWord) != 0 ||
+       !ReadInt (&src, &ival, 1, TRUE) || ival != np) {
+      CloseSource (&src);
+      Dispose (&gcheap, tab);
+      if (trace & T_TOP)
+         printf ("LexNet cache %s is out of date, rebuilding\n", fn);
+      return NULL;
+   }
+
+   net = (LexNet *) New (heap, sizeof (LexNet));
+   net->heap = heap;
+   net->voc = voc;
+   net->vocabFN = NULL;
+   net->hset = hset;
+   net->silDict = silDict;
+   map = (HLink *) New (&gcheap, (np + 1) * sizeof (HLink));
+   bad = ReadLexNetBody (&src, heap, net, map, np);
+   CloseSource (&src);
+   Dispose (&gcheap, map);
+   Dispose (&gcheap, tab);
+   if (bad != NULL) {
+      HError (-9999, "HLVNet: %s in LexNet cache %s, rebuilding", bad, fn);
+      if (heap->type == MSTAK)
+         Dispose (heap, net);
+      return NULL;
+   }
+
+   /* number the prons only now that the whole cache has been read,
+      since CreateLexNet relies on their marks if it is rebuilt */
+   for (i = 1; i <= voc->nprons; ++i)
+      if (net->pronlist[i])
+         net->pronlist[i]->aux = (Ptr) (size_t) i;
+
+   { 
+      LabId spLab;
+      spLab = GetLabId ("sp", FALSE);
+      if (!spLab)
+         HError (9999, "cannot find 'sp' model.");
+      net->hmmSP = FindHMM (net->hset, spLab);
+   }
+
+   return net;
+}
+
+/* EXPORT->CreateLexNetCached: as CreateLexNet, but load the network
+   from cacheFN when it was built for the same dictionary and HMM
+   list.  Otherwise build the network and save it in cacheFN. */
+LexNet *CreateLexNetCached (MemHeap *heap, Vocab *voc, HMMSet *hset, 
+                            char *startWord, char *endWord, Boolean silDict,
+                            char *cacheFN)
+{
+   LexNet *net;
+   unsigned int dictHash;
+
+   if (!cacheFN)
+      return CreateLexNet (heap, voc, hset, startWord, endWord, silDict);
+
+   dictHash = DictHash (voc);
+   net = ReadLexNet (heap, cacheFN, voc, hset, dictHash, startWord, endWord, silDict);
+   if (net) {
+      if (trace & T_TOP)
+         printf ("Loaded LexNet from cache %s: %d nodes\n", cacheFN, net->nNodes);
+      return net;
+   }
+
+   net = CreateLexNet (heap, voc, hset, startWord, endWord, silDict);
+   if (WriteLexNet (net, cacheFN, dictHash, startWord, endWord) == SUCCESS &&
+       (trace & T_TOP))
+      printf ("Saved LexNet to cache %s\n", cacheFN);
+   return net;
+}
+
+
 /* -------------- vocab handling --------------- */
 
 Boolean CompareBasePron (Pron b, Pron p)
@@ -285,6 +285,12 @@ void InitLVNet(void);
 LexNet *CreateLexNet (MemHeap *heap, Vocab *voc, HMMSet *hset, 
                       char *startWord, char *endWord, Boolean silDict);
 
+/* as CreateLexNet, but reuse network stored in cacheFN if it was
+   built for the same dictionary and HMM list */
+LexNet *CreateLexNetCached (MemHeap *heap, Vocab *voc, HMMSet *hset, 
+                            char *startWord, char *endWord, Boolean silDict,
+                            char *cacheFN);
+
 
 void ConvertSilDict (Vocab *voc, LabId spLab, LabId silLab, 
                      LabId startLab, LabId endLab);
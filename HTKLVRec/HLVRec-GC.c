@@ -44,17 +44,17 @@
 /* mark AltWordendHyp in least significant bit of a->prev, which is normally 
    always 0, since pointers are aligned */
 #define MARK_ALTPATH_MASK     0x00000001UL
-#define MARK_ALTPATH(a)         (a->prev = (int)(a->prev) | MARK_ALTPATH_MASK)
-#define MARKED_ALTPATH_P(a)     ((int)((a)->prev) & MARK_ALTPATH_MASK)
-#define UNMARK_ALTPATH(a)       (a->prev = (int)(a->prev) & ~MARK_ALTPATH_MASK)
+#define MARK_ALTPATH(a)         (a->prev = (WordendHyp *) ((size_t)(a->prev) | MARK_ALTPATH_MASK))
+#define MARKED_ALTPATH_P(a)     ((size_t)((a)->prev) & MARK_ALTPATH_MASK)
+#define UNMARK_ALTPATH(a)       (a->prev = (WordendHyp *) ((size_t)(a->prev) & ~MARK_ALTPATH_MASK))
 
-#define GC_ALTPATH_PREV(a)      ((WordendHyp *) ((int)(a)->prev & ~MARK_ALTPATH_MASK))
+#define GC_ALTPATH_PREV(a)      ((WordendHyp *) ((size_t)(a)->prev & ~MARK_ALTPATH_MASK))
 
 #ifdef MODALIGN
 #define MARK_MODPATH_MASK     0x00000001UL
-#define MARK_MODPATH(m)         (m->ln = (int)((m)->ln) | MARK_MODPATH_MASK)
-#define MARKED_MODPATH_P(m)     ((int)((m)->ln) & MARK_MODPATH_MASK)
-#define UNMARK_MODPATH(m)       (m->ln = (int)((m)->ln) & ~MARK_MODPATH_MASK)
+#define MARK_MODPATH(m)         (m->ln = (LexNode *) ((size_t)((m)->ln) | MARK_MODPATH_MASK))
+#define MARKED_MODPATH_P(m)     ((size_t)((m)->ln) & MARK_MODPATH_MASK)
+#define UNMARK_MODPATH(m)       (m->ln = (LexNode *) ((size_t)((m)->ln) & ~MARK_MODPATH_MASK))
 
 
 static void MarkModPath (ModendHyp *m)
@@ -280,11 +280,413 @@ static void SweepModPaths (MemHeap *heap)
 }
 #endif
 
+/* ------------------------ Nursery ------------------------ */
+
+/* New word end hyps are allocated in the nursery heaps.  Every gcFreq
+   frames the hyps in the nursery that are still reachable are copied
+   into weHypHeap/altweHypHeap and the whole nursery is cleared, so the
+   cost only depends on the number of active tokens and the number of
+   hyps created since the last collection.  A hyp is only changed in the
+   frame it is created, and its prev and alt->prev always point to
+   older hyps, so no hyp outside the nursery can point into it.
+   Hyps that die after they have been copied are freed by the
+   incremental sweep below.
+
+   During a collection all hyps in the nursery are tagged as young.
+   A copied hyp keeps the new address in prev, a copied alt in next.
+*/
+
+#define YOUNG_PATH_MASK  0x4000
+#define MOVED_PATH_MASK  0x2000
+#define YOUNG_PATH_P(p)         ((p)->user & YOUNG_PATH_MASK)
+#define MOVED_PATH_P(p)         ((p)->user & MOVED_PATH_MASK)
+
+/* alts are tagged in the two lowest bits of a->prev */
+#define YOUNG_ALTPATH_MASK    0x00000002UL
+#define MOVED_ALTPATH_MASK    MARK_ALTPATH_MASK
+#define YOUNG_ALTPATH_P(a)      ((size_t)((a)->prev) & YOUNG_ALTPATH_MASK)
+#define MOVED_ALTPATH_P(a)      ((size_t)((a)->prev) & MOVED_ALTPATH_MASK)
+#define UNTAGGED_ALTPATH_PREV(a) ((WordendHyp *) ((size_t)(a)->prev & \
+                                  ~(YOUNG_ALTPATH_MASK | MOVED_ALTPATH_MASK)))
+
+/* NewWordendHyp
+
+     allocate a new WordendHyp, in the nursery if used
+*/
+static WordendHyp *NewWordendHyp (DecoderInst *dec)
+{
+   return (WordendHyp *) New (dec->nursery ? &dec->weHypNursery : &dec->weHypHeap,
+                              sizeof (WordendHyp));
+}
+
+/* NewAltWordendHyp
+
+     allocate a new AltWordendHyp, in the nursery if used
+*/
+static AltWordendHyp *NewAltWordendHyp (DecoderInst *dec)
+{
+   return (AltWordendHyp *) New (dec->nursery ? &dec->altweHypNursery : &dec->altweHypHeap, 
+                                 sizeof (AltWordendHyp));
+}
+
+/* PromotePath
+
+     return the copy of path outside the nursery, copying it and all
+     young hyps reachable from it if necessary
+*/
+static WordendHyp *PromotePath (DecoderInst *dec, WordendHyp *path)
+{
+   WordendHyp *new;
+
+   if (!path || !YOUNG_PATH_P (path))
+      return path;
+   if (MOVED_PATH_P (path))
+      return path->prev;
+
+   new = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+   *new = *path;
+   new->user &= ~(YOUNG_PATH_MASK | MOVED_PATH_MASK);
+   path->user |= MOVED_PATH_MASK;
+   path->prev = new;
+
+   new->prev = PromotePath (dec, new->prev);
+   new->alt = PromoteAltPath (dec, new->alt);
+   return new;
+}
+
+/* PromoteAltPath
+
+     return the copy of the list of alternatives starting at alt outside
+     the nursery.  Lists can be shared by several hyps, but the young
+     alts are always at the front.
+*/
+static AltWordendHyp *PromoteAltPath (DecoderInst *dec, AltWordendHyp *alt)
+{
+   AltWordendHyp *new;
+
+   if (!alt || !YOUNG_ALTPATH_P (alt))
+      return alt;
+   if (MOVED_ALTPATH_P (alt))
+      return alt->next;
+
+   new = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+   *new = *alt;
+   new->prev = UNTAGGED_ALTPATH_PREV (alt);
+   alt->prev = (WordendHyp *) ((size_t) alt->prev | MOVED_ALTPATH_MASK);
+   alt->next = new;
+
+   new->prev = PromotePath (dec, new->prev);
+   new->next = PromoteAltPath (dec, new->next);
+   return new;
+}
+
+/* TagNursery
+
+     tag all elements of nursery heap as young and return their number
+*/
+static int TagNursery (MemHeap *heap, Boolean alt)
+{
+   int i, n;
+   BlockP b;
+   char *p;
+   WordendHyp *path;
+   AltWordendHyp *altpath;
+
+   assert (heap->type == MHEAP);
+
+   n = 0;
+   for (b = heap->heap; b; b = b->next) {
+      for (i = 0, p = b->data; i < b->numElem; ++i, p += heap->elemSize) {
+         if (b->used[i/8] & (1 << (i&7))) {
+            ++n;
+            if (alt) {
+               altpath = (AltWordendHyp *) p;
+               altpath->prev = (WordendHyp *) ((size_t) altpath->prev | YOUNG_ALTPATH_MASK);
+            }
+            else {
+               path = (WordendHyp *) p;
+               path->user |= YOUNG_PATH_MASK;
+            }
+         }
+      }
+   }
+   return n;
+}
+
+/* ClearNursery
+
+     free all elements of nursery heap, but keep its blocks
+*/
+static void ClearNursery (MemHeap *heap)
+{
+   BlockP b;
+
+   for (b = heap->heap; b; b = b->next) {
+      memset (b->used, 0, (b->numElem + 7) / 8);
+      b->numFree = b->numElem;
+      b->firstFree = 0;
+   }
+   heap->totUsed = 0;
+}
+
+/* CollectNursery
+
+     copy all hyps in the nursery that are reachable by active tokens
+     (or the partial traceback) out of the nursery and clear it
+*/
+static void CollectNursery (DecoderInst *dec)
+{
+   int i, j, l, N, nYoung, nAltYoung;
+   size_t nOld, nAltOld;
+   LexNodeInst *inst;
+   TokenSet *ts;
+
+   nYoung = TagNursery (&dec->weHypNursery, FALSE);
+   nAltYoung = dec->latgen ? TagNursery (&dec->altweHypNursery, TRUE) : 0;
+   nOld = dec->weHypHeap.totUsed;
+   nAltOld = dec->latgen ? dec->altweHypHeap.totUsed : 0;
+
+   for (l = 0; l < dec->nLayers; ++l) {
+      for (inst = dec->instsLayer[l]; inst; inst = inst->next) {
+         N = (inst->node->type == LN_MODEL) ? inst->node->data.hmm->numStates : 1;
+         for (i = 0; i < N; ++i) {
+            ts = &inst->ts[i];
+            for (j = 0; j < ts->n; ++j)
+               ts->relTok[j].path = PromotePath (dec, ts->relTok[j].path);
+         }
+      }
+   }
+   dec->partAnchor = PromotePath (dec, dec->partAnchor);
+   dec->partEnd = PromotePath (dec, dec->partEnd);
+
+   ClearNursery (&dec->weHypNursery);
+   if (dec->latgen)
+      ClearNursery (&dec->altweHypNursery);
+
+   if (trace&T_GC)
+      printf ("frame %d: promoted %d of %d Paths, %d of %d AltPaths\n", dec->frame,
+              (int) (dec->weHypHeap.totUsed - nOld), nYoung, 
+              (int) (dec->latgen ? dec->altweHypHeap.totUsed - nAltOld : 0), nAltYoung);
+}
+
+/* ------------------------ Incremental sweep ------------------------ */
+
+/* With the nursery the old hyps are not collected all at once.  Every
+   fullGCFreq nursery collections the hyps reachable from the active
+   tokens are marked in bitmaps kept beside the blocks of weHypHeap and
+   altweHypHeap, so the hyps themselves (which are copied freely by the
+   decoder) carry no marks.  Each bitmap is then turned into a map of
+   the dead hyps of its block, and every nursery collection frees the
+   dead hyps of the next slice of the maps, so that the sweep is spread
+   over fullGCFreq collections.  Dead hyps can never become reachable
+   again and hyps promoted during the sweep are not in the maps, so the
+   maps stay valid until the sweep is finished.  The marking itself
+   still visits all live hyps.
+*/
+
+/* StartSweep
+
+     record the blocks of heap and create an empty mark bitmap for each
+*/
+static void StartSweep (MemHeap *gcHeap, MemHeap *heap, GCSweep *s)
+{
+   BlockP b;
+   int i, j;
+   size_t n;
+
+   for (s->nBlocks = 0, b = heap->heap; b; b = b->next)
+      ++s->nBlocks;
+   s->block = (BlockP *) New (gcHeap, (s->nBlocks + 1) * sizeof (BlockP));
+   s->map = (unsigned char **) New (gcHeap, (s->nBlocks + 1) * sizeof (unsigned char *));
+
+   /* insertion sort by address, there are only a few large blocks */
+   for (i = 0, b = heap->heap; b; b = b->next, ++i) {
+      for (j = i; j > 0 && (char *) s->block[j-1]->data > (char *) b->data; --j)
+         s->block[j] = s->block[j-1];
+      s->block[j] = b;
+   }
+
+   s->slice = 0;
+   for (i = 0; i < s->nBlocks; ++i) {
+      n = (s->block[i]->numElem + 7) / 8;
+      s->map[i] = (unsigned char *) New (gcHeap, n);
+      memset (s->map[i], 0, n);
+      s->slice += n;
+   }
+   s->slice = s->slice / fullGCFreq + 1;
+   s->next = 0;
+   s->pos = 0;
+}
+
+/* SweepMark
+
+     mark element p of heap in the bitmaps of s, return FALSE if it was
+     already marked
+*/
+static Boolean SweepMark (MemHeap *heap, GCSweep *s, void *p)
+{
+   int lo, hi, m;
+   BlockP b;
+   size_t i;
+
+   lo = 0;
+   hi = s->nBlocks - 1;
+   while (lo <= hi) {
+      m = (lo + hi) / 2;
+      b = s->block[m];
+      if ((char *) p < (char *) b->data)
+         hi = m - 1;
+      else if ((char *) p >= (char *) b->data + b->numElem * heap->elemSize)
+         lo = m + 1;
+      else {
+         i = ((char *) p - (char *) b->data) / heap->elemSize;
+         if (s->map[m][i/8] & (1 << (i&7)))
+            return FALSE;
+         s->map[m][i/8] |= 1 << (i&7);
+         return TRUE;
+      }
+   }
+   HError (9999, "SweepMark: hyp not in %s", heap->name);
+   return FALSE;
+}
+
+/* MarkOldPath
+
+     mark path and all hyps reachable from it
+*/
+static void MarkOldPath (DecoderInst *dec, WordendHyp *path)
+{
+   AltWordendHyp *alt;
+
+   for (; path && SweepMark (&dec->weHypHeap, &dec->weSweep, path); path = path->prev)
+      for (alt = path->alt; alt; alt = alt->next)
+         if (SweepMark (&dec->altweHypHeap, &dec->altweSweep, alt))
+            MarkOldPath (dec, alt->prev);
+}
+
+/* DeadMaps
+
+     turn the mark bitmaps of s into maps of the unmarked used elements
+*/
+static void DeadMaps (GCSweep *s)
+{
+   int i;
+   size_t j, n;
+   BlockP b;
+
+   for (i = 0; i < s->nBlocks; ++i) {
+      b = s->block[i];
+      n = (b->numElem + 7) / 8;
+      for (j = 0; j < n; ++j)
+         s->map[i][j] = b->used[j] & ~s->map[i][j];
+   }
+}
+
+/* MarkOldPaths
+
+     mark all hyps reachable by active tokens (or the partial traceback)
+     and start a new sweep.  The nursery must be empty.
+*/
+static void MarkOldPaths (DecoderInst *dec)
+{
+   int i, j, l, N;
+   LexNodeInst *inst;
+   TokenSet *ts;
+
+   ResetHeap (&dec->gcHeap);
+   StartSweep (&dec->gcHeap, &dec->weHypHeap, &dec->weSweep);
+   if (dec->latgen)
+      StartSweep (&dec->gcHeap, &dec->altweHypHeap, &dec->altweSweep);
+
+   for (l = 0; l < dec->nLayers; ++l) {
+      for (inst = dec->instsLayer[l]; inst; inst = inst->next) {
+         N = (inst->node->type == LN_MODEL) ? inst->node->data.hmm->numStates : 1;
+         for (i = 0; i < N; ++i) {
+            ts = &inst->ts[i];
+            for (j = 0; j < ts->n; ++j)
+               MarkOldPath (dec, ts->relTok[j].path);
+         }
+      }
+   }
+   MarkOldPath (dec, dec->partAnchor);
+   MarkOldPath (dec, dec->partEnd);
+
+   DeadMaps (&dec->weSweep);
+   if (dec->latgen)
+      DeadMaps (&dec->altweSweep);
+}
+
+/* SweepSlice
+
+     free the dead elements in the next nBytes bytes of the maps of s
+     and return their number
+*/
+static int SweepSlice (MemHeap *heap, GCSweep *s, size_t nBytes)
+{
+   BlockP b;
+   unsigned char *dead;
+   size_t i, j, n;
+   int k, freed;
+
+   freed = 0;
+   for (; s->next < s->nBlocks; ++s->next, s->pos = 0) {
+      b = s->block[s->next];
+      dead = s->map[s->next];
+      n = (b->numElem + 7) / 8;
+      for (j = s->pos; j < n && nBytes > 0; ++j, --nBytes) {
+         if (!dead[j])
+            continue;
+         for (k = 0; k < 8; ++k) {
+            if (dead[j] & (1 << k)) {
+               /* similar to Dispose (heap, elem) */
+               i = j * 8 + k;
+               b->used[j] &= ~(1 << k);
+               if (i < b->firstFree) 
+                  b->firstFree = i;
+               b->numFree++; 
+               heap->totUsed--;
+               ++freed;
+            }
+         }
+      }
+      if (j < n) {
+         s->pos = j;
+         break;
+      }
+   }
+   return freed;
+}
+
+/* CollectPaths
+
+     collect the nursery and sweep the next slice of the old hyps.  The
+     old hyps are marked again every fullGCFreq collections, by which
+     time the previous sweep has finished.
+*/
+static void CollectPaths (DecoderInst *dec)
+{
+   int freed, altFreed;
+
+   CollectNursery (dec);
+   if (++dec->nMinorGC >= fullGCFreq && dec->weSweep.next >= dec->weSweep.nBlocks) {
+      MarkOldPaths (dec);
+      dec->nMinorGC = 0;
+   }
+
+   freed = SweepSlice (&dec->weHypHeap, &dec->weSweep, dec->weSweep.slice);
+   altFreed = dec->latgen ? 
+      SweepSlice (&dec->altweHypHeap, &dec->altweSweep, dec->altweSweep.slice) : 0;
+
+   if (trace&T_GC)
+      printf ("frame %d: swept %d Paths, %d AltPaths, %d/%d Paths in use\n", dec->frame,
+              freed, altFreed, (int) dec->weHypHeap.totUsed, (int) dec->weHypHeap.totAlloc);
+}
+
 /* GarbageCollectPaths
 
      dispose all WordEndhyps that are not reachable by active tokens
      anymore
-     uses simple mark & sweep GC
+     uses simple mark & sweep GC, after emptying the nursery
 */
 static void GarbageCollectPaths (DecoderInst *dec)
 {
@@ -292,6 +694,14 @@ static void GarbageCollectPaths (DecoderInst *dec)
    LexNodeInst *inst;
    TokenSet *ts;
 
+   if (dec->nursery) {
+      CollectNursery (dec);
+      dec->nMinorGC = 0;
+      /* the sweep maps are no longer valid */
+      dec->weSweep.nBlocks = dec->altweSweep.nBlocks = 0;
+      dec->weSweep.next = dec->altweSweep.next = 0;
+   }
+
    if (trace&T_GC) {
       printf ("Garbage Collecting paths.\n");
       PrintHeapStats (&dec->weHypHeap);
@@ -342,3 +752,301 @@ static void GarbageCollectPaths (DecoderInst *dec)
 #endif
    }
 }
+
+
+/* ------------------------ Partial Traceback ------------------------ */
+
+/* PushPartPath
+
+     add path to the front of FindPartialPath, kept as a heap with the 
+     latest word end at the top
+*/
+static void PushPartPath (WordendHyp **front, int *n, WordendHyp *path)
+{
+   int i, p;
+
+   if (MARKED_PATH_P (path))     /* already in front (or expanded) */
+      return;
+   MARK_PATH (path);
+
+   for (i = (*n)++; i > 0; i = p) {
+      p = (i - 1) / 2;
+      if (front[p]->frame >= path->frame)
+         break;
+      front[i] = front[p];
+   }
+   front[i] = path;
+}
+
+/* PopPartPath
+
+     remove and return the latest word end from the front
+*/
+static WordendHyp *PopPartPath (WordendHyp **front, int *n)
+{
+   WordendHyp *top, *last;
+   int i, c;
+
+   top = front[0];
+   last = front[--(*n)];
+   for (i = 0; (c = 2 * i + 1) < *n; i = c) {
+      if (c + 1 < *n && front[c+1]->frame > front[c]->frame)
+         ++c;
+      if (last->frame >= front[c]->frame)
+         break;
+      front[i] = front[c];
+   }
+   front[i] = last;
+
+   return top;
+}
+
+/* FindPartialPath
+
+     find the latest word end that lies on the paths of all active
+     tokens, i.e. the part of the traceback that can no longer change.
+     Starting from the paths of all tokens the latest word end in the
+     front is replaced by its predecessors (including the alternatives
+     for lattice generation) until only one word end is left.  With
+     several tokens per state the paths of the different LM states can
+     take long to meet, see ForcePartialPath().
+     Sets dec->partEnd and returns TRUE if this is later than the last
+     committed word end.
+*/
+Boolean FindPartialPath (DecoderInst *dec)
+{
+   int i, j, l, N, n, nDone, size;
+   LexNodeInst *inst;
+   TokenSet *ts;
+   WordendHyp **front, **done, *path;
+   AltWordendHyp *alt;
+   Boolean root;
+
+#ifdef MODALIGN
+   if (dec->modAlign)
+      HError (9999, "FindPartialPath: partial traceback not supported with model alignment");
+#endif
+   dec->partEnd = NULL;
+
+   /* each word end enters the front at most once */
+   size = dec->weHypHeap.totUsed + 1;
+   if (dec->nursery)
+      size += dec->weHypNursery.totUsed;
+   front = (WordendHyp **) New (&gstack, size * sizeof (WordendHyp *));
+   done = (WordendHyp **) New (&gstack, size * sizeof (WordendHyp *));
+   n = nDone = 0;
+   root = FALSE;
+
+   for (l = 0; l < dec->nLayers && !root; ++l) {
+      for (inst = dec->instsLayer[l]; inst && !root; inst = inst->next) {
+         N = (inst->node->type == LN_MODEL) ? inst->node->data.hmm->numStates : 1;
+         for (i = 0; i < N; ++i) {
+            ts = &inst->ts[i];
+            for (j = 0; j < ts->n; ++j) {
+               path = ts->relTok[j].path;
+               if (!path) 
+                  root = TRUE;
+               else
+                  PushPartPath (front, &n, path);
+            }
+         }
+      }
+   }
+
+   while (!root && n > 1) {
+      path = PopPartPath (front, &n);
+      done[nDone++] = path;
+      if (!path->prev || path == dec->partAnchor) {
+         /* some token reaches the start without passing the rest of the front */
+         root = TRUE;
+         break;
+      }
+      PushPartPath (front, &n, path->prev);
+      for (alt = path->alt; alt; alt = alt->next) {
+         if (!alt->prev)
+            root = TRUE;
+         else
+            PushPartPath (front, &n, alt->prev);
+      }
+   }
+
+   if (!root && n == 1 && front[0] != dec->partAnchor)
+      dec->partEnd = front[0];
+
+   for (i = 0; i < n; ++i)
+      UNMARK_PATH (front[i]);
+   for (i = 0; i < nDone; ++i)
+      UNMARK_PATH (done[i]);
+   Dispose (&gstack, front);
+
+   if (trace & T_GC && dec->partEnd)
+      printf ("frame %d: path stable up to frame %d\n", dec->frame, dec->partEnd->frame);
+
+   return (dec->partEnd != NULL);
+}
+
+/* PassesPath
+
+     TRUE if the best path leading to path passes through anchor
+*/
+static Boolean PassesPath (WordendHyp *path, WordendHyp *anchor)
+{
+   while (path && path != anchor && path->frame >= anchor->frame)
+      path = path->prev;
+   return (path == anchor);
+}
+
+/* KeepPartPaths
+
+     remove the alternatives that do not pass through anchor from all
+     word ends on the paths leading to path.  The word ends seen are
+     marked and added to done.
+*/
+static void KeepPartPaths (WordendHyp *path, WordendHyp *anchor,
+                           WordendHyp **done, int *nDone)
+{
+   AltWordendHyp *alt, **altp;
+
+   for (; path && path != anchor && !MARKED_PATH_P (path); path = path->prev) {
+      MARK_PATH (path);
+      done[(*nDone)++] = path;
+      for (altp = &path->alt; (alt = *altp); ) {
+         if (PassesPath (alt->prev, anchor)) {
+            KeepPartPaths (alt->prev, anchor, done, nDone);
+            altp = &alt->next;
+         }
+         else
+            *altp = alt->next;
+      }
+   }
+}
+
+/* PrunePartTokSet
+
+     remove the tokens in ts whose paths do not pass through anchor
+*/
+static void PrunePartTokSet (DecoderInst *dec, TokenSet *ts, WordendHyp *anchor,
+                             WordendHyp **done, int *nDone)
+{
+   RelToken *tok;
+   RelTokScore bestDelta;
+   int i, n;
+
+   bestDelta = LZERO;
+   for (i = n = 0, tok = ts->relTok; i < ts->n; ++i, ++tok) {
+      if (!PassesPath (tok->path, anchor))
+         continue;
+      KeepPartPaths (tok->path, anchor, done, nDone);
+      if (tok->delta > bestDelta)
+         bestDelta = tok->delta;
+      ts->relTok[n++] = *tok;
+   }
+   if (n == ts->n)
+      return;
+
+   ts->n = n;
+   if (n > 0) {         /* renormalise to new best score */
+      for (i = 0, tok = ts->relTok; i < n; ++i, ++tok)
+         tok->delta -= bestDelta;
+      ts->score += bestDelta;
+      ts->id = ++dec->tokSetIdCount;
+   }
+   else {
+      ts->score = LZERO;
+      ts->id = 0;
+   }
+}
+
+/* ForcePartialPath
+
+     called when the paths of the active tokens have not met: if the
+     last committed word end is more than lag frames back, the latest
+     word end on the best path that ends at least lag frames back is
+     made the stable word end.  Tokens and lattice alternatives whose
+     paths do not pass through it are pruned, so this bounds the
+     latency and the memory of partial traceback at the cost of a
+     forced decision.
+     Sets dec->partEnd and returns TRUE if such a word end was found.
+*/
+Boolean ForcePartialPath (DecoderInst *dec, int lag)
+{
+   int i, j, l, N, nDone, size;
+   LexNodeInst *inst;
+   TokenSet *ts;
+   WordendHyp **done, *path, *best;
+   TokScore score, bestScore;
+
+   dec->partEnd = NULL;
+   if (dec->frame - (dec->partAnchor ? dec->partAnchor->frame : 0) <= lag)
+      return FALSE;
+
+   best = NULL;
+   bestScore = LZERO;
+   for (l = 0; l < dec->nLayers; ++l) {
+      for (inst = dec->instsLayer[l]; inst; inst = inst->next) {
+         N = (inst->node->type == LN_MODEL) ? inst->node->data.hmm->numStates : 1;
+         for (i = 0; i < N; ++i) {
+            ts = &inst->ts[i];
+            for (j = 0; j < ts->n; ++j) {
+               score = ts->score + ts->relTok[j].delta;
+               if (score > bestScore) {
+                  bestScore = score;
+                  best = ts->relTok[j].path;
+               }
+            }
+         }
+      }
+   }
+
+   for (path = best; path && path != dec->partAnchor; path = path->prev)
+      if (path->frame <= dec->frame - lag)
+         break;
+   if (!path || path == dec->partAnchor)
+      return FALSE;
+
+   size = dec->weHypHeap.totUsed + 1;
+   if (dec->nursery)
+      size += dec->weHypNursery.totUsed;
+   done = (WordendHyp **) New (&gstack, size * sizeof (WordendHyp *));
+   nDone = 0;
+
+   for (l = 0; l < dec->nLayers; ++l) {
+      for (inst = dec->instsLayer[l]; inst; inst = inst->next) {
+         N = (inst->node->type == LN_MODEL) ? inst->node->data.hmm->numStates : 1;
+         for (i = 0; i < N; ++i)
+            if (inst->ts[i].n > 0)
+               PrunePartTokSet (dec, &inst->ts[i], path, done, &nDone);
+      }
+   }
+
+   for (i = 0; i < nDone; ++i)
+      UNMARK_PATH (done[i]);
+   Dispose (&gstack, done);
+
+   dec->partEnd = path;
+   if (trace & T_GC)
+      printf ("frame %d: path forced up to frame %d\n", dec->frame, path->frame);
+
+   return TRUE;
+}
+
+/* CommitPartialPath
+
+     cut the traceback at the word end found by FindPartialPath() so
+     that the word ends before it are freed by the next garbage
+     collection.  Later tracebacks stop at this word end.
+*/
+void CommitPartialPath (DecoderInst *dec)
+{
+   WordendHyp *path;
+
+   path = dec->partEnd;
+   if (!path)
+      return;
+
+   path->prev = NULL;
+   path->alt = NULL;
+   path->user &= 3;     /* keep pronvar, clear lattice node number */
+   dec->partAnchor = path;
+   dec->partEnd = NULL;
+}
@@ -339,6 +339,14 @@ static LMTokScore LMCacheLookaheadProb (DecoderInst *dec, LMState lmState,
 
    cache = dec->lmCache;
    assert (lmlaIdx < cache->nNode);
+
+   if (dec->lmlaTable && dec->lm == dec->lmlaTableLM) {  /* static network */
+      lmscore = dec->lmScale * 
+         dec->lmlaTable[((FSLM_LatNode *) lmState - dec->lm->data.latlm->fslmln) *
+                        (size_t) cache->nNode + lmlaIdx];
+      return (lmscore < LSMALL) ? LZERO : lmscore;
+   }
+
    nodeCache = cache->node[lmlaIdx];
 
    if (fastlmla) {      /* #### should only go to fast LMState if real one is not cahced */
@@ -412,3 +420,77 @@ static LMTokScore LMCacheLookaheadProb (DecoderInst *dec, LMState lmState,
    return lmscore;
 }
 
+/* LMLATableCompNode
+
+     unscaled lookahead of complex node from the simple nodes in row
+*/
+static LogFloat LMLATableCompNode (LMlaTree *laTree, LogFloat *row, int lmlaIdx)
+{
+   CompLMlaNode *laNode;
+   LogFloat score, best;
+   int i;
+
+   if (lmlaIdx < laTree->nNodes)
+      return row[lmlaIdx];
+
+   laNode = &laTree->compNode[lmlaIdx - laTree->nNodes];
+   best = LZERO;
+   for (i = 0; i < laNode->n; ++i) {
+      score = LMLATableCompNode (laTree, row, laNode->lmlaIdx[i]);
+      if (score > best)
+         best = score;
+   }
+   return best;
+}
+
+/* EXPORT->CreateLMLATable
+
+     precompute the LM lookahead for every state of a static lattice LM
+     and every node of the lookahead tree of net, so that
+     LMCacheLookaheadProb() becomes a table lookup. The table is only
+     built if it fits into MAXLMLATABLE MBytes, otherwise the normal
+     cache is used. Scaling is applied at lookup time, as lmScale is
+     only known in InitDecoderInst().
+*/
+void CreateLMLATable (DecoderInst *dec, LexNet *net, MemHeap *heap)
+{
+   FSLM_latlm *latlm;
+   LMlaTree *laTree;
+   LMlaNode *laNode;
+   LogFloat *row;
+   double size;
+   int i, j, nLA;
+
+   if (dec->lm->type != fslm_latlm)
+      HError (9999, "CreateLMLATable: only supported for lattice LMs");
+   latlm = dec->lm->data.latlm;
+   laTree = net->laTree;
+   nLA = laTree->nNodes + laTree->nCompNodes;
+   size = (double) latlm->nnodes * nLA * sizeof (LogFloat) / 1048576.0;
+   if (size > maxLMLATable) {
+      if (trace & T_TOP)
+         printf ("CreateLMLATable: %.1f MB exceeds MAXLMLATABLE, using LMLA cache\n", size);
+      return;
+   }
+
+   dec->lmlaTable = (LogFloat *) New (heap, (size_t) latlm->nnodes * nLA * sizeof (LogFloat));
+   for (i = 0; i < latlm->nnodes; ++i) {
+      row = dec->lmlaTable + (size_t) i * nLA;
+      if (latlm->fslmln[i].nfoll == 0) {   /* end node, never an LM state */
+         for (j = 0; j < nLA; ++j)
+            row[j] = LZERO;
+         continue;
+      }
+      for (j = 0, laNode = laTree->node; j < laTree->nNodes; ++j, ++laNode)
+         row[j] = LMLookAhead (dec->lm, (LMState) &latlm->fslmln[i], 
+                               laNode->loWE, laNode->hiWE);
+      for (j = laTree->nNodes; j < nLA; ++j)
+         row[j] = LMLATableCompNode (laTree, row, j);
+   }
+   dec->lmlaTableLM = dec->lm;
+
+   if (trace & T_TOP)
+      printf ("CreateLMLATable: %d LM states x %d lookahead nodes (%.1f MB)\n",
+              latlm->nnodes, nLA, size);
+}
+
@@ -142,14 +142,14 @@ static WordendHyp *CombinePaths (DecoderInst *dec, RelToken *winner, RelToken *l
 
    /*   assert (winner->path->score > loser->path->score);  */
 
-   weHyp = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+   weHyp = NewWordendHyp (dec);
    *weHyp = *winner->path;
 
    weHyp->frame = dec->frame;
 
    p = &weHyp->alt;
    for (alt = winner->path->alt; alt; alt = alt->next) {
-      newalt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+      newalt = NewAltWordendHyp (dec);
       *newalt = *alt;
       newalt->next = NULL;
       *p = newalt;
@@ -158,7 +158,7 @@ static WordendHyp *CombinePaths (DecoderInst *dec, RelToken *winner, RelToken *l
 
    /* add info from looser */
 
-   newalt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+   newalt = NewAltWordendHyp (dec);
    newalt->prev = loser->path->prev;
    newalt->score = diff;
    newalt->lm = loser->path->lm;
@@ -174,7 +174,7 @@ static WordendHyp *CombinePaths (DecoderInst *dec, RelToken *winner, RelToken *l
          it anyway later on */
       /* should be latprunebeam? */
       if (diff + alt->score > -dec->beamWidth) {
-         newalt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+         newalt = NewAltWordendHyp (dec);
          *newalt = *alt;
          newalt->score = diff + alt->score;
          newalt->next = NULL;
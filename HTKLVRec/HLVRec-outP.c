@@ -100,8 +100,11 @@ static OutPCache *CreateOutPCache (MemHeap *heap, HMMSet *hset, int block)
    /* the sIdx values are 1..numSharedStates, thus the +1 below. Same for mIdx */
    
    cache->stateOutP = cache->mixOutP = NULL;
+   cache->active = NULL;
+   cache->nActive = 0;
    if (cache->nStates > 0) {
       cache->stateT = (int *) New (heap, (cache->nStates + 1) * sizeof (int));
+      cache->active = (int *) New (heap, (cache->nStates + 1) * sizeof (int));
       cache->stateOutP = (LogFloat *) New (heap, (cache->nStates + 1) * cache->block * sizeof (LogFloat));
    }
    if (cache->nMix > 0) {
@@ -307,6 +310,107 @@ x      CACHE_FLAG_SET(dec, sIdx);
 
 
 
+/* CollectActiveStates
+
+     find the shared states that PropagateInternal() will score in this
+     frame and that are not in the cache yet.  A state is needed if any 
+     of its predecessors holds tokens within the current beam.  The
+     states are marked as cached here so each is listed only once.
+*/
+static void CollectActiveStates (DecoderInst *dec)
+{
+   OutPCache *cache;
+   LexNodeInst *inst;
+   TokenSet *instTS;
+   HLink hmm;
+   SMatrix trP;
+   int l, i, j, N, sIdx;
+   Boolean needed;
+
+   cache = dec->outPCache;
+   cache->nActive = 0;
+   for (l = 0; l < dec->nLayers; ++l) {
+      for (inst = dec->instsLayer[l]; inst; inst = inst->next) {
+         if (inst->node->type != LN_MODEL)
+            continue;
+         hmm = inst->node->data.hmm;
+         N = hmm->numStates;
+         trP = hmm->transP;
+         instTS = inst->ts;
+         for (j = 2; j < N; ++j) {
+            needed = FALSE;
+            for (i = 1; i < N && !needed; ++i)
+               if (instTS[i-1].n > 0 && instTS[i-1].score >= dec->beamLimit &&
+                   (i == j || trP[i][j] > LSMALL))
+                  needed = TRUE;
+            if (!needed)
+               continue;
+            sIdx = hmm->svec[j].info->sIdx;
+            if (dec->frame - cache->stateT[sIdx] < cache->block)
+               continue;
+            cache->stateT[sIdx] = dec->frame;
+            cache->active[cache->nActive++] = sIdx;
+         }
+      }
+   }
+}
+
+#define SCORE_CHUNK 16          /* states scored by one thread task */
+
+/* ScoreStatesTask: fill the cache for one chunk of the active states */
+static void ScoreStatesTask (int thread, int task, Ptr arg)
+{
+   DecoderInst *dec = (DecoderInst *) arg;
+   OutPCache *cache = dec->outPCache;
+   int k, kEnd, sIdx;
+
+   kEnd = (task + 1) * SCORE_CHUNK;
+   if (kEnd > cache->nActive)
+      kEnd = cache->nActive;
+   for (k = task * SCORE_CHUNK; k < kEnd; ++k) {
+      sIdx = cache->active[k];
+      OutPBlock (dec->si, &dec->obsBlock[0], cache->block,
+                 sIdx, dec->acScale, &cache->stateOutP[sIdx * cache->block]);
+   }
+}
+
+/* ScoreActiveStates
+
+     first phase of ProcessFrame(): score all states needed in this frame
+     for the whole observation block before any tokens are propagated,
+     spreading the states over the decoder's threads.  The cache then
+     satisfies every cOutP() call made during propagation.
+*/
+static void ScoreActiveStates (DecoderInst *dec)
+{
+   OutPCache *cache;
+   int k, nTasks;
+
+   cache = dec->outPCache;
+   if (cache->mixOutP || cache->nStates == 0) {   /* left to cOutP() */
+      cache->nActive = 0;
+      return;
+   }
+   CollectActiveStates (dec);
+   if (dec->si->useHModel) {   /* adaptation code is not re-entrant */
+      for (k = 0; k < cache->nActive; ++k)
+         OutPBlock_HMod (dec->si, &dec->obsBlock[0], cache->block,
+                         cache->active[k], dec->acScale, 
+                         &cache->stateOutP[cache->active[k] * cache->block],
+                         dec->frame);
+   }
+   else {
+      nTasks = (cache->nActive + SCORE_CHUNK - 1) / SCORE_CHUNK;
+      if (dec->pool != NULL)
+         RunThreadTasks (dec->pool, nTasks, ScoreStatesTask, (Ptr) dec);
+      else
+         for (k = 0; k < nTasks; ++k)
+            ScoreStatesTask (0, k, (Ptr) dec);
+   }
+   cache->cacheMiss += cache->nActive;
+   dec->nScored += cache->nActive;
+}
+
 /* outP caclulation for USEHMODEL=T case  */
 
 
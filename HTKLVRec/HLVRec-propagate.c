@@ -87,13 +87,91 @@ static int winTok_cmp (const void *v1,const void *v2)
 }
 
 
-/* stats for TokenSet Id optimisation */
-static int mts_copy = 0;
-static int mts_fast = 0;
-static int mts_slow = 0;
-static int mts_newid = 0;
-static int mts_newidNTOK = 0;
+/* SameLMStates
 
+     TRUE if TokenSets a and b contain tokens in exactly the same LM
+     states (and have the same size).
+*/
+static Boolean SameLMStates (TokenSet *a, TokenSet *b)
+{
+   int i;
+   RelToken *aTok, *bTok;
+
+   for (i = a->n, aTok = a->relTok, bTok = b->relTok; i > 0; --i, ++aTok, ++bTok)
+      if (!TOK_LMSTATE_EQ(aTok, bTok))
+         return FALSE;
+   return TRUE;
+}
+
+/* MergeAlignedTokSet
+
+     MergeTokSet for the common case of src and dest containing tokens
+     in the same LM states.  Token i of the result can only come from
+     token i of src or dest, so the merge is done in place in dest
+     without the sorted merge and the winTok copy.  Token selection,
+     scores and pruning are the same as in the general merge and the
+     result never needs histogram pruning.
+*/
+static void MergeAlignedTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest, 
+                                LogFloat score, Boolean prune)
+{
+   int i, n, nSrc, nDest;
+   RelToken *srcTok, *destTok, *winTok;
+   TokScore winScore;
+   RelTokScore srcCorr, destCorr, deltaLimit;
+
+   /* find best score */
+   if (src->score + score > dest->score) {
+      winScore = src->score + score;
+      srcCorr = - score;     /* avoid adding score twice! */
+      destCorr = dest->score - winScore;
+   } else {
+      winScore = dest->score;
+      srcCorr = src->score - winScore;
+      destCorr = 0.0;
+   }
+
+   deltaLimit = dec->nTok * dec->relBeamWidth;  /* scaled relative beam */
+   if (prune) {
+      deltaLimit = dec->beamLimit - winScore;     /* main beam */
+      if (dec->relBeamWidth > deltaLimit)            
+         deltaLimit = dec->relBeamWidth;          /* relative beam */
+   }
+
+   n = nSrc = nDest = 0;
+   srcTok = src->relTok;
+   destTok = dest->relTok;
+   for (i = src->n; i > 0; --i, ++srcTok, ++destTok) {
+      winTok = &dest->relTok[n];        /* n <= index of destTok */
+      if (src->score + srcTok->delta + score > dest->score + destTok->delta) {
+         *winTok = *srcTok;
+         winTok->delta += srcCorr + score;
+         if (winTok->delta >= deltaLimit) {      /* keep or prune? */
+            ++n;
+            ++nSrc;
+         }
+      } else {
+         if (winTok != destTok)
+            *winTok = *destTok;
+         winTok->delta += destCorr;
+         if (winTok->delta >= deltaLimit) {      /* keep or prune? */
+            ++n;
+            ++nDest;
+         }
+      }
+   }
+
+   dest->n = n;
+   dest->score = winScore;
+   if (nSrc == n)
+      dest->id = src->id;          /* copy src->id */
+   else if (nDest == n)
+      dest->id = dest->id;         /* copy dest->id */
+   else {
+      dest->id = ++dec->tokSetIdCount;    /* new id */
+      ++dec->mtsNewId;
+   }
+}
 
 /* MergeTokSet
 
@@ -119,7 +197,7 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
       dest->score = src->score + score;
       dest->id = src->id;
 
-      ++mts_copy;
+      ++dec->mtsCopy;
       for (i = 0, srcTok = src->relTok, destTok = dest->relTok; i < src->n; ++i, ++srcTok, ++destTok)
          *destTok = *srcTok;
       /*         dest->relTok[i] = src->relTok[i]; */
@@ -132,7 +210,7 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
    else if (src->id == dest->id) {      /* TokenSet Id optimisation from [Odell:2000] */
       TokScore srcScore;
 
-      ++mts_fast;
+      ++dec->mtsFast;
       /* only compare Tokensets' best scores and pick better */
       srcScore = src->score + score;
       
@@ -145,6 +223,10 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
       }
    }
 #endif
+   else if (src->n == dest->n && SameLMStates (src, dest)) {
+      ++dec->mtsAligned;
+      MergeAlignedTokSet (dec, src, dest, score, prune);
+   }
    else {    /* expensive MergeTokSet, #### move into separate function */
 #if 1
       /* exploit & retain RelTok order (sorted by lmState?) */
@@ -154,7 +236,7 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
       TokScore winScore;
       RelTokScore srcCorr, destCorr, deltaLimit;
 
-      ++mts_slow;
+      ++dec->mtsSlow;
 
       winTok = dec->winTok;
       nWinTok = 0;
@@ -274,7 +356,7 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
             dest->id = dest->id;         /* copy dest->id */
          else {
             dest->id = ++dec->tokSetIdCount;    /* new id */
-            ++mts_newid;
+            ++dec->mtsNewId;
          }
       } else {
          /* perform Bucket sort/Histogram pruning to reduce to dec->nTok tokens */
@@ -286,7 +368,7 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
          LogFloat binWidth, limit;
 
          dest->id = ++dec->tokSetIdCount;    /* #### new id always necessary? */
-         ++mts_newidNTOK;
+         ++dec->mtsNewIdNTok;
 
          binWidth = deltaLimit*1.001 / NBINS;   /* handle delta==deltaLimit case */
 
@@ -895,7 +977,7 @@ static void HandleWordend (DecoderInst *dec, LexNode *ln)
             else {      /* latgen */
                AltWordendHyp *alt;
 
-               alt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+               alt = NewAltWordendHyp (dec);
                
                if (newDelta > tokJ->delta) {
                   /* move tokJ->path to alt */
@@ -956,7 +1038,7 @@ static void HandleWordend (DecoderInst *dec, LexNode *ln)
          ++newN;
 
          /* new wordendHyp */
-         weHyp = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+         weHyp = NewWordendHyp (dec);
       
          weHyp->prev = prev;
          weHyp->pron = ln->data.pron;
@@ -1043,7 +1125,7 @@ static void UpdateWordEndHyp (DecoderInst *dec, LexNodeInst *inst)
 
       /* don't copy weHyp, if it is up-to-date (i.e. for <s>) */
       if (oldweHyp->frame != dec->frame || oldweHyp->pron != dec->net->startPron) {
-         weHyp = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+         weHyp = NewWordendHyp (dec);
          *weHyp = *oldweHyp;
          weHyp->score = ts->score + tok->delta;
          weHyp->frame = dec->frame;
@@ -1089,7 +1171,7 @@ static void AddPronProbs (DecoderInst *dec, TokenSet *ts, int var)
       if (path->user != var) {
          WordendHyp *weHyp;
 
-         weHyp = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+         weHyp = NewWordendHyp (dec);
          *weHyp = *path;
          weHyp->user = var;
          tok->path = weHyp;
@@ -1192,6 +1274,7 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
    LexNodeInst *inst, *prevInst, *next;
    int nActive, modelActive;
    TokScore beamLimit;
+   double t0, t1, t2;
    
    inXForm = xform; /* sepcifies the transform to use */
    
@@ -1203,12 +1286,19 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
    dec->bestInst = NULL;
    ++dec->frame;
 
-   if (dec->frame % gcFreq == 0)
-      GarbageCollectPaths (dec);
+   if (dec->frame % gcFreq == 0) {
+      if (dec->nursery)
+         CollectPaths (dec);
+      else
+         GarbageCollectPaths (dec);
+   }
 
-   mts_copy = mts_fast = mts_slow = 0;
-   mts_newid = mts_newidNTOK = 0;
+   /* phase 1: score all states that will be needed in this frame */
+   t0 = WallTime ();
+   ScoreActiveStates (dec);
+   t1 = WallTime ();
 
+   /* phase 2: token propagation */
    if (trace & T_BEST) {
       printf ("frame: %d beamLimit: %f\n", dec->frame, dec->beamLimit);
    }
@@ -1249,8 +1339,8 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
          /*         printf ("BEST %p %f\n", inst->node, inst->best); */
       }
 #if 0
-   printf ("MTS_copy: %d MTS_fast: %d  MTS slow: %d ", mts_copy, mts_fast, mts_slow);
-   printf ("MTS_newid: %d MTS_newidNTOK: %d\n", mts_newid, mts_newidNTOK);
+   printf ("MTS_copy: %ld MTS_fast: %ld  MTS slow: %ld ", dec->mtsCopy, dec->mtsFast, dec->mtsSlow);
+   printf ("MTS_newid: %ld MTS_newidNTOK: %ld\n", dec->mtsNewId, dec->mtsNewIdNTok);
 #endif
       if (trace & T_TOKSTATS)
          printf ("Pass1: %d active nodes in layer %d\n", nActive, l);
@@ -1471,8 +1561,8 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
       } /* for inst */
 
 #if 0
-      printf ("MTS_copy: %d MTS_fast: %d  MTS slow: %d ", mts_copy, mts_fast, mts_slow);
-      printf ("MTS_newid: %d MTS_newidNTOK: %d\n", mts_newid, mts_newidNTOK);
+      printf ("MTS_copy: %ld MTS_fast: %ld  MTS slow: %ld ", dec->mtsCopy, dec->mtsFast, dec->mtsSlow);
+      printf ("MTS_newid: %ld MTS_newidNTOK: %ld\n", dec->mtsNewId, dec->mtsNewIdNTok);
       printf ("LMCacheLA:  %d hits  %d misses\n", 
               dec->lmCache->laHit, dec->lmCache->laMiss);
 #endif
@@ -1545,6 +1635,13 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
 
    dec->beamLimit = dec->bestScore - dec->curBeamWidth;
 
+   t2 = WallTime ();
+   dec->outPTime += t1 - t0;
+   dec->propTime += t2 - t1;
+   if (trace & T_TIM)
+      printf ("frame %d: scored %d states in %.3f ms, propagation %.3f ms\n",
+              dec->frame, dec->outPCache->nActive, 1000.0 * (t1 - t0), 
+              1000.0 * (t2 - t1));
 
 #ifdef COLLECT_STATS
    ++dec->stats.nFrames;
@@ -1553,8 +1650,8 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
 #if 0
    printf ("cacheHits: %d  cacheMisses: %d\n", 
            dec->outPCache->cacheHit, dec->outPCache->cacheMiss);
-   printf ("MTS_copy: %d MTS_fast: %d  MTS slow: %d ", mts_copy, mts_fast, mts_slow);
-   printf ("MTS_newid: %d MTS_newidNTOK: %d\n", mts_newid, mts_newidNTOK);
+   printf ("MTS_copy: %ld MTS_fast: %ld  MTS slow: %ld ", dec->mtsCopy, dec->mtsFast, dec->mtsSlow);
+   printf ("MTS_newid: %ld MTS_newidNTOK: %ld\n", dec->mtsNewId, dec->mtsNewIdNTok);
    printf ("tokSetIDcount: %d\n", dec->tokSetIdCount);
    printf ("PI_LR: %d  PI_GEN: %d\n", PI_LR, PI_GEN);
 #endif
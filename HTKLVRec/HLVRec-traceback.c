@@ -159,6 +159,69 @@ TokenSet *BestTokSet (DecoderInst *dec)
    return (ts);
 }
 
+/* Path2Trans
+
+     convert the word end hyps from path back to the last partial
+     traceback (or the start of the utterance) into a transcription
+*/
+static Transcription *Path2Trans (MemHeap *heap, DecoderInst *dec, WordendHyp *path)
+{
+   Transcription *trans;
+   LabList *ll;
+   LLink lab, nextlab;
+   WordendHyp *weHyp;
+   LogFloat prevScore, score;
+   Pron pron;
+   HTime start;
+
+   trans = CreateTranscription (heap);
+   ll = CreateLabelList (heap, 0);
+
+   /* going backwards from </s> to <s> */
+   for (weHyp = path; weHyp && weHyp != dec->partAnchor; weHyp = weHyp->prev) {
+      lab = CreateLabel (heap, ll->maxAuxLab);
+      pron = dec->net->pronlist[weHyp->pron];
+      if ((weHyp->user & 3) == 1)
+         pron = pron->next;             /* sp */
+      else if ((weHyp->user & 3) == 2)
+         pron = pron->next->next;       /* sil */
+
+      lab->labid = pron->outSym;
+      lab->score = weHyp->score;
+      lab->start = 0.0;
+      lab->end = weHyp->frame * dec->frameDur * 1.0e7;
+      lab->succ = ll->head->succ;
+      lab->pred = ll->head;
+      lab->succ->pred = lab->pred->succ = lab;
+   }
+
+   if (dec->partAnchor) {
+      start = dec->partAnchor->frame * dec->frameDur * 1.0e7;
+      prevScore = dec->partAnchor->score;
+   }
+   else {
+      start = 0.0;
+      prevScore = 0.0;
+   }
+   for (lab = ll->head->succ; lab != ll->tail; lab = lab->succ) {
+      lab->start = start;
+      start = lab->end;
+      score = lab->score - prevScore;
+      prevScore = lab->score;
+      lab->score = score;
+   }
+
+   for (lab = ll->head->succ; lab != ll->tail; lab = nextlab) {
+      nextlab = lab->succ;
+      if (!lab->labid)          /* delete words with [] outSym */
+         DeleteLabel (lab);
+   }
+
+   AddLabelList (ll, trans);
+   
+   return trans;
+}
+
 /* TraceBack
 
      Finds best token in end state and returns path.
@@ -168,15 +231,10 @@ Transcription *TraceBack(MemHeap *heap, DecoderInst *dec)
 {
    Transcription *trans;
    LabList *ll;
-   LLink lab, nextlab;
-   WordendHyp *weHyp;
    TokenSet *ts;
    RelToken *bestTok=NULL;
-   LogFloat prevScore, score;
    RelTokScore bestDelta;
-   Pron pron;
    int i;
-   HTime start;
 
    if (dec->net->end->inst && dec->net->end->inst->ts->n > 0)
       ts = dec->net->end->inst->ts;
@@ -210,46 +268,20 @@ Transcription *TraceBack(MemHeap *heap, DecoderInst *dec)
       PrintRelTok (dec, bestTok);
    }
 
-   trans = CreateTranscription (heap);
-   ll = CreateLabelList (heap, 0);
-
-   /* going backwards from </s> to <s> */
-   for (weHyp = bestTok->path; weHyp; weHyp = weHyp->prev) {
-      lab = CreateLabel (heap, ll->maxAuxLab);
-      pron = dec->net->pronlist[weHyp->pron];
-      if ((weHyp->user & 3) == 1)
-         pron = pron->next;             /* sp */
-      else if ((weHyp->user & 3) == 2)
-         pron = pron->next->next;       /* sil */
-
-      lab->labid = pron->outSym;
-      lab->score = weHyp->score;
-      lab->start = 0.0;
-      lab->end = weHyp->frame * dec->frameDur * 1.0e7;
-      lab->succ = ll->head->succ;
-      lab->pred = ll->head;
-      lab->succ->pred = lab->pred->succ = lab;
-   }
+   return Path2Trans (heap, dec, bestTok->path);
+}
 
-   start = 0.0;
-   prevScore = 0.0;
-   for (lab = ll->head->succ; lab != ll->tail; lab = lab->succ) {
-      lab->start = start;
-      start = lab->end;
-      score = lab->score - prevScore;
-      prevScore = lab->score;
-      lab->score = score;
-   }
+/* PartialTraceBack
 
-   for (lab = ll->head->succ; lab != ll->tail; lab = nextlab) {
-      nextlab = lab->succ;
-      if (!lab->labid)          /* delete words with [] outSym */
-         DeleteLabel (lab);
-   }
+     returns the words between the last partial traceback and the
+     stable word end found by FindPartialPath()
+*/
+Transcription *PartialTraceBack (MemHeap *heap, DecoderInst *dec)
+{
+   if (!dec->partEnd)
+      HError (9999, "PartialTraceBack: no stable path found");
 
-   AddLabelList (ll, trans);
-   
-   return trans;
+   return Path2Trans (heap, dec, dec->partEnd);
 }
 
 /* LatTraceBackCount
@@ -261,7 +293,7 @@ static void LatTraceBackCount (DecoderInst *dec, WordendHyp *path, int *nnodes,
 {
    AltWordendHyp *alt;
 
-   if (!path)
+   if (!path || path == dec->partAnchor)
       return;
 
    /* the pronvar is encoded in the user field: 
@@ -310,7 +342,7 @@ static void Paths2Lat (DecoderInst *dec, Lattice *lat, WordendHyp *path,
    LArc *la;
    Pron pron;
 
-   if (!path)
+   if (!path || path == dec->partAnchor)
       return;
 
    n = (int) (path->user / 4);  /* current node (end node of arcs) */
@@ -430,7 +462,6 @@ static void Paths2Lat (DecoderInst *dec, Lattice *lat, WordendHyp *path,
 Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec)
 {
    Lattice *lat;
-   int i, nnodes = 0, nlinks = 0;
    WordendHyp *sentEndWE;
 
    if (!dec->net->end->inst)
@@ -462,11 +493,43 @@ Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec)
    if (!sentEndWE)
       return NULL;
    
+   lat = LatFromPath (heap, dec, sentEndWE);
+   printf ("nnodes %d nlinks %d\n", lat->nn, lat->na);
+
+#ifdef MODALIGN
+   if (dec->modAlign)
+      CheckLAlign (dec, lat);
+#endif
+   return lat;
+}
+
+/* PartialLatTraceBack
+
+     produce the Lattice between the last partial traceback and the
+     stable word end found by FindPartialPath()
+*/
+Lattice *PartialLatTraceBack (MemHeap *heap, DecoderInst *dec)
+{
+   if (!dec->partEnd)
+      HError (9999, "PartialLatTraceBack: no stable path found");
+
+   return LatFromPath (heap, dec, dec->partEnd);
+}
+
+/* LatFromPath
+
+     create Lattice from the wordEnd hypotheses leading to path.  The
+     lattice start node is placed at the last partial traceback.
+*/
+static Lattice *LatFromPath (MemHeap *heap, DecoderInst *dec, WordendHyp *path)
+{
+   Lattice *lat;
+   int i, nnodes = 0, nlinks = 0;
+
    /* recursively number weHyps (nodes), count weHyp + altweHyp (links) */
-   LatTraceBackCount (dec, sentEndWE, &nnodes, &nlinks);
+   LatTraceBackCount (dec, path, &nnodes, &nlinks);
 
    ++nnodes;    /* !NULL lattice start node */
-   printf ("nnodes %d nlinks %d\n", nnodes, nlinks);
 
    /*# create lattice */
    lat = NewLattice (heap, nnodes, nlinks);
@@ -484,18 +547,16 @@ Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec)
       
    for (i = 0; i < nnodes; ++i)
       lat->lnodes[i].hook = NULL;
+   if (dec->partAnchor)
+      lat->lnodes[0].time = dec->partAnchor->frame*dec->frameDur;
 
    {
       int na;
       na = 0;
       /* create lattice nodes & arcs */
-      Paths2Lat (dec, lat, sentEndWE, &na);
+      Paths2Lat (dec, lat, path, &na);
    }
    
-#ifdef MODALIGN
-   if (dec->modAlign)
-      CheckLAlign (dec, lat);
-#endif
    return lat;
 }
 
@@ -710,7 +771,7 @@ AltWordendHyp *FakeSEpath (DecoderInst *dec, RelToken *tok, Boolean useLM)
       assert (!useLM || dest == (Ptr) 0xfffffffe);
       lmScore += dec->insPen;
 
-      alt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+      alt = NewAltWordendHyp (dec);
       alt->next = NULL;
 
       if (!dec->fastlmla) {
@@ -746,7 +807,7 @@ WordendHyp *AltPathList2Path (DecoderInst *dec, AltWordendHyp *alt, PronId pron)
       }
    
    /* create full WordendHyp for best */
-   path = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+   path = NewWordendHyp (dec);
    path->prev = bestAlt->prev;
    path->pron = pron;
    path->frame = dec->frame;
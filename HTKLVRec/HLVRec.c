@@ -89,6 +89,7 @@ char *hlvrec_vc_id = "$Id: HLVRec.c,v 1.9 2012/12/22 07:01:28 uratec Exp $";
 #include "HUtil.h"
 #include "HNet.h"       /* for Lattice -- move to HLattice? */
 #include "HAdapt.h"
+#include "HThreads.h"
 
 #include "config.h"
 
@@ -113,6 +114,7 @@ char *hlvrec_vc_id = "$Id: HLVRec.c,v 1.9 2012/12/22 07:01:28 uratec Exp $";
 #define T_LAT 0200         /* details of lattice generation */
 #define T_GC 0400          /* details of garbage collection */
 #define T_MEM 01000          /* details of memory usage */
+#define T_TIM 02000        /* time spent scoring and propagating per frame */
 
 static int trace=0;
 static ConfParam *cParm[MAXGLOBS];      /* config parameters */
@@ -125,6 +127,8 @@ static Boolean buildLatSE = FALSE;/* build lat from single tok in SENTEND node *
 static Boolean forceLatOut = TRUE;/* always output lattice, even when no token survived */
 
 static int gcFreq = 100;          /* run Garbage Collection every gcFreq frames */
+static Boolean gcNursery = TRUE;  /* allocate new word end hyps in a nursery */
+static int fullGCFreq = 10;       /* mark old hyps every fullGCFreq nursery collections */
 
 static Boolean pde = FALSE;      /* partial distance elimination */
 
@@ -132,6 +136,7 @@ static Boolean useOldPrune = FALSE;     /* backward compatibility for max model
 static Boolean mergeTokOnly = TRUE;     /* if merge token set with pruning */
 static float maxLNBeamFlr = 0.8;        /* maximum percentile of glogal beam for max model pruning */
 static float dynBeamInc = 1.3;          /* dynamic beam increment for max model pruning */
+static int maxLMLATable = 256;          /* max size of precomputed LM lookahead table in MB */
 #define LAYER_SIL_NTOK_SCALE 6          /* SIL layer re-adjust token set size e.g. 6 */
 
 /* -------------------------- Global Variables --------------------- */
@@ -161,6 +166,8 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
                       LogFloat insPen, float acScale, float pronScale, float lmScale,
                       LogFloat fastlmlaBeam);
 void CleanDecoderInst (DecoderInst *dec);
+void SetDecoderThreads (DecoderInst *dec, int nThreads);
+void CreateLMLATable (DecoderInst *dec, LexNet *net, MemHeap *heap);
 static TokenSet *NewTokSetArray(DecoderInst *dec, int N);
 static TokenSet *NewTokSetArrayVar(DecoderInst *dec, int N, Boolean isSil);
 static LexNodeInst *ActivateNode (DecoderInst *dec, LexNode *ln);
@@ -202,17 +209,22 @@ static LMTokScore LMCacheTransProb (DecoderInst *dec, FSLM *lm,
 LMTokScore LMLA_nocache (DecoderInst *dec, LMState lmState, int lmlaIdx);
 static LMTokScore LMCacheLookaheadProb (DecoderInst *dec, LMState lmState, 
                                         int lmlaIdx, Boolean fastlmla);
+static LogFloat LMLATableCompNode (LMlaTree *laTree, LogFloat *row, int lmlaIdx);
 /* HLVRec-traceback.c */
 static void PrintPath (DecoderInst *dec, WordendHyp *we);
 static void PrintTok(DecoderInst *dec, Token *tok);
 static void PrintRelTok(DecoderInst *dec, RelToken *tok);
 static void PrintTokSet (DecoderInst *dec, TokenSet *ts);
 TokenSet *BestTokSet (DecoderInst *dec);
+static Transcription *Path2Trans (MemHeap *heap, DecoderInst *dec, WordendHyp *path);
 Transcription *TraceBack(MemHeap *heap, DecoderInst *dec);
+Transcription *PartialTraceBack (MemHeap *heap, DecoderInst *dec);
 static void LatTraceBackCount (DecoderInst *dec, WordendHyp *path, int *nnodes, int *nlinks);
 static void Paths2Lat (DecoderInst *dec, Lattice *lat, WordendHyp *path,
                        int *na);
+static Lattice *LatFromPath (MemHeap *heap, DecoderInst *dec, WordendHyp *path);
 Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec);
+Lattice *PartialLatTraceBack (MemHeap *heap, DecoderInst *dec);
 #ifdef MODALIGN
 LAlign *LAlignFromModpath (DecoderInst *dec, MemHeap *heap,
                            ModendHyp *modpath, int wordStart, short *nLAlign);
@@ -240,6 +252,29 @@ static void SweepAltPaths (MemHeap *heap);
 static void SweepModPaths (MemHeap *heap);
 #endif
 static void GarbageCollectPaths (DecoderInst *dec);
+static void CollectPaths (DecoderInst *dec);
+static WordendHyp *NewWordendHyp (DecoderInst *dec);
+static AltWordendHyp *NewAltWordendHyp (DecoderInst *dec);
+static WordendHyp *PromotePath (DecoderInst *dec, WordendHyp *path);
+static AltWordendHyp *PromoteAltPath (DecoderInst *dec, AltWordendHyp *alt);
+static int TagNursery (MemHeap *heap, Boolean alt);
+static void ClearNursery (MemHeap *heap);
+static void CollectNursery (DecoderInst *dec);
+static void StartSweep (MemHeap *gcHeap, MemHeap *heap, GCSweep *s);
+static Boolean SweepMark (MemHeap *heap, GCSweep *s, void *p);
+static void MarkOldPath (DecoderInst *dec, WordendHyp *path);
+static void MarkOldPaths (DecoderInst *dec);
+static int SweepSlice (MemHeap *heap, GCSweep *s, size_t nBytes);
+static void PushPartPath (WordendHyp **front, int *n, WordendHyp *path);
+static WordendHyp *PopPartPath (WordendHyp **front, int *n);
+Boolean FindPartialPath (DecoderInst *dec);
+static Boolean PassesPath (WordendHyp *path, WordendHyp *anchor);
+static void KeepPartPaths (WordendHyp *path, WordendHyp *anchor,
+                           WordendHyp **done, int *nDone);
+static void PrunePartTokSet (DecoderInst *dec, TokenSet *ts, WordendHyp *anchor,
+                             WordendHyp **done, int *nDone);
+Boolean ForcePartialPath (DecoderInst *dec, int lag);
+void CommitPartialPath (DecoderInst *dec);
 
 
 /* HLVRec-outP.c */
@@ -247,6 +282,7 @@ static void ResetOutPCache (OutPCache *cache);
 static OutPCache *CreateOutPCache (MemHeap *heap, HMMSet *hset, int block);
 LogFloat SOutP_ID_mix_Block(HMMSet *hset, int s, Observation *x, StreamInfo *sti);
 static LogFloat cOutP (DecoderInst *dec, Observation *x, HLink hmm, int state);
+static void ScoreActiveStates (DecoderInst *dec);
 void OutPBlock_HMod (StateInfo_lv *si, Observation **obsBlock, 
                      int n, int sIdx, float acScale, LogFloat *outP, int id);
 
@@ -289,11 +325,14 @@ void InitLVRec(void)
       if (GetConfBool (cParm, nParm, "BUILDLATSENTEND",&b)) buildLatSE = b;
       if (GetConfBool (cParm, nParm, "FORCELATOUT",&b)) forceLatOut = b;
       if (GetConfInt (cParm, nParm,"GCFREQ", &i)) gcFreq = i;
+      if (GetConfBool (cParm, nParm, "GCNURSERY",&b)) gcNursery = b;
+      if (GetConfInt (cParm, nParm,"FULLGCFREQ", &i)) fullGCFreq = i;
       if (GetConfBool (cParm, nParm, "PDE",&b)) pde = b;
       if (GetConfBool (cParm, nParm, "USEOLDPRUNE",&b)) useOldPrune = b;
       if (GetConfBool (cParm, nParm, "MERGETOKONLY",&b)) mergeTokOnly = b;
       if (GetConfFlt (cParm, nParm, "MAXLNBEAMFLR", &f)) maxLNBeamFlr = f;
       if (GetConfFlt (cParm, nParm, "DYNBEAMINC", &f)) dynBeamInc = f;
+      if (GetConfInt (cParm, nParm, "MAXLMLATABLE", &i)) maxLMLATable = i;
 
       if (useOldPrune) {
          mergeTokOnly = FALSE; maxLNBeamFlr = 0.0; dynBeamInc = 1.1;
@@ -395,9 +434,26 @@ DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen,
       HError (9999, "CreateDecoderInst: model alignment not supported; recompile with MODALIGN");
 #endif
 
+   /* nursery heaps for word end hyps created since the last GC
+      (not used with model alignment) */
+   dec->nursery = gcNursery && !modAlign;
+   if (dec->nursery) {
+      CreateHeap (&dec->weHypNursery, "WordendHyp nursery", MHEAP, 
+                  sizeof (WordendHyp), 1.0, 80000, 800000);
+      if (dec->latgen)
+         CreateHeap (&dec->altweHypNursery, "AltWordendHyp nursery", MHEAP, 
+                     sizeof (AltWordendHyp), 1.0, 8000, 80000);
+      CreateHeap (&dec->gcHeap, "GC sweep maps", MSTAK, 1, 1.0, 20000, 200000);
+      dec->weSweep.nBlocks = dec->altweSweep.nBlocks = 0;
+      dec->weSweep.next = dec->altweSweep.next = 0;
+   }
+
    /* output probability cache */
 
    dec->outPCache = CreateOutPCache (&dec->heap, dec->hset, outpBlocksize);
+   dec->pool = NULL;
+   dec->lmlaTable = NULL;
+   dec->lmlaTableLM = NULL;
 
    /* cache debug code */
 #if 0
@@ -496,6 +552,15 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
    ResetHeap (&dec->weHypHeap);
    if (dec->latgen)
       ResetHeap (&dec->altweHypHeap);
+   if (dec->nursery) {
+      ResetHeap (&dec->weHypNursery);
+      if (dec->latgen)
+         ResetHeap (&dec->altweHypNursery);
+      ResetHeap (&dec->gcHeap);
+      dec->weSweep.nBlocks = dec->altweSweep.nBlocks = 0;
+      dec->weSweep.next = dec->altweSweep.next = 0;
+   }
+   dec->nMinorGC = 0;
 #ifdef MODALIGN
    if (dec->modAlign)
       ResetHeap (&dec->modendHypHeap);
@@ -531,6 +596,7 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
    }
 
    dec->tokSetIdCount = 0;
+   dec->partAnchor = dec->partEnd = NULL;
 
    dec->insPen = insPen;
    dec->acScale = acScale;
@@ -595,6 +661,10 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
 
    /* invalidate OutP cache */
    ResetOutPCache (dec->outPCache);
+   dec->nScored = 0;
+   dec->outPTime = dec->propTime = 0.0;
+   dec->mtsCopy = dec->mtsFast = dec->mtsAligned = dec->mtsSlow = 0;
+   dec->mtsNewId = dec->mtsNewIdNTok = 0;
 }
 
 void CleanDecoderInst (DecoderInst *dec)
@@ -602,6 +672,15 @@ void CleanDecoderInst (DecoderInst *dec)
    FreeLMCache (dec->lmCache);
 }
 
+/* EXPORT->SetDecoderThreads: score active states with nThreads threads */
+void SetDecoderThreads (DecoderInst *dec, int nThreads)
+{
+   if (dec->pool != NULL)
+      HError (9999, "SetDecoderThreads: threads already set");
+   if (nThreads > 1)
+      dec->pool = CreateThreadPool (&dec->heap, nThreads);
+}
+
 
 /* NewTokSetArray
 
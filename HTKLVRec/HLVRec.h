@@ -137,6 +137,17 @@ struct _TokenSet {
    unsigned int id;             /*####  should be only 2byte short! */
 };
    
+typedef struct _GCSweep GCSweep;        /* incremental sweep of an old hyp heap */
+
+struct _GCSweep {
+   int nBlocks;                 /* number of blocks when the hyps were marked */
+   BlockP *block;               /* these blocks, sorted by address */
+   unsigned char **map;         /* mark (later dead) bitmap for each block */
+   int next;                    /* next block to sweep */
+   size_t pos;                  /* next byte of its map to sweep */
+   size_t slice;                /* map bytes to sweep per nursery collection */
+};
+
 struct _LexNodeInst {           /* attached to active LexNode's, contains info about tokens */
    LexNode *node;
    TokenSet *ts;                /* array of TokenSets; one per state (incl. entry and exit) */
@@ -197,6 +208,8 @@ struct _OutPCache {
    LogFloat *mixOutP;
    int cacheHit;
    int cacheMiss;
+   int *active;                 /* states to be scored in current frame */
+   int nActive;                 /* number of states in active */
 };
 
 
@@ -299,6 +312,13 @@ struct _DecoderInst {
    MemHeap nodeInstanceHeap;    /* MHEAP for LexNodeInsts */
    MemHeap weHypHeap;           /* MHEAP for word end hyps */
    MemHeap altweHypHeap;        /* MHEAP for alt word end hyps (for latgen) */
+   Boolean nursery;             /* allocate new word end hyps in the nursery heaps */
+   MemHeap weHypNursery;        /* MHEAP for word end hyps created since last GC */
+   MemHeap altweHypNursery;     /* MHEAP for alt word end hyps created since last GC */
+   int nMinorGC;                /* nursery collections since the old hyps were last marked */
+   MemHeap gcHeap;              /* MSTAK for the maps of the incremental sweep */
+   GCSweep weSweep;             /* incremental sweep of weHypHeap */
+   GCSweep altweSweep;          /* incremental sweep of altweHypHeap */
    MemHeap *tokSetHeap;         /* MHEAPs for N TokenSet arrays */
    MemHeap relTokHeap;          /* MHEAP for RelToken arrays (dec->nTok-1 elements) */
    MemHeap lrelTokHeap;         /* MHEAP for larger size RelToken arrays (e.g. 6 * dec->nTok-1 elements) */
@@ -346,13 +366,29 @@ struct _DecoderInst {
    Boolean useHModel;           /* use normal HModel OutP() functions? */
    /*    outP cache */
    OutPCache *outPCache;        /* cache of outP values for block of observations */
+   ThreadPool *pool;            /* threads for scoring active states (or NULL) */
+   long nScored;                /* states scored in current utterance */
+   double outPTime;             /* wall time spent scoring states */
+   double propTime;             /* wall time spent propagating tokens */
+   long mtsCopy;                /* MergeTokSet() into empty dest */
+   long mtsFast;                /* MergeTokSet() with equal TokenSet ids */
+   long mtsAligned;             /* MergeTokSet() of sets with the same LM states */
+   long mtsSlow;                /* full MergeTokSet() */
+   long mtsNewId;               /* merges giving a new TokenSet id */
+   long mtsNewIdNTok;           /* full merges pruned to nTok tokens */
 
    /* LM lookahead cache */
    LMCache *lmCache;
+   LogFloat *lmlaTable;         /* precomputed lookahead for static network (or NULL) */
+   FSLM *lmlaTableLM;           /* LM the table was computed for */
 
    /* relToken set identifier */
    unsigned int tokSetIdCount;/* max id used so far for token sets */
 
+   /* partial traceback */
+   WordendHyp *partAnchor;      /* last word end committed by partial traceback */
+   WordendHyp *partEnd;         /* stable word end found by FindPartialPath() */
+
    StateInfo_lv *si;
 
 #ifdef MODALIGN
@@ -390,12 +426,20 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
                       LogFloat fastlmlaBeam);
 
 void CleanDecoderInst (DecoderInst *dec);
+void SetDecoderThreads (DecoderInst *dec, int nThreads);
+void CreateLMLATable (DecoderInst *dec, LexNet *net, MemHeap *heap);
 void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
                    AdaptXForm *xform);
 
 Transcription *TraceBack (MemHeap *heap, DecoderInst *dec);
 Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec);
 
+Boolean FindPartialPath (DecoderInst *dec);
+Boolean ForcePartialPath (DecoderInst *dec, int lag);
+Transcription *PartialTraceBack (MemHeap *heap, DecoderInst *dec);
+Lattice *PartialLatTraceBack (MemHeap *heap, DecoderInst *dec);
+void CommitPartialPath (DecoderInst *dec);
+
 void ReFormatTranscription(Transcription *trans,HTime frameDur,
                            Boolean states,Boolean models,Boolean triStrip,
                            Boolean normScores,Boolean killScores,
@@ -98,6 +98,7 @@ char *hadapt_vc_id =  "$Id: HAdapt.c,v 1.66 2012/12/22 07:01:28 uratec Exp $";
 #include "HUtil.h"
 #include "HAdapt.h"
 #include "HFB.h"
+#include "HThreads.h"
 
 /* trace flags */
 #define T_TOP   00001    /* Top level tracing */
@@ -136,6 +137,14 @@ typedef struct {
    float gConst;
 } MInfo;
 
+typedef struct {
+   int nFrames;          /* number of frames currently buffered */
+   int maxFrames;        /* buffer size */
+   Vector *obs;          /* [1..maxFrames] buffered observations */
+   DVector *wgt;         /* [1..maxFrames] per-dimension frame weights */
+   double *prod;         /* outer products of the buffered frames in a block */
+} FrameBuf;
+
 typedef struct {
    double  occ;
    DVector spSum;
@@ -143,6 +152,7 @@ typedef struct {
    DTriMat *bTriMat;
    DTriMat *bDiagMat;
    DVector bVector;
+   FrameBuf *bFrames;    /* frames awaiting accumulation into bTriMat */
 } RegAcc;
 
 typedef struct {
@@ -169,6 +179,7 @@ static Boolean saveSpkrModels = FALSE;
 
 /* The xform config variable information */
 static float minOccThresh = 0.0;       /* minimum occupancy to accumulate stats to estimate xform */
+static int accFrameBlock = 32;         /* frames buffered per base class before updating bTriMat */
 static Boolean storeMInfo = TRUE;      /* whether original model information  is to be stored */
 static Boolean keepXFormDistinct = TRUE;
 static Boolean swapXForms = FALSE;     /* swap the transforms around after generating transform */
@@ -200,6 +211,26 @@ static Boolean useVBLR = FALSE;            /* perform VBLR adaptation */
 static float   priorscale = 1.0;           /* prior parameter for VBLR */
 static float   vbvarfloor = 1.0E-20;       /* floor for VB posterior variance */
 
+/* deferred estimation of speaker transforms (SetAdaptThreads) */
+#define JOBS_PER_THREAD 4    /* speakers queued per thread */
+
+typedef struct {             /* one queued speaker */
+   MemHeap mem;              /* saved class statistics */
+   AdaptXForm *xform;        /* output transform of speaker */
+   char spkr[MAXSTRLEN];     /* speaker name */
+   int nXForms;              /* number of class transforms */
+   AccStruct **accs;         /* [1..nXForms] class statistics */
+   LinXForm **xf;            /* [1..nXForms] class transforms */
+} SpkrXFormJob;
+
+typedef struct _XFormBatch {
+   ThreadPool *pool;         /* estimation threads */
+   int nJobs;                /* number of queued speakers */
+   int maxJobs;              /* size of queue */
+   SpkrXFormJob *job;        /* [0..maxJobs-1] queued speakers */
+   MemHeap *scratch;         /* [0..nThreads-1] workspace of each thread */
+} XFormBatch;
+
 /*------------------------------------------------------------------------*/
 /*    Support Routines for determining internal structures required       */
 /*    Note: these only act on the transform NOT any parents.              */
@@ -528,6 +559,7 @@ static void InitXFInfo (XFInfo *xfinfo)
    xfinfo->headpoc = NULL;
    xfinfo->headboc = NULL;
    xfinfo->headac = NULL;
+   xfinfo->xfBatch = NULL;
 
    CreateHeap(&xfinfo->acccaStack,"AccStore", MSTAK, 1, 1.0, 50000, 500000);
    CreateHeap(&xfinfo->bobcaStack,"baseObsStore", MSTAK, 1, 1.0, 50000, 500000);
@@ -556,6 +588,7 @@ void InitAdapt (XFInfo *xfinfo_hmm, XFInfo *xfinfo_dur)
       /* general adaptation config variables */
       if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
       if (GetConfFlt(cParm,nParm,"MINOCCTHRESH",&d)) minOccThresh = (float) d;
+      if (GetConfInt(cParm,nParm,"ACCFRAMEBLOCK",&i)) accFrameBlock = i;
       if (GetConfBool(cParm,nParm,"STOREMINFO",&b)) storeMInfo = b;
       if (GetConfBool(cParm,nParm,"KEEPXFORMDISTINCT",&b)) keepXFormDistinct = b;
       if (GetConfBool(cParm,nParm,"SAVESPKRMODELS",&b)) saveSpkrModels = b;
@@ -1493,6 +1526,27 @@ static void ZeroBaseTriMat(DTriMat *bTriMat)
   }  
 }
 
+/* CreateFrameBuf: buffer of up to accFrameBlock frames for a base class
+   whose largest block has maxBlock dimensions */
+static FrameBuf *CreateFrameBuf(MemHeap *x, int vsize, int maxBlock)
+{
+   FrameBuf *fb;
+   int f;
+
+   fb = (FrameBuf *)New(x,sizeof(FrameBuf));
+   fb->nFrames = 0;
+   fb->maxFrames = (accFrameBlock>1) ? accFrameBlock : 1;
+   fb->obs = (Vector *)New(x,sizeof(Vector)*fb->maxFrames);
+   fb->wgt = (DVector *)New(x,sizeof(DVector)*fb->maxFrames);
+   --fb->obs; --fb->wgt;
+   for (f=1;f<=fb->maxFrames;f++) {
+      fb->obs[f] = CreateVector(x,vsize);
+      fb->wgt[f] = CreateDVector(x,vsize);
+   }
+   fb->prod = (double *)New(x,sizeof(double)*fb->maxFrames*maxBlock*(maxBlock+1)/2);
+   return(fb);
+}
+
 static void CreateBaseTriMat(XFInfo *xfinfo, MemHeap *x, MixPDF *mp, int class)
 {
    DTriMat *tm;
@@ -1502,7 +1556,7 @@ static void CreateBaseTriMat(XFInfo *xfinfo, MemHeap *x, MixPDF *mp, int class)
   MixPDF *me;
   BaseClass *bclass;
   ILink i;
-   int j, cntj, b, bsize;
+   int j, cntj, b, bsize, maxb;
    long *vsp;
    AdaptXForm *xform = xfinfo->outXForm;
 
@@ -1515,14 +1569,16 @@ static void CreateBaseTriMat(XFInfo *xfinfo, MemHeap *x, MixPDF *mp, int class)
     ZeroBlockTriMat(regAcc->bDiagMat);
       tm = (DTriMat *)New(x,sizeof(DTriMat)*(vsize+1));
       vsp = (long *) tm; *vsp = (long) vsize;
-    for (b=1,cntj=1;b<=IntVecSize(blockSize);b++) {
+    for (b=1,cntj=1,maxb=0;b<=IntVecSize(blockSize);b++) {
       bsize = blockSize[b];
+      if (bsize>maxb) maxb = bsize;
       for (j=1;j<=bsize;j++,cntj++) {
             tm[cntj] =  CreateDTriMat(x, bsize);  
             ZeroDTriMat(tm[cntj]);
       }
     }
     regAcc->bTriMat = tm;    
+      regAcc->bFrames = CreateFrameBuf(x,vsize,maxb);
 
       /* link BaseTriMat to models in the same class */
   bclass = xform->bclass;
@@ -1533,6 +1589,7 @@ static void CreateBaseTriMat(XFInfo *xfinfo, MemHeap *x, MixPDF *mp, int class)
         ra->bVector = regAcc->bVector;
         ra->bDiagMat = regAcc->bDiagMat;
         ra->bTriMat = regAcc->bTriMat;
+        ra->bFrames = regAcc->bFrames;
       }
       }
   }      
@@ -1576,55 +1633,103 @@ void UpdateAccCache(double Lr, Vector svec, MixPDF *mp)
    }
 }
 
-void UpdateBaseAccs(XFInfo *xfinfo, Vector svec, const int t, RegAcc *regAcc)
+/* FlushFrameBuf: add the buffered frames into the rows of bTriMat.
+   Row i of a block receives X' diag(w_i) X, where X holds the
+   buffered frames of the block.  The outer product of each frame is
+   formed once in fb->prod and then added into four rows at a time,
+   so each product is loaded once per four rows instead of being
+   recomputed for every row.  The products are formed in float as
+   before and the frames are added in time order, so the sums are the
+   same as when accumulating one frame at a time */
+static void FlushFrameBuf(RegAcc *ra)
 {
-   int i,j,k,b,bsize;
+   FrameBuf *fb = ra->bFrames;
+   int i,j,k,f,n,q,nr,bsize,tsize;
    long nblock, bl;
-   int cnt, cnti, cntj;
-   DTriMat tm, m;
+   int cnti, bstart;
+   DVector r[4];
+   double w[4],pk,*p;
+   Vector x;
+   float xj;
+
+   n = fb->nFrames;
+   if (n==0) return;
+   nblock = (long)(ra->bDiagMat[0]);
+   for (bl=1,cnti=1,bstart=0;bl<=nblock;bl++) {
+      bsize = DTriMatSize(ra->bDiagMat[bl]);
+      tsize = bsize*(bsize+1)/2;
+      /* lower triangles of the frame outer products, row by row */
+      for (f=1,p=fb->prod; f<=n; f++) {
+         x = fb->obs[f]+bstart;
+         for (j=1; j<=bsize; j++) {
+            xj = x[j];
+            for (k=1; k<=j; k++)
+               *p++ = (double)(xj*x[k]);
+         }
+      }
+      /* rank-n update of the rows of the block, nr at a time */
+      for (i=1; i<=bsize; i+=nr, cnti+=nr) {
+         nr = (bsize-i+1 < 4) ? bsize-i+1 : 4;
+         for (j=1; j<=bsize; j++) {
+            for (q=0; q<nr; q++)
+               r[q] = ra->bTriMat[cnti+q][j];
+            for (f=1; f<=n; f++) {
+               p = fb->prod + (f-1)*tsize + j*(j-1)/2 - 1;
+               for (q=0; q<nr; q++)
+                  w[q] = fb->wgt[f][cnti+q];
+               if (nr==4) {
+                  for (k=1; k<=j; k++) {
+                     pk = p[k];
+                     r[0][k] += pk * w[0];
+                     r[1][k] += pk * w[1];
+                     r[2][k] += pk * w[2];
+                     r[3][k] += pk * w[3];
+                  }
+               } else {
+                  for (q=0; q<nr; q++)
+                     for (k=1; k<=j; k++)
+                        r[q][k] += p[k] * w[q];
+               }
+            }
+         }
+      }
+      bstart += bsize;
+   }
+   fb->nFrames = 0;
+}
+
+void UpdateBaseAccs(XFInfo *xfinfo, Vector svec, const int t, RegAcc *regAcc)
+{
+   int b;
    RegAcc *ra;
-   DVector acc;
+   FrameBuf *fb;
    BaseClass *bclass;
    MixPDF *mp;
    AdaptXForm *outXForm = xfinfo->outXForm;
    
-   /* store statistics */
+   /* move the completed frame into the buffer of each class it hit */
    if (t != xfinfo->baseTriMatTime) {
-   bclass = outXForm->bclass;
-#pragma omp parallel for private(mp,ra,acc,nblock,bl,cnti,m,bsize,i,tm,j,k)
-   for (b=1;b<=bclass->numClasses;b++) {
-      mp = ((MixtureElem *)(bclass->ilist[b])->item)->mpdf;
-      ra = GetRegAcc(mp);
-         if ((ra->bTriMat!=NULL) && (ra->bVector[1]>0.0)) {    
-         acc = ra->bVector;
-            nblock = (long)(ra->bDiagMat[0]);
-    for (bl=1,cnti=1;bl<=nblock;bl++) {
-      m = ra->bDiagMat[bl];
-               bsize = DTriMatSize(m);
-      for (i=1;i<=bsize;i++,cnti++) { /* Fill the accumulate stores */
-        tm = ra->bTriMat[cnti];
-        for (j=1; j<=bsize; j++)
-          for (k=1; k<=j; k++)
-            tm[j][k] += m[j][k] * acc[cnti];
-      }
+      bclass = outXForm->bclass;
+      for (b=1;b<=bclass->numClasses;b++) {
+         mp = ((MixtureElem *)(bclass->ilist[b])->item)->mpdf;
+         ra = GetRegAcc(mp);
+         if (ra->bTriMat==NULL) continue;
+         fb = ra->bFrames;
+         if (ra->bVector[1]>0.0) {    
+            fb->nFrames++;
+            CopyDVector(ra->bVector,fb->wgt[fb->nFrames]);
+            ZeroDVector(ra->bVector);
          }
-         ZeroDVector(ra->bVector);
+         if (fb->nFrames==fb->maxFrames || (t<0 && fb->nFrames>0))
+            FlushFrameBuf(ra);
       }
    }
-}
 
+   /* the first component of a class seen in this frame supplies svec */
    if (regAcc==NULL) return;
    if ((regAcc->bTriMat!=NULL) && (regAcc->bVector[1]==0.0) && (svec!=NULL)) {
-      nblock = (long)(regAcc->bDiagMat[0]);
-      for (bl=1,cnt=1; bl<=nblock; bl++) {
-         bsize = DTriMatSize(regAcc->bDiagMat[bl]);
-         m = regAcc->bDiagMat[bl];
-         for (i=1,cnti=cnt; i<=bsize; i++,cnti++) {
-            for (j=1,cntj=cnt; j<=i; j++,cntj++)
-               m[i][j] = svec[cnti]*svec[cntj];
-         }
-         cnt +=bsize;
-      }
+      fb = regAcc->bFrames;
+      CopyVector(svec,fb->obs[fb->nFrames+1]);
    }
 }
 
@@ -1776,6 +1881,7 @@ static RegAcc *CreateRegAcc(MemHeap *x, MixPDF *mp, AdaptXForm *xform)
   regAcc->bTriMat = NULL;   
    regAcc->bDiagMat = NULL;
    regAcc->bVector = NULL;   
+   regAcc->bFrames = NULL;
 
   return regAcc;
 }
@@ -3466,7 +3572,7 @@ static void EstMLLRDiagCovXForm(AccStruct *accs, LinXForm *xf, LinXForm *dxf)
 }
 
 /* InvertG: invert matrix G (band or full structure) */
-static void InvertG (DMatrix G, DMatrix invG, const int c, const int bsize, const int bandw, const Boolean uBias)
+static void InvertG (MemHeap *x, DMatrix G, DMatrix invG, const int c, const int bsize, const int bandw, const Boolean uBias)
 {
    DMatrix inv, u, v;
    DVector w;
@@ -3480,10 +3586,10 @@ static void InvertG (DMatrix G, DMatrix invG, const int c, const int bsize, cons
       size = (uBias) ? en-st+2 : en-st+1; 
 
       /* matrices for inversion */
-      w   = CreateDVector(&gstack,size);
-      u   = CreateDMatrix(&gstack,size,size);
-      v   = CreateDMatrix(&gstack,size,size);
-      inv = CreateDMatrix(&gstack,size,size);
+      w   = CreateDVector(x,size);
+      u   = CreateDMatrix(x,size,size);
+      v   = CreateDMatrix(x,size,size);
+      inv = CreateDMatrix(x,size,size);
 
       /* shrink G */
       ZeroDMatrix(inv);
@@ -3500,7 +3606,7 @@ static void InvertG (DMatrix G, DMatrix invG, const int c, const int bsize, cons
       }
 
       /* inversion */
-      InvSVD(inv,u,w,v,inv);
+      InvSVDHeap(x,inv,u,w,v,inv);
 
       /* store inv matrix to invG */
       ZeroDMatrix(invG);
@@ -3519,19 +3625,19 @@ static void InvertG (DMatrix G, DMatrix invG, const int c, const int bsize, cons
    else {
       /* matrices for inversion */
       dim  = (uBias) ? bsize+1 : bsize;
-      w = CreateDVector(&gstack,dim);
-      u = CreateDMatrix(&gstack,dim,dim);
-      v = CreateDMatrix(&gstack,dim,dim);
-      InvSVD(G,u,w,v,invG);
+      w = CreateDVector(x,dim);
+      u = CreateDMatrix(x,dim,dim);
+      v = CreateDMatrix(x,dim,dim);
+      InvSVDHeap(x,G,u,w,v,invG);
    }
 
-   FreeDVector(&gstack,w);
+   FreeDVector(x,w);
 
    return;
 }
 
 /* EstMLLRMeanXForm: estimate MLLR mean transform */
-static void EstMLLRMeanXForm(AccStruct *accs, LinXForm *xf)
+static void EstMLLRMeanXForm(MemHeap *x, AccStruct *accs, LinXForm *xf)
 {
    DMatrix invG;
    SMatrix A;
@@ -3550,7 +3656,7 @@ static void EstMLLRMeanXForm(AccStruct *accs, LinXForm *xf)
          if (uBias) dim = bsize+1;
          else dim = bsize;
          /* set up the matrices for the inversion and the transforms to be estimated */
-         invG = CreateDMatrix(&gstack,dim,dim);
+         invG = CreateDMatrix(x,dim,dim);
          A = xf->xform[b]; 
          ZeroMatrix(A); 
          for (i=1;i<=bsize;i++,cnti++) {
@@ -3567,7 +3673,7 @@ static void EstMLLRMeanXForm(AccStruct *accs, LinXForm *xf)
                }
             }
             Tri2DMat(accs->G[cnti],invG);
-            InvertG(invG, invG, i, bsize, accs->bandWidth[b], uBias);
+            InvertG(x, invG, invG, i, bsize, accs->bandWidth[b], uBias);
             for (j=1; j<=bsize; j++) {
                for (k=1;k<=dim;k++)
                   A[i][j] += invG[j][k] * accs->K[cnti][k];
@@ -3578,7 +3684,7 @@ static void EstMLLRMeanXForm(AccStruct *accs, LinXForm *xf)
                   bias[cnti] += invG[dim][k] * accs->K[cnti][k];
             }
          }
-         FreeDMatrix(&gstack,invG);
+         FreeDMatrix(x,invG);
       } 
       else {
          bsize = accs->blockSize[b];         
@@ -3597,7 +3703,7 @@ static double GetAlphaLike(double a, double b, double c, double alpha)
   return (-c*log(fabs(alpha*a+b))-(alpha*alpha*a)/2);
 }
 
-static double GetAlpha(DMatrix invgmat,DVector kmat,double occ, DVector cofact)
+static double GetAlpha(MemHeap *x, DMatrix invgmat,DVector kmat,double occ, DVector cofact)
 {
   int bsize, dim, i ,j;
   DVector tvec;
@@ -3606,7 +3712,7 @@ static double GetAlpha(DMatrix invgmat,DVector kmat,double occ, DVector cofact)
  
   bsize= DVectorSize(cofact); 
   dim = DVectorSize(kmat);
-  tvec = CreateDVector(&gstack,dim);
+  tvec = CreateDVector(x,dim);
   ZeroDVector(tvec);
   for (i=1;i<=dim;i++)
     for (j=1;j<=bsize;j++)
@@ -3638,7 +3744,7 @@ static double GetAlpha(DMatrix invgmat,DVector kmat,double occ, DVector cofact)
     return alpha1;
 }
 
-static double GetRowLike(DMatrix gmat,DVector kmat, DVector cofact, double occ, DVector w)
+static double GetRowLike(MemHeap *x, DMatrix gmat,DVector kmat, DVector cofact, double occ, DVector w)
 {
   double rowLike, det;
   int i, j, size,size2;
@@ -3647,8 +3753,8 @@ static double GetRowLike(DMatrix gmat,DVector kmat, DVector cofact, double occ,
  
   size = DVectorSize(w);
   size2 = DVectorSize(cofact);
-  tvec = CreateDVector(&gstack,size);
-  tmat = CreateDMatrix(&gstack,size,size);
+  tvec = CreateDVector(x,size);
+  tmat = CreateDMatrix(x,size,size);
   Tri2DMat(gmat,tmat);
   ZeroDVector(tvec);
   for (i=1;i<=size;i++)
@@ -3661,7 +3767,7 @@ static double GetRowLike(DMatrix gmat,DVector kmat, DVector cofact, double occ,
   for (i=1;i<=size2;i++)
     det += cofact[i]*w[i];
   rowLike = log(fabs(det))*occ - rowLike/2;
-  FreeDVector(&gstack,tvec);
+  FreeDVector(x,tvec);
   return rowLike;
 }
 
@@ -3709,7 +3815,7 @@ static double GetSemiTiedLike(AccStruct *accs, LinXForm *xf)
    return loglike;
 }
 
-static void InitCMLLRXForm(AccStruct *accs, DVector W, DVector bias)
+static void InitCMLLRXForm(MemHeap *x, AccStruct *accs, DVector W, DVector bias)
 {
   DMatrix invG,u,v,lG;
   int i,k,dim,ldim;
@@ -3721,19 +3827,19 @@ static void InitCMLLRXForm(AccStruct *accs, DVector W, DVector bias)
   
   if (bias==NULL) uBias = FALSE;
   else uBias = TRUE;
-  cofact = CreateDVector(&gstack,1);
+  cofact = CreateDVector(x,1);
   if (uBias) ldim = 2;
   else ldim = 1;
   /* set up the matrices for the inversion */
-  lG = CreateDMatrix(&gstack,ldim,ldim);
-  invG = CreateDMatrix(&gstack,ldim,ldim);
-  u = CreateDMatrix(&gstack, ldim, ldim);
-  v = CreateDMatrix(&gstack, ldim, ldim);
-  w = CreateDVector(&gstack, ldim);
-  tW = CreateDVector(&gstack, ldim);
-  tvec = CreateDVector(&gstack, ldim);
-  lK = CreateDVector(&gstack, ldim);
-  iW = CreateDVector(&gstack, ldim);
+  lG = CreateDMatrix(x,ldim,ldim);
+  invG = CreateDMatrix(x,ldim,ldim);
+  u = CreateDMatrix(x, ldim, ldim);
+  v = CreateDMatrix(x, ldim, ldim);
+  w = CreateDVector(x, ldim);
+  tW = CreateDVector(x, ldim);
+  tvec = CreateDVector(x, ldim);
+  lK = CreateDVector(x, ldim);
+  iW = CreateDVector(x, ldim);
   /* identity xform for log-likelihood check */
   iW[1]=1; iW[2]=0;
   for (b=1,cnt=1;b<=IntVecSize(accs->blockSize);b++) {
@@ -3754,8 +3860,8 @@ static void InitCMLLRXForm(AccStruct *accs, DVector W, DVector bias)
       }
       /* For diag case the cofactors are independent */
       cofact[1]=1;
-      InvSVD(lG, u, w, v, invG);
-      alpha = GetAlpha(invG,lK,accs->occ,cofact);
+      InvSVDHeap(x, lG, u, w, v, invG);
+      alpha = GetAlpha(x,invG,lK,accs->occ,cofact);
       tvec[1] = alpha * cofact[1] + lK[1];
       if (uBias) tvec[2] = lK[2];
       ZeroDVector(tW);
@@ -3766,9 +3872,9 @@ static void InitCMLLRXForm(AccStruct *accs, DVector W, DVector bias)
 	for (k=1;k<=ldim;k++)
 	  tW[ldim] += invG[ldim][k] * tvec[k];
       }
-      likeNew = GetRowLike(lG,lK,cofact,accs->occ,tW);
+      likeNew = GetRowLike(x,lG,lK,cofact,accs->occ,tW);
       /* compare to identity transform */
-      likeOld = GetRowLike(lG,lK,cofact,accs->occ,iW);
+      likeOld = GetRowLike(x,lG,lK,cofact,accs->occ,iW);
       if (likeNew<likeOld) {
 	if (likeOld/likeNew>1.00001) /* put a threshold on this! */
 	  printf(" Issue in intialising row %d of block %d (%f->%f)\n",
@@ -3783,10 +3889,10 @@ static void InitCMLLRXForm(AccStruct *accs, DVector W, DVector bias)
     }     
     cnt += bsize;
   }
-  FreeDVector(&gstack,cofact);
+  FreeDVector(x,cofact);
 }
 
-static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
+static void EstCMLLRXForm(MemHeap *x, AccStruct *accs, LinXForm *xf)
 {
    DMatrix *InvG,invG;
   DMatrix A;
@@ -3800,45 +3906,45 @@ static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
   DVector W, iniW, tvec, iniA;
   DVector cofact;
   
-  iniA = CreateDVector(&gstack, xf->vecSize);
+  iniA = CreateDVector(x, xf->vecSize);
   if (xf->bias == NULL) {
      uBias = FALSE;
      bias = NULL;
    }
    else {
      uBias = TRUE;
-     bias = CreateDVector(&gstack,xf->vecSize);
+     bias = CreateDVector(x,xf->vecSize);
   } 
 
-  InitCMLLRXForm(accs, iniA , bias);
-  InvG = (DMatrix *)New(&gstack,sizeof(DMatrix)*(accs->dim+1)); 
+  InitCMLLRXForm(x, accs, iniA , bias);
+  InvG = (DMatrix *)New(x,sizeof(DMatrix)*(accs->dim+1)); 
   tdet = 0;
   
   for (b=1,cnt=1;b<=IntVecSize(accs->blockSize);b++) {
     bsize = accs->blockSize[b];
-    cofact = CreateDVector(&gstack,bsize);
+    cofact = CreateDVector(x,bsize);
     if (uBias) dim = bsize+1;
     else dim = bsize;
     /* and the transforms to be estimated */
-    A = CreateDMatrix(&gstack, bsize,bsize);
-    W = CreateDVector(&gstack,dim);
-    iniW = CreateDVector(&gstack,dim);
-    tvec = CreateDVector(&gstack,dim);
+    A = CreateDMatrix(x, bsize,bsize);
+    W = CreateDVector(x,dim);
+    iniW = CreateDVector(x,dim);
+    tvec = CreateDVector(x,dim);
     ZeroDMatrix(A); 
     for (i=1,cnti=cnt;i<=bsize;i++,cnti++) {
       A[i][i] = iniA[cnti];   
-      InvG[cnti] = CreateDMatrix(&gstack,dim,dim);
+      InvG[cnti] = CreateDMatrix(x,dim,dim);
          DTri2DMat(accs->G[cnti],InvG[cnti]);
-         InvertG(InvG[cnti], InvG[cnti], i, bsize, accs->bandWidth[b], uBias);
+         InvertG(x, InvG[cnti], InvG[cnti], i, bsize, accs->bandWidth[b], uBias);
     }
     for (iter=1;iter<=maxXFormIter;iter++) {
       ZeroDVector(iniW);
       for (i=1,cnti=cnt;i<=bsize;i++,cnti++) {
         for (j=1;j<=bsize;j++)      iniW[j] = A[i][j];
         if (uBias)  iniW[dim] = bias[cnti];
-        det = DMatCofact(A,i,cofact);        
+        det = DMatCofactHeap(x,A,i,cofact);        
 	invG = InvG[cnti];    
-        alpha = GetAlpha(invG,accs->K[cnti],accs->occ,cofact);
+        alpha = GetAlpha(x,invG,accs->K[cnti],accs->occ,cofact);
         ZeroDVector(W);
         for (j=1;j<=bsize;j++)
           tvec[j] = alpha * cofact[j] + accs->K[cnti][j];
@@ -3851,8 +3957,8 @@ static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
           for (k=1;k<=dim;k++)
             W[dim] += invG[dim][k] * tvec[k];
         }      
-        likeNew = GetRowLike(accs->G[cnti],accs->K[cnti],cofact,accs->occ,W);
-        likeOld = GetRowLike(accs->G[cnti],accs->K[cnti],cofact,accs->occ,iniW);
+        likeNew = GetRowLike(x,accs->G[cnti],accs->K[cnti],cofact,accs->occ,W);
+        likeOld = GetRowLike(x,accs->G[cnti],accs->K[cnti],cofact,accs->occ,iniW);
             if (trace&T_XFM)
                printf("Iteration %d (row %d): Old=%e, New=%e (diff=%e)\n",iter,cnti,likeOld,likeNew,likeNew-likeOld);
         if (likeNew>likeOld) {
@@ -3879,14 +3985,14 @@ static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
     for (i=1;i<=bsize;i++)
        for (j=1;j<=bsize;j++)
           xf->xform[b][i][j] = A[i][j];
-    FreeDVector(&gstack,cofact);
+    FreeDVector(x,cofact);
   }
   /* Copy the bias transform and determinant (stored single precision) */
   if (uBias) {
      for (i=1;i<=xf->vecSize;i++) xf->bias[i] = bias[i];
   }
   xf->det = tdet*2;
-  FreeDVector(&gstack, iniA);
+  FreeDVector(x, iniA);
 }
 
 static void AccMixPDFSemiTiedStats(HMMSet *hset,MixPDF *mp, AccStruct *accs)
@@ -4451,14 +4557,14 @@ static void UpdateSemiTiedXForm(AccStruct *accs, LinXForm *xf, LinXForm *ixf)
             A[i][i] = 1.0/A[i][i];
            InvG[cnti] = CreateDMatrix(&gstack,dim,dim);
            Tri2DMat(accs->G[cnti],InvG[cnti]);
-            InvertG(InvG[cnti], InvG[cnti], i, bsize, accs->bandWidth[b], FALSE);
+            InvertG(&gstack, InvG[cnti], InvG[cnti], i, bsize, accs->bandWidth[b], FALSE);
         }
       } 
       else {
         for (i=1,cnti=cnt;i<=bsize;i++, cnti++) {
            InvG[cnti] = CreateDMatrix(&gstack,dim,dim);
            Tri2DMat(accs->G[cnti],InvG[cnti]);
-            InvertG(InvG[cnti], InvG[cnti], i, bsize, accs->bandWidth[b], FALSE);
+            InvertG(&gstack, InvG[cnti], InvG[cnti], i, bsize, accs->bandWidth[b], FALSE);
            for (j=1;j<=bsize;j++)
               A[i][j] = ixf->xform[b][i][j];
         }
@@ -4489,8 +4595,8 @@ static void UpdateSemiTiedXForm(AccStruct *accs, LinXForm *xf, LinXForm *ixf)
             W[j] *= beta;          
          }
          ZeroDVector(w);
-         likeNew = GetRowLike(accs->G[cnti],w,cofact,accs->occ,W);
-         likeOld = GetRowLike(accs->G[cnti],w,cofact,accs->occ,iniW);
+         likeNew = GetRowLike(&gstack,accs->G[cnti],w,cofact,accs->occ,W);
+         likeOld = GetRowLike(&gstack,accs->G[cnti],w,cofact,accs->occ,iniW);
             if (trace&T_XFM)
                printf("Iteration %d (row %d): Old=%e, New=%e (diff=%e)\n",iter,cnti,likeOld,likeNew,likeNew-likeOld);
          if (likeNew>likeOld) {
@@ -4669,7 +4775,7 @@ static void EstSemiTXForm(AdaptXForm *xform, AccStruct *accs, LinXForm *xf, IntV
 }
 
 /* EstMLLRCovXForm: estimate MLLR covariance transform */
-static void EstMLLRCovXForm(AccStruct *accs, LinXForm *xf)
+static void EstMLLRCovXForm(MemHeap *x, AccStruct *accs, LinXForm *xf)
 {
    DMatrix invG;
   DMatrix *InvG;
@@ -4685,32 +4791,32 @@ static void EstMLLRCovXForm(AccStruct *accs, LinXForm *xf)
   
    /* Reset xform  to identity matrix */
   
-   InvG = (DMatrix *)New(&gstack,sizeof(DMatrix)*(accs->dim+1)); 
+   InvG = (DMatrix *)New(x,sizeof(DMatrix)*(accs->dim+1)); 
    for (b=1,cnt=1;b<=IntVecSize(accs->blockSize);b++) {
      bsize = accs->blockSize[b];
      dim = bsize;
-     cofact = CreateDVector(&gstack,bsize);
+     cofact = CreateDVector(x,bsize);
      ZeroDVector(cofact); 
       /* set up the transforms to be estimated */
-     A = CreateDMatrix(&gstack,bsize,bsize);
+     A = CreateDMatrix(x,bsize,bsize);
      ZeroDMatrix(A); 
-      w = CreateDVector(&gstack,dim);
-     W = CreateDVector(&gstack,dim);
-     iniW = CreateDVector(&gstack,dim);
+      w = CreateDVector(x,dim);
+     W = CreateDVector(x,dim);
+     iniW = CreateDVector(x,dim);
      /* initialise with the diagonal transform */
      for (i=1,cnti=cnt;i<=bsize;i++, cnti++) {
         A[i][i] = sqrt(accs->G[cnti][i][i]/accs->occ); 
          A[i][i] = 1.0/A[i][i];
-        InvG[cnti] = CreateDMatrix(&gstack,dim,dim);
+        InvG[cnti] = CreateDMatrix(x,dim,dim);
          DTri2DMat(accs->G[cnti],InvG[cnti]);
-         InvertG(InvG[cnti], InvG[cnti], i, bsize, accs->bandWidth[b], FALSE);
+         InvertG(x, InvG[cnti], InvG[cnti], i, bsize, accs->bandWidth[b], FALSE);
      }
      for (iter=1;iter<=maxXFormIter;iter++) {
        ZeroDVector(iniW);
        for (i=1,cnti=cnt;i<=bsize;i++,cnti++) {
          for (j=1;j<=bsize;j++)      iniW[j] = A[i][j];
          invG = InvG[cnti];    
-         det = DMatCofact(A,i,cofact);     
+         det = DMatCofactHeap(x,A,i,cofact);     
          beta = 0;
          for(j=1;j<=bsize;j++){
             for(k=1;k<=bsize;k++)
@@ -4727,8 +4833,8 @@ static void EstMLLRCovXForm(AccStruct *accs, LinXForm *xf)
             W[j] *= beta;          
          }
          ZeroDVector(w);
-         likeNew = GetRowLike(accs->G[cnti],w,cofact,accs->occ,W);
-         likeOld = GetRowLike(accs->G[cnti],w,cofact,accs->occ,iniW);
+         likeNew = GetRowLike(x,accs->G[cnti],w,cofact,accs->occ,W);
+         likeOld = GetRowLike(x,accs->G[cnti],w,cofact,accs->occ,iniW);
             if (trace&T_XFM) 
                printf("Iteration %d (row %d): Old=%e, New=%e (diff=%e)\n",iter,cnti,likeOld,likeNew,likeNew-likeOld);
          if (likeNew>likeOld) {
@@ -4751,10 +4857,10 @@ static void EstMLLRCovXForm(AccStruct *accs, LinXForm *xf)
      for (i=1;i<=bsize;i++)
         for (j=1;j<=bsize;j++)
            xf->xform[b][i][j] = A[i][j];
-     FreeDVector(&gstack, cofact);
+     FreeDVector(x, cofact);
    }
    xf->det = tdet*2;
-   Dispose(&gstack,InvG);
+   Dispose(x,InvG);
 }
 
 static void EstXForm(AccStruct *accs, XFInfo *xfinfo, IntVec classes)
@@ -4774,7 +4880,7 @@ static void EstXForm(AccStruct *accs, XFInfo *xfinfo, IntVec classes)
 
   switch (accs->xkind) {
   case MLLRMEAN:    
-    EstMLLRMeanXForm(accs, xf);
+    EstMLLRMeanXForm(&gstack,accs, xf);
     if (mllrDiagCov) { /* additional code to allow efficient diagonal cov */
       diagBlockSize = CreateIntVec(xform->mem,accs->dim);
       for (i=1;i<=accs->dim;i++) diagBlockSize[i] = 1;
@@ -4788,10 +4894,10 @@ static void EstXForm(AccStruct *accs, XFInfo *xfinfo, IntVec classes)
     }
     break;
   case MLLRCOV:    
-    EstMLLRCovXForm(accs, xf);
+    EstMLLRCovXForm(&gstack,accs, xf);
     break;
   case CMLLR: 
-    EstCMLLRXForm(accs, xf);
+    EstCMLLRXForm(&gstack,accs, xf);
     break;
   case SEMIT:
      EstSemiTXForm(xform,accs,xf,classes);
@@ -4851,14 +4957,60 @@ Boolean GenXForm(RegNode *node, XFInfo *xfinfo, IntVec classes, int pxfindex)
    }
 }
 
-static Boolean GenClassXForm(XFInfo *xfinfo)
+/* 
+   AccClassStats: accumulate the statistics of base class b in a new
+   AccStruct allocated in x. est is set if there is enough data to 
+   estimate a transform for the class.
+*/
+static AccStruct *AccClassStats(MemHeap *x, XFInfo *xfinfo, int b, Boolean *est)
 {
-  AccStruct *accs;
-   int s,b;
+   AccStruct *accs;
+   int s;
    float thresh[SMAX];
-  ILink i;
-  MixPDF *mp = NULL;
-   IntVec classes,blockSize,bandWidth;
+   ILink i;
+   MixPDF *mp = NULL;
+   IntVec blockSize,bandWidth;
+
+   AdaptXForm *xform = xfinfo->outXForm;
+   BaseClass *bclass = xform->bclass;
+
+   /* Accumulate structure regenerated each time as this will handle
+      streams of different sizes simply */
+   blockSize = GetBlockSize(xfinfo,b);
+   bandWidth = GetBandWidth(xfinfo,b,blockSize);
+   if (strmProj)
+      accs = CreateAccStruct(x,xfinfo,xform->hset->vecSize,blockSize,bandWidth);
+   else     
+      accs = CreateAccStruct(x,xfinfo,GetBaseClassVSize(bclass,b),blockSize,bandWidth);
+   for (i=bclass->ilist[b]; i!=NULL; i=i->next) {
+      mp = ((MixtureElem *)i->item)->mpdf;
+      AccMixPDFStats(xform->hset,mp,accs);
+   }
+   /* Use last component of the baseclass to access baseclass stats */
+   if (AccAdaptBaseTriMat(xform))  AccBaseClassStats(mp,accs);
+   
+   /* get threshold for this base class */
+   s = bclass->stream[b];
+   GetSplitThresh(xfinfo,thresh);
+         
+   printf("Class %d (stream=%d, vsize=%d", b, s, accs->dim);
+   if (xform->xformSet->xkind!=SEMIT)
+      printf(",occ=%f)\n", accs->occ);
+   else
+      printf(")\n"); 
+   
+   *est = (accs->dim>0) && ((xform->xformSet->xkind==SEMIT) || (accs->occ > thresh[s]));
+   if (*est && (useVBLR || useMAPLR))
+      AddIPrior(accs);
+   return accs;
+}
+
+static Boolean GenClassXForm(XFInfo *xfinfo)
+{
+   AccStruct *accs;
+   int b;
+   Boolean est;
+   IntVec classes;
    
    AdaptXForm *xform = xfinfo->outXForm;
    BaseClass *bclass = xform->bclass;
@@ -4880,35 +5032,9 @@ static Boolean GenClassXForm(XFInfo *xfinfo)
   classes = CreateIntVec(&gstack,bclass->numClasses);
   for (b=1;b<=bclass->numClasses;b++) {
       if (GetBaseClassVSize(bclass,b)>0) {
-     ZeroIntVec(classes); classes[b] = 1;
-    /* Accumulate structure regenerated each time as this will handle
-       streams of different sizes simply */
-         blockSize = GetBlockSize(xfinfo,b);
-         bandWidth = GetBandWidth(xfinfo,b,blockSize);
-     if (strmProj)
-            accs = CreateAccStruct(&gstack,xfinfo,xform->hset->vecSize,blockSize,bandWidth);
-     else     
-            accs = CreateAccStruct(&gstack,xfinfo,GetBaseClassVSize(bclass,b),blockSize,bandWidth);
-    for (i=bclass->ilist[b]; i!=NULL; i=i->next) {
-      mp = ((MixtureElem *)i->item)->mpdf;
-      AccMixPDFStats(xform->hset,mp,accs);
-    }
-         /* Use last component of the baseclass to access baseclass stats */
-         if (AccAdaptBaseTriMat(xform))  AccBaseClassStats(mp,accs);
-   
-         /* get threshold for this base class */
-         s = bclass->stream[b];
-         GetSplitThresh(xfinfo,thresh);
-         
-         printf("Class %d (stream=%d, vsize=%d", b, s, accs->dim);
-         if (xform->xformSet->xkind!=SEMIT)
-            printf(",occ=%f)\n", accs->occ);
-         else
-            printf(")\n"); 
-   
-         if ((accs->dim>0) && ((xform->xformSet->xkind==SEMIT) || (accs->occ > thresh[s]))) {
-            if (useVBLR || useMAPLR)
-               AddIPrior(accs);
+         ZeroIntVec(classes); classes[b] = 1;
+         accs = AccClassStats(&gstack,xfinfo,b,&est);
+         if (est) {
             EstXForm(accs,xfinfo,classes);
             xform->xformWgts.assign[b] = xform->xformSet->numXForms;
             if (mllrDiagCov) 
@@ -4923,6 +5049,148 @@ static Boolean GenClassXForm(XFInfo *xfinfo)
    return TRUE;
 }
 
+/* 
+   Deferred estimation of speaker transforms: at the end of each
+   speaker the class statistics are copied to the speaker's job and 
+   the accumulators are reset, so that the next speaker can be 
+   processed.  When JOBS_PER_THREAD*nThreads speakers are queued, 
+   or at the end of the data, the transforms of all the queued 
+   speakers are estimated in parallel and then saved in speaker order.
+*/
+
+/* BatchXForm: true if the output transform just created can be deferred */
+static Boolean BatchXForm(XFInfo *xfinfo)
+{
+   AdaptXForm *xform = xfinfo->outXForm;
+
+   return (xfinfo->xfBatch != NULL) && (xform->akind == BASE) &&
+      (xform->xformSet->xkind != SEMIT) && !swapXForms && 
+      !saveSpkrModels && !mllrDiagCov;
+}
+
+/* SaveSpkrXForm: output the transform of speaker spkr */
+static void SaveSpkrXForm(HMMSet *hset, XFInfo *xfinfo, AdaptXForm *xform, char *spkr)
+{
+   char newFn[MAXSTRLEN];
+   char newMn[MAXSTRLEN];
+
+   if (keepXFormDistinct) {  /* Output individual transform */
+      MakeFN(spkr,xfinfo->outXFormDir,xfinfo->outXFormExt,newFn);
+      SaveOneXForm(hset,xform,newFn,xfinfo->saveBinary);
+   } 
+   else { /* Create macro from the masked speaker name and extension */
+      MakeFN(spkr,NULL,xfinfo->outXFormExt,newMn);
+      CreateXFormMacro(hset,xform,newMn);
+   }
+}
+
+/* EstSpkrXFormTask: estimate the class transforms of one queued speaker */
+static void EstSpkrXFormTask(int thread, int task, Ptr arg)
+{
+   XFormBatch *xb = (XFormBatch *)arg;
+   SpkrXFormJob *job = xb->job+task;
+   MemHeap *x = xb->scratch+thread;
+   int n;
+
+   for (n=1; n<=job->nXForms; n++) {
+      switch (job->accs[n]->xkind) {
+      case MLLRMEAN:    
+         EstMLLRMeanXForm(x,job->accs[n],job->xf[n]);
+         break;
+      case MLLRCOV:    
+         EstMLLRCovXForm(x,job->accs[n],job->xf[n]);
+         break;
+      case CMLLR: 
+         EstCMLLRXForm(x,job->accs[n],job->xf[n]);
+         break;
+      default :
+         HError(999,"Transform kind not currently supported");
+         break;
+      }
+      ResetHeap(x);
+   }
+}
+
+/* FlushSpkrXForms: estimate and save the transforms of all queued speakers */
+static void FlushSpkrXForms(HMMSet *hset, XFInfo *xfinfo)
+{
+   XFormBatch *xb = xfinfo->xfBatch;
+   SpkrXFormJob *job;
+   int j,n;
+
+   if (xb == NULL || xb->nJobs == 0) return;
+   RunThreadTasks(xb->pool,xb->nJobs,EstSpkrXFormTask,xb);
+   for (j=0; j<xb->nJobs; j++) {
+      job = xb->job+j;
+      if (trace&T_XFM)
+         for (n=1; n<=job->nXForms; n++)
+            printf("Estimated XForm %d of %s using %f observations\n",
+                   n,job->spkr,job->accs[n]->occ);
+      SaveSpkrXForm(hset,xfinfo,job->xform,job->spkr);
+      ResetHeap(&job->mem);
+   }
+   xb->nJobs = 0;
+}
+
+/* 
+   QueueSpkrXForm: save the class statistics of the current output 
+   transform and create its class transforms, which are estimated
+   when the queue is flushed
+*/
+static void QueueSpkrXForm(HMMSet *hset, XFInfo *xfinfo)
+{
+   XFormBatch *xb = xfinfo->xfBatch;
+   SpkrXFormJob *job = xb->job+xb->nJobs++;
+   AdaptXForm *xform = xfinfo->outXForm;
+   BaseClass *bclass = xform->bclass;
+   XFormSet *xformSet = xform->xformSet;
+   AccStruct *accs;
+   Boolean est;
+   int b,n;
+
+   job->xform = xform;
+   strcpy(job->spkr,xfinfo->coutspkr);
+   job->accs = (AccStruct **)New(&job->mem,(bclass->numClasses+1)*sizeof(AccStruct *));
+   job->xf = (LinXForm **)New(&job->mem,(bclass->numClasses+1)*sizeof(LinXForm *));
+   xformSet->numXForms = 0;
+   for (b=1;b<=bclass->numClasses;b++) {
+      xform->xformWgts.assign[b] = 0;
+      if (GetBaseClassVSize(bclass,b)>0) {
+         accs = AccClassStats(&job->mem,xfinfo,b,&est);
+         if (est) {
+            n = ++xformSet->numXForms;
+            job->accs[n] = accs;
+            job->xf[n] = xformSet->xforms[n] 
+               = CreateLinXForm(xform->mem,accs->dim,accs->blockSize,accs->useBias); 
+            xform->xformWgts.assign[b] = n;
+         }
+         else
+            Dispose(&job->mem,accs);
+      }
+   }
+   job->nXForms = xformSet->numXForms;
+   if (xb->nJobs == xb->maxJobs) FlushSpkrXForms(hset,xfinfo);
+}
+
+/* EXPORT->SetAdaptThreads: estimate speaker transforms with nThreads threads */
+void SetAdaptThreads(XFInfo *xfinfo, int nThreads)
+{
+   XFormBatch *xb;
+   int i;
+
+   if (nThreads <= 1 || xfinfo->xfBatch != NULL) return;
+   xb = (XFormBatch *)New(&gcheap,sizeof(XFormBatch));
+   xb->pool = CreateThreadPool(&gcheap,nThreads);
+   xb->nJobs = 0; xb->maxJobs = JOBS_PER_THREAD*nThreads;
+   xb->job = (SpkrXFormJob *)New(&gcheap,xb->maxJobs*sizeof(SpkrXFormJob));
+   for (i=0; i<xb->maxJobs; i++)
+      CreateHeap(&xb->job[i].mem,"SpkrAccStore",MSTAK,1,1.0,50000,500000);
+   xb->scratch = (MemHeap *)New(&gcheap,nThreads*sizeof(MemHeap));
+   for (i=0; i<nThreads; i++)
+      CreateHeap(xb->scratch+i,"XFormScratch",MSTAK,1,1.0,50000,500000);
+   xfinfo->xfBatch = xb;
+}
+
 InputXForm *AdaptXForm2InputXForm (HMMSet *hset, AdaptXForm *xform)
 {
    InputXForm *ixform;
@@ -5247,7 +5515,10 @@ void ZeroAdaptAccs(HMMSet *hset, AdaptXForm *xform)
             if (ra->spSumSq != NULL) ZeroDVector(ra->spSumSq);
          }
          /* Use last component of the baseclass to access baseclass stats */
-         if (ra->bTriMat != NULL) ZeroBaseTriMat(ra->bTriMat);
+         if (ra->bTriMat != NULL) {
+            ZeroBaseTriMat(ra->bTriMat);
+            ra->bFrames->nFrames = 0;
+         }
       }
    }
 }
@@ -5648,17 +5919,14 @@ Boolean UpdateSpkrStats(HMMSet *hset, XFInfo *xfinfo, char *datafn)
             /* Generate the new transform */
             MakeFN(xfinfo->coutspkr,NULL,xfinfo->outXFormExt, newMn);
             xfinfo->outXForm = CreateAdaptXForm(hset, xfinfo, newMn);
-            GenAdaptXForm(hset,xfinfo);
-            if (mllrDiagCov) xfinfo->outXForm = xfinfo->diagCovXForm;
             /* After generating a transform need to reset parameters */
             resetHMMSet = TRUE;
-            if (keepXFormDistinct) {  /* Output individual transform */
-               MakeFN(xfinfo->coutspkr,xfinfo->outXFormDir,xfinfo->outXFormExt,newFn);
-               SaveOneXForm(hset,xfinfo->outXForm,newFn,xfinfo->saveBinary);
-            } 
-            else { /* Create macro from the masked speaker name and extension */
-               MakeFN(xfinfo->coutspkr,NULL,xfinfo->outXFormExt,newMn);
-               CreateXFormMacro(hset,xfinfo->outXForm,newMn);
+            if (BatchXForm(xfinfo))  /* estimate later with other speakers */
+               QueueSpkrXForm(hset,xfinfo);
+            else {
+               GenAdaptXForm(hset,xfinfo);
+               if (mllrDiagCov) xfinfo->outXForm = xfinfo->diagCovXForm;
+               SaveSpkrXForm(hset,xfinfo,xfinfo->outXForm,xfinfo->coutspkr);
             }
             if (saveSpkrModels) { 
                /* 
@@ -5844,6 +6112,7 @@ Boolean UpdateSpkrStats(HMMSet *hset, XFInfo *xfinfo, char *datafn)
 
    /* All the files have been handled - store xforms */
    if (datafn == NULL) { 
+      FlushSpkrXForms(hset,xfinfo);
       if (!keepXFormDistinct) {
          if (xfinfo->xformTMF == NULL) {
             MakeFN("TMF",xfinfo->outXFormDir,NULL,newFn);
@@ -194,6 +194,9 @@ typedef struct {
    /* specifies whether the transforms change the model variances */
    Boolean covarChanged;
    Boolean covarPChanged;
+
+   /* speakers queued for parallel estimation (SetAdaptThreads) */
+   struct _XFormBatch *xfBatch;
 } XFInfo;
 
 /* -------------------- Initialisation Functions -------------------------- */
@@ -315,6 +318,15 @@ Boolean UpdateSpkrStats(HMMSet *hset, XFInfo *xfinfo, char *datafn);
    has changed
 */
 
+void SetAdaptThreads(XFInfo *xfinfo, int nThreads);
+/*
+   Make UpdateSpkrStats estimate BASE class MLLR and CMLLR output
+   transforms with nThreads threads.  The class statistics of each
+   speaker are saved and the transforms of up to 4*nThreads speakers
+   are then estimated together and saved in speaker order.  Not used
+   with SWAPXFORMS, SAVESPKRMODELS or MLLRDIAGCOV.
+*/
+
 Boolean HardAssign(AdaptXForm *xform);
 /* 
    Whether the transform uses hard assignment or not - required
@@ -723,7 +723,7 @@ void DoExactCorrectness(FBLatInfo *fbInfo, Lattice *lat){
 	int startT, endT;
 	int w = (int) larc->score;
 	if(w<0 || w>=nWords) HError(-1, "Problem with word numbering [2] (%d,%d)...",w,nWords);
-	GetTimes(larc, 0, &startT, &endT); /* get times [of first phone]... */
+	GetTimes(fbInfo, larc, 0, &startT, &endT); /* get times [of first phone]... */
 	if(startT<1){ HError(-1, "Invalid start time..."); startT=1;}
 	if(endT>fbInfo->T){ HError(-1, "Invalid end time..."); endT=fbInfo->T; }
 	if(startT>fbInfo->T){ HError(-1, "Invalid start time..."); startT=fbInfo->T;}
@@ -824,7 +824,7 @@ void DoExactCorrectness(FBLatInfo *fbInfo, Lattice *lat){
 	    if(Quinphone && state_quinphone != 2) HError(1, "Quinphone problem... check code, may not be compat with this quinphone set.");
 	    for(x=0;x<niphones[startPos+p];x++)if(local_iphone==iphone[startPos+p][x]){ Found=TRUE; break; } 
 	    if(!Found){ iphone[startPos+p][niphones[startPos+p]++] = local_iphone; }
-	    GetTimes(larc, j, &startT, &endT); /* set times... */
+	    GetTimes(fbInfo, larc, j, &startT, &endT); /* set times... */
 	    if(startT<1){ HError(-1, "Invalid start time..."); startT=1;}
 	    if(endT>fbInfo->T){ HError(-1, "Invalid end time..."); endT=fbInfo->T; }
 	    if(startT>fbInfo->T){ HError(-1, "Invalid start time..."); startT=fbInfo->T;}
@@ -120,6 +120,7 @@ float _exp(float x){
 /* Trace Flags */
 #define T_TOP   0001    /* Top level tracing */
 #define T_TIM   0002    /* Output timings */
+#define T_LST   0004    /* Likelihood store counts per utterance */
 
 /* Global Settings */
 
@@ -134,6 +135,7 @@ static Boolean ExactCorrectness=FALSE; /*IMPORTANT*/         /* Do 'exact' versi
                                                                 worse for Switchboard.  See also configs in HFBExactMPE, if this is TRUE. */
 static Boolean DoingFourthAcc=FALSE;    /* Indicate currently it is doing MPE with MMI prior */
 static int add_index = 999;   /* additional index for discriminative training: 3 for MPE with MMI prior */
+                              /* (both are copied to the FBLatInfo by FBLatPrepare) */
 static float InsCorrectness = -1;                            /* Correctness of an inserted phone.  Can be tuned, it affects recognition insertion rate.
                                                                 E.g. InsCorrectness = -0.85 will increase insertions upon testing, relative to default = -1. */
 static Boolean NoSilence = FALSE;                      /* If TRUE, then (in non-exact MPE) the silences are omitted from the reference transcription
@@ -154,6 +156,10 @@ static float probScale = 1.0;                 /* Scales the state-output and lm
 static float langProbScale = 1.0;             /* Extra scale on lm probabilities.   Leave this alone for normal usage. */
 
 
+static Boolean shareLikes = TRUE;            /* Keep the likelihoods of the first pass over an utterance for later passes */
+static long totStHit=0, totStMiss=0;         /* likelihood store counts over all utterances */
+static long totMixHit=0, totMixMiss=0;
+
 static float phnInsPen = 0.0;                 /* Insertion penalty for each phone, not subject to lm scaling.  Normally zero, but setting it to e.g.
                                                  -0.5 increases test set insertion errors (reducing deletions) and can be helpful where there
                                                  is very strong (small) probability scaling or the LM is scaled down.   */
@@ -161,12 +167,8 @@ static float phnInsPen = 0.0;                 /* Insertion penalty for each phon
 
 /* Misc variables that can be kept at global level. */
 
-static int StartTime=0;     /* This is a value that we use to help calculating the PreComp's of
-			       the MOutP's, to make sure not to use previously cached values. 
-			       Doesn't matter if shared between different FBLatInfo's.  */
 float hfwdbkwd_totalProbScale = 1.0;          /* (not a config.) Product of all scales affecting lm likelihoods.   Also read in HFBExactMPE.c and possibly
                                                  HMMIRest.c */
-static FBLatInfo *fbInfo; /* current fbInfo, so don't have to pass it around. */
 
 static ConfParam *cParm[MAXGLOBS];  /* config parameters */
 static int nParm = 0;
@@ -204,6 +206,51 @@ typedef struct _CorrectArcList{
    struct _CorrectArcList *t;
 } CorrectArcList;
 
+typedef struct{
+   MixPDF *mp;
+   float occ;
+   float scaledOcc; /*for MEE.*/
+} MixOcc;
+
+typedef struct _LikeEntry{  /* log likelihood of a stream or mixture at one frame */
+   Ptr key;                 /* StreamInfo or MixPDF */
+   int t;                   /* frame within the utterance */
+   float *prob;             /* StreamInfo: copy of the ShStrP vector */
+   float mixp;              /* MixPDF: log likelihood incl. xform det */
+   struct _LikeEntry *next;
+} LikeEntry;
+
+typedef struct{   /* likelihoods of the utterance being aligned */
+   char fn[MAXFNAMELEN];    /* data file of the stored utterance */
+   int T;                   /* and its number of frames */
+   HMMSet *hset;            /* models used */
+   AdaptXForm *xform;       /* input xform used */
+   Boolean fill;            /* add entries during this pass */
+   Boolean use;             /* look up entries during this pass */
+   MemHeap heap;            /* MSTAK for table and entries */
+   int nBuckets;            /* power of two */
+   int nEntries;
+   LikeEntry **table;       /* [0..nBuckets-1] */
+} LikeStore;
+
+struct _FBLatWorker{  /* state of one thread doing FBLatCompute */
+   int index;       /* PreComp copy (mp->hook) used by this worker */
+   int accOffset;   /* added to all accumulator indices */
+   int startTime;   /* This is a value that we use to help calculating the PreComp's of
+                       the MOutP's, to make sure not to use previously cached values.
+                       Incremented by T after each second pass. */
+   MemHeap mixHeap; /* C heap for SavedMixes */
+   /* Following variables relate to caching of mixture occupation probabilities. */
+   int nPDFs[SMAX];
+   int SavedMixesSize[SMAX];
+   MixOcc *SavedMixes[SMAX]; /* [1..S][1..nPDFs[s]] */
+   LikeStore store;  /* likelihoods of the current utterance */
+};
+
+static FBLatWorker *serialWorker = NULL;  /* used by FBLatFirstPass/SecondPass */
+
+#define AccIndex(fbInfo,i) ((int)(i)+(fbInfo)->worker->accOffset)  /* acc slot i of current worker */
+
 
 /* -------------------------- Misc routines        ----------------------- */
 
@@ -704,7 +751,7 @@ static void SetCorrectnessAsError(FBLatInfo *fbInfo, Lattice *numLat){    /* re
 
 
 /* ZeroAlpha: zero alpha's of all models */
-static void ZeroAlpha(int sq, int eq)
+static void ZeroAlpha(FBLatInfo *fbInfo, int sq, int eq)
 {
    int Nq,j,q;
    DVector aq;
@@ -722,7 +769,7 @@ static void ZeroAlpha(int sq, int eq)
 
 /* StepAlpha: calculate alphat column for time t */
 /* Calculates the forward (alpha) likelihoods given the previous alpha likelihoods, i.e. for t-1 */
-static void StepAlpha(int t)
+static void StepAlpha(FBLatInfo *fbInfo, int t)
 {
    DVector aq,laq,tmp;
    float ***outprob;
@@ -739,7 +786,7 @@ static void StepAlpha(int t)
    /* Zero any alphas that may be nonzero.*/
    /* not needed. */
    /*  if(t>2)
-       ZeroAlpha(fbInfo->aInfo->qLo[t-2],fbInfo->aInfo->qHi[t-2]);   / * Because the alphat vectors are swapped over each time,
+       ZeroAlpha(fbInfo, fbInfo->aInfo->qLo[t-2],fbInfo->aInfo->qHi[t-2]);   / * Because the alphat vectors are swapped over each time,
        we need to zero the one from t-2. */
    
    for (q = fbInfo->aInfo->qLo[t]; q <= fbInfo->aInfo->qHi[t]; q++) { /*This is just to avoid iterating over all q's.*/
@@ -808,47 +855,164 @@ static float * NewOtprobVec(MemHeap *x, int M)
 }
 
 
+/* -------------------------- Likelihood store ----------------------- */
+
+/*
+   Numerator arcs are nearly always a subset of the denominator arcs
+   in both time and model, so the passes over one utterance evaluate
+   mostly the same Gaussians.  The first pass over an utterance adds
+   every stream and mixture likelihood it computes to the store of
+   its worker, keyed on (structure,frame).  Later passes over the same
+   data file only look them up, so the store never holds more than
+   the entries of one pass over T frames.
+*/
+
+#define LS_BUCKETS 4096   /* initial table size */
+
+/* LikeHash: bucket of (key,t) */
+static int LikeHash(LikeStore *ls, Ptr key, int t)
+{
+   unsigned long h;
+
+   h = ((unsigned long)key >> 4) * 31 + (unsigned long)t * 2654435761UL;
+   return (int)((h ^ (h >> 16)) & (ls->nBuckets-1));
+}
+
+/* NewLikeTable: create an empty table of n buckets in the store */
+static void NewLikeTable(LikeStore *ls, int n)
+{
+   int i;
+
+   ls->nBuckets = n;
+   ls->table = (LikeEntry **)New(&ls->heap, n*sizeof(LikeEntry *));
+   for (i=0; i<n; i++) ls->table[i] = NULL;
+}
+
+/* FindLike: return entry for (key,t) or NULL */
+static LikeEntry *FindLike(LikeStore *ls, Ptr key, int t)
+{
+   LikeEntry *le;
+
+   for (le=ls->table[LikeHash(ls,key,t)]; le!=NULL; le=le->next)
+      if (le->key==key && le->t==t) return le;
+   return NULL;
+}
+
+/* AddLike: add a new entry for (key,t), doubling the table when full */
+static LikeEntry *AddLike(LikeStore *ls, Ptr key, int t)
+{
+   LikeEntry *le,*next,**old;
+   int i,h,n;
+
+   if (ls->nEntries >= 2*ls->nBuckets) {
+      old = ls->table; n = ls->nBuckets;
+      NewLikeTable(ls, 2*n);   /* old table is freed with the heap */
+      for (i=0; i<n; i++)
+         for (le=old[i]; le!=NULL; le=next) {
+            next = le->next; h = LikeHash(ls,le->key,le->t);
+            le->next = ls->table[h]; ls->table[h] = le;
+         }
+   }
+   le = (LikeEntry *)New(&ls->heap, sizeof(LikeEntry));
+   le->key = key; le->t = t; le->prob = NULL; le->mixp = LZERO;
+   h = LikeHash(ls,key,t);
+   le->next = ls->table[h]; ls->table[h] = le;
+   ls->nEntries++;
+   return le;
+}
+
+/* StartLikeStore: set up the store of the worker for a pass over fbInfo */
+static void StartLikeStore(FBLatInfo *fbInfo)
+{
+   LikeStore *ls = &fbInfo->worker->store;
+
+   fbInfo->stHit = fbInfo->stMiss = fbInfo->mixHit = fbInfo->mixMiss = 0;
+   ls->fill = ls->use = FALSE;
+   if (!shareLikes || (fbInfo->hsKind!=PLAINHS && fbInfo->hsKind!=SHAREDHS))
+      return;
+   if (ls->table!=NULL && ls->T==fbInfo->T && ls->hset==fbInfo->hset &&
+       ls->xform==fbInfo->inXForm && strcmp(ls->fn,fbInfo->datafn)==0) {
+      ls->use = TRUE;   /* same utterance as the previous pass */
+      return;
+   }
+   ResetHeap(&ls->heap);
+   strcpy(ls->fn, fbInfo->datafn);
+   ls->T = fbInfo->T; ls->hset = fbInfo->hset; ls->xform = fbInfo->inXForm;
+   ls->nEntries = 0;
+   NewLikeTable(ls, LS_BUCKETS);
+   ls->fill = TRUE;
+}
+
+/* MixLike: log likelihood of mp for frame t (tt is the memo time) */
+static LogFloat MixLike(FBLatInfo *fbInfo, MixPDF *mp, Vector v, AdaptXForm *xform, int t, int tt)
+{
+   LikeStore *ls = &fbInfo->worker->store;
+   LikeEntry *le;
+   LogFloat det,x;
+
+   if (ls->use) {
+      if ((le=FindLike(ls,mp,t))!=NULL) {
+         fbInfo->mixHit++;
+         return le->mixp;
+      }
+      fbInfo->mixMiss++;
+   }
+   x = MOutP(ApplyCompFXForm(mp,v,xform,&det,tt),mp);
+   x += det;
+   if (ls->fill) {
+      le = AddLike(ls,mp,t);
+      le->mixp = x;
+   }
+   return x;
+}
+
 /* ShStrP: Stream Outp calculation exploiting sharing */
-static float *ShStrP (Vector v, int t, StreamInfo *sti, AdaptXForm *xform, MemHeap *amem)
+static float *ShStrP (FBLatInfo *fbInfo, Vector v, int t, StreamInfo *sti, AdaptXForm *xform, MemHeap *amem)
 {
    WtAcc *wa;
    MixtureElem *me;
    MixPDF *mp;
    float *outprobjs;
-   int m,M;
+   int m,M,MM;
    PreComp *pMix;
-   LogFloat det,x,mixp;
+   LogFloat x,mixp;
+   LikeStore *ls = &fbInfo->worker->store;
+   LikeEntry *le;
+   int tt = t+fbInfo->worker->startTime;   /* unique time for the memos */
    
-   wa = (WtAcc *)sti->hook;
-   if (wa->time==t)           /* seen this state before */
-      outprobjs = wa->prob;
-   else {
-      M = sti->nMix;
-      outprobjs = NewOtprobVec(amem,M);
+   wa = ((WtAcc *)sti->hook) + fbInfo->worker->accOffset;  /* memo of this worker */
+   if (wa->time==tt)           /* seen this state before */
+      return wa->prob;
+   M = sti->nMix; MM = (M==1)?1:M+1;
+   outprobjs = NewOtprobVec(amem,M);
+   le = ls->use ? FindLike(ls,sti,t) : NULL;
+   if (le!=NULL) {             /* computed by an earlier pass */
+      fbInfo->stHit++;
+      for (m=0;m<MM;m++) outprobjs[m] = le->prob[m];
+   } else {
+      if (ls->use) fbInfo->stMiss++;
       me = sti->spdf.cpdf+1;
       if (M==1){                 /* Single Mix Case */
          mp = me->mpdf;
-         pMix = (PreComp *)mp->hook;
-         if (pMix->time == t)
+         pMix = ((PreComp *)mp->hook) + fbInfo->worker->index;
+         if (pMix->time == tt)
             x = pMix->prob;
          else {
-            x = MOutP(ApplyCompFXForm(mp,v,xform,&det,t),mp);
-            x += det; 
-            pMix->prob = x; pMix->time = t; /*dp10006:*/pMix->indx=-1;  /*This relates to the accumulation of the occ.*/
+            x = MixLike(fbInfo,mp,v,xform,t,tt);
+            pMix->prob = x; pMix->time = tt; /*dp10006:*/pMix->indx=-1;  /*This relates to the accumulation of the occ.*/
          }
       } else {                   /* Multiple Mixture Case */
          x = LZERO;
          for (m=1;m<=M;m++,me++) {
             if (MixWeight(fbInfo->hset,me->weight)>MINMIX){
                mp = me->mpdf;
-               pMix = (PreComp *)mp->hook;
-               if (pMix->time==t)
+               pMix = ((PreComp *)mp->hook) + fbInfo->worker->index;
+               if (pMix->time==tt)
                   mixp = pMix->prob;
                else {
-                  mixp = MOutP(ApplyCompFXForm(mp,v,xform,&det,t),mp);
-                  mixp += det; 
+                  mixp = MixLike(fbInfo,mp,v,xform,t,tt);
 		  if(isnan(mixp)) HError(1, "mixp zero...");
-                  pMix->prob = mixp; pMix->time = t; pMix->indx=-1;
+                  pMix->prob = mixp; pMix->time = tt; pMix->indx=-1;
                }
                x = LAdd(x,MixLogWeight(fbInfo->hset,me->weight)+mixp);
 	       outprobjs[m] = mixp;
@@ -856,15 +1020,20 @@ static float *ShStrP (Vector v, int t, StreamInfo *sti, AdaptXForm *xform, MemHe
          }
       }
       outprobjs[0] = x;
-      wa->prob = outprobjs;
-      wa->time = t;
+      if (ls->fill) {   /* keep a copy, the caller scales outprobjs in place */
+         le = AddLike(ls,sti,t);
+         le->prob = (float *)New(&ls->heap, MM*sizeof(float));
+         for (m=0;m<MM;m++) le->prob[m] = outprobjs[m];
+      }
    }
+   wa->prob = outprobjs;
+   wa->time = tt;
    return outprobjs;
 }
    
 
 /* Setotprob: allocate and calculate otprob matrix at time t */
-static void Setotprob (const int t)
+static void Setotprob (FBLatInfo *fbInfo, const int t)
 {
    int q,j,Nq,s;
    float ***outprob;
@@ -906,9 +1075,9 @@ static void Setotprob (const int t)
                                 sharing is needed in any case for lattices. */
                case SHAREDHS:
 		  if (fbInfo->S==1)
-		     outprob[j][0] = ShStrP(fbInfo->al_ot.fv[s],t+StartTime,sti,fbInfo->inXForm,fbInfo->aInfo->mem);
+		     outprob[j][0] = ShStrP(fbInfo,fbInfo->al_ot.fv[s],t,sti,fbInfo->inXForm,fbInfo->aInfo->mem);
 		  else
-		     outprob[j][s] = ShStrP(fbInfo->al_ot.fv[s],t+StartTime,sti,fbInfo->inXForm,fbInfo->aInfo->mem);
+		     outprob[j][s] = ShStrP(fbInfo,fbInfo->al_ot.fv[s],t,sti,fbInfo->inXForm,fbInfo->aInfo->mem);
 		  break;
                default:       HError(1, "Unknown hset kind.");
                }
@@ -929,7 +1098,7 @@ static void Setotprob (const int t)
    }
 }
 
-void SetModelBetaPlus (const int t, const int q)
+static void SetModelBetaPlus (FBLatInfo *fbInfo, const int t, const int q)
 {
    double x=LZERO;
    Acoustic *ac = fbInfo->aInfo->ac+q;
@@ -958,7 +1127,7 @@ void SetModelBetaPlus (const int t, const int q)
 
 
 /* SetBetaPlus: calculate gamma and otprob matrices */
-static void SetBetaPlus()
+static void SetBetaPlus(FBLatInfo *fbInfo)
 {
    int t,q; /*,lNq=0,q_at_gMax;*/
    LogDouble x;
@@ -969,11 +1138,11 @@ static void SetBetaPlus()
    */
    ResetObsCache(fbInfo->xfinfo);  
    for (t=fbInfo->T;t>=1;t--) {
-      Setotprob(t);
+      Setotprob(fbInfo,t);
       for (q=fbInfo->aInfo->qHi[t];q>=fbInfo->aInfo->qLo[t];q--) { /*MAX(qHi[t],qLo[t]) because of the case for tee models where qHi[t]=qLo[t]-1 .*/
          Acoustic *ac = fbInfo->aInfo->ac + q;
          if(t>=ac->t_start && t<=ac->t_end){ /*in beam.*/
-            SetModelBetaPlus(t,q);
+            SetModelBetaPlus(fbInfo,t,q);
          }
          if(t==ac->t_start){ /* We need to set "aclike", the total accumulated acoustic
                                 probability for this frame. */
@@ -990,20 +1159,20 @@ static void SetBetaPlus()
 
 
 
-void UpSkipTranParms(int q, int t){
+static void UpSkipTranParms(FBLatInfo *fbInfo, int q, int t){
    Acoustic *ac = fbInfo->aInfo->ac+q;
    HLink hmm=ac->hmm;
    double occ = ac->locc;
    float mee_acc_scale = fbInfo->AccScale*(fbInfo->MPE?ac->mpe_occscale:1), abs_mee_acc_scale = fabs(mee_acc_scale); 
-   int local_accindx = (mee_acc_scale > 0 ? fbInfo->num_index : fbInfo->den_index);
+   int local_accindx = AccIndex(fbInfo, mee_acc_scale > 0 ? fbInfo->num_index : fbInfo->den_index);
    TrAcc *ta,*tammi=NULL; int N = hmm->numStates; ta = ((TrAcc*)GetHook(hmm->transP)) + local_accindx;
-   if(DoingFourthAcc) tammi = ((TrAcc*)GetHook(hmm->transP)) + add_index;  
+   if(fbInfo->DoingFourthAcc) tammi = ((TrAcc*)GetHook(hmm->transP)) + AccIndex(fbInfo,fbInfo->add_index);  
 
    if(occ > MINEARG){
       float occmmi = exp(occ);  
       ta->occ[1] += occmmi * abs_mee_acc_scale;
       ta->tran[1][N] += occmmi * abs_mee_acc_scale;
-      if(DoingFourthAcc) {   /* doing 4th acc for MPE with MMI prior */
+      if(fbInfo->DoingFourthAcc) {   /* doing 4th acc for MPE with MMI prior */
          tammi->occ[1] += occmmi;
          tammi->tran[1][N] += occmmi;
       }
@@ -1012,7 +1181,7 @@ void UpSkipTranParms(int q, int t){
 
 /* UpTranParms: update the transition counters of given hmm */
 
-static void UpTranParms(int t, int q){ 
+static void UpTranParms(FBLatInfo *fbInfo, int t, int q){ 
    TrAcc *ta,*tammi=NULL;   
    Acoustic *ac = fbInfo->aInfo->ac+q;
    HLink hmm = ac->hmm;
@@ -1020,11 +1189,11 @@ static void UpTranParms(int t, int q){
    DVector aqt = ac->alphat,
       bqtPlus = ac->betaPlus[t],
       bqt1Plus = (t<ac->t_end ? ac->betaPlus[t+1] : NULL);
-   int local_accindx = (mee_acc_scale > 0 ? fbInfo->num_index : fbInfo->den_index);
+   int local_accindx = AccIndex(fbInfo, mee_acc_scale > 0 ? fbInfo->num_index : fbInfo->den_index);
    int i,j,N;
 
    N = hmm->numStates;    ta = ((TrAcc*)GetHook(hmm->transP)) + local_accindx;
-   if(DoingFourthAcc) tammi = ((TrAcc*)GetHook(hmm->transP)) + add_index;   
+   if(fbInfo->DoingFourthAcc) tammi = ((TrAcc*)GetHook(hmm->transP)) + AccIndex(fbInfo,fbInfo->add_index);   
 
 
    for(i=1;i<N;i++){
@@ -1046,7 +1215,7 @@ static void UpTranParms(int t, int q){
             occmmi = exp(x);
             occ = occmmi*abs_mee_acc_scale;
             ti[j] += occ; ta->occ[i] += occ;
-            if(DoingFourthAcc) {   /* do 4th acc if MPE with MMI prior */
+            if(fbInfo->DoingFourthAcc) {   /* do 4th acc if MPE with MMI prior */
                tammi->tran[i][j] += occmmi;
                tammi->occ[i] += occmmi;
             }
@@ -1057,58 +1226,42 @@ static void UpTranParms(int t, int q){
 
 
 
-typedef struct{
-   MixPDF *mp;
-   float occ;
-   float scaledOcc; /*for MEE.*/
-} MixOcc;
-
-Boolean CachingInitialised = FALSE;
-MemHeap cacheMixoccHeap;
-
-/* Following variables relate to caching of mixture occupation probabilities. */
-
-
-static int nPDFs[SMAX];  /*rely on it being initialised to zeros.*/
-static int SavedMixesSize[SMAX]; 
-static MixOcc *SavedMixes[SMAX]; /* [1..S][1..nPDFs[s]] */
-
-
-void DoMixUpdate(MixPDF *mp, int s, float Lr, float meescale, int t){  
+static void DoMixUpdate(FBLatInfo *fbInfo, MixPDF *mp, int s, float Lr, float meescale, int t){  
    /* Stores the mp for update later...  The updates are performed once every time frame.  Avoids
       accumulating stats more than once for the same Gaussian.  */
   
-   int RealT = -(10+t+StartTime); /*now t is a unique identifier; the minus is to distinguish from the use of PreComp for caching of OutPs.
+   FBLatWorker *w = fbInfo->worker;
+   int RealT = -(10+t+w->startTime); /*now t is a unique identifier; the minus is to distinguish from the use of PreComp for caching of OutPs.
                                     10 is to avoid zero. */
    PreComp *pMix;
-   pMix = (PreComp *)mp->hook;
+   pMix = ((PreComp *)mp->hook) + w->index;
 
    if(pMix->time != RealT){
-      int indx = nPDFs[s]++;
+      int indx = w->nPDFs[s]++;
       pMix->indx = indx;
       pMix->time = RealT;
-      if(SavedMixesSize[s] <= indx){
+      if(w->SavedMixesSize[s] <= indx){
          MixOcc *NewArray;
-         int NewSize = MAX(100, SavedMixesSize[s]*2), n;
-         SavedMixesSize[s] = NewSize;
-         NewArray = New(&cacheMixoccHeap, sizeof(MixOcc) * NewSize);
+         int NewSize = MAX(100, w->SavedMixesSize[s]*2), n;
+         w->SavedMixesSize[s] = NewSize;
+         NewArray = New(&w->mixHeap, sizeof(MixOcc) * NewSize);
          for(n=0;n<indx;n++){
-            NewArray[n] = SavedMixes[s][n];
+            NewArray[n] = w->SavedMixes[s][n];
          }
-         if(SavedMixes[s]!=NULL)
-            Dispose(&gcheap, SavedMixes[s]);
-         SavedMixes[s] = NewArray;
+         if(w->SavedMixes[s]!=NULL)
+            Dispose(&w->mixHeap, w->SavedMixes[s]);
+         w->SavedMixes[s] = NewArray;
       }
-      SavedMixes[s][indx].mp = mp;
-      SavedMixes[s][indx].occ = 0;
-      SavedMixes[s][indx].scaledOcc = 0;
+      w->SavedMixes[s][indx].mp = mp;
+      w->SavedMixes[s][indx].occ = 0;
+      w->SavedMixes[s][indx].scaledOcc = 0;
    }
-   SavedMixes[s][pMix->indx].occ += Lr;
-   SavedMixes[s][pMix->indx].scaledOcc += Lr*meescale;
+   w->SavedMixes[s][pMix->indx].occ += Lr;
+   w->SavedMixes[s][pMix->indx].scaledOcc += Lr*meescale;
 
 }
 
-void DoAllMixUpdates(int t){
+static void DoAllMixUpdates(FBLatInfo *fbInfo, int t){
    int s,m,k,vSize;
    MixPDF *mp;
    float Lr, unscaledLr, LrWithSign;
@@ -1119,20 +1272,21 @@ void DoAllMixUpdates(int t){
    MuAcc *ma,*mammi=NULL;
    VaAcc *va,*vammi;
    int local_accindx;
+   FBLatWorker *w = fbInfo->worker;
   
    for(s=1;s<=fbInfo->S;s++){
       float steSumLr = 0.0;
       vSize = fbInfo->hset->swidth[s];
       al_otvs = fbInfo->al_ot.fv[s];
     
-      for(m=0;m<nPDFs[s];m++){
-         unscaledLr = SavedMixes[s][m].occ;  /*differs in MPE case from Lr*/
-         LrWithSign = SavedMixes[s][m].scaledOcc; 
+      for(m=0;m<w->nPDFs[s];m++){
+         unscaledLr = w->SavedMixes[s][m].occ;  /*differs in MPE case from Lr*/
+         LrWithSign = w->SavedMixes[s][m].scaledOcc; 
 
-         if(LrWithSign>0.0) local_accindx = fbInfo->num_index; else local_accindx = fbInfo->den_index;
+         local_accindx = AccIndex(fbInfo, LrWithSign>0.0 ? fbInfo->num_index : fbInfo->den_index);
          Lr = fabs(LrWithSign);
 
-         mp = SavedMixes[s][m].mp;
+         mp = w->SavedMixes[s][m].mp;
          steSumLr += unscaledLr; /*just a check.*/
          mean = mp->mean; 
          variance = mp->cov.var;
@@ -1155,7 +1309,7 @@ void DoAllMixUpdates(int t){
 
 
             ma = ((MuAcc *) GetHook(mean))+local_accindx; mu_jm = ma->mu;
-            if(DoingFourthAcc) mammi = ((MuAcc *) GetHook(mean))+add_index;
+            if(fbInfo->DoingFourthAcc) mammi = ((MuAcc *) GetHook(mean))+AccIndex(fbInfo,fbInfo->add_index);
 
             if (fbInfo->uFlags&UPVARS){ /* This code is longer than it has to be, to reduce if-statements within loops. */
                switch(mp->ckind){
@@ -1169,8 +1323,8 @@ void DoAllMixUpdates(int t){
                      mu_jm[k] += zmeanlr;
                      va->cov.var[k] += zmean*zmeanlr; 
                   }
-                  if(DoingFourthAcc){   
-                     vammi = ((VaAcc *) GetHook(variance))+add_index;
+                  if(fbInfo->DoingFourthAcc){   
+                     vammi = ((VaAcc *) GetHook(variance))+AccIndex(fbInfo,fbInfo->add_index);
                      mammi->occ += unscaledLr;
                      vammi->occ += unscaledLr;
                      for (k=1;k<=vSize;k++) {
@@ -1193,8 +1347,8 @@ void DoAllMixUpdates(int t){
                         va->cov.inv[j][k] += zmeanj*zmeanlr; 
                      }
                   } 
-                  if(DoingFourthAcc){   
-                     vammi = ((VaAcc *) GetHook(variance))+add_index; 
+                  if(fbInfo->DoingFourthAcc){   
+                     vammi = ((VaAcc *) GetHook(variance))+AccIndex(fbInfo,fbInfo->add_index); 
                      vammi->occ += unscaledLr; 
                      mammi->occ += unscaledLr;
                      for (k=1;k<=vSize;k++) {
@@ -1216,7 +1370,7 @@ void DoAllMixUpdates(int t){
                   zmean=up_otvs[k]-mean[k]; zmeanlr=zmean*Lr;
                   mu_jm[k] += zmeanlr;
                }
-               if(DoingFourthAcc){   
+               if(fbInfo->DoingFourthAcc){   
                   mammi->occ += unscaledLr;
                   for (k=1;k<=vSize;k++) {
                      zmean=up_otvs[k]-mean[k]; zmeanlr=zmean*unscaledLr;
@@ -1229,12 +1383,12 @@ void DoAllMixUpdates(int t){
       if(steSumLr > 1.01 || steSumLr < 0.99) HError(-1, "Wrong steSumLr: %f, t=%d, s=%d",steSumLr, t, s);
    }
    for(s=1;s<=fbInfo->S;s++) /*Reset.*/
-      nPDFs[s] = 0;
+      w->nPDFs[s] = 0;
 }
 
 
 /* UpMixParms: update mu/va accs of given hmm  */
-static double UpMixParms(int q, HLink hmm, int t, DVector aqt, 
+static double UpMixParms(FBLatInfo *fbInfo, int q, HLink hmm, int t, DVector aqt, 
 			 DVector aqt1, DVector gqt)
 {
    Acoustic *ac = fbInfo->aInfo->ac+q;
@@ -1256,7 +1410,7 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
    Boolean mmix=FALSE;  /* TRUE if multiple mixture */
    float wght=0.0;
    float mee_acc_scale =   fbInfo->AccScale * (fbInfo->MPE? fbInfo->aInfo->ac[q].mpe_occscale: 1 ),
-      abs_mee_acc_scale = fabs(mee_acc_scale); int local_accindx = (mee_acc_scale > 0 ? fbInfo->num_index : fbInfo->den_index);
+      abs_mee_acc_scale = fabs(mee_acc_scale); int local_accindx = AccIndex(fbInfo, mee_acc_scale > 0 ? fbInfo->num_index : fbInfo->den_index);
 
    float local_probscale;
 
@@ -1304,7 +1458,7 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
          }
        
          wa = ((WtAcc*)sti->hook) + local_accindx;
-         if(DoingFourthAcc) wammi = ((WtAcc*)sti->hook) + add_index;   
+         if(fbInfo->DoingFourthAcc) wammi = ((WtAcc*)sti->hook) + AccIndex(fbInfo,fbInfo->add_index);   
          steSumLr = 0.0;      /*  zero stream occupation count */
        
        
@@ -1333,10 +1487,10 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
                /* compute mixture likelihood */
                if (!mmix || (fbInfo->hsKind==DISCRETEHS)){       /*    Don't need the MOutP for 1-mix systems. */
                   x = aqt[j]+gqt[j]-outprob[j][0][0]/*-pr*/;   
-                  pMix = (PreComp *)mp->hook;
-                  if(pMix->time != t+StartTime){ /* set the indx to -1, this relates to caching of the mixture occupation
+                  pMix = ((PreComp *)mp->hook) + fbInfo->worker->index;
+                  if(pMix->time != t+fbInfo->worker->startTime){ /* set the indx to -1, this relates to caching of the mixture occupation
                                                     probability on each time frame. */
-                     pMix->time = t+StartTime; 
+                     pMix->time = t+fbInfo->worker->startTime; 
 #ifdef MIX_UPDATE_SHARING
                      pMix->indx = -1;
 #endif
@@ -1354,10 +1508,10 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
 		        prob = outprob[j][0][mx];
 		     else
 		        prob = outprob[j][s][mx];
-		     pMix = (PreComp *)mp->hook;
-		     if(pMix->time != t+StartTime){ /* set the indx to -1, this relates to caching of the mixture occupation
+		     pMix = ((PreComp *)mp->hook) + fbInfo->worker->index;
+		     if(pMix->time != t+fbInfo->worker->startTime){ /* set the indx to -1, this relates to caching of the mixture occupation
 						       probability on each time frame. */
-		        pMix->time = t+StartTime; 
+		        pMix->time = t+fbInfo->worker->startTime; 
 #ifdef MIX_UPDATE_SHARING
 			pMix->indx = -1;
 #endif
@@ -1386,13 +1540,13 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
 	     
                   steSumLr += Lr;
 	     
-                  DoMixUpdate(mp, s, Lr, mee_acc_scale, t); /* This now does not actually update the mixture, but just notes down
+                  DoMixUpdate(fbInfo, mp, s, Lr, mee_acc_scale, t); /* This now does not actually update the mixture, but just notes down
                                                                the probability for later updating with "DoAllMixUpdates", which is called
                                                                once every time frame. */
                   /* ------------------ update mixture weight counts ----------------- */
                   if (fbInfo->uFlags&UPMIXES) {
                      wa->c[m] += Lr * abs_mee_acc_scale;
-                     if(DoingFourthAcc) wammi->c[m] += Lr;
+                     if(fbInfo->DoingFourthAcc) wammi->c[m] += Lr;
                   }
                } 
                /*   printf("q=%d, N=%d,j=%d, M=%d, m=%d, x=%f, prob=%f,stocc=%f\n", q,N,j,M,m,x,prob,aqt[j]+gqt[j]-outprob[j][0][0]); */
@@ -1401,8 +1555,8 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
    
          wa = ((WtAcc*)sti->hook) + local_accindx;
          wa->occ += steSumLr * abs_mee_acc_scale;
-         if(DoingFourthAcc){   /* do 4th acc if MPE with MMI prior */            
-            wammi = ((WtAcc*)sti->hook) + add_index;
+         if(fbInfo->DoingFourthAcc){   /* do 4th acc if MPE with MMI prior */            
+            wammi = ((WtAcc*)sti->hook) + AccIndex(fbInfo,fbInfo->add_index);
             wammi->occ += steSumLr;
          }
       }
@@ -1415,7 +1569,7 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
 /* -------------------- Top Level of F-B Updating ---------------- */
 
 /* CheckData: check data file consistent with HMM definition */
-static void CheckData(char *fn, BufferInfo *info) 
+static void CheckData(FBLatInfo *fbInfo, char *fn, BufferInfo *info) 
 {
    if (info->tgtVecSize!=fbInfo->hset->vecSize)
       HError(2350,"CheckData: Vector size in %s[%d] is incompatible with hset [%d]",
@@ -1430,27 +1584,20 @@ static void CheckData(char *fn, BufferInfo *info)
 
 
 /* StepForward: Step from 1 to T calc'ing Alpha columns and updating parms */
-static void StepForward()
+static void StepForward(FBLatInfo *fbInfo)
 {
    int q,t;
-   long negs;
    DVector aqt,aqt1,bqt,bqt1,tmp;
    double occ, total_occ;
-   HLink hmm, up_hmm;
+   HLink hmm;
 
    ResetObsCache(fbInfo->xfinfo);
-   ZeroAlpha(1, fbInfo->Q); /*Zero the alphat column,*/
+   ZeroAlpha(fbInfo, 1, fbInfo->Q); /*Zero the alphat column,*/
    for(q=1;q<=fbInfo->Q;q++){ /*And switch: now the alphat1 column is zero.*/
       Acoustic *ac = fbInfo->aInfo->ac + q;
       tmp=ac->alphat;ac->alphat=ac->alphat1;ac->alphat1=tmp;
    }
-   ZeroAlpha(1, fbInfo->Q); /*Now the alphat column is zero too.*/
-  
-   for (q=1;q<=fbInfo->Q;q++){  /* inc access counters */
-      up_hmm = fbInfo->aInfo->ac[q].hmm;
-      negs = (long)up_hmm->hook+1;
-      up_hmm->hook = (void *)negs;
-   }
+   ZeroAlpha(fbInfo, 1, fbInfo->Q); /*Now the alphat column is zero too.*/
 
    for (t=1;t<=fbInfo->T;t++) {
       /* Get Data */
@@ -1461,7 +1608,7 @@ static void StepForward()
 
       if (fbInfo->hsKind == TIEDHS)  PrecomputeTMix(fbInfo->hset,&fbInfo->al_ot,minFrwdP,0);
 
-      StepAlpha(t); /* Calculate this time's Alpha column. */
+      StepAlpha(fbInfo, t); /* Calculate this time's Alpha column. */
 
       /* Now accumulate statistics. */
       total_occ=LZERO;
@@ -1470,7 +1617,7 @@ static void StepForward()
          int tLo = ac->t_start,
             tHi = ac->t_end;
          if(t==tLo && tHi==tLo-1 && fbInfo->uFlags&UPTRANS){ /*In the ExactMatch case, where we have a skip transition.*/
-            UpSkipTranParms(q, t);
+            UpSkipTranParms(fbInfo, q, t);
          }
          if(t>=tLo&&t<=tHi){
             hmm = ac->hmm; 
@@ -1480,14 +1627,14 @@ static void StepForward()
             aqt1 = (t==1) ? NULL:ac->alphat1; /* alpha from t-1 */
 
 	if (fbInfo->uFlags&(UPMEANS|UPVARS|UPMIXES|UPXFORM|UPMIXES))
-	  if((occ=UpMixParms(q,hmm,t,aqt,aqt1,bqt)) > LSMALL){
+	  if((occ=UpMixParms(fbInfo,q,hmm,t,aqt,aqt1,bqt)) > LSMALL){
 	    total_occ = LAdd(total_occ, occ);
 	  }
 	if (fbInfo->uFlags&UPTRANS)
-	  UpTranParms(t,q);
+	  UpTranParms(fbInfo,t,q);
       }
     }
-    DoAllMixUpdates(t);  /* Iterates over all active mpdf's and actually accumulates stats. */
+    DoAllMixUpdates(fbInfo, t);  /* Iterates over all active mpdf's and actually accumulates stats. */
   
     if(fabs(total_occ) > 0.1)
       HError( 1, "in HFwdBkwdLat.c: Wrong occ: exp(%f)\n",total_occ);
@@ -1506,7 +1653,7 @@ static  char buf1[MAXSTRLEN];
 static  Boolean eSep;
 
  
-void GetTimes(LArc *larc, int i, int *start, int *end){ /* get start & end times for a lattice arc.  Frame
+void GetTimes(FBLatInfo *fbInfo, LArc *larc, int i, int *start, int *end){ /* get start & end times for a lattice arc.  Frame
                                                            duration is afrom the aInfo structure which is usually initialised
                                                            to 0.1 or by config HARC:FRAMEDUR */
    float s = larc->start->time,e; int j;
@@ -1572,10 +1719,26 @@ int MPE_GetFileLen(Lattice *lat){
 
 void FBLatClearUp(FBLatInfo *fbInfo); 
 
-void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *datafn2, Lattice *MPECorrLat){
-   int q,T2=0; Boolean MPE;
+/* RegisterPhones: enter the phone names used by the MPE correctness
+   code into the name table, so that FBLatCompute only looks them up */
+static void RegisterPhones(FBLatInfo *fbInfo, Lattice *corrLat)
+{
+   HArc *a;
+   LArc *larc;
+   int i,j,nStates,state;
+
+   if(!PhoneMEE || PhoneMEEUseContext) return;
+   for(a=fbInfo->aInfo->start;a;a=a->foll)
+      GetNoContextPhone(a->phone,&nStates,&state,NULL,NULL);
+   for(i=0,larc=corrLat->larcs;i<corrLat->na;i++,larc++)
+      for(j=0;j<larc->nAlign;j++)
+         GetNoContextPhone(larc->lAlign[j].label,&nStates,&state,NULL,NULL);
+}
+
+/* EXPORT->FBLatPrepare: serial part of first pass */
+void FBLatPrepare(FBLatInfo *fbInfo, FileFormat dff, char * datafn, char *datafn2, Lattice *MPECorrLat){
+   int T2=0; Boolean MPE;
   
-   fbInfo = _fbInfo;
    if(fbInfo->InUse) FBLatClearUp(fbInfo); 
    fbInfo->InUse=TRUE; /* will now initialise */
   
@@ -1585,8 +1748,16 @@ void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *dat
    }
    MPE = fbInfo->MPE = ((MPECorrLat!=NULL) ? TRUE:FALSE);
   
+   fbInfo->MPECorrLat = MPECorrLat;
+   strcpy(fbInfo->datafn, datafn);
+   fbInfo->DoingFourthAcc = DoingFourthAcc;
+   fbInfo->add_index = add_index;
+  
    ArcFromLat(fbInfo->aInfo, fbInfo->hset);
-   if(MPE) AttachMPEInfo(fbInfo->aInfo);
+   if(MPE){
+      AttachMPEInfo(fbInfo->aInfo);
+      RegisterPhones(fbInfo, MPECorrLat);
+   }
   
    /*[trace:] PrintArcInfo(stdout, &fbInfo->aInfo);*/
    fbInfo->Q = fbInfo->aInfo->Q;
@@ -1602,11 +1773,11 @@ void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *dat
       SetNewConfig("HPARM2");
       fbInfo->up_pbuf=OpenBuffer(&fbInfo->up_dataStack,datafn2,0,dff,FALSE_dup,FALSE_dup);
       GetBufferInfo(fbInfo->up_pbuf,&fbInfo->up_info);
-      CheckData(datafn2,&fbInfo->up_info);
+      CheckData(fbInfo,datafn2,&fbInfo->up_info);
       /*      SyncBuffers(pbuf,pbuf2); */
       T2 = ObsInBuffer(fbInfo->up_pbuf);
    }else
-      CheckData(datafn,&fbInfo->al_info);
+      CheckData(fbInfo,datafn,&fbInfo->al_info);
    fbInfo->T = ObsInBuffer(fbInfo->al_pbuf);
   
    if (fbInfo->twoDataFiles && (fbInfo->T != T2))
@@ -1624,9 +1795,15 @@ void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *dat
       }
       fbInfo->firstTime = FALSE;
    }
+}
+
+/* FirstPassCompute: the forward-backward over arcs of the first pass */
+static void FirstPassCompute(FBLatInfo *fbInfo){
+   int q; Boolean MPE = fbInfo->MPE;
+   Lattice *MPECorrLat = fbInfo->MPECorrLat;
   
-  
-   SetBetaPlus(); /* Step back through file. */
+   StartLikeStore(fbInfo);
+   SetBetaPlus(fbInfo); /* Step back through file. */
   
    {
       HArc *a; ArcTrans *at; LogFloat lmprob;
@@ -1816,28 +1993,102 @@ void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *dat
          }
 
 	 if(CalcAsError) fbInfo->AvgCorr += fbInfo->MPEFileLength;       
-         if(trace&T_TOP) printf("FLen=%d, AvCor=%f\n", fbInfo->MPEFileLength, fbInfo->AvgCorr); /*normal case.*/
 
       } /*endif ( MPE ) */
    }
+}
+
+/* FirstPassTrace: print the results of the first pass */
+static void FirstPassTrace(FBLatInfo *fbInfo){
+   if(fbInfo->MPE && trace&T_TOP) printf("FLen=%d, AvCor=%f\n", fbInfo->MPEFileLength, fbInfo->AvgCorr); /*normal case.*/
    if(trace&T_TOP) printf("T=%d, pr/fr=%f\n", fbInfo->T, fbInfo->pr/fbInfo->T);
+   if((trace&T_LST) && fbInfo->stHit+fbInfo->stMiss > 0)
+      printf("Stored likelihoods: states %ld hit %ld miss, mixtures %ld hit %ld miss\n",
+             fbInfo->stHit, fbInfo->stMiss, fbInfo->mixHit, fbInfo->mixMiss);
+}
+
+/* SecondPassFinish: count the models seen and release fbInfo */
+static void SecondPassFinish(FBLatInfo *fbInfo){
+   int q;
+   long negs;
+   HLink up_hmm;
+
+   for (q=1;q<=fbInfo->Q;q++){  /* inc access counters */
+      up_hmm = fbInfo->aInfo->ac[q].hmm;
+      negs = (long)up_hmm->hook+1;
+      up_hmm->hook = (void *)negs;
+   }
+   totStHit += fbInfo->stHit; totStMiss += fbInfo->stMiss;
+   totMixHit += fbInfo->mixHit; totMixMiss += fbInfo->mixMiss;
+   FBLatClearUp(fbInfo);
+}
 
+void FBLatFirstPass(FBLatInfo *fbInfo, FileFormat dff, char * datafn, char *datafn2, Lattice *MPECorrLat){
+   FBLatPrepare(fbInfo, dff, datafn, datafn2, MPECorrLat);
+   fbInfo->worker = serialWorker;
+   FirstPassCompute(fbInfo);
+   FirstPassTrace(fbInfo);
 }
 
 
-void FBLatSecondPass(FBLatInfo *_fbInfo, int num_index, int den_index){
-   fbInfo = _fbInfo;
+void FBLatSecondPass(FBLatInfo *fbInfo, int num_index, int den_index){
    fbInfo->num_index = num_index; fbInfo->den_index = den_index;
 
 
    if(fbInfo->pr == 0) HError(1, "FBLatSecondPass: 1st pass not done!!");
-   StepForward();
+   StepForward(fbInfo);
 
-   FBLatClearUp(fbInfo);
-   StartTime += fbInfo->T; /*relates to caching of likelihoods */
+   SecondPassFinish(fbInfo);
+   fbInfo->worker->startTime += fbInfo->T; /*relates to caching of likelihoods */
 
 }
 
+/* EXPORT->CreateFBLatWorker: create state for a worker thread */
+FBLatWorker *CreateFBLatWorker(MemHeap *x, int index, int accOffset){
+   FBLatWorker *w;
+   int s;
+
+   w = (FBLatWorker *)New(x, sizeof(FBLatWorker));
+   w->index = index; w->accOffset = accOffset;
+   w->startTime = 0;
+   CreateHeap(&w->mixHeap,    "cacheMixocc C heap",       CHEAP, 1, 0.5, 1000,  10000);
+   for(s=0;s<SMAX;s++){
+      w->nPDFs[s] = 0; w->SavedMixesSize[s]=0; w->SavedMixes[s]=NULL;
+   }
+   CreateHeap(&w->store.heap, "likeStore", MSTAK, 1, 1.0, 100000, 10000000);
+   w->store.table = NULL; w->store.fn[0] = '\0';
+   w->store.fill = w->store.use = FALSE;
+   return w;
+}
+
+/* EXPORT->FBLatCompute: do both passes of a prepared fbInfo */
+void FBLatCompute(FBLatInfo *fbInfo, FBLatWorker *w, int num_index, int den_index){
+   fbInfo->worker = w;
+   FirstPassCompute(fbInfo);
+   fbInfo->num_index = num_index; fbInfo->den_index = den_index;
+   if(fbInfo->pr == 0) HError(1, "FBLatCompute: 1st pass not done!!");
+   StepForward(fbInfo);
+   w->startTime += fbInfo->T; /*relates to caching of likelihoods */
+}
+
+/* EXPORT->PrintFBLatStats: print likelihood store counts */
+void PrintFBLatStats(void){
+   long n;
+
+   if ((n = totStHit+totStMiss) > 0)
+      printf("Likelihood store: states %ld hits %ld misses (%.1f%% hit)\n",
+             totStHit, totStMiss, 100.0*totStHit/n);
+   if ((n = totMixHit+totMixMiss) > 0)
+      printf("                  mixtures %ld hits %ld misses (%.1f%% hit)\n",
+             totMixHit, totMixMiss, 100.0*totMixHit/n);
+}
+
+/* EXPORT->FBLatFinish: print results and release fbInfo */
+void FBLatFinish(FBLatInfo *fbInfo){
+   FirstPassTrace(fbInfo);
+   SecondPassFinish(fbInfo);
+}
+
 
 
 
@@ -1865,6 +2116,7 @@ void InitFBLat(void)
          if (GetConfFlt(cParm,nParm,"PHNINSPEN",&f))  phnInsPen = f; /* this config also used in HExactMPE.c */
          
          if (GetConfBool(cParm,nParm,"NOSILENCE",&b)) NoSilence = b;
+         if (GetConfBool(cParm,nParm,"SHARELIKES",&b)) shareLikes = b;
 #ifdef SUPPORT_QUINPHONE
          if (GetConfBool(cParm,nParm,"QUINPHONE",&b)) Quinphone = b;/* this config also used in HExactMPE.c */
 #endif
@@ -1900,8 +2152,6 @@ void InitialiseFBInfo(FBLatInfo *fbInfo,
 		      UPDSet uflags, 
                       Boolean twoDataFiles)
 {
-   int s;
-
    /* Stacks for global structures requiring memory allocation */
    CreateHeap(&fbInfo->arcStack,    "fbLatArcStore",       MSTAK, 1, 1.0, 1000000,  20000000);
    CreateHeap(&fbInfo->tempStack,   "fbLatTempStore",       MSTAK, 1, 0.5, 1000,  10000);
@@ -1924,13 +2174,9 @@ void InitialiseFBInfo(FBLatInfo *fbInfo,
    fbInfo->aInfo->mem = &(fbInfo->arcStack);
    fbInfo->InUse = FALSE;
    fbInfo->aInfo->nLats = 0;
-   if(!CachingInitialised){ /* Initialise the mix occupation-caching  stack. */
-      CachingInitialised = TRUE;
-      CreateHeap(&cacheMixoccHeap,    "cacheMixocc C heap",       CHEAP, 1, 0.5, 1000,  10000);
-      for(s=0;s<SMAX;s++){
-         nPDFs[s] = 0; SavedMixesSize[s]=0; SavedMixes[s]=0;
-      }
-   }
+   fbInfo->worker = NULL;
+   if(serialWorker==NULL) /* Initialise the mix occupation-caching  stack. */
+      serialWorker = CreateFBLatWorker(&gcheap, 0, 0);
 }
 
 
@@ -84,8 +84,26 @@
    components.    For MLLR adaptation, the HAdapt routine
    AddAdaptFrame is called for each input frame within
    each mixture component.
+
+   FBLatFirstPass and FBLatSecondPass process one utterance at a
+   time.  To spread utterances over several threads the work can be
+   split into FBLatPrepare, which reads the lattices and data and
+   must be called from the main thread, FBLatCompute, which does both
+   passes and may run in a worker thread, and FBLatFinish, which
+   must again be called from the main thread.  Each worker thread
+   needs its own FBLatWorker, which selects the PreComp copy (see
+   AttachPreCompsParallel) and the block of accumulators it uses.
+
+   The stream and mixture log likelihoods computed by the first pass
+   over an utterance are kept in a likelihood store owned by the
+   worker.  Later passes over the same data file (typically the
+   denominator pass following the numerator pass) look them up
+   instead of recomputing them.  The store is emptied when the
+   worker moves to another file.
 */   
 
+typedef struct _FBLatWorker FBLatWorker;   /* per-thread state */
+
 typedef struct {
   /* protected [readonly] : */
   int T;
@@ -96,6 +114,7 @@ typedef struct {
   /* Private: */
   ArcInfo lattices; 
   Lattice *numLat; /* for MPE. */
+  Lattice *MPECorrLat; /* correct lattice given to FBLatPrepare */
   int Q;
   HMMSet *hset;
 
@@ -129,6 +148,13 @@ typedef struct {
 
   float num_index; /*make sure set. */
   float den_index; /*only for MPE. */ /*make sure set. */
+  Boolean DoingFourthAcc; /* copy of SetDoingFourthAcc when prepared */
+  int add_index;
+
+  FBLatWorker *worker; /* worker doing the current passes */
+  char datafn[MAXFNAMELEN]; /* data file, identifies the utterance in the store */
+  long stHit, stMiss;   /* likelihood store lookups of streams... */
+  long mixHit, mixMiss; /* ... and of mixtures during this utterance */
 
   Boolean InUse; /* FALSE if stacks are cleared and lattices empty. */
 
@@ -165,12 +191,45 @@ void FBLatSecondPass(FBLatInfo *fbInfo,
                      int index, /* in MMI case, this is the index to store the accs. */
                      int den_index /* den_index is used only for MPE, for negative accs.*/ );
 
+FBLatWorker *CreateFBLatWorker(MemHeap *x, int index, int accOffset);
+/*
+   Create the state for worker index, which uses PreComp copy index
+   and adds accOffset to every accumulator index.
+*/
+
+void FBLatPrepare(FBLatInfo *fbInfo, FileFormat dff, char *datafn, char *datafn2,
+                  Lattice *MPECorrLat);
+/*
+   Do the serial part of FBLatFirstPass: expand the lattices added
+   to fbInfo and open the data.  Must be called from the main thread.
+*/
+
+void FBLatCompute(FBLatInfo *fbInfo, FBLatWorker *w, int index, int den_index);
+/*
+   Do both passes for fbInfo prepared by FBLatPrepare, accumulating
+   into the accumulators of w.  Touches only fbInfo and data private
+   to w so different fbInfo's may be computed in parallel, provided
+   the HMM set is PLAINHS or SHAREDHS with diagonal covariances and
+   no transforms are used.
+*/
+
+void FBLatFinish(FBLatInfo *fbInfo);
+/*
+   Print the traces, update the numEg counters and release fbInfo
+   after FBLatCompute.  Must be called from the main thread.
+*/
+
 #define SUPPORT_QUINPHONE 
 
 
 /*For use in HExactLat.c: */
 int GetNoContextPhone(LabId phone, int *nStates_quinphone, int *state_quinphone, HArc *a, int *frame_end); 
-void GetTimes(LArc *larc, int i, int *start, int *end);   /*gets times as ints. */
+void GetTimes(FBLatInfo *fbInfo, LArc *larc, int i, int *start, int *end);   /*gets times as ints. */
+
+void PrintFBLatStats(void);
+/*
+   Print the total hit and miss counts of the likelihood store
+*/
 
 /* EXPORT-> SetDoingFourthAcc: Indicate whether it is currently storing MMI statistics */
 void SetDoingFourthAcc(Boolean DO, int indx);
@@ -124,10 +124,6 @@ static Boolean compressMerge = TRUE; /* compressing lattice scores when merging
 
 static char *llfExt = "LLF";    /* extension for LLF lattice files */
 
-#ifndef NO_LAT_LM
-static MemHeap slaHeap, slnHeap;/* MHEAPs for use in LatExpand() */
-#endif
-
 /* --------------------------- Prototypes ---------------------------- */
 
 
@@ -142,6 +138,8 @@ struct _SubLNode {
    } data;
    SubLArc *foll;
    SubLNode *next;
+   LNode *ln;           /* lattice node this sub-node belongs to */
+   SubLNode *hnext;     /* next sub-node in LMStateMemo bucket */
 };
 
 struct _SubLArc {
@@ -150,6 +148,13 @@ struct _SubLArc {
    LArc *la;
    SubLArc *next;
 };
+
+typedef struct {        /* hash of SubLNodes keyed by (LNode, LMState) */
+   SubLNode **bucket;   /* array [0..size-1] of bucket chains */
+   int size;            /* number of buckets (power of 2) */
+   int used;            /* number of SubLNodes held */
+   MemHeap *heap;       /* heap for SubLNodes */
+} LMStateMemo;
 #endif
 
 /* --------------------------- LLF processing ---------------------- */
@@ -330,20 +335,12 @@ void InitLat(void)
    }
 
    CreateHeap (&llfHeap, "LLF stack", MSTAK, 1, 1.0, 1000, 10000);
-#ifndef NO_LAT_LM
-   CreateHeap (&slaHeap, "LatExpand arc heap", MHEAP, sizeof (SubLArc), 1.0, 1000, 128000);
-   CreateHeap (&slnHeap, "LatExpand node heap", MHEAP,sizeof (SubLNode), 1.0, 1000, 32000);
-#endif
 }
 
 
 /* EXPORT->ResetLat: reset the module */
 void ResetLat (void)
 {
-#ifndef NO_LAT_LM
-   ResetHeap(&slnHeap);
-   ResetHeap(&slaHeap);
-#endif
    ResetHeap(&llfHeap);
    
    return;
@@ -1109,26 +1106,82 @@ static LogFloat  LatLMTrans (LModel *lm, LMState src, LabId wordId, LMState *des
    return prob;
 }
 
+/* MemoHash: bucket of (ln,lmstate) in a memo with size buckets */
+static int MemoHash (LNode *ln, LMState lmstate, int size)
+{
+   unsigned long h;
+
+   h = ((unsigned long) ln >> 3) * 31 + ((unsigned long) lmstate >> 3);
+   return (int) ((h ^ (h >> 16)) & (size - 1));
+}
+
+/* InitLMStateMemo
+
+     create an empty memo with about n buckets
+*/
+static void InitLMStateMemo (LMStateMemo *memo, MemHeap *heap, int n)
+{
+   int i;
+
+   for (memo->size = 64; memo->size < n; memo->size *= 2);
+   memo->bucket = (SubLNode **) New (&gcheap, memo->size * sizeof (SubLNode *));
+   for (i = 0; i < memo->size; ++i)
+      memo->bucket[i] = NULL;
+   memo->used = 0;
+   memo->heap = heap;
+}
+
+/* GrowLMStateMemo
+
+     double the number of buckets in memo
+*/
+static void GrowLMStateMemo (LMStateMemo *memo)
+{
+   int i, b, size;
+   SubLNode **bucket, *subln, *next;
+
+   size = memo->size * 2;
+   bucket = (SubLNode **) New (&gcheap, size * sizeof (SubLNode *));
+   for (i = 0; i < size; ++i)
+      bucket[i] = NULL;
+   for (i = 0; i < memo->size; ++i)
+      for (subln = memo->bucket[i]; subln; subln = next) {
+         next = subln->hnext;
+         b = MemoHash (subln->ln, subln->data.lmstate, size);
+         subln->hnext = bucket[b];
+         bucket[b] = subln;
+      }
+   Dispose (&gcheap, memo->bucket);
+   memo->bucket = bucket;
+   memo->size = size;
+}
+
 /* FindAddSubLNode
 
-     Search for SubLNode in chain and add it if necessary
+     Look up the SubLNode of ln for lmstate in memo and add it to
+     the chain of ln if necessary
 */
-static SubLNode *FindAddSubLNode (MemHeap *heap, LNode *ln, LMState lmstate, int *nsln)
+static SubLNode *FindAddSubLNode (LMStateMemo *memo, LNode *ln, LMState lmstate, int *nsln)
 {
    SubLNode *subln;
+   int b;
    
-   for (subln = (SubLNode *) ln->hook; subln; subln = subln->next) {
-      if (subln->data.lmstate == lmstate)
+   b = MemoHash (ln, lmstate, memo->size);
+   for (subln = memo->bucket[b]; subln; subln = subln->hnext) {
+      if (subln->ln == ln && subln->data.lmstate == lmstate)
          return subln;
    }
-   if (!subln) {
-      ++*nsln;
-      subln = New (heap, sizeof (SubLNode));
-      subln->data.lmstate = lmstate;
-      subln->foll = NULL;
-      subln->next = (SubLNode *) ln->hook;
-      ln->hook = (Ptr) subln;
-   }
+   ++*nsln;
+   subln = New (memo->heap, sizeof (SubLNode));
+   subln->data.lmstate = lmstate;
+   subln->foll = NULL;
+   subln->next = (SubLNode *) ln->hook;
+   ln->hook = (Ptr) subln;
+   subln->ln = ln;
+   subln->hnext = memo->bucket[b];
+   memo->bucket[b] = subln;
+   if (++memo->used > 2 * memo->size)
+      GrowLMStateMemo (memo);
    return subln;
 }
 
@@ -1148,6 +1201,8 @@ Lattice *LatExpand (MemHeap *heap, Lattice *lat, LModel *lm)
    LogFloat lmprob;
    LMState dest;
    Lattice *newlat;
+   MemHeap slnHeap, slaHeap;
+   LMStateMemo memo;
 
    nsln = nsla = 0;
 
@@ -1163,13 +1218,21 @@ Lattice *LatExpand (MemHeap *heap, Lattice *lat, LModel *lm)
       ln->hook) of sub-nodes (corresponding to LMStates in the new
       LM). */
 
+   /* sub-nodes and sub-arcs are held in heaps local to this call so
+      that lattices can be expanded in several threads at once.  The
+      sub-node for a given node and LMState is found via a hash memo
+      rather than by searching the node's chain. */
+   CreateHeap (&slaHeap, "LatExpand arc heap", MHEAP, sizeof (SubLArc), 1.0, 1000, 128000);
+   CreateHeap (&slnHeap, "LatExpand node heap", MHEAP,sizeof (SubLNode), 1.0, 1000, 32000);
+   InitLMStateMemo (&memo, &slnHeap, lat->nn);
+
    /* init sub-node linked lists */
    for (i = 0, ln = lat->lnodes; i < lat->nn; ++i, ++ln) {
       ln->hook = NULL;
    }
 
    /* create one sub-node for lattice start node with LMState = NULL */
-   FindAddSubLNode (&slnHeap, LatStartNode (lat), NULL, &nsln);
+   FindAddSubLNode (&memo, LatStartNode (lat), NULL, &nsln);
    
    /* find topological order of nodes */
    topOrder = (LNode **) New (&gcheap, lat->nn * sizeof(LNode *));
@@ -1184,7 +1247,7 @@ Lattice *LatExpand (MemHeap *heap, Lattice *lat, LModel *lm)
          for (la = ln->foll; la; la = la->farc) {
             assert (la->start == ln);
             lmprob = LatLMTrans (lm, startSLN->data.lmstate, la->end->word->wordName, &dest);
-            endSLN = FindAddSubLNode (&slnHeap, la->end, dest, &nsln);
+            endSLN = FindAddSubLNode (&memo, la->end, dest, &nsln);
 
             /* add new subLArc */
             ++nsla;
@@ -1199,6 +1262,8 @@ Lattice *LatExpand (MemHeap *heap, Lattice *lat, LModel *lm)
       }
    }
 
+   Dispose (&gcheap, memo.bucket);
+
    if (trace & T_EXP)
       printf ("expanded lattice from %d/%d  to %d/%d\n", lat->nn, lat->na, nsln, nsla);
    
@@ -1253,8 +1318,8 @@ Lattice *LatExpand (MemHeap *heap, Lattice *lat, LModel *lm)
    }
 
    Dispose (&gcheap, topOrder);
-   ResetHeap (&slaHeap);
-   ResetHeap (&slnHeap);
+   DeleteHeap (&slaHeap);
+   DeleteHeap (&slnHeap);
 
    return newlat;
 }
@@ -100,6 +100,30 @@ static double g_fMeanBiasScale_xform = 0.2f;
 
 #define MAX_BOUND_ADJ_LEN  100
 
+#define MGE_UPD_BLOCK 1024      /* updates per MgeUpdBlock */
+
+typedef enum _MgeUpdKind {
+   UPD_OCC,                     /* add val to the occ of MuAcc par */
+   UPD_MEAN,                    /* subtract val from mean[k] of MixPDF par */
+   UPD_VAR                      /* divide var[k] of MixPDF par by 10^val */
+} MgeUpdKind;
+
+typedef struct _MgeUpdate {     /* one update recorded by SeqPDUpdate */
+   MgeUpdKind kind;
+   Ptr par;                     /* MuAcc or MixPDF */
+   MixPDF *ref_mpdf;            /* reference for the range check, or NULL */
+   IntVec pnFloorNum;           /* flooring counts, or NULL */
+   int limit;                   /* LOW/HIGH_FLOOR if val was limited, else 0 */
+   int k;                       /* dimension */
+   float val;
+} MgeUpdate;
+
+struct _MgeUpdBlock {
+   MgeUpdate upd[MGE_UPD_BLOCK];
+   int n;
+   MgeUpdBlock *next;
+};
+
 /* CalGainWght: Calculate gain weight for generation error */
 static float CalGainWght(float fGain, float fComp)
 {
@@ -270,7 +294,6 @@ static void SetupMgeTrnInfo(MgeTrnInfo * mtInfo, char *labfn, char *datafn)
 
       if (mtInfo->pbMTrn[p]) {
          mst->nInvQuaSize = mtInfo->pnInvQuaSize[p];
-         mst->quasi_invRef = CreateDMatrix(mtInfo->mgeMem, pst->T, mst->nInvQuaSize * 2);       /* L~-1, L*L'=WUW */
          mst->quasi_invWUW = CreateDMatrix(mtInfo->mgeMem, pst->T, mst->nInvQuaSize * 2);       /* (WUW)~-1 */
          mst->quasi_P = CreateDMatrix(mtInfo->mgeMem, pst->T, mst->nInvQuaSize * pst->win.num * 2);     /* P = (W'UW)~-1 * W' ~ */
       }
@@ -291,97 +314,45 @@ static void ResetMgeTrnInfo(MgeTrnInfo * mtInfo)
    ResetGenInfo(mtInfo->genInfo);
 }
 
-/* InverseWUW: */
+/* InverseWUW: band of (W'UW)~-1 from the Cholesky factor U of W'UW */
+/* Takahashi recursion: since U*Z = U'~-1 is lower triangular, for j>i */
+/*   Z(i,j) = -sum_{k>i} U(i,k)*Z(k,j) / U(i,i)                       */
+/*   Z(i,i) = (1/U(i,i) - sum_{k>i} U(i,k)*Z(k,i)) / U(i,i)           */
+/* so each row only needs the band of the rows after it.  Elements of */
+/* Z outside the band of nInvQuaSize are taken as zero.               */
 static void InverseWUW(MgeStream * mst, PdfStream * pst)
 {
-   int i, j, k, ii, jj, kk;
-   int nInvQuaSize;
+   int i, j, k, d, kj;
+   int nInvQuaSize, nBand;
+   double sum;
 
-   DMatrix WUW;
-   DMatrix quasi_invRef;
+   DMatrix U;
    DMatrix quasi_invWUW;
 
-   WUW = pst->WUW;
-   quasi_invRef = mst->quasi_invRef;
+   U = pst->WUW;                /* U[t][1+d] = U(t,t+d) after Cholesky_Factorization */
    quasi_invWUW = mst->quasi_invWUW;
    nInvQuaSize = mst->nInvQuaSize;
+   nBand = nInvQuaSize - 1;
 
-   ZeroDMatrix(mst->quasi_invRef);
-   for (i = 1; i <= pst->T; i++) {
-      quasi_invRef[i][nInvQuaSize] = pst->WUW[i][1];
-      for (k = 1; k < pst->width; k++) {
-         if (i + k <= pst->T) {
-            quasi_invRef[i][nInvQuaSize + k] = pst->WUW[i][k + 1];
-            quasi_invRef[i + k][nInvQuaSize - k] = pst->WUW[i][k + 1];
-         }
-      }
-   }
-
-   /* inverse WUW */
    ZeroDMatrix(quasi_invWUW);
-   /* zero left-down */
-   for (i = 1; i <= pst->T; i++) {
-      /* normalize one row */
-      quasi_invWUW[i][nInvQuaSize] = 1.0 / quasi_invRef[i][nInvQuaSize];
-      /* norm orig matrix */
-      for (k = 1; k < pst->width; k++) {
-         if (i + k <= pst->T)
-            quasi_invRef[i][nInvQuaSize + k] /= quasi_invRef[i][nInvQuaSize];
-      }
-      /* norm inv matrix */
-      j = i - nInvQuaSize + 1 > 0 ? i - nInvQuaSize + 1 : 1;
-      for (; j < i; j++)
-         quasi_invWUW[i][(j - i) + nInvQuaSize] /= quasi_invRef[i][nInvQuaSize];
-      quasi_invRef[i][nInvQuaSize] = 1.0;       /* useless code */
-
-      /* zero one colum */
-      for (k = 1; k < pst->width; k++) {
-         ii = i + k;
-         kk = nInvQuaSize - k;
-         if (ii <= pst->T) {
-            /* process inv matrix */
-            j = i - nInvQuaSize + k + 1 > 0 ? i - nInvQuaSize + k + 1 : 1;
-            jj = j - i + nInvQuaSize;
-            for (; j <= i; j++, jj++) {
-               quasi_invWUW[ii][j - i + kk] -= quasi_invWUW[i][jj] * quasi_invRef[ii][kk];
-            }
-            /* process orig matrix */
-            for (j = 1; j < pst->width; j++) {
-               if (i + j <= pst->T)
-                  quasi_invRef[ii][j + kk] -= quasi_invRef[i][j + nInvQuaSize] * quasi_invRef[ii][kk];
-            }
-         }
-      }
-   }
-
-   /* zero right-upper */
    for (i = pst->T; i >= 1; i--) {
-      /* zero one colum */
-      for (k = 1; k < pst->width; k++) {
-         ii = i - k;
-         kk = k + nInvQuaSize;
-         if (ii > 0) {
-            /* process inv matrix */
-            j = i - nInvQuaSize + 1 > 0 ? i - nInvQuaSize + 1 : 1;
-            jj = j - i + nInvQuaSize;
-            for (; j < i + nInvQuaSize - k; j++, jj++) {
-               if (j > pst->T)
-                  break;
-               quasi_invWUW[ii][j - i + kk] -= quasi_invWUW[i][jj] * quasi_invRef[ii][kk];
-            }
-         }
-      }
-   }
-
-   /* need to make it symmetrical */
-   for (i = 1; i <= pst->T; i++) {
-      for (j = nInvQuaSize - 1; j >= 1; j--) {
-         jj = nInvQuaSize - j;
-         if (i - jj > 0) {
-            quasi_invWUW[i][j] = (quasi_invWUW[i][j] + quasi_invWUW[i - jj][nInvQuaSize + jj]) / 2;
-            quasi_invWUW[i - jj][nInvQuaSize + jj] = quasi_invWUW[i][j];
+      /* upper band of row i, mirrored into the lower band of the later rows */
+      for (d = (nBand < pst->T - i) ? nBand : pst->T - i; d >= 1; d--) {
+         j = i + d;
+         sum = 0.0;
+         for (k = 1; k < pst->width && i + k <= pst->T; k++) {
+            kj = j - (i + k);
+            if (kj <= nBand && kj >= -nBand)
+               sum += U[i][k + 1] * quasi_invWUW[i + k][nInvQuaSize + kj];
          }
+         quasi_invWUW[i][nInvQuaSize + d] = -sum / U[i][1];
+         quasi_invWUW[j][nInvQuaSize - d] = quasi_invWUW[i][nInvQuaSize + d];
       }
+      /* diagonal */
+      sum = 0.0;
+      for (k = 1; k < pst->width && k <= nBand && i + k <= pst->T; k++)
+         sum += U[i][k + 1] * quasi_invWUW[i][nInvQuaSize + k];
+      quasi_invWUW[i][nInvQuaSize] = (1.0 / U[i][1] - sum) / U[i][1];
    }
 }
 
@@ -440,13 +411,13 @@ static void ParaGenOneDim(PdfStream * pst, int m, Boolean bCalDyn)
 static void CalcMgeTrnInfo(MgeStream * mst, PdfStream * pst, int m)
 {
    Calc_WUM_and_WUW(pst, m - 1);
+   Cholesky_Factorization(pst); /* Cholesky decomposition */
 
-   /* calculate inverse matrix (W'UW)~-1 */
+   /* calculate inverse matrix (W'UW)~-1 from the Cholesky factor */
    InverseWUW(mst, pst);
    /* calculate Matrix P = R~-1 * W' = (W'UW)~-1 * W' */
    CalMatrixP(mst, pst, m);
 
-   Cholesky_Factorization(pst); /* Cholesky decomposition */
    Forward_Substitution(pst);   /* forward substitution   */
    Backward_Substitution(pst, m - 1);   /* backward substitution  */
 
@@ -626,6 +597,58 @@ static int CalcUpdateRatio(MgeTrnInfo * mtInfo, MgeStream * mst, PdfStream * pst
    return (ei - si);
 }
 
+/* UpdateMean: update mean parameter and bound it by ref_mpdf (if any) */
+static void UpdateMean(MixPDF * mpdf, MixPDF * ref_mpdf, IntVec pnFloorNum, int k, float upRate)
+{
+   mpdf->mean[k] -= (float) upRate;
+   if (ref_mpdf != NULL)
+      CheckMeanUpdateRange(mpdf, ref_mpdf, pnFloorNum, k);
+}
+
+/* UpdateVar: update var parameter and bound it by ref_mpdf (if any) */
+static void UpdateVar(MixPDF * mpdf, MixPDF * ref_mpdf, IntVec pnFloorNum, int k, float upRate)
+{
+   mpdf->cov.var[k] /= (float) pow(10, upRate);
+   if (ref_mpdf != NULL)
+      CheckVarUpdateRange(mpdf, ref_mpdf, pnFloorNum, k);
+}
+
+/* AddMgeUpdate: record an update of a deferred mtInfo */
+static void AddMgeUpdate(MgeTrnInfo * mtInfo, MgeUpdKind kind, Ptr par, MixPDF * ref_mpdf, IntVec pnFloorNum, int limit, int k, float val)
+{
+   MgeUpdBlock *b;
+   MgeUpdate *u;
+
+   b = mtInfo->updTail;
+   if (b == NULL || b->n == MGE_UPD_BLOCK) {
+      b = (MgeUpdBlock *) New(mtInfo->mgeMem, sizeof(MgeUpdBlock));
+      b->n = 0;
+      b->next = NULL;
+      if (mtInfo->updTail == NULL)
+         mtInfo->updHead = b;
+      else
+         mtInfo->updTail->next = b;
+      mtInfo->updTail = b;
+   }
+   u = b->upd + b->n++;
+   u->kind = kind;
+   u->par = par;
+   u->ref_mpdf = ref_mpdf;
+   u->pnFloorNum = pnFloorNum;
+   u->limit = limit;
+   u->k = k;
+   u->val = val;
+}
+
+/* AddMuOcc: accumulate occ for MSD weight updating */
+static void AddMuOcc(MgeTrnInfo * mtInfo, MuAcc * ma, float occ)
+{
+   if (mtInfo->bDeferUpd)
+      AddMgeUpdate(mtInfo, UPD_OCC, ma, NULL, NULL, 0, 0, occ);
+   else
+      ma->occ += occ;
+}
+
 /* SeqPDUpdate: Parameter updating by online PD */
 static void SeqPDUpdate(MgeTrnInfo * mtInfo, MgeStream * mst, PdfStream * pst, int p, int m)
 {
@@ -641,6 +664,8 @@ static void SeqPDUpdate(MgeTrnInfo * mtInfo, MgeStream * mst, PdfStream * pst, i
    MTStatInfo *statInfo;
    MuAcc *ma;
    float occ, all_occ;
+   IntVec pnFloorNum;
+   int limit;
 
    genInfo = mtInfo->genInfo;
    statInfo = mtInfo->statInfo;
@@ -671,7 +696,8 @@ static void SeqPDUpdate(MgeTrnInfo * mtInfo, MgeStream * mst, PdfStream * pst, i
             ref_hmm = FindMacroName(mtInfo->orighset, 'l', label->auxLab[1])->structure;
          else
             ref_hmm = FindMacroName(mtInfo->orighset, 'l', labid)->structure;
-         hmm->hook = ref_hmm;   /* link reference hmm */
+         if (!mtInfo->bDeferUpd)
+            hmm->hook = ref_hmm;        /* link reference hmm */
       }
 
       for (; j < hmm->numStates; j++) {
@@ -699,15 +725,17 @@ static void SeqPDUpdate(MgeTrnInfo * mtInfo, MgeStream * mst, PdfStream * pst, i
                ma = (MuAcc *) GetHook(mpdf->mean);
                if (ma != NULL) {
                   if (m == 1 && (genInfo->nPdfStream[p] > 1 || (genInfo->nPdfStream[p] == 1 && l == 0)))
-                     ma->occ += occ;
+                     AddMuOcc(mtInfo, ma, occ);
                   if (genInfo->nPdfStream[p] > 1) {
                      /* second mixture is unvoiced mixture */
                      ma = (MuAcc *) GetHook(hmm->svec[j].info->pdf[stm].info->spdf.cpdf[2].mpdf->mean);
                      if (m == 1)
-                        ma->occ += (all_occ - occ);
+                        AddMuOcc(mtInfo, ma, (all_occ - occ));
                   }
                }
                /* calculate updating step */
+               pnFloorNum = (statInfo != NULL) ? statInfo->pnMeanFloor[p][m][l + 1] : NULL;
+               limit = 0;
                upRate = mtInfo->currStepSize * (float) mtInfo->mrat[l + 1];
                if (mtInfo->bMScale)
                   upRate *= mtInfo->SRMean[p][m];
@@ -720,42 +748,40 @@ static void SeqPDUpdate(MgeTrnInfo * mtInfo, MgeStream * mst, PdfStream * pst, i
                   else
                      var = (float) sqrt(mpdf->cov.var[k]);
                   meanLimit = MAX_MEAN_UP_STEP / var * limitStep;
-                  if (statInfo != NULL)
-                     CheckUpStepLimit(&upRate, meanLimit, !(mtInfo->bOrigHmmRef), statInfo->pnMeanFloor[p][m][l + 1]);
-                  else
-                     CheckUpStepLimit(&upRate, meanLimit, !(mtInfo->bOrigHmmRef), NULL);
+                  if (mtInfo->bDeferUpd) {
+                     if (CheckUpStepLimit(&upRate, meanLimit, FALSE, NULL) && !(mtInfo->bOrigHmmRef))
+                        limit = (upRate > 0) ? HIGH_FLOOR : LOW_FLOOR;
+                  } else
+                     CheckUpStepLimit(&upRate, meanLimit, !(mtInfo->bOrigHmmRef), pnFloorNum);
                }
                /* update mean parameter */
-               mpdf->mean[k] -= (float) upRate;
-               if (mtInfo->bOrigHmmRef && ref_mpdf != NULL) {
-                  if (statInfo != NULL)
-                     CheckMeanUpdateRange(mpdf, ref_mpdf, statInfo->pnMeanFloor[p][m][l + 1], k);
-                  else
-                     CheckMeanUpdateRange(mpdf, ref_mpdf, NULL, k);
-               }
+               if (mtInfo->bDeferUpd)
+                  AddMgeUpdate(mtInfo, UPD_MEAN, mpdf, ref_mpdf, pnFloorNum, limit, k, upRate);
+               else
+                  UpdateMean(mpdf, ref_mpdf, pnFloorNum, k, upRate);
             }
 
             /* variance updating */
             if (mtInfo->uFlags & UPVARS) {
+               pnFloorNum = (statInfo != NULL) ? statInfo->pnVarFloor[p][m][l + 1] : NULL;
+               limit = 0;
                upRate = mtInfo->currStepSize * (float) mtInfo->vrat[l + 1];
                if (mtInfo->bMScale)
                   upRate *= mtInfo->SRVar[p][m];
                upRate *= mpdf->cov.var[k];
 
                if (mtInfo->bStepLimit) {
-                  if (statInfo != NULL)
-                     CheckUpStepLimit(&upRate, varLimit, !(mtInfo->bOrigHmmRef), statInfo->pnVarFloor[p][m][l + 1]);
-                  else
-                     CheckUpStepLimit(&upRate, varLimit, !(mtInfo->bOrigHmmRef), NULL);
+                  if (mtInfo->bDeferUpd) {
+                     if (CheckUpStepLimit(&upRate, varLimit, FALSE, NULL) && !(mtInfo->bOrigHmmRef))
+                        limit = (upRate > 0) ? HIGH_FLOOR : LOW_FLOOR;
+                  } else
+                     CheckUpStepLimit(&upRate, varLimit, !(mtInfo->bOrigHmmRef), pnFloorNum);
                }
                /* update var parameter */
-               mpdf->cov.var[k] /= (float) pow(10, upRate);
-               if (mtInfo->bOrigHmmRef && ref_mpdf != NULL) {
-                  if (statInfo != NULL)
-                     CheckVarUpdateRange(mpdf, ref_mpdf, statInfo->pnVarFloor[p][m][l + 1], k);
-                  else
-                     CheckVarUpdateRange(mpdf, ref_mpdf, NULL, k);
-               }
+               if (mtInfo->bDeferUpd)
+                  AddMgeUpdate(mtInfo, UPD_VAR, mpdf, ref_mpdf, pnFloorNum, limit, k, upRate);
+               else
+                  UpdateVar(mpdf, ref_mpdf, pnFloorNum, k, upRate);
             }
          }
          s++;
@@ -801,7 +827,9 @@ static void AccOneDimGenErr(MgeTrnInfo * mtInfo, MgeStream * mst, PdfStream * ps
 
    /* calculate generation error for one dimension */
    fErr = CalOneDimGenErr(mtInfo, mst, pst, p, m);
-   if (mtInfo->statInfo != NULL)
+   if (mtInfo->bDeferUpd)
+      mtInfo->errAcc[p][m] += fErr;
+   else if (mtInfo->statInfo != NULL)
       mtInfo->statInfo->currErrAcc[p][m] += fErr;
 }
 
@@ -884,6 +912,88 @@ void OneSentGenErrAcc(MgeTrnInfo * mtInfo, char *labfn, char *datafn)
    ResetMgeTrnInfo(mtInfo);
 }
 
+/* EXPORT->CloneMgeTrnInfo: Create a deferred copy of mtInfo */
+MgeTrnInfo *CloneMgeTrnInfo(MemHeap * x, MgeTrnInfo * mtInfo)
+{
+   MgeTrnInfo *clone;
+   GenInfo *genInfo;
+   int p;
+
+   clone = (MgeTrnInfo *) New(x, sizeof(MgeTrnInfo));
+   *clone = *mtInfo;
+   genInfo = (GenInfo *) New(x, sizeof(GenInfo));
+   *genInfo = *mtInfo->genInfo;
+   genInfo->genMem = (MemHeap *) New(x, sizeof(MemHeap));
+   CreateHeap(genInfo->genMem, "Gen Stack", MSTAK, 1, 1.0, 80000, 400000);
+   clone->genInfo = genInfo;
+   clone->mgeMem = (MemHeap *) New(x, sizeof(MemHeap));
+   CreateHeap(clone->mgeMem, "MGE Train Stack", MSTAK, 1, 1.0, 80000, 400000);
+   clone->bDeferUpd = TRUE;
+   clone->updHead = clone->updTail = NULL;
+   for (p = 1; p <= genInfo->nPdfStream[0]; p++)
+      clone->errAcc[p] = CreateDVector(x, genInfo->pst[p].order * 2);
+
+   return clone;
+}
+
+/* EXPORT->PrepareMgeUtt: Load one utterance into a deferred mtInfo */
+void PrepareMgeUtt(MgeTrnInfo * mtInfo, char *labfn, char *datafn)
+{
+   int p;
+
+   if (!mtInfo->bDeferUpd)
+      HError(6690, "PrepareMgeUtt: MgeTrnInfo not created by CloneMgeTrnInfo");
+   SetupMgeTrnInfo(mtInfo, labfn, datafn);
+   SetupPdfStreams(mtInfo->genInfo, -1, -1);
+   mtInfo->updHead = mtInfo->updTail = NULL;
+   for (p = 1; p <= mtInfo->genInfo->nPdfStream[0]; p++)
+      ZeroDVector(mtInfo->errAcc[p]);
+}
+
+/* EXPORT->ComputeMgeUtt: Record the updates for a prepared utterance */
+void ComputeMgeUtt(MgeTrnInfo * mtInfo, float stepSize, Boolean bOnlyAccErr)
+{
+   HmmTrainByMge(mtInfo, stepSize, bOnlyAccErr);
+}
+
+/* EXPORT->ApplyMgeUpdate: Apply the recorded updates and release the utterance */
+void ApplyMgeUpdate(MgeTrnInfo * mtInfo)
+{
+   MgeUpdBlock *b;
+   MgeUpdate *u;
+   GenInfo *genInfo;
+   int i, p, m;
+
+   for (b = mtInfo->updHead; b != NULL; b = b->next) {
+      for (i = 0, u = b->upd; i < b->n; i++, u++) {
+         if (u->limit != 0 && u->pnFloorNum != NULL)
+            u->pnFloorNum[u->limit]++;
+         switch (u->kind) {
+         case UPD_OCC:
+            ((MuAcc *) u->par)->occ += u->val;
+            break;
+         case UPD_MEAN:
+            UpdateMean((MixPDF *) u->par, u->ref_mpdf, u->pnFloorNum, u->k, u->val);
+            break;
+         case UPD_VAR:
+            UpdateVar((MixPDF *) u->par, u->ref_mpdf, u->pnFloorNum, u->k, u->val);
+            break;
+         }
+      }
+   }
+   genInfo = mtInfo->genInfo;
+   if (mtInfo->statInfo != NULL) {
+      for (p = 1; p <= genInfo->nPdfStream[0]; p++) {
+         if (!mtInfo->pbAccErr[p])
+            continue;
+         for (m = 1; m <= genInfo->pst[p].order; m++)
+            mtInfo->statInfo->currErrAcc[p][m] += mtInfo->errAcc[p][m];
+      }
+   }
+   mtInfo->updHead = mtInfo->updTail = NULL;
+   ResetMgeTrnInfo(mtInfo);
+}
+
 /* UpdateOneMSDWeight: Update MSD mixture weight for one state models */
 static void UpdateOneMSDWeight(MgeTrnInfo * mtInfo, StateElem * se, float all_occ, int p)
 {
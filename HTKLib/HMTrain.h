@@ -79,7 +79,6 @@ typedef struct {
 
 typedef struct {
    Matrix origObs;
-   DMatrix quasi_invRef;
    DMatrix quasi_invWUW;
    DMatrix quasi_P;
    DMatrix origMean;            /* mean vector of original feature sequence */
@@ -92,6 +91,8 @@ typedef struct {
    int nVarWinSize;             /* size of the window for variance calculation */
 } MgeStream;
 
+typedef struct _MgeUpdBlock MgeUpdBlock;   /* updates recorded by a deferred MgeTrnInfo */
+
 typedef struct {
    MemHeap *mgeMem;
    GenInfo *genInfo;            /* Point to GenInfo */
@@ -126,6 +127,10 @@ typedef struct {
    Vector DWght[SMAX];          /* Distance weight for different dimension of parameters */
    DVector mrat;                /* temporary updating rate for mean */
    DVector vrat;                /* temporary updating rate for variance */
+   Boolean bDeferUpd;           /* Record updates for ApplyMgeUpdate instead of applying them */
+   MgeUpdBlock *updHead;        /* recorded updates of the current utterance */
+   MgeUpdBlock *updTail;
+   DVector errAcc[SMAX];        /* generation error of the current utterance if deferred */
 } MgeTrnInfo;
 
 void InitMTrain();
@@ -143,6 +148,34 @@ void OneSentGenErrAcc(MgeTrnInfo * mtInfo, char *labfn, char *datafn);
   Accumulate generation error for one utterance
 */
 
+MgeTrnInfo *CloneMgeTrnInfo(MemHeap * x, MgeTrnInfo * mtInfo);
+/*
+  Create a copy of mtInfo with its own GenInfo and heaps, which 
+  records its updates (bDeferUpd) so that several utterances can be
+  processed in parallel against the same models
+*/
+
+void PrepareMgeUtt(MgeTrnInfo * mtInfo, char *labfn, char *datafn);
+/*
+  Load the label and data of one utterance into a cloned mtInfo and
+  set up its PdfStreams from the current models.  Must be called from
+  the main thread.
+*/
+
+void ComputeMgeUtt(MgeTrnInfo * mtInfo, float stepSize, Boolean bOnlyAccErr);
+/*
+  Compute the generation error and parameter updates of a prepared
+  utterance.  The models are only read so this may run in a worker
+  thread for each of several cloned mtInfo's.
+*/
+
+void ApplyMgeUpdate(MgeTrnInfo * mtInfo);
+/*
+  Apply the updates and add the generation error recorded by
+  ComputeMgeUtt to the models and statistics, then release the
+  utterance.  Must be called from the main thread.
+*/
+
 void UpdateAllMSDWeight(MgeTrnInfo * mtInfo);
 /*
   Update MSD mixture weight for all state models 
@@ -1468,7 +1468,7 @@ static void CopyDColumn(DMatrix M, int k, DVector v)
 
 /* BiFactor -- perform preliminary factorisation for bisvd
    -- updates U and/or V, which ever is not NULL */
-static void BiFactor(DMatrix A, DMatrix U, DMatrix V)
+static void BiFactor(MemHeap *x, DMatrix A, DMatrix U, DMatrix V)
 {
    int n, k;
    DVector tmp1, tmp2, tmp3;
@@ -1476,9 +1476,9 @@ static void BiFactor(DMatrix A, DMatrix U, DMatrix V)
 
    n = NumDRows(A);
 
-   tmp1 = CreateDVector(&gstack, n);
-   tmp2 = CreateDVector(&gstack, n);
-   tmp3 = CreateDVector(&gstack, n);
+   tmp1 = CreateDVector(x, n);
+   tmp2 = CreateDVector(x, n);
+   tmp3 = CreateDVector(x, n);
 
    for ( k = 1; k <= n; k++ ) {
       CopyDColumn(A,k,tmp1);
@@ -1495,7 +1495,7 @@ static void BiFactor(DMatrix A, DMatrix U, DMatrix V)
          HholdTrCols(V,k+1,1,tmp2,beta,tmp3);
    }
 
-   FreeDVector(&gstack, tmp1);
+   FreeDVector(x, tmp1);
 }
 
 /* mat_id -- set A to being closest to identity matrix as possible
@@ -1510,9 +1510,10 @@ static void InitIdentity(DMatrix A)
       A[i][i] = 1.0;
 }
 
-/* EXPORT->SVD: Calculate the decompostion of matrix A.
+/* EXPORT->SVDHeap: Calculate the decompostion of matrix A using
+   x for workspace.
    NOTE: on return that U and V hold U' and V' respectively! */
-void SVD(DMatrix A, DMatrix U, DMatrix V, DVector d)
+void SVDHeap(MemHeap *x, DMatrix A, DMatrix U, DMatrix V, DVector d)
 {
    DVector f=NULL;
    int i, n;
@@ -1527,13 +1528,13 @@ void SVD(DMatrix A, DMatrix U, DMatrix V, DVector d)
    if (U == NULL || V == NULL || d == NULL)
       HError(1, "SVD: The svd matrices and vector must be initialised b4 call");
  
-   A_tmp = CreateDMatrix(&gstack, n, n);
+   A_tmp = CreateDMatrix(x, n, n);
    CopyDMatrix(A, A_tmp);
    InitIdentity(U);
    InitIdentity(V);
-   f = CreateDVector(&gstack,n-1);
+   f = CreateDVector(x,n-1);
 
-   BiFactor(A_tmp,U,V);
+   BiFactor(x,A_tmp,U,V);
    for ( i = 1; i <= n; i++ ) {
       d[i] = A_tmp[i][i];
       if ( i+1 <= n )
@@ -1542,12 +1543,20 @@ void SVD(DMatrix A, DMatrix U, DMatrix V, DVector d)
 
    BiSVD(d,f,U,V);
    FixSVD(d,U,V);
-   FreeDMatrix(&gstack, A_tmp);
+   FreeDMatrix(x, A_tmp);
 }
 
-/* EXPORT->InvSVD: Inverted Singular Value Decomposition (calls SVD)
-   and inverse of A is returned in Result */
-void InvSVD(DMatrix A, DMatrix U, DVector W, DMatrix V, DMatrix Result)
+/* EXPORT->SVD: Calculate the decompostion of matrix A.
+   NOTE: on return that U and V hold U' and V' respectively! */
+void SVD(DMatrix A, DMatrix U, DMatrix V, DVector d)
+{
+   SVDHeap(&gstack,A,U,V,d);
+}
+
+/* EXPORT->InvSVDHeap: Inverted Singular Value Decomposition (calls
+   SVDHeap) using x for workspace, inverse of A is returned in Result */
+void InvSVDHeap(MemHeap *x, DMatrix A, DMatrix U, DVector W, DMatrix V, 
+                DMatrix Result)
 {
    int m, n, i, j, k;
    double wmax, wmin;
@@ -1560,10 +1569,10 @@ void InvSVD(DMatrix A, DMatrix U, DVector W, DMatrix V, DMatrix Result)
    if (m != n)
       HError(1, "InvSVD: Matrix inversion only for symmetric matrices!\n");
 
-   SVD(A, U, V, W);
+   SVDHeap(x, A, U, V, W);
    /* NOTE U and V actually now hold U' and V' ! */
 
-   tmp1 = CreateDMatrix(&gstack,m, n);
+   tmp1 = CreateDMatrix(x,m, n);
 
    wmax = 0.0;
    for (k = 1; k <= n; k ++)
@@ -1603,7 +1612,14 @@ void InvSVD(DMatrix A, DMatrix U, DVector W, DMatrix V, DMatrix Result)
       for (j=1;j<=m;j++)
          for (k=1;k<=n;k++)
             Result[i][j] += tmp1[i][k] * U[k][j];
-   FreeDMatrix(&gstack,tmp1);
+   FreeDMatrix(x,tmp1);
+}
+
+/* EXPORT->InvSVD: Inverted Singular Value Decomposition (calls SVD)
+   and inverse of A is returned in Result */
+void InvSVD(DMatrix A, DMatrix U, DVector W, DMatrix V, DMatrix Result)
+{
+   InvSVDHeap(&gstack,A,U,W,V,Result);
 }
 
 /* LUDecompose: perform LU decomposition on Matrix a, the permutation
@@ -1689,14 +1705,14 @@ float MatDet(Matrix c)
        of the rows is returned in perm and sign is returned as +/-1
        depending on whether there was an even/odd number of row 
        interchanges */
-static Boolean DLUDecompose(DMatrix a, int *perm, int *sign)
+static Boolean DLUDecompose(MemHeap *x, DMatrix a, int *perm, int *sign)
 {
    int i,imax,j,k,n;
    double scale,sum,xx,yy;
    DVector vv,tmp;
    
    n = NumDRows(a); imax = 0;
-   vv = CreateDVector(&gstack,n);
+   vv = CreateDVector(x,n);
    *sign = 1;
    for (i=1; i<=n; i++) {
       scale = 0.0;
@@ -1739,7 +1755,7 @@ static Boolean DLUDecompose(DMatrix a, int *perm, int *sign)
          for (i=j+1; i<=n;i++) a[i][j] *= yy;
       }
    }
-   FreeDVector(&gstack,vv);
+   FreeDVector(x,vv);
    return(TRUE);
 }
 
@@ -1754,7 +1770,7 @@ double DMatDet(DMatrix c)
    n=NumDRows(c);
    a=CreateDMatrix(&gstack,n,n);
    CopyDMatrix(c,a);                /* Make a copy of c */
-   DLUDecompose(a,perm,&sign);      /* Do LU Decomposition */
+   DLUDecompose(&gstack,a,perm,&sign);      /* Do LU Decomposition */
    det = (double)sign;              /* Calc Det(c) */
    for (i=1; i<=n; i++) {
       det *= a[i][i];
@@ -1855,7 +1871,7 @@ double DMatInvert(DMatrix c, DMatrix invc)
    n=NumDRows(c);
    a=CreateDMatrix(&gstack,n,n);
    CopyDMatrix(c,a);           /* Make a copy of c */
-   DLUDecompose(a,perm,&sign);      /* Do LU Decomposition */
+   DLUDecompose(&gstack,a,perm,&sign);      /* Do LU Decomposition */
    for (j=1; j<=n; j++) {     /* Invert matrix */
       for (i=1; i<=n; i++)
          col[i]=0.0;
@@ -1872,8 +1888,9 @@ double DMatInvert(DMatrix c, DMatrix invc)
    return det;
 }
 
-/* EXPORT-> DMatCofact: generates the cofactors of row r of matrix c */
-double DMatCofact(DMatrix c, int r, DVector cofact)
+/* EXPORT-> DMatCofactHeap: generates the cofactors of row r of
+   matrix c using x for workspace */
+double DMatCofactHeap(MemHeap *x, DMatrix c, int r, DVector cofact)
 {
    DMatrix a;
    double col[MAX_VSIZE];
@@ -1882,9 +1899,9 @@ double DMatCofact(DMatrix c, int r, DVector cofact)
    int n,i,perm[MAX_VSIZE];
    
    n=NumDRows(c);
-   a=CreateDMatrix(&gstack,n,n);
+   a=CreateDMatrix(x,n,n);
    CopyDMatrix(c,a);                      /* Make a copy of c */
-   if (! DLUDecompose(a,perm,&sign))      /* Do LU Decomposition */
+   if (! DLUDecompose(x,a,perm,&sign))    /* Do LU Decomposition */
      return 0;
    det = (double)sign;                    /* Calc det(c) */
    for (i=1; i<=n; i++) {
@@ -1896,10 +1913,16 @@ double DMatCofact(DMatrix c, int r, DVector cofact)
    DLinSolve(a,perm,col);
    for (i=1; i<=n; i++)
      cofact[i] = col[i]*det;
-   FreeDMatrix(&gstack,a);
+   FreeDMatrix(x,a);
    return det;
 }
 
+/* EXPORT-> DMatCofact: generates the cofactors of row r of matrix c */
+double DMatCofact(DMatrix c, int r, DVector cofact)
+{
+   return DMatCofactHeap(&gstack,c,r,cofact);
+}
+
 /* EXPORT-> MatCofact: generates the cofactors of row r of matrix c */
 double MatCofact(Matrix c, int r, Vector cofact)
 {
@@ -1915,7 +1938,7 @@ double MatCofact(Matrix c, int r, Vector cofact)
    b=CreateDMatrix(&gstack,n,n);
    Mat2DMat(c,b);
    CopyDMatrix(b,a);                      /* Make a copy of c */
-   if (! DLUDecompose(a,perm,&sign))      /* Do LU Decomposition */
+   if (! DLUDecompose(&gstack,a,perm,&sign))      /* Do LU Decomposition */
      return 0;
    det = (double)sign;                    /* Calc det(c) */
    for (i=1; i<=n; i++) {
@@ -266,6 +266,10 @@ double DMatDet(DMatrix c);
  
 /* DMatCofact: generates the cofactors of row r of doublematrix c */
 double DMatCofact(DMatrix c, int r, DVector cofact);
+double DMatCofactHeap(MemHeap *x, DMatrix c, int r, DVector cofact);
+/*
+   As DMatCofact but allocates its workspace in x rather than gstack
+*/
 
 /* MatCofact: generates the cofactors of row r of doublematrix c */
 double MatCofact(Matrix c, int r, Vector cofact);
@@ -284,6 +288,14 @@ void InvSVD(DMatrix A, DMatrix U, DVector W, DMatrix V, DMatrix Result);
    A is m x n ,  U is m x n,  W is diag N x 1, V is n x n, Result is m x n 
 */
 
+void SVDHeap(MemHeap *x, DMatrix A, DMatrix U,  DMatrix V, DVector d);
+void InvSVDHeap(MemHeap *x, DMatrix A, DMatrix U, DVector W, DMatrix V, 
+                DMatrix Result);
+/* 
+   As SVD and InvSVD but allocate their workspace in x rather than
+   gstack, so that separate threads can use them with separate heaps
+*/
+
 /* ------------------- Log Arithmetic Routines ----------------------- */
 
 LogDouble LAdd(LogDouble x, LogDouble y);
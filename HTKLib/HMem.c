@@ -70,6 +70,14 @@ char *hmem_vc_id = "$Id: HMem.c,v 1.12 2012/12/22 07:01:28 uratec Exp $";
 #include "HShell.h"
 #include "HMem.h"
 
+#if defined(WIN32) && !defined(NO_THREADS)
+#define NO_THREADS
+#endif
+
+#ifndef NO_THREADS
+#include <pthread.h>
+#endif
+
 int debug_level = 0;               /* For esps linking */
 
 /* --------------------------- Trace Flags ------------------------ */
@@ -113,6 +121,27 @@ typedef struct _MemHeapRec {
 
 static MemHeapRec *heapList = NULL;
 
+#ifndef NO_THREADS
+/* guards heapList and the counters of CHEAP heaps */
+static pthread_mutex_t heapLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* LockHeaps: enter section which updates shared heap records */
+static void LockHeaps(void)
+{
+#ifndef NO_THREADS
+   pthread_mutex_lock(&heapLock);
+#endif
+}
+
+/* UnlockHeaps: leave section which updates shared heap records */
+static void UnlockHeaps(void)
+{
+#ifndef NO_THREADS
+   pthread_mutex_unlock(&heapLock);
+#endif
+}
+
 /* RecordHeap: add given heap to list */
 static void RecordHeap(MemHeap *x)
 {
@@ -120,8 +149,11 @@ static void RecordHeap(MemHeap *x)
    
    if ((p=(MemHeapRec *)malloc(sizeof(MemHeapRec))) == NULL)
       HError(5105,"RecordHeap: Cannot allocate memory for MemHeapRec");
-   p->heap = x; p->next = heapList;
+   p->heap = x;
+   LockHeaps();
+   p->next = heapList;
    heapList = p;
+   UnlockHeaps();
 }
 
 /* UnRecordHeap: remove given heap from list */
@@ -129,17 +161,21 @@ static void UnRecordHeap(MemHeap *x)
 {
    MemHeapRec *p, *q;
    
+   LockHeaps();
    p = heapList; q = NULL;
    while (p != NULL && p->heap != x){
       q = p;
       p = p->next;
    }
-   if (p == NULL)
+   if (p == NULL) {
+      UnlockHeaps();
       HError(5171,"UnRecordHeap: heap %s not found",x->name);
+   }
    if (p==heapList) 
       heapList = p->next;
    else
       q->next = p->next;
+   UnlockHeaps();
    free(p);
 }
 
@@ -399,8 +435,10 @@ void *New(MemHeap *x,size_t size)
       q = malloc(size+chdr);
       if (q==NULL)
          HError(5105,"New: memory exhausted");
+      LockHeaps();
       x->totUsed += size; 
       x->totAlloc += size+chdr;
+      UnlockHeaps();
       ip = (size_t *)q; *ip = size;
       if (trace&T_CHP)
          printf("HMem: %s[C] %zd+%zd bytes at %p allocated\n",x->name,chdr,size,q);
@@ -537,7 +575,9 @@ void Dispose(MemHeap *x, void *p)
       chdr = MRound(sizeof(size_t));
       bp = (ByteP)p-chdr;
       ip = (size_t *)bp;
+      LockHeaps();
       x->totAlloc -= (*ip + chdr); x->totUsed -= *ip;
+      UnlockHeaps();
       if (trace&T_CHP)
          printf("HMem: %s[C] %zd+%zd bytes at %p de-allocated\n",
                 x->name,chdr,*ip,bp);
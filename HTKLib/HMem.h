@@ -87,6 +87,10 @@
    then the block is free'd.  Every item in a heap can be freed via the 
    ResetHeap function.  For MSTAK heaps this is a very low cost
    operation.
+
+   Heaps may be created and deleted, and CHEAP heaps (including gcheap)
+   used, from any thread.  MHEAP and MSTAK heaps are not locked so each
+   must only be used by one thread at a time.
    
    On top of the above basic memory types, this module defines
    vector, matrix and string memory manipulation routines.
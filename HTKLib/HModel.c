@@ -91,6 +91,8 @@ char *hmodel_vc_id = "$Id: HModel.c,v 1.44 2012/12/22 07:01:28 uratec Exp $";
 #include "HUtil.h"
 #include "HTrain.h"
 #include "HAdapt.h"
+#include <sys/types.h>
+#include <sys/stat.h>
 
 /* --------------------------- Trace Flags ------------------------- */
 
@@ -113,6 +115,13 @@ static int trace = 0;
 
 /* ------------------ Input XForm directory info ------------------- */
 
+typedef struct _XFCacheEntry {
+  MemHeap mem;             /* storage of the transform and its macro */
+  AdaptXForm *xform;       /* the loaded transform */
+  MLink m;                 /* its 'a' macro */
+  struct _XFCacheEntry *next; /* next less recently used entry */
+} XFCacheEntry;
+
 typedef struct _XFDirInfo {
   char *dirName;           /* input XForm directory name */
   XFDirLink next;          /* next directory name in list */
@@ -152,6 +161,11 @@ static int nGaussPDE2 = 0;
 
 static float ignoreValue = LZERO;      /* ignore value for multi-space distribution */
 
+static char likeCacheDir[MAXFNAMELEN] = ""; /* likelihood cache directory */
+static int xfCacheSize = 0;            /* max loaded xforms kept, 0=all */
+static int xfLoadDepth = 0;            /* nesting of LoadOneXForm calls */
+static int xfCacheLoads = 0;           /* num cache entries created */
+
 void InitSymNames(void);
 
 /* EXPORT->InitModel: initialise memory and configuration parameters */
@@ -195,6 +209,9 @@ void InitModel(void)
       if (GetConfFlt(cParm,nParm,"PDETHRESHOLD1",&d)) pdeTh1 = d;
       if (GetConfFlt(cParm,nParm,"PDETHRESHOLD2",&d)) pdeTh2 = d;
       if (GetConfFlt(cParm,nParm,"IGNOREVALUE",&d)) ignoreValue = d;
+      if (GetConfStr (cParm,nParm,"LIKECACHE",buf))
+         strcpy(likeCacheDir,buf);
+      if (GetConfInt(cParm,nParm,"XFORMCACHESIZE",&i)) xfCacheSize = i;
    }
    }
 
@@ -4586,6 +4603,8 @@ void CreateHMMSet(HMMSet *hset, MemHeap *heap, Boolean allowTMods)
    hset->semiTied = NULL;
    hset->projSize = 0;
    hset->xformDirNames = NULL;
+   hset->xfCache = NULL;
+   hset->numCachedXForms = 0;
 }
 
 /* CreateHMM: create logical macro. If pId is unknown, create macro for
@@ -4971,6 +4990,72 @@ RegTree *LoadRegTree(HMMSet *hset, char* macroname, char *fname)
   return regTree;
 }
 
+/* XFormInUse: true if xform may still be referenced */
+static Boolean XFormInUse(HMMSet *hset, AdaptXForm *xform)
+{
+  XFCacheEntry *e;
+
+  if (xform == hset->curXForm || xform == hset->parentXForm ||
+      xform == hset->semiTied || xform->nUse > 0)
+    return TRUE;
+  for (e=hset->xfCache; e!=NULL; e=e->next)
+    if (e->xform->parentXForm == xform) return TRUE;
+  return FALSE;
+}
+
+/* FreeCachedXForm: remove the macro of cache entry e and free its memory */
+static void FreeCachedXForm(HMMSet *hset, XFCacheEntry *e)
+{
+  MLink *mp;
+  PtrMap **pp;
+
+  for (mp=hset->mtab+Hash(e->m->id->name); *mp!=NULL; mp=&(*mp)->next)
+    if (*mp == e->m) {
+      *mp = e->m->next; break;
+    }
+  if (hset->pmap != NULL)
+    for (pp=hset->pmap+(unsigned long)e->m->structure % PTRHASHSIZE; 
+         *pp!=NULL; pp=&(*pp)->next)
+      if ((*pp)->m == e->m) {
+        *pp = (*pp)->next; break;
+      }
+  if (e->m->type != '*') --hset->numMacros;
+  if (trace&T_XFM)
+    printf("  Freeing xform macro \"%s\"\n",e->m->id->name);
+  DeleteHeap(&e->mem);
+  Dispose(&gcheap,e);
+}
+
+/* TrimXFormCache: free least recently used xforms not in use until 
+   there are at most xfCacheSize left */
+static void TrimXFormCache(HMMSet *hset)
+{
+  XFCacheEntry *e,**ep,**lru;
+
+  while (hset->numCachedXForms > xfCacheSize) {
+    lru = NULL;   /* the most recent entry is never freed */
+    for (ep=&hset->xfCache->next; *ep!=NULL; ep=&(*ep)->next)
+      if (!XFormInUse(hset,(*ep)->xform)) lru = ep;
+    if (lru == NULL) break;
+    e = *lru; *lru = e->next;
+    --hset->numCachedXForms;
+    FreeCachedXForm(hset,e);
+  }
+}
+
+/* TouchCachedXForm: move the cache entry of xform, if any, to the front */
+static void TouchCachedXForm(HMMSet *hset, AdaptXForm *xform)
+{
+  XFCacheEntry *e,**ep;
+
+  for (ep=&hset->xfCache; *ep!=NULL; ep=&(*ep)->next)
+    if ((*ep)->xform == xform) {
+      e = *ep; *ep = e->next;
+      e->next = hset->xfCache; hset->xfCache = e;
+      return;
+    }
+}
+
 /* EXPORT->LoadOneXForm: loads, or returns, the specified transform */
 AdaptXForm *LoadOneXForm(HMMSet *hset, char* macroname, char *fname)
 {
@@ -4981,11 +5066,25 @@ AdaptXForm *LoadOneXForm(HMMSet *hset, char* macroname, char *fname)
   AdaptXForm *xform;
   Ptr structure;
   MLink m;
+  Boolean cached = TRUE;
   int fidx = LOADFIDX; /* indicates that these are loaded xform macros */
+  XFCacheEntry *e = NULL;
+  MemHeap *hmem = NULL;
+  int nMacros = 0, nLoads = 0;
 
-  /* First see whether the macro exists */
+  /* First see whether the macro exists: a transform is parsed once
+     and then kept as a macro, so returning speakers reuse it */
   id = GetLabId(macroname,FALSE);
   if ((id == NULL) || ((m = FindMacroName(hset,'a',id))==NULL)) { 
+    cached = FALSE;
+    if (xfCacheSize > 0) { 
+      /* parse into a heap of its own so that it can be freed */
+      e = (XFCacheEntry *)New(&gcheap,sizeof(XFCacheEntry));
+      CreateHeap(&e->mem,"XFormCache",MSTAK,1,1.0,5000,50000);
+      hmem = hset->hmem; hset->hmem = &e->mem;
+      nMacros = hset->numMacros; nLoads = xfCacheLoads++;
+      ++xfLoadDepth;
+    }
     fn = InitXFormScanner(hset, macroname, fname, &src, &tok);
     SkipWhiteSpace(&src);
     if(GetToken(&src,&tok)<SUCCESS){
@@ -5000,16 +5099,33 @@ AdaptXForm *LoadOneXForm(HMMSet *hset, char* macroname, char *fname)
       structure = xform = GetAdaptXForm(hset,&src,&tok);
       if (xform->xformName == NULL) /* may have been stored without the macro header */
 	xform->xformName = CopyString(hset->hmem,macroname);
-      NewMacro(hset,fidx,'a',id,structure);
+      m = NewMacro(hset,fidx,'a',id,structure);
     } else {
       xform = (AdaptXForm *)m->structure;
     }
     TermScanner(&src);
+    if (e != NULL) {
+      hset->hmem = hmem;
+      --xfLoadDepth;
+      /* 
+         The heap can only be freed later if it holds no macro other
+         than this one, ie every macro defined while loading belongs
+         to this or to a nested cache entry.  Otherwise it is kept.
+      */
+      if (hset->numMacros-nMacros == xfCacheLoads-nLoads) {
+        e->xform = xform; e->m = m;
+        e->next = hset->xfCache; hset->xfCache = e;
+        ++hset->numCachedXForms;
+        if (xfLoadDepth == 0) TrimXFormCache(hset);
+      }
+    }
   } else { /* macro already exists so just return it */
     xform = (AdaptXForm *)m->structure;
+    if (xfCacheSize > 0) TouchCachedXForm(hset,xform);
   }
   if (trace&T_XFM)
-    printf("  Using xform macro \"%s\" from file %s\n",macroname,xform->fname);
+    printf("  Using %s xform macro \"%s\" from file %s\n",
+           cached?"cached":"loaded",macroname,xform->fname);
   return xform;
 }
 
@@ -6036,6 +6152,493 @@ LogFloat OutP(Observation *x, HLink hmm, int state)
    return bx;
 }
 
+
+/* ---------------- Cross-Utterance Likelihood Cache --------------- */
+
+/*
+   The likelihoods of a data file are stored in LIKECACHE/base_hash.lkc
+   where hash is a hash of the full data file name, as
+
+     magic, version, T, transform hash, nRecs, file size, file mtime
+     data file name
+     T x observation hash
+     nRecs x { key, stream, parameter hash, T x log likelihood }
+
+   where the key is "p name" for a stream of macro ~p name, "s name"
+   for a stream of macro ~s name and "h name i" for a stream of
+   state i of HMM name.  A record is only loaded if the current HMM
+   set has a stream with the same key and parameter hash, so after
+   an edit of some of the models only their streams are recomputed.
+   The values are unweighted stream log likelihoods including the
+   determinant term of any input transform.
+
+   The whole file is discarded if the data file name, size or
+   modification time has changed, or if the input or parent transform
+   differs.  Transforms are compared by a hash of their matrices,
+   biases, determinants and class assignments, since adaptation
+   iterations re-estimate them under the same name.  Each observation is also checked
+   against its stored hash as it is read, so values computed from
+   different features (eg with another front-end configuration) or
+   for frames beyond the end of the file are never used.
+*/
+
+#define LIKECACHEMAGIC 0x484c4b43   /* "HLKC" */
+#define LIKECACHEVERSION 3
+#define LCMINROW 256                /* min frames in a row */
+
+typedef struct _LCEntry {
+   StreamInfo *sti;         /* stream cached by this entry */
+   int s;                   /* stream index of sti */
+   char *key;               /* name of sti in cache files */
+   unsigned int hash;       /* hash of the parameters of sti */
+   float *like;             /* array[1..size] of log likelihoods */
+   int size;                /* frames in like, 0 if unused */
+   struct _LCEntry *pnext;  /* next entry in sti hash chain */
+   struct _LCEntry *knext;  /* next entry in key hash chain */
+   struct _LCEntry *used;   /* next entry used by current file */
+} LCEntry;
+
+struct _LikeCache {
+   MemHeap rowHeap;         /* rows of current file */
+   int tabSize;             /* size of hash tables (power of 2) */
+   LCEntry **ptab;          /* entries hashed by sti */
+   LCEntry **ktab;          /* entries hashed by key and stream */
+   LCEntry *used;           /* entries used by current file */
+   char fn[MAXFNAMELEN];    /* cache file of current file */
+   char datafn[MAXFNAMELEN];/* current data file */
+   unsigned int tag;        /* hash of transforms of current file */
+   int fsize;               /* data file size */
+   int ftime;               /* data file modification time */
+   unsigned int *ohash;     /* array[1..osize] of observation hashes */
+   int osize;               /* frames in ohash */
+   int T;                   /* frames loaded from fn */
+   int nObs;                /* frames of current file checked so far */
+   int nLoaded;             /* values loaded from fn */
+   Boolean stale;           /* values in fn were discarded */
+};
+
+/* LCHash: FNV-1a style hash of n bytes continuing from h */
+static unsigned int LCHash(unsigned int h, void *p, int n)
+{
+   unsigned char *c = (unsigned char *) p;
+
+   for (; n>0; n--,c++)
+      h = (h ^ *c) * 16777619U;
+   return h;
+}
+
+/* LCHashStr: hash string s including terminator */
+static unsigned int LCHashStr(unsigned int h, char *s)
+{
+   return LCHash(h,s,strlen(s)+1);
+}
+
+/* LCXFormHash: hash the parameters of xform and its parents */
+static unsigned int LCXFormHash(unsigned int h, AdaptXForm *xform)
+{
+   XFormSet *xfs;
+   LinXForm *lx;
+   int i,b,r,nb;
+
+   for (; xform != NULL; xform = xform->parentXForm) {
+      xfs = xform->xformSet;
+      h = LCHash(h,&xform->akind,sizeof(AdaptKind));
+      h = LCHash(h,&xfs->xkind,sizeof(XFormKind));
+      h = LCHash(h,&xfs->numXForms,sizeof(int));
+      for (i=1; i<=xfs->numXForms; i++) {
+         lx = xfs->xforms[i];
+         h = LCHash(h,&lx->vecSize,sizeof(int));
+         nb = IntVecSize(lx->blockSize);
+         h = LCHash(h,lx->blockSize+1,nb*sizeof(int));
+         for (b=1; b<=nb; b++)
+            for (r=1; r<=lx->blockSize[b]; r++)
+               h = LCHash(h,lx->xform[b][r]+1,VectorSize(lx->xform[b][r])*sizeof(float));
+         if (lx->bias != NULL)
+            h = LCHash(h,lx->bias+1,VectorSize(lx->bias)*sizeof(float));
+         h = LCHash(h,&lx->det,sizeof(float));
+      }
+      if (xform->xformWgts.assign != NULL)
+         h = LCHash(h,xform->xformWgts.assign+1,
+                    IntVecSize(xform->xformWgts.assign)*sizeof(int));
+   }
+   return h;
+}
+
+/* LCParmHash: hash all parameters which determine the likelihood of sti */
+static unsigned int LCParmHash(StreamInfo *sti)
+{
+   unsigned int h = 2166136261U;
+   MixtureElem *me;
+   MixPDF *mp;
+   int m,i,n;
+
+   h = LCHash(h,&sti->nMix,sizeof(int));
+   for (m=1,me=sti->spdf.cpdf+1; m<=sti->nMix; m++,me++) {
+      mp = me->mpdf;
+      h = LCHash(h,&me->weight,sizeof(float));
+      h = LCHash(h,&mp->ckind,sizeof(CovKind));
+      h = LCHash(h,&mp->gConst,sizeof(float));
+      h = LCHash(h,mp->mean+1,VectorSize(mp->mean)*sizeof(float));
+      switch (mp->ckind) {
+      case DIAGC:
+      case INVDIAGC:
+         if (mp->cov.var != NULL)
+            h = LCHash(h,mp->cov.var+1,VectorSize(mp->cov.var)*sizeof(float));
+         break;
+      case FULLC:
+      case LLTC:
+         n = TriMatSize(mp->cov.inv);
+         for (i=1; i<=n; i++)
+            h = LCHash(h,mp->cov.inv[i]+1,i*sizeof(float));
+         break;
+      case XFORMC:
+         n = NumCols(mp->cov.xform);
+         for (i=1; i<=NumRows(mp->cov.xform); i++)
+            h = LCHash(h,mp->cov.xform[i]+1,n*sizeof(float));
+         break;
+      default:
+         break;
+      }
+   }
+   return h;
+}
+
+/* FindLCEntry: return entry of sti or NULL */
+static LCEntry *FindLCEntry(LikeCache *lc, StreamInfo *sti)
+{
+   LCEntry *e;
+
+   e = lc->ptab[LCHash(2166136261U,&sti,sizeof(StreamInfo *)) & (lc->tabSize-1)];
+   while (e != NULL && e->sti != sti)
+      e = e->pnext;
+   return e;
+}
+
+/* LCKeyIndex: index in lc->ktab of key and stream s */
+static int LCKeyIndex(LikeCache *lc, char *key, int s)
+{
+   return LCHash(LCHashStr(2166136261U,key),&s,sizeof(int)) & (lc->tabSize-1);
+}
+
+/* FindLCKey: return entry with key and stream s or NULL */
+static LCEntry *FindLCKey(LikeCache *lc, char *key, int s)
+{
+   LCEntry *e;
+
+   for (e=lc->ktab[LCKeyIndex(lc,key,s)]; e!=NULL; e=e->knext)
+      if (e->s == s && strcmp(e->key,key) == 0)
+         return e;
+   return NULL;
+}
+
+/* AddLCEntry: add entry for stream s of sti with given key */
+static void AddLCEntry(MemHeap *x, LikeCache *lc, StreamInfo *sti, int s, char *key)
+{
+   LCEntry *e;
+   int i;
+
+   e = (LCEntry *) New(x,sizeof(LCEntry));
+   e->sti = sti; e->s = s;
+   e->key = CopyString(x,key);
+   e->hash = LCParmHash(sti);
+   e->like = NULL; e->size = 0; e->used = NULL;
+   i = LCHash(2166136261U,&sti,sizeof(StreamInfo *)) & (lc->tabSize-1);
+   e->pnext = lc->ptab[i]; lc->ptab[i] = e;
+   i = LCKeyIndex(lc,key,s);
+   e->knext = lc->ktab[i]; lc->ktab[i] = e;
+}
+
+/* GrowLCRow: make the row of e hold at least t frames */
+static void GrowLCRow(LikeCache *lc, LCEntry *e, int t)
+{
+   float *like;
+   int i,size;
+
+   size = (e->size > 0) ? 2*e->size : LCMINROW;
+   if (size < t) size = t;
+   like = (float *) New(&lc->rowHeap,size*sizeof(float)) - 1;
+   for (i=1; i<=e->size; i++) like[i] = e->like[i];
+   for (; i<=size; i++) like[i] = LIKEUNSET;
+   if (e->size == 0) {
+      e->used = lc->used; lc->used = e;
+   }
+   e->like = like; e->size = size;
+}
+
+/* GrowLCObs: make the observation hashes hold at least t frames */
+static void GrowLCObs(LikeCache *lc, int t)
+{
+   unsigned int *ohash;
+   int i,size;
+
+   size = (lc->osize > 0) ? 2*lc->osize : LCMINROW;
+   if (size < t) size = t;
+   ohash = (unsigned int *) New(&lc->rowHeap,size*sizeof(unsigned int)) - 1;
+   for (i=1; i<=lc->osize; i++) ohash[i] = lc->ohash[i];
+   for (; i<=size; i++) ohash[i] = 0;
+   lc->ohash = ohash; lc->osize = size;
+}
+
+/* FreeLCRows: free the rows of the current file */
+static void FreeLCRows(LikeCache *lc)
+{
+   LCEntry *e;
+
+   for (e=lc->used; e!=NULL; e=e->used) {
+      e->like = NULL; e->size = 0;
+   }
+   lc->used = NULL;
+   lc->ohash = NULL; lc->osize = 0;
+   ResetHeap(&lc->rowHeap);
+}
+
+/* ReadLCKey: read length prefixed key from src */
+static Boolean ReadLCKey(Source *src, char *key)
+{
+   int n,i,c;
+
+   if (!ReadInt(src,&n,1,TRUE) || n < 0 || n >= MAXSTRLEN)
+      return FALSE;
+   for (i=0; i<n; i++) {
+      if ((c = GetCh(src)) == EOF)
+         return FALSE;
+      key[i] = (char) c;
+   }
+   key[n] = '\0';
+   return TRUE;
+}
+
+/* ReadLikeCache: load the values in lc->fn which are still valid */
+static void ReadLikeCache(LikeCache *lc)
+{
+   Source src;
+   LCEntry *e;
+   char key[MAXSTRLEN];
+   float *skip = NULL;
+   int n,t,T,nRecs,rec[7];
+   Boolean ok;
+   FILE *f;
+
+   if ((f = fopen(lc->fn,"rb")) == NULL)      /* nothing cached yet */
+      return;
+   fclose(f);
+   if (InitSource(lc->fn,&src,NoFilter) < SUCCESS)
+      return;
+   if (!ReadInt(&src,rec,7,TRUE) || rec[0] != LIKECACHEMAGIC ||
+       rec[1] != LIKECACHEVERSION || rec[2] < 0 || rec[4] < 0 ||
+       (unsigned int) rec[3] != lc->tag || rec[5] != lc->fsize ||
+       rec[6] != lc->ftime || !ReadLCKey(&src,key) ||
+       strcmp(key,lc->datafn) != 0) {
+      CloseSource(&src);
+      lc->stale = TRUE;
+      if (trace&T_TOP)
+         printf("HModel: likelihood cache %s is out of date\n",lc->fn);
+      return;
+   }
+   T = rec[2]; nRecs = rec[4];
+   GrowLCObs(lc,T);
+   ok = ReadInt(&src,(int *) lc->ohash+1,T,TRUE);
+   for (n=0; ok && n<nRecs; n++) {
+      ok = ReadLCKey(&src,key) && ReadInt(&src,rec,2,TRUE);
+      if (!ok) break;
+      e = FindLCKey(lc,key,rec[0]);
+      if (e != NULL && e->hash == (unsigned int) rec[1] && e->size == 0) {
+         GrowLCRow(lc,e,T);
+         ok = ReadFloat(&src,e->like+1,T,TRUE);
+         for (t=1; t<=T; t++)
+            if (e->like[t] < LIKEUNSET) lc->nLoaded++;
+      }
+      else {
+         if (skip == NULL) skip = (float *) New(&lc->rowHeap,(T+1)*sizeof(float));
+         ok = ReadFloat(&src,skip,T,TRUE);
+         lc->stale = TRUE;
+      }
+   }
+   CloseSource(&src);
+   if (!ok) {
+      HError(-7050,"ReadLikeCache: likelihood cache %s is corrupt",lc->fn);
+      FreeLCRows(lc);
+      lc->nLoaded = 0; lc->stale = TRUE;
+      return;
+   }
+   lc->T = T;
+   if (trace&T_TOP)
+      printf("HModel: loaded %d likelihoods from %s\n",lc->nLoaded,lc->fn);
+}
+
+/* WriteLikeCache: write the rows of the current file to lc->fn */
+static void WriteLikeCache(LikeCache *lc)
+{
+   FILE *f;
+   LCEntry *e;
+   float unset = LIKEUNSET;
+   int i,n,rec[7];
+   Boolean isPipe;
+
+   for (n=0,e=lc->used; e!=NULL; e=e->used) n++;
+   if ((f = FOpen(lc->fn,NoOFilter,&isPipe)) == NULL) {
+      HError(-7011,"WriteLikeCache: Cannot create output file %s",lc->fn);
+      return;
+   }
+   rec[0] = LIKECACHEMAGIC; rec[1] = LIKECACHEVERSION;
+   rec[2] = lc->T; rec[3] = (int) lc->tag; rec[4] = n;
+   rec[5] = lc->fsize; rec[6] = lc->ftime;
+   WriteInt(f,rec,7,TRUE);
+   n = strlen(lc->datafn);
+   WriteInt(f,&n,1,TRUE);
+   fwrite(lc->datafn,1,n,f);
+   if (lc->T > 0)
+      WriteInt(f,(int *) lc->ohash+1,lc->T,TRUE);
+   for (e=lc->used; e!=NULL; e=e->used) {
+      n = strlen(e->key);
+      WriteInt(f,&n,1,TRUE);
+      fwrite(e->key,1,n,f);
+      rec[0] = e->s; rec[1] = (int) e->hash;
+      WriteInt(f,rec,2,TRUE);
+      n = (e->size < lc->T) ? e->size : lc->T;
+      WriteFloat(f,e->like+1,n,TRUE);
+      for (i=n+1; i<=lc->T; i++)
+         WriteFloat(f,&unset,1,TRUE);
+   }
+   FClose(f,isPipe);
+}
+
+/* EXPORT->CreateLikeCache: create likelihood cache for hset if enabled */
+LikeCache *CreateLikeCache(MemHeap *x, HMMSet *hset)
+{
+   LikeCache *lc;
+   MLink m,ms,mp;
+   HLink hmm;
+   StateInfo *si;
+   StreamInfo *sti;
+   char key[2*MAXSTRLEN];
+   int h,i,n,s,S;
+
+   if (likeCacheDir[0] == '\0')
+      return NULL;
+   if (hset->hsKind != PLAINHS && hset->hsKind != SHAREDHS) {
+      HError(-7070,"CreateLikeCache: likelihood cache needs PLAINHS or SHAREDHS models");
+      return NULL;
+   }
+   S = hset->swidth[0];
+   for (n=0,h=0; h<MACHASHSIZE; h++)
+      for (m=hset->mtab[h]; m!=NULL; m=m->next)
+         if (m->type == 'h')
+            n += (((HLink) m->structure)->numStates-2)*S;
+   lc = (LikeCache *) New(x,sizeof(LikeCache));
+   for (lc->tabSize=64; lc->tabSize<n; lc->tabSize*=2);
+   lc->ptab = (LCEntry **) New(x,lc->tabSize*sizeof(LCEntry *));
+   lc->ktab = (LCEntry **) New(x,lc->tabSize*sizeof(LCEntry *));
+   for (i=0; i<lc->tabSize; i++)
+      lc->ptab[i] = lc->ktab[i] = NULL;
+   CreateHeap(&lc->rowHeap,"LikeCache rows",MSTAK,1,1.0,20000,1000000);
+   lc->used = NULL; lc->fn[0] = lc->datafn[0] = '\0';
+   lc->ohash = NULL; lc->osize = 0;
+   lc->tag = 0; lc->fsize = lc->ftime = 0;
+   lc->T = lc->nObs = lc->nLoaded = 0; lc->stale = FALSE;
+
+   for (n=0,h=0; h<MACHASHSIZE; h++)
+      for (m=hset->mtab[h]; m!=NULL; m=m->next) {
+         if (m->type != 'h') continue;
+         hmm = (HLink) m->structure;
+         for (i=2; i<hmm->numStates; i++) {
+            si = hmm->svec[i].info;
+            ms = FindMacroStruct(hset,'s',si);
+            for (s=1; s<=S; s++) {
+               sti = si->pdf[s].info;
+               if (FindLCEntry(lc,sti) != NULL) continue;
+               if ((mp = FindMacroStruct(hset,'p',sti)) != NULL)
+                  sprintf(key,"p %s",mp->id->name);
+               else if (ms != NULL)
+                  sprintf(key,"s %s",ms->id->name);
+               else
+                  sprintf(key,"h %s %d",m->id->name,i);
+               AddLCEntry(x,lc,sti,s,key);
+               n++;
+            }
+         }
+      }
+   if (trace&T_TOP)
+      printf("HModel: caching likelihoods of %d streams in %s\n",n,likeCacheDir);
+   return lc;
+}
+
+/* EXPORT->OpenLikeCache: start caching the likelihoods of file fn */
+void OpenLikeCache(LikeCache *lc, char *fn, AdaptXForm *xform, AdaptXForm *paXForm)
+{
+   char base[MAXFNAMELEN],name[MAXFNAMELEN];
+   struct stat st;
+
+   if (strlen(fn) >= MAXFNAMELEN)
+      HError(7070,"OpenLikeCache: data file name %s too long",fn);
+   strcpy(lc->datafn,fn);
+   sprintf(name,"%s_%08x",BaseOf(fn,base),LCHashStr(2166136261U,fn));
+   MakeFN(name,likeCacheDir,"lkc",lc->fn);
+   lc->tag = LCXFormHash(2166136261U,xform);
+   lc->tag = LCXFormHash(LCHashStr(lc->tag,"parent"),paXForm);
+   if (stat(fn,&st) == 0) {
+      lc->fsize = (int) st.st_size; lc->ftime = (int) st.st_mtime;
+   }
+   else
+      lc->fsize = lc->ftime = 0;
+   lc->T = lc->nObs = lc->nLoaded = 0; lc->stale = FALSE;
+   ReadLikeCache(lc);
+}
+
+/* EXPORT->CheckLikeCacheObs: check observation x of frame t */
+void CheckLikeCacheObs(LikeCache *lc, int t, Observation *x)
+{
+   LCEntry *e;
+   unsigned int h = 2166136261U;
+   int s;
+
+   for (s=1; s<=x->swidth[0]; s++)
+      h = LCHash(h,x->fv[s]+1,VectorSize(x->fv[s])*sizeof(float));
+   if (t > lc->osize)
+      GrowLCObs(lc,t);
+   if (t <= lc->T && lc->ohash[t] != h) {
+      for (e=lc->used; e!=NULL; e=e->used)
+         if (t <= e->size && e->like[t] < LIKEUNSET) {
+            e->like[t] = LIKEUNSET; lc->nLoaded--;
+         }
+      lc->stale = TRUE;
+   }
+   lc->ohash[t] = h;
+   if (t > lc->nObs)
+      lc->nObs = t;
+}
+
+/* EXPORT->CachedLike: return cache entry of stream s of sti at frame t */
+float *CachedLike(LikeCache *lc, int s, StreamInfo *sti, int t)
+{
+   LCEntry *e;
+
+   if (t > lc->nObs || (e = FindLCEntry(lc,sti)) == NULL || e->s != s)
+      return NULL;
+   if (t > e->size)
+      GrowLCRow(lc,e,t);
+   return e->like+t;
+}
+
+/* EXPORT->CloseLikeCache: save new likelihoods of the current file */
+void CloseLikeCache(LikeCache *lc)
+{
+   LCEntry *e;
+   int t,n;
+
+   if (lc->nObs != lc->T) {           /* frame count has changed */
+      lc->T = lc->nObs; lc->stale = TRUE;
+   }
+   for (n=0,e=lc->used; e!=NULL; e=e->used)
+      for (t=1; t<=e->size && t<=lc->T; t++)
+         if (e->like[t] < LIKEUNSET) n++;
+   if (n != lc->nLoaded || lc->stale) {
+      WriteLikeCache(lc);
+      if (trace&T_TOP)
+         printf("HModel: saved %d likelihoods in %s\n",n,lc->fn);
+   }
+   FreeLCRows(lc);
+}
          
 /* EXPORT->DProb2Short: convert prob to scaled log form */
 short DProb2Short(float p)
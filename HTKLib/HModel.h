@@ -405,6 +405,10 @@ typedef struct _HMMSet{
    /* Added to support delayed loading of the semi-tied transform */
    char *semiTiedMacro;  /* macroname of semi-tied transform */
 
+   /* Loaded transforms, most recently used first (XFORMCACHESIZE) */
+   struct _XFCacheEntry *xfCache;
+   int numCachedXForms;
+
 } HMMSet;
 
 /* ---------------------- MSD Information ----------------------- */
@@ -728,6 +732,54 @@ float MixWeight(HMMSet *hset, float weight);
   Get the log-weight
 */
 
+/* ---------------- Cross-Utterance Likelihood Cache --------------- */
+
+#define LIKEUNSET 1.0E10   /* cache value not yet computed */
+
+typedef struct _LikeCache LikeCache;
+
+LikeCache *CreateLikeCache(MemHeap *x, HMMSet *hset);
+/*
+   If the configuration variable LIKECACHE names a directory, return
+   a cache for the unweighted stream log likelihoods of hset,
+   allocated in x.  Otherwise return NULL.  Each stream is identified
+   by the name of its ~p macro, or of the ~s macro or HMM holding it,
+   and by a hash of its parameters.  The parameters of hset must not
+   change while the cache is in use.
+*/
+
+void OpenLikeCache(LikeCache *lc, char *fn, AdaptXForm *xform, AdaptXForm *paXForm);
+/*
+   Start caching the likelihoods of data file fn, loading any values
+   stored by an earlier run over the same file.  Values of streams
+   whose parameters have changed since are discarded.  xform and
+   paXForm are the input and parent transforms in use (NULL if none);
+   all values stored with transforms of different contents, or for a
+   data file of a different size or modification time, are discarded.
+*/
+
+void CheckLikeCacheObs(LikeCache *lc, int t, Observation *x);
+/*
+   Set x as the observation at frame t of the current file.  Stored
+   values of frame t are discarded if they were computed from a
+   different observation.  Must be called for each frame before
+   CachedLike is used for it.
+*/
+
+float *CachedLike(LikeCache *lc, int s, StreamInfo *sti, int t);
+/*
+   Return the cache entry for stream s of sti at frame t of the
+   current file, or NULL if sti is not cached or frame t has not
+   been checked.  An entry not yet computed holds LIKEUNSET and the
+   caller should store the value.
+*/
+
+void CloseLikeCache(LikeCache *lc);
+/*
+   Save the likelihoods of the current file in the directory LIKECACHE
+   if any were added, and free them.
+*/
+
 /* ---------------------- XForm support code ---------------------- */
 
 /* EXPORT->LoadInputXForm: loads, or returns, the specified transform */
@@ -738,6 +790,12 @@ void SaveInputXForm(HMMSet *hset, InputXForm *xf, char *fname, Boolean binary);
 
 /* EXPORT->LoadOneXForm: loads, or returns, the specified transform */
 AdaptXForm *LoadOneXForm(HMMSet *hset, char* macroname, char* fname);
+/*
+   A loaded transform is kept as an 'a' macro so that it is only
+   parsed once.  If XFORMCACHESIZE is set, at most that many loaded
+   transforms are kept and the least recently used one that is no
+   longer referenced is freed when another is loaded.
+*/
 
 /* EXPORT->SaveOneXForm: outputs an individual transform */
 void SaveOneXForm(HMMSet *hset, AdaptXForm *xform, char *fname, Boolean binary);
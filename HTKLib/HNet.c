@@ -3709,4 +3709,351 @@ Network *ExpandWordNet(MemHeap *heap,Lattice *lat,Vocab *voc,HMMSet *hset)
    return(net);
 }   
 
+/* ------------------- Compiled Network Files ---------------------- */
+
+/* 
+   A compiled network file holds the result of ExpandWordNet so that
+   it can be reloaded without repeating the expansion.  All values are
+   written in HTK binary (big-endian) form.  The file consists of
+
+     magic, version
+     numPhy, numLog, logical model list checksum
+     numPhy x { name, numStates, tee }       physical model table
+     nullWord flag, teeWords, numNode, numLink
+     numNode-2 x { type, aux, model/word, tag, nlinks, links } 
+     initial node links
+
+   Nodes are numbered 0=initial, 1=final and then in chain order.  HMM
+   nodes refer to the physical model table and word nodes to a word
+   name plus pronunciation number.  The physical model table is in
+   name order so that the file and checksum do not depend on where
+   the models happen to be allocated.
+*/
+
+#define NETFILEMAGIC 0x4854534e   /* "HTSN" */
+#define NETFILEVERSION 2
+
+typedef struct {
+   HLink hmm;          /* physical model */
+   LabId id;           /* its macro name */
+   int idx;            /* its index in name order */
+} PhyModel;
+
+/* QSCmpPhyName: order physical model table by name */
+static int QSCmpPhyName(const void *v1,const void *v2)
+{
+   return(strcmp(((PhyModel*)v1)->id->name,((PhyModel*)v2)->id->name));
+}
+
+/* QSCmpPhyModel: order physical model table by address */
+static int QSCmpPhyModel(const void *v1,const void *v2)
+{
+   HLink h1 = ((PhyModel*)v1)->hmm, h2 = ((PhyModel*)v2)->hmm;
+
+   if (h1<h2) return(-1);
+   if (h1>h2) return(1);
+   return(0);
+}
+
+/* FindPhyModel: return position of hmm in address sorted table */
+static int FindPhyModel(PhyModel *tab,int n,HLink hmm)
+{
+   int l,r,m;
+
+   for (l=0,r=n-1; l<=r; ) {
+      m = (l+r)/2;
+      if (tab[m].hmm==hmm) return(m);
+      if (tab[m].hmm<hmm) l=m+1; else r=m-1;
+   }
+   return(-1);
+}
+
+/* NameHash: string hash for model list checksum */
+static unsigned int NameHash(char *s)
+{
+   unsigned int h;
+
+   for (h=0; *s!='\0'; s++) h = h*31 + (unsigned char)*s;
+   return(h);
+}
+
+/* MakePhyTable: collect physical models of hset and checksum of the
+   logical to physical mapping.  Each entry records its index in name
+   order, which is what the checksum and the network file use, but the
+   table itself is sorted by address for FindPhyModel. */
+static PhyModel *MakePhyTable(MemHeap *heap,HMMSet *hset,int *np,
+                              int *nl,int *sum)
+{
+   PhyModel *tab;
+   MLink q;
+   unsigned int chk;
+   int h,n,i;
+
+   tab = (PhyModel*) New(heap,(hset->numPhyHMM+1)*sizeof(PhyModel));
+   for (h=n=0; h<MACHASHSIZE; h++)
+      for (q=hset->mtab[h]; q!=NULL; q=q->next)
+         if (q->type=='h') {
+            if (n>=hset->numPhyHMM)
+               HError(8260,"MakePhyTable: Physical model count mismatch");
+            tab[n].hmm = (HLink) q->structure; tab[n++].id = q->id;
+         }
+   qsort(tab,n,sizeof(PhyModel),QSCmpPhyName);
+   for (i=0; i<n; i++) tab[i].idx = i;
+   qsort(tab,n,sizeof(PhyModel),QSCmpPhyModel);
+   for (h=0,chk=0,*nl=0; h<MACHASHSIZE; h++)
+      for (q=hset->mtab[h]; q!=NULL; q=q->next)
+         if (q->type=='l') {
+            i = FindPhyModel(tab,n,(HLink) q->structure);
+            chk += NameHash(q->id->name) * (unsigned int)(2*tab[i].idx+1) + 
+               NameHash(tab[i].id->name);
+            (*nl)++;
+         }
+   *np = n; *sum = (int) chk;
+   return(tab);
+}
+
+/* WriteNetString: write length prefixed (-1==NULL) string */
+static void WriteNetString(FILE *f,char *s)
+{
+   int n;
+
+   if (s==NULL) {
+      n = -1; WriteInt(f,&n,1,TRUE);
+   }
+   else {
+      n = strlen(s); WriteInt(f,&n,1,TRUE);
+      fwrite(s,1,n,f);
+   }
+}
+
+/* ReadNetString: read length prefixed string into heap */
+static char *ReadNetString(Source *src,MemHeap *heap,char *buf)
+{
+   int n,i,c;
+
+   if (!ReadInt(src,&n,1,TRUE) || n>=MAXSTRLEN)
+      HError(8261,"ReadNetString: Bad string in %s",src->name);
+   if (n<0) return(NULL);
+   for (i=0; i<n; i++) {
+      if ((c=GetCh(src))==EOF)
+         HError(8261,"ReadNetString: Unexpected EOF in %s",src->name);
+      buf[i] = (char) c;
+   }
+   buf[n] = '\0';
+   return(heap==NULL ? buf : CopyString(heap,buf));
+}
+
+/* EXPORT->WriteNetwork: write expanded network net to file fn */
+ReturnStatus WriteNetwork(Network *net,char *fn,HMMSet *hset)
+{
+   FILE *f;
+   Boolean isPipe;
+   NetNode *node,**nodes;
+   PhyModel *tab,**order;
+   MemHeap tmpHeap;
+   int *aux,np,nl,sum,i,j,k,n,ival;
+   float like;
+
+   if ((f=FOpen(fn,NoOFilter,&isPipe))==NULL) {
+      HRError(8262,"WriteNetwork: Cannot create network file %s",fn);
+      return(FAIL);
+   }
+   CreateHeap(&tmpHeap,"NetWrite Heap",MSTAK,1,0.0,10000,100000);
+   tab = MakePhyTable(&tmpHeap,hset,&np,&nl,&sum);
+
+   /* Number nodes in chain order using aux (restored afterwards) */
+   n = net->numNode;
+   nodes = (NetNode**) New(&tmpHeap,n*sizeof(NetNode*));
+   aux = (int*) New(&tmpHeap,n*sizeof(int));
+   nodes[0] = &net->initial; nodes[1] = &net->final;
+   for (node=net->chain,i=2; node!=NULL; node=node->chain,i++) {
+      if (i>=n) 
+         HError(8260,"WriteNetwork: Node count mismatch");
+      nodes[i] = node;
+   }
+   if (i!=n) 
+      HError(8260,"WriteNetwork: Node count mismatch");
+   for (i=0; i<n; i++) {
+      aux[i] = nodes[i]->aux; nodes[i]->aux = i;
+   }
+
+   ival = NETFILEMAGIC; WriteInt(f,&ival,1,TRUE);
+   ival = NETFILEVERSION; WriteInt(f,&ival,1,TRUE);
+   WriteInt(f,&np,1,TRUE); WriteInt(f,&nl,1,TRUE);
+   WriteInt(f,&sum,1,TRUE);
+   order = (PhyModel**) New(&tmpHeap,(np+1)*sizeof(PhyModel*));
+   for (i=0; i<np; i++) order[tab[i].idx] = tab+i;
+   for (i=0; i<np; i++) {
+      WriteNetString(f,order[i]->id->name);
+      ival = order[i]->hmm->numStates;
+      WriteInt(f,&ival,1,TRUE);
+      ival = order[i]->hmm->transP[1][order[i]->hmm->numStates]>LSMALL;
+      WriteInt(f,&ival,1,TRUE);
+   }
+   ival = (net->nullWord!=NULL); WriteInt(f,&ival,1,TRUE);
+   ival = net->teeWords; WriteInt(f,&ival,1,TRUE);
+   WriteInt(f,&net->numNode,1,TRUE);
+   WriteInt(f,&net->numLink,1,TRUE);
+   for (i=2; i<n; i++) {
+      node = nodes[i];
+      WriteInt(f,&node->type,1,TRUE);
+      WriteInt(f,&aux[i],1,TRUE);
+      if (node->type & n_hmm) {
+         if ((k=FindPhyModel(tab,np,node->info.hmm))<0)
+            HError(8260,"WriteNetwork: Node %d model not in HMM set",i);
+         WriteInt(f,&tab[k].idx,1,TRUE);
+      }
+      else if (node->info.pron==NULL)
+         WriteNetString(f,NULL);
+      else {
+         WriteNetString(f,node->info.pron->word->wordName->name);
+         ival = node->info.pron->pnum;
+         WriteInt(f,&ival,1,TRUE);
+      }
+      WriteNetString(f,node->tag);
+   }
+   for (i=0; i<n; i++) {
+      if (i==1) continue;
+      node = nodes[i];
+      WriteInt(f,&node->nlinks,1,TRUE);
+      for (j=0; j<node->nlinks; j++) {
+         WriteInt(f,&node->links[j].node->aux,1,TRUE);
+         like = node->links[j].like;
+         WriteFloat(f,&like,1,TRUE);
+      }
+   }
+   for (i=0; i<n; i++)
+      nodes[i]->aux = aux[i];
+   DeleteHeap(&tmpHeap);
+   FClose(f,isPipe);
+   return(SUCCESS);
+}
+
+/* EXPORT->ReadNetwork: load network written by WriteNetwork */
+Network *ReadNetwork(MemHeap *heap,char *fn,Vocab *voc,HMMSet *hset)
+{
+   Source src;
+   Network *net;
+   NetNode *node,*nodes;
+   HLink *map;
+   MemHeap tmpHeap;
+   MLink ml = NULL;
+   LabId id;
+   Word word = NULL;
+   Pron pron;
+   char buf[MAXSTRLEN],*name;
+   int np,nl,sum,fnp,fnl,fsum,i,j,k,n,ival,ns,tee;
+   float like;
+
+   if (InitSource(fn,&src,NoFilter)<SUCCESS)
+      HError(8262,"ReadNetwork: Cannot open network file %s",fn);
+   if (!ReadInt(&src,&ival,1,TRUE) || ival!=NETFILEMAGIC)
+      HError(8261,"ReadNetwork: %s is not a compiled network file",fn);
+   if (!ReadInt(&src,&ival,1,TRUE) || ival!=NETFILEVERSION)
+      HError(8261,"ReadNetwork: Unsupported network file version %d",ival);
+
+   /* Check the model list matches the one the network was built with */
+   CreateHeap(&tmpHeap,"NetRead Heap",MSTAK,1,0.0,10000,100000);
+   MakePhyTable(&tmpHeap,hset,&np,&nl,&sum);
+   if (!ReadInt(&src,&fnp,1,TRUE) || !ReadInt(&src,&fnl,1,TRUE) ||
+       !ReadInt(&src,&fsum,1,TRUE))
+      HError(8261,"ReadNetwork: Bad header in %s",fn);
+   if (fnp!=np || fnl!=nl || fsum!=sum)
+      HError(8260,"ReadNetwork: %s built with different HMM list "
+             "(%d/%d models)",fn,fnl,fnp);
+   map = (HLink*) New(&tmpHeap,np*sizeof(HLink));
+   for (i=0; i<np; i++) {
+      name = ReadNetString(&src,NULL,buf);
+      if (!ReadInt(&src,&ns,1,TRUE) || !ReadInt(&src,&tee,1,TRUE) ||
+          name==NULL)
+         HError(8261,"ReadNetwork: Bad model table in %s",fn);
+      if ((id=GetLabId(name,FALSE))==NULL ||
+          (ml=FindMacroName(hset,'h',id))==NULL)
+         HError(8260,"ReadNetwork: Model %s not in HMM set",name);
+      map[i] = (HLink) ml->structure;
+      if (map[i]->numStates!=ns ||
+          (map[i]->transP[1][ns]>LSMALL)!=(tee!=0))
+         HError(8260,"ReadNetwork: Model %s topology changed",name);
+   }
+
+   net=(Network*) New(heap,sizeof(Network));
+   net->heap=heap;
+   net->vocab=voc;
+   net->chain=NULL;
+   if (!ReadInt(&src,&ival,1,TRUE))
+      HError(8261,"ReadNetwork: Bad header in %s",fn);
+   if (ival) {
+      net->nullWord = GetWord(voc,GetLabId("!NULL", TRUE),TRUE);
+      if (net->nullWord->pron==NULL)
+         NewPron(voc,net->nullWord,0,NULL,net->nullWord->wordName,1.0);
+   }
+   else
+      net->nullWord = NULL;
+   if (!ReadInt(&src,&ival,1,TRUE) || !ReadInt(&src,&net->numNode,1,TRUE) ||
+       !ReadInt(&src,&net->numLink,1,TRUE) || net->numNode<2)
+      HError(8261,"ReadNetwork: Bad header in %s",fn);
+   net->teeWords = (Boolean) ival;
+
+   n = net->numNode;
+   nodes = (n>2) ? (NetNode*) New(heap,(n-2)*sizeof(NetNode)) : NULL;
+   net->initial.type = net->final.type = n_word;
+   net->initial.info.pron = net->final.info.pron = NULL;
+   net->initial.tag = net->final.tag = NULL;
+   net->initial.nlinks = net->final.nlinks = 0;
+   net->initial.links = net->final.links = NULL;
+   net->initial.inst = net->final.inst = NULL;
+   net->initial.chain = net->final.chain = NULL;
+   net->initial.aux = net->final.aux = 0;
+   for (i=0; i<n-2; i++) {
+      node = nodes+i;
+      if (!ReadInt(&src,&node->type,1,TRUE) || !ReadInt(&src,&node->aux,1,TRUE))
+         HError(8261,"ReadNetwork: Bad node in %s",fn);
+      node->inst = NULL; node->links = NULL; node->nlinks = 0;
+      node->chain = (i<n-3) ? nodes+i+1 : NULL;
+      if (node->type & n_hmm) {
+         if (!ReadInt(&src,&k,1,TRUE) || k<0 || k>=np)
+            HError(8261,"ReadNetwork: Bad model index in %s",fn);
+         node->info.hmm = map[k];
+      }
+      else if ((name=ReadNetString(&src,NULL,buf))==NULL)
+         node->info.pron = NULL;
+      else {
+         if (!ReadInt(&src,&k,1,TRUE))
+            HError(8261,"ReadNetwork: Bad word node in %s",fn);
+         if ((id=GetLabId(name,FALSE))==NULL || 
+             (word=GetWord(voc,id,FALSE))==NULL)
+            HError(8220,"ReadNetwork: Word %s not in dictionary",name);
+         for (pron=word->pron; pron!=NULL; pron=pron->next)
+            if (pron->pnum==k) break;
+         if (pron==NULL)
+            HError(8220,"ReadNetwork: Pronunciation %d of %s not in dictionary",
+                   k,name);
+         node->info.pron = pron;
+      }
+      node->tag = ReadNetString(&src,heap,buf);
+   }
+   net->chain = (n>2) ? nodes : NULL;
+   for (i=0; i<n; i++) {
+      if (i==1) continue;
+      node = (i==0) ? &net->initial : nodes+i-2;
+      if (!ReadInt(&src,&node->nlinks,1,TRUE) || node->nlinks<0)
+         HError(8261,"ReadNetwork: Bad link count in %s",fn);
+      if (node->nlinks>0)
+         node->links = (NetLink*) New(heap,node->nlinks*sizeof(NetLink));
+      for (j=0; j<node->nlinks; j++) {
+         if (!ReadInt(&src,&k,1,TRUE) || !ReadFloat(&src,&like,1,TRUE) ||
+             k<0 || k>=n)
+            HError(8261,"ReadNetwork: Bad link in %s",fn);
+         node->links[j].node = (k==0) ? &net->initial : 
+            (k==1) ? &net->final : nodes+k-2;
+         node->links[j].like = like;
+      }
+   }
+   CloseSource(&src);
+   DeleteHeap(&tmpHeap);
+   if (trace&T_ALL)
+      PrintChain(net,hset);
+   return(net);
+}
+
 /* ------------------------ End of HNet.c -------------------------- */
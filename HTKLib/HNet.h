@@ -548,6 +548,21 @@ Network *ExpandWordNet(MemHeap *heap,Lattice *lat,Vocab *voc,HMMSet *hset);
      and last phone of context dependent models ].
 */
 
+ReturnStatus WriteNetwork(Network *net,char *fn,HMMSet *hset);
+/*
+   Write the expanded network net to the binary file fn.  Models are
+   stored as indices into a table of the physical model names of hset
+   and words as word name plus pronunciation number.
+*/
+
+Network *ReadNetwork(MemHeap *heap,char *fn,Vocab *voc,HMMSet *hset);
+/*
+   Read a network written by WriteNetwork into heap, resolving models
+   in hset and pronunciations in voc.  It is an error if the logical and
+   physical model lists of hset differ from those used to write the
+   file or if any word or pronunciation is not in voc.
+*/
+
 /* --- Context handling stuff useful for general network building --- */
 
 HMMSetCxtInfo *GetHMMSetCxtInfo(HMMSet *hset, Boolean frcCxtInd);
@@ -93,6 +93,9 @@ char *hparm_vc_id = "$Id: HParm.c,v 1.16 2012/12/22 07:01:28 uratec Exp $";
 #include "esignal.h"
 #ifdef UNIX
 #include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #endif
 
 /* ----------------------------- Trace Flags ------------------------- */
@@ -106,10 +109,12 @@ static int trace = 0;
 #define T_OBS  0040     /* Observation extraction */
 #define T_DET  0100     /* Silence detector operation */
 #define T_MAT  0200     /* Matrix operations */
+#define T_TIM  0400     /* Qualifier timing */
 
 /* --------------------- Global Variables ------------------- */
 
 static Boolean natWriteOrder = FALSE; /* Preserve natural write byte order*/
+static Boolean mmapRead = FALSE;      /* Map native order HTK parm files */
 extern Boolean vaxOrder;              /* true if byteswapping needed to 
                                                preserve SUNSO */
 /* varScale stuff: acts as a cache to stop the scaling file being re-read 
@@ -126,6 +131,9 @@ static ParmKind ForcePKind = ANON; /* force to output a customized parm kind to
 
 static HMMSet *hset = NULL;        /* hmmset to be used for frontend */
 
+static double quaTime = 0.0;       /* cpu time spent adding qualifiers */
+static long quaRows = 0;           /* and the number of rows qualified */
+
 /* ------------------------------------------------------------------- */
 /* 
    Parameter layout in tables/buffers is
@@ -548,6 +556,7 @@ typedef struct _ParmBuf {
    Boolean chClear;    /* End of channel reached */
    Boolean dShort;     /* data is array of shorts not floats (DISCRETE) */
    Boolean fShort;     /* file is array of shorts (DISCRETE, COMPX or IREFC) */
+   Boolean inArc;      /* file is an entry in a shared archive */
 
    /* New parameters for channel type buffer */
    HParmSrcDef ext;     /* external source functions */
@@ -558,6 +567,10 @@ typedef struct _ParmBuf {
    }
    in;
    unsigned short crcc;/* Put crcc here when we read it !! */
+   void *mapBase;      /* Start of memory mapped parm file (or NULL) */
+   size_t mapLen;      /* Length of mapping */
+   float *map;         /* First frame of mapped data */
+   Boolean mapDirect;  /* main.data points straight into the mapping */
 
    /*  Channel buffer consists of a main active (for inwards reading, sil */
    /*  detection and qualification) block plus preceding blocks that form */
@@ -961,6 +974,7 @@ ReturnStatus InitParm(void)
    if (nParm>0){
       if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
       if (GetConfBool(cParm,nParm,"NATURALWRITEORDER",&b)) natWriteOrder = b;
+      if (GetConfBool(cParm,nParm,"MMAPREAD",&b)) mmapRead = b;
       if (GetConfBool(cParm,nParm,"HIGHDIFF",&b)) highDiff = b;
       if (GetConfBool(cParm,nParm,"USEOLDXFORMCVN",&b)) UseOldXFormCVN = b;
       if (GetConfStr(cParm,nParm,"FORCEPKIND",buf))
@@ -1665,6 +1679,24 @@ static void DeleteColumn(float *data, int nUsed, int si, int d)
 }
 
 
+/* ScaleRows: scale the first d cols of each of nRows rows by 
+   sqrt(tgtVar/curVar) for variance normalisation */
+static void ScaleRows(float *data, int nRows, int nCols, int d, 
+                      Vector tgtVar, Vector curVar)
+{
+   float *fp,*scale;
+   int i,j;
+
+   if (d<=0) return;
+   scale = (float *)New(&gstack,d*sizeof(float));
+   for (i=0; i<d; i++)
+      scale[i] = sqrt(tgtVar[i+1] / curVar[i+1]);
+   for (j=0,fp=data; j<nRows; j++,fp+=nCols)
+      for (i=0; i<d; i++)
+         fp[i] *= scale[i];
+   Dispose(&gstack,scale);
+}
+
 /* AddQualifiers: add quals needed to get from cf->curPK to cf->tgtPK. */
 /*  Ensures that nRows of data are valid and fully qualified. */
 /*  This means that delta coefs may be calculated beyond this range */
@@ -1676,7 +1708,7 @@ static void AddQualifiers(ParmBuf pbuf,float *data, int nRows, IOConfig cf,
    char buf[MAXSTRLEN],buff1[MAXSTRLEN],buff2[MAXSTRLEN];
    int si,ti,d=0,ds,de, i, j, step, size;
    short span[12];
-   float *fp, mean, scale;
+   float *fp, *mv;
    ParmKind tgtBase;
    Vector tmp;
    LinXForm *xf;
@@ -1781,17 +1813,13 @@ static void AddQualifiers(ParmBuf pbuf,float *data, int nRows, IOConfig cf,
       }
       /* if a global cepstral mean file is available */
       else {
-         /* subtract the mean vector from cf */
+         /* subtract the mean vector from each row of cf */
          d = VectorSize(cf->cMeanVector);
          step = cf->nCols;
-         for ( i=0; i<d ; i++){
-            /* subtract mean from i'th components */
-            fp = data+i;
-            mean = cf->cMeanVector[i+1];
-            for (j=0;j<nRows;j++){
-               *fp -= mean; fp += step;
-            }
-         }
+         mv = cf->cMeanVector+1;
+         for (j=0,fp=data; j<nRows; j++,fp+=step)
+            for (i=0; i<d; i++)
+               fp[i] -= mv[i];
          cf->curPK |= HASZEROM;
       }
    }
@@ -1830,15 +1858,7 @@ static void AddQualifiers(ParmBuf pbuf,float *data, int nRows, IOConfig cf,
             else {
                d = VectorSize(cf->varScaleVector);
             }
-            step = cf->nCols;
-            for (i=0; i<d ; i++){
-               scale = sqrt(cf->varScale[i+1] / cf->varScaleVector[i+1]);
-               fp = data+i;
-               for (j=0; j<nRows; j++) {
-                  *fp *= scale;
-                  fp += step;
-               }
-            }
+            ScaleRows(data,nRows,cf->nCols,d,cf->varScale,cf->varScaleVector);
          }
       }
    }
@@ -1856,15 +1876,7 @@ static void AddQualifiers(ParmBuf pbuf,float *data, int nRows, IOConfig cf,
          if (trace&T_QUA)
             printf("\nHParm:  variance normalisation for %d cols from %d rows",
                    cf->tgtUsed, nRows);
-         step = cf->nCols;
-         for (i=0; i<d ; i++){
-            scale = sqrt(cf->varScale[i+1] / cf->varScaleVector[i+1]);
-            fp = data+i;
-            for (j=0; j<nRows; j++) {
-               *fp *= scale;
-               fp += step;
-            }
-         }
+         ScaleRows(data,nRows,cf->nCols,d,cf->varScale,cf->varScaleVector);
       }
 
       /* Now apply any side specific xforms */
@@ -3537,6 +3549,19 @@ static int GetParm(ParmBuf pbuf,int nFrame,void *data)
    /* Don't try to read past known end of file */
    if (pbuf->lastRow>=0 && pbuf->inRow>=pbuf->lastRow) return(0);
 
+   if (pbuf->mapDirect) {
+      /* Table is the mapped file itself so there is nothing to convert */
+      r = pbuf->lastRow - pbuf->inRow;
+      if (r>nFrame) r=nFrame;
+      fp = pbuf->map + pbuf->inRow*cf->srcUsed;
+      if (fp != (float *) data)
+         memmove(data,fp,r*cf->srcUsed*sizeof(float));
+      cf->nUsed = cf->nCvrt = cf->srcUsed;
+      cf->curPK = cf->unqPK = cf->srcPK&(~(HASCRCC|HASCOMPX));
+      if (pbuf->inRow+r>=pbuf->lastRow) pbuf->chClear=TRUE;
+      return(r);
+   }
+
    r=n=0;
    size=(cf->srcUsed>cf->tgtUsed)?cf->srcUsed:cf->tgtUsed;
    v=CreateVector(&gstack,size);
@@ -3559,6 +3584,14 @@ static int GetParm(ParmBuf pbuf,int nFrame,void *data)
                r++;
             }
          }
+         else if (pbuf->map != NULL) {
+            /* Mapped file so take a copy of the frame for conversion */
+            if (pbuf->inRow+n <= pbuf->lastRow) {
+               memcpy(v+1,pbuf->map+(pbuf->inRow+n-1)*cf->srcUsed,
+                      cf->srcUsed*sizeof(float));
+               r++;
+            }
+         }
          else {
             /* Otherwise just a vector of floats */
             if (GetCRCCFrame(pbuf,v+1,cf->srcUsed,sizeof(float),cf->bSwap)) r++;
@@ -3621,6 +3654,48 @@ static int FramesInParm(ParmBuf pbuf)
    return(n);
 }
 
+/* MapParmFile: map an uncompressed native order HTK parm file into
+   memory so that frames can be taken without going through stdio */
+static void MapParmFile(ParmBuf pbuf, char *fname)
+{
+#ifdef UNIX
+   IOConfig cf = pbuf->cf;
+   struct stat st;
+   long off;
+   size_t len;
+   void *base;
+
+   if (cf->srcFF!=HTK || cf->src.isPipe || cf->bSwap || pbuf->fShort ||
+       pbuf->crcc!=CRCC_NONE || pbuf->lastRow<=0)
+      return;
+   off = ftell(cf->src.f);
+   if (off<0 || off%sizeof(float)!=0 || fstat(fileno(cf->src.f),&st)!=0)
+      return;
+   len = off + (size_t)pbuf->lastRow*cf->srcUsed*sizeof(float);
+   if ((size_t)st.st_size < len) return;
+   /* Private writable mapping so in place qualification is copy on write */
+   base = mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_PRIVATE,fileno(cf->src.f),0);
+   if (base == MAP_FAILED) {
+      HError(-6313,"MapParmFile: cannot map %s, reading normally",fname);
+      return;
+   }
+   pbuf->mapBase = base; pbuf->mapLen = len;
+   pbuf->map = (float *)((char *)base + off);
+   if (trace&T_BUF)
+      printf("HParm: Mapped %d frames from %s\n",pbuf->lastRow,fname);
+#endif
+}
+
+/* UnmapParmFile: release any mapping made by MapParmFile */
+static void UnmapParmFile(ParmBuf pbuf)
+{
+#ifdef UNIX
+   if (pbuf->mapBase != NULL)
+      munmap(pbuf->mapBase,pbuf->mapLen);
+#endif
+   pbuf->mapBase = NULL; pbuf->map = NULL; pbuf->mapDirect = FALSE;
+}
+
 /* Open HTK/ESIG parameter read - returns initRows to read */
 /*  with -1 indicating this is actually a waveform file */
 static ReturnStatus OpenParmChannel(ParmBuf pbuf,char *fname, int *ret_val)
@@ -3642,7 +3717,14 @@ static ReturnStatus OpenParmChannel(ParmBuf pbuf,char *fname, int *ret_val)
    strncpy (actfname, fname, MAXFNAMELEN);
    isEXF = GetFileNameExt (fname, actfname, &stIndex, &enIndex);
    
-   if ((f = FOpen (actfname, ParmFilter, &isPipe)) == NULL) {
+   if (IsArchiveName(actfname)) {
+      if ((f = OpenArchiveEntry(actfname)) == NULL) {
+         HRError(6310,"OpenParmChannel: cannot open Parm File %s",fname);
+         return(FAIL);
+      }
+      isPipe = FALSE; pbuf->inArc = TRUE;
+   }
+   else if ((f = FOpen (actfname, ParmFilter, &isPipe)) == NULL) {
       HRError(6310,"OpenParmChannel: cannot open Parm File %s",fname);
       return(FAIL);
    }
@@ -3682,6 +3764,12 @@ static ReturnStatus OpenParmChannel(ParmBuf pbuf,char *fname, int *ret_val)
                  ParmKind2Str(cf->srcPK,b1));
          return(FAIL);
       }
+      if (pbuf->inArc) {
+         CloseArchiveEntry(f);
+         HRError(6313,"OpenParmChannel: cannot read waveform %s from archive",
+                 fname);
+         return(FAIL);
+      }
       cf->srcPK = WAVEFORM; FClose(f,isPipe);
       *ret_val=-1;
       return(SUCCESS);
@@ -3818,6 +3906,8 @@ static ReturnStatus OpenParmChannel(ParmBuf pbuf,char *fname, int *ret_val)
    else
       pbuf->crcc=CRCC_AT_CLOSE;
 
+   if (mmapRead) MapParmFile(pbuf,fname);
+
    *ret_val=initRows;
    return(SUCCESS);
 }
@@ -3998,6 +4088,7 @@ static void FillBufFromChannel(ParmBuf pbuf,int minRows)
    int availRows,newRows,space,i,head,tail,nShift;
    short *sp1=NULL, *sp2;
    float *fp1=NULL, *fp2;
+   clock_t t0 = 0;
    
    if ((trace&T_BUF) && minRows>0) {
       printf("HParm: Filling Parm Buf: max=%d, in=%d, out=%d, qst=%d, min=%d\n",
@@ -4173,7 +4264,12 @@ static void FillBufFromChannel(ParmBuf pbuf,int minRows)
       /* Reset current nUsed/PK to indicate results of conversion */
       cf->nUsed = cf->nCvrt; cf->curPK = cf->unqPK;
 
+      if (trace&T_TIM) t0 = clock();
       AddQualifiers(pbuf,fp1,pbuf->qen-pbuf->qst+1,cf,head,tail);
+      if (trace&T_TIM) {
+         quaTime += (double)(clock()-t0)/CLOCKS_PER_SEC;
+         quaRows += pbuf->qen-pbuf->qst+1;
+      }
       /* Assume session adaptation now done */
       pbuf->chan->oCnt+=pbuf->qen-pbuf->qst+1;
       /* Set qst for the next time */
@@ -4375,7 +4471,15 @@ static ReturnStatus OpenAsChannel(ParmBuf pbuf, int maxObs,
       pbuf->dShort=FALSE;
       dBytes = cf->nCols * pbuf->main.maxRows * sizeof(float);
    }
-   pbuf->main.data = New(pbuf->mem,dBytes);
+   /* A mapped file which needs no conversion can be used as the table */
+   if (pbuf->map != NULL && !pbuf->dShort && cf->nCols == cf->srcUsed &&
+       pbuf->main.maxRows == pbuf->lastRow && cf->MatTranFN == NULL &&
+       cf->tgtPK == (cf->srcPK&(~(HASCRCC|HASCOMPX)))) {
+      pbuf->mapDirect = TRUE;
+      pbuf->main.data = pbuf->map;
+   }
+   else
+      pbuf->main.data = New(pbuf->mem,dBytes);
 
    if (cf->useSilDet) 
       pbuf->spVal = (float *) New(pbuf->mem,sizeof(float)*pbuf->main.maxRows);
@@ -4431,6 +4535,8 @@ ParmBuf OpenBuffer(MemHeap *x, char *fn, int maxObs, FileFormat ff,
    pbuf = (ParmBuf)New(x,sizeof(ParmBufRec));
    pbuf->mem = x; pbuf->status = PB_INIT;
    pbuf->chan = curChan; pbuf->ext=NULL; pbuf->chClear=FALSE;
+   pbuf->mapBase = NULL; pbuf->map = NULL; pbuf->mapDirect = FALSE;
+   pbuf->inArc = FALSE;
    pbuf->cf = MakeIOConfig(pbuf->mem, pbuf->chan);
    if (enSpeechDet!=TRI_UNDEF) pbuf->cf->useSilDet=(Boolean)enSpeechDet;
    if (pbuf->cf->addDither>0.0) RandInit(12345);
@@ -4452,6 +4558,7 @@ ParmBuf OpenBuffer(MemHeap *x, char *fn, int maxObs, FileFormat ff,
    }
 
    if(OpenAsChannel(pbuf,maxObs,fn,ff,silMeasure)<SUCCESS){
+      UnmapParmFile(pbuf);
       Dispose(x, pbuf);
       HRError(6316,"OpenBuffer: OpenAsChannel failed");   
       return(NULL);
@@ -4474,11 +4581,14 @@ ParmBuf OpenExtBuffer(MemHeap *x, char *fn, int maxObs,
    pbuf = (ParmBuf)New(x,sizeof(ParmBufRec));
    pbuf->mem = x; pbuf->status = PB_INIT;
    pbuf->chan = curChan; pbuf->ext=ext; pbuf->chClear=FALSE;
+   pbuf->mapBase = NULL; pbuf->map = NULL; pbuf->mapDirect = FALSE;
+   pbuf->inArc = FALSE;
    pbuf->cf = MakeIOConfig(pbuf->mem, pbuf->chan);
    if (enSpeechDet!=TRI_UNDEF) pbuf->cf->useSilDet=(Boolean)enSpeechDet;
    if (pbuf->cf->addDither>0.0) RandInit(12345);
 
    if(OpenAsChannel(pbuf,maxObs,fn,ff,silMeasure)<SUCCESS){
+      UnmapParmFile(pbuf);
       Dispose(x, pbuf);
       HRError(6316,"OpenBuffer: OpenAsChannel failed");   
       return(NULL);
@@ -4579,7 +4689,11 @@ void CloseBuffer(ParmBuf pbuf)
          if (crcc!=pbuf->cf->crcc)
             HError(6350,"CloseBuffer: Crc error");
       }
-      FClose(pbuf->cf->src.f,pbuf->cf->src.isPipe);
+      UnmapParmFile(pbuf);
+      if (pbuf->inArc)
+         CloseArchiveEntry(pbuf->cf->src.f);
+      else
+         FClose(pbuf->cf->src.f,pbuf->cf->src.isPipe);
       break;
    case ch_hrfe:
       break;
@@ -4588,6 +4702,12 @@ void CloseBuffer(ParmBuf pbuf)
       pbuf->ext->fClose(pbuf->ext->xInfo,pbuf->in.i);
       break;
    }
+   if (trace&T_TIM && quaRows>0) {
+      printf("HParm: qualified %ld rows in %.3f secs (%.0f rows/sec)\n",
+             quaRows,quaTime,quaTime>0.0?quaRows/quaTime:0.0);
+      fflush(stdout);
+   }
+   quaTime = 0.0; quaRows = 0;
    Dispose(pbuf->mem,pbuf);
 }
 
@@ -5032,7 +5152,7 @@ ReturnStatus SaveBuffer(ParmBuf pbuf, char *fname, FileFormat ff)
    PBlock *pb,*pbInit,*pbFin;
    FILE *f;
    IOConfig cf = pbuf->cf;
-   Boolean bSwap,isPipe;
+   Boolean bSwap,isPipe,inArc;
    short sampSize,kind,*sp;
    long nSamples,sampPeriod;
    char buf[50];
@@ -5075,7 +5195,16 @@ ReturnStatus SaveBuffer(ParmBuf pbuf, char *fname, FileFormat ff)
    else
       sampSize = cf->nCols * sizeof(float);
 
-   if ( (f = FOpen(fname,ParmOFilter,&isPipe)) == NULL){ /* Binary file */
+   inArc = IsArchiveName(fname);
+   if (inArc) {
+      /* Entries are appended to a shared archive which stays open */
+      if ((f = CreateArchiveEntry(fname)) == NULL){
+         HRError(6311,"SaveBuffer: cannot create file %s",fname);
+         return(FAIL);
+      }
+      isPipe = FALSE;
+   }
+   else if ( (f = FOpen(fname,ParmOFilter,&isPipe)) == NULL){ /* Binary file */
       HRError(6311,"SaveBuffer: cannot create file %s",fname);
       return(FAIL);
    }
@@ -5091,7 +5220,7 @@ ReturnStatus SaveBuffer(ParmBuf pbuf, char *fname, FileFormat ff)
    default:
       HRError(6270,"SaveBuffer: Cannot save data as %s.",
               Format2Str(cf->tgtFF));
-      FClose(f,isPipe);
+      if (!inArc) FClose(f,isPipe);
       return(FAIL);
       break;
    }
@@ -5147,7 +5276,7 @@ ReturnStatus SaveBuffer(ParmBuf pbuf, char *fname, FileFormat ff)
       if (cf->saveCompressed) printf(" compressed");
       if (cf->saveWithCRC) printf(" with CRC"); printf("\n");
    }
-   FClose(f,isPipe);
+   if (!inArc) FClose(f,isPipe);
 
    if (pbFin) {
       pbFin->next=NULL;
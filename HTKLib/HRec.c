@@ -92,6 +92,7 @@ char *hrec_vc_id = "$Id: HRec.c,v 1.12 2012/12/22 07:01:28 uratec Exp $";
 static int trace=0;
 static Boolean forceOutput=FALSE;
 static Boolean pde=FALSE; /* partial distance elimination */
+static Boolean flatEngine=FALSE; /* flat instance arrays and path arenas */
 
 const Token null_token={LZERO,0.0,NULL,NULL};
 
@@ -186,6 +187,8 @@ struct _NetInst
    Boolean pxd;         /* External propagation done this frame */
    Boolean ooo;         /* Instance potentially out of order */
 
+   int apos;            /* Position in active array (flat engine) */
+
 #ifdef SANITY
    int ipos;
 #endif
@@ -229,6 +232,8 @@ struct precinfo {
    /* Input parameters - Set once and unseen */
 
    Observation *obs;         /* Current Observation */
+   AdaptXForm *inXForm;     /* Input transform for current observation */
+   LikeCache *lcache;       /* Likelihood cache for current observation */
 
    PSetInfo *psi;           /* HMMSet information */
    Network *net;            /* Recognition network */
@@ -285,6 +290,24 @@ struct precinfo {
    NetInst head;            /* Head (oldest) of Inst linked list */
    NetInst tail;            /* Tail (newest) of Inst linked list */
    NetInst *nxtInst;        /* Inst used to select next in step sequence */
+
+   /* Flat engine: instances are stored in an array with one slot per */
+   /*  network node and the active ones are kept in an array in       */
+   /*  propagation order.  Path, NxtPath and Align records are        */
+   /*  allocated in an arena and the live ones are copied to a second */
+   /*  arena when the first one has grown enough.                     */
+   Boolean flat;            /* Use flat engine */
+   MemHeap flatHeap;        /* Instance and token set arrays for net */
+   MemHeap arena[2];        /* Path/NxtPath/Align arenas */
+   int curArena;            /* Arena used for new records */
+   int fnn;                 /* Number of nodes (and instances) */
+   NetInst *fInst;          /* Array[0..fnn-1] of instances */
+   NetInst **fHash;         /* Hash table of instances by node */
+   int fMask;               /* Size of fHash - 1 */
+   NetInst **fAct;          /* Array[0..nfAct-1] of active insts (or NULL) */
+   int nfAct;               /* Number of entries used in fAct */
+   int fActSize;            /* Size of fAct */
+
 #ifdef SANITY
    NetInst *start_inst;     /* Inst that started a move */
    int ipos;                /* Current inst position */
@@ -298,9 +321,8 @@ struct precinfo {
 
 };
 
-/* Global variable (so we want to get rid of them) */
-static PRecInfo *pri;
-static AdaptXForm *inXForm;
+/* HMM set used by TracePath to name the models on a path */
+static HMMSet *traceSet = NULL;
 
 /* Module Initialisation */
 static ConfParam *cParm[MAXGLOBS];      /* config parameters */
@@ -319,6 +341,7 @@ void InitRec(void)
       if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
       if (GetConfBool(cParm,nParm,"FORCEOUT",&b)) forceOutput = b;
       if (GetConfBool(cParm,nParm,"PDE",&b)) pde = b;
+      if (GetConfBool(cParm,nParm,"FLATENGINE",&b)) flatEngine = b;
    }
 }
 
@@ -331,7 +354,7 @@ void ResetRec(void)
 /* Basic token merging step used during propagation.      */ 
 /* Token in cmp plus extra info from src merged into res. */
 /*  tokens less likely that info.nThresh ignored.         */
-static void TokSetMerge(TokenSet *res,Token *cmp,TokenSet *src)
+static void TokSetMerge(PRecInfo *pri,TokenSet *res,Token *cmp,TokenSet *src)
 {
    Path *path;
    TokenSet tmp;
@@ -490,8 +513,8 @@ static void TokSetMerge(TokenSet *res,Token *cmp,TokenSet *src)
 }
 
 /* Caching version of SOutP used when mixPDFs shared */
-static LogFloat cMOutP(HMMSet *hset, int s, Observation *x, StreamInfo *sti,
-                       int id)
+static LogFloat cMOutP(PRecInfo *pri, HMMSet *hset, int s, Observation *x,
+                       StreamInfo *sti, int id)
 {
    PreComp *pre;
    LogFloat bx,px,wt,det;
@@ -512,10 +535,10 @@ static LogFloat cMOutP(HMMSet *hset, int s, Observation *x, StreamInfo *sti,
             pre=pri->psi->mPre+me->mpdf->mIdx;
          else pre=NULL;
          if (pre==NULL) {
-            bx= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+            bx= MOutP(ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
             bx += det;
          } else if (pre->id!=id) {
-            bx= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+            bx= MOutP(ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
             bx += det;
             pre->id=id;
             pre->outp=bx;
@@ -531,10 +554,10 @@ static LogFloat cMOutP(HMMSet *hset, int s, Observation *x, StreamInfo *sti,
                   pre=pri->psi->mPre+me->mpdf->mIdx;
                else pre=NULL;
                if (pre==NULL) {
-                  px= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+                  px= MOutP(ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
                   px += det;
                } else if (pre->id!=id) {
-                  px= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+                  px= MOutP(ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
                   px += det;
                   pre->id=id;
                   pre->outp=px;
@@ -563,7 +586,8 @@ static LogFloat cMOutP(HMMSet *hset, int s, Observation *x, StreamInfo *sti,
 }
 
 /*  outP calculation from HModel.c and extended for new adapt code */
-static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamInfo *sti, int id)
+static LogFloat SOutP_HMod (PRecInfo *pri, HMMSet *hset, int s, Observation *x,
+                            StreamInfo *sti, int id)
 {
    int m;
    LogFloat bx,px,wt,det;
@@ -577,7 +601,7 @@ static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamInfo *sti
    v=x->fv[s];
    me=sti->spdf.cpdf+1;
    if (sti->nMix==1){     /* Single Mixture Case */
-      bx= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+      bx= MOutP(ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
       bx += det;
    }
    else if (!pde) {
@@ -585,7 +609,7 @@ static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamInfo *sti
       for (m=1; m<=sti->nMix; m++,me++) {
          wt = MixLogWeight(hset,me->weight);
          if (wt>LMINMIX) {
-            px= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+            px= MOutP(ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
 	    px += det;
             bx=LAdd(bx,wt+px);
          }
@@ -595,7 +619,7 @@ static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamInfo *sti
       wt = MixLogWeight(hset,me->weight);
       mp = me->mpdf;
       if (!hset->msdflag[s] || SpaceOrder(v)==VectorSize(mp->mean)) {
-         otvs = ApplyCompFXForm(mp,v,inXForm,&det,id);
+         otvs = ApplyCompFXForm(mp,v,pri->inXForm,&det,id);
          px = IDOutP(otvs,VectorSize(otvs),mp);
       }
       else {
@@ -607,7 +631,7 @@ static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamInfo *sti
          wt = MixLogWeight(hset,me->weight);
          if (wt>LMINMIX){
             mp = me->mpdf;
-            otvs = ApplyCompFXForm(mp,v,inXForm,&det,id);
+            otvs = ApplyCompFXForm(mp,v,pri->inXForm,&det,id);
             if (PDEMOutP(otvs,mp,&px,bx-wt-det) == TRUE)
                bx = LAdd(bx,wt+px+det);
          }
@@ -617,8 +641,8 @@ static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamInfo *sti
 }
 
 /* Caching version of SOutP used when streaminfo shared */
-static LogFloat cSOutP(HMMSet *hset, int s, Observation *x, StreamInfo *sti,
-                       int id)
+static LogFloat cSOutP(PRecInfo *pri, HMMSet *hset, int s, Observation *x,
+                       StreamInfo *sti, int id)
 {
    PreComp *pre;
    LogFloat bx;
@@ -630,9 +654,9 @@ static LogFloat cSOutP(HMMSet *hset, int s, Observation *x, StreamInfo *sti,
       pre= pri->psi->pPre + sti->pIdx;
    else pre=NULL;
    if (pre==NULL)
-      bx=SOutP_HMod(hset,s,x,sti,id);
+      bx=SOutP_HMod(pri,hset,s,x,sti,id);
    else if (pre->id!=id) {
-      bx=SOutP_HMod(hset,s,x,sti,id);
+      bx=SOutP_HMod(pri,hset,s,x,sti,id);
       pre->id=id;
       pre->outp=bx;
    }
@@ -642,8 +666,26 @@ static LogFloat cSOutP(HMMSet *hset, int s, Observation *x, StreamInfo *sti,
    return bx;
 }
 
+/* Stream outp of current frame, using the cross-utterance cache if any */
+static LogFloat lSOutP(PRecInfo *pri,PSetInfo *psi,int s,Observation *obs,
+                       StreamInfo *sti,int id)
+{
+   float *like = NULL;
+   LogFloat bx;
+
+   if (pri->lcache!=NULL &&
+       (like=CachedLike(pri->lcache,s,sti,pri->frame))!=NULL && *like<LIKEUNSET)
+      return *like;
+   if (psi->streamShared)
+      bx=cSOutP(pri,psi->hset,s,obs,sti,id);
+   else
+      bx=cMOutP(pri,psi->hset,s,obs,sti,id);
+   if (like!=NULL) *like=bx;
+   return bx;
+}
+
 /* Version of POutP that caches outp values with frame id */
-static LogFloat cPOutP(PSetInfo *psi,Observation *obs,StateInfo *si,int id)
+static LogFloat cPOutP(PRecInfo *pri,PSetInfo *psi,Observation *obs,StateInfo *si,int id)
 {
    PreComp *pre;
    LogFloat outp;
@@ -669,20 +711,14 @@ static LogFloat cPOutP(PSetInfo *psi,Observation *obs,StateInfo *si,int id)
          S=obs->swidth[0];
          if (S==1 && si->weights==NULL){
             sti=si->pdf[1].info;
-            if (psi->streamShared)
-               outp=cSOutP(psi->hset,1,obs,sti,id);
-            else 
-               outp=cMOutP(psi->hset,1,obs,sti,id);
+            outp=lSOutP(pri,psi,1,obs,sti,id);
          }
          else {
             outp=0.0;
             w=si->weights;
             for (s=1;s<=S;s++) {
                sti = si->pdf[s].info;
-               if (psi->streamShared)
-                  outp+=w[s]*cSOutP(psi->hset,s,obs,sti,id);
-               else
-                  outp+=w[s]*cMOutP(psi->hset,s,obs,sti,id);
+               outp+=w[s]*lSOutP(pri,psi,s,obs,sti,id);
             }
          }
       }
@@ -693,7 +729,7 @@ static LogFloat cPOutP(PSetInfo *psi,Observation *obs,StateInfo *si,int id)
 }
 
 /* Move align record to (head of) YES referenced list */
-static void MoveAlignYesRef(Align *align)
+static void MoveAlignYesRef(PRecInfo *pri,Align *align)
 {
    align->link->knil=align->knil;
    align->knil->link=align->link;
@@ -704,10 +740,11 @@ static void MoveAlignYesRef(Align *align)
 
 /* Add reference to align record.                     */
 /* Moves record to YES referenced list when necessary */
-static void RefAlign(Align *align)
+static void RefAlign(PRecInfo *pri,Align *align)
 {
+   if (pri->flat) return;  /* arena records are not ref'd */
    if (align->usage==0) {
-      MoveAlignYesRef(align);
+      MoveAlignYesRef(pri,align);
 #ifdef SANITY
       pri->anlen--;pri->aylen++;
 #endif
@@ -717,7 +754,7 @@ static void RefAlign(Align *align)
 
 /* Remove reference to align record, moving to  */ 
 /* (tail of) NO referenced list when necessary. */
-static void DeRefAlign(Align *align)
+static void DeRefAlign(PRecInfo *pri,Align *align)
 {
 #ifdef SANITY
    if (align->usage<0)
@@ -737,15 +774,21 @@ static void DeRefAlign(Align *align)
 }
 
 /* Allocate new align record and add to NOT referenced list */
-static Align *NewNRefAlign(NetNode *node,int state,double like,
+static Align *NewNRefAlign(PRecInfo *pri,NetNode *node,int state,double like,
                            int frame,Align *prev)
 {
    Align *align;
 
-   align=(Align*) New(&pri->alignHeap,0);
-   align->link=pri->aNoRef.link;
-   align->knil=&pri->aNoRef;
-   align->link->knil=align->knil->link=align;
+   if (pri->flat) {
+      align=(Align*) New(pri->arena+pri->curArena,sizeof(Align));
+      align->link=align->knil=NULL;
+   }
+   else {
+      align=(Align*) New(&pri->alignHeap,0);
+      align->link=pri->aNoRef.link;
+      align->knil=&pri->aNoRef;
+      align->link->knil=align->knil->link=align;
+   }
    align->usage=0;
    align->used=FALSE;
 
@@ -755,7 +798,7 @@ static Align *NewNRefAlign(NetNode *node,int state,double like,
    align->frame=frame;
    
    if ((align->prev=prev)!=NULL)
-      RefAlign(prev);
+      RefAlign(pri,prev);
 
    pri->nalign++;
 #ifdef SANITY
@@ -766,7 +809,7 @@ static Align *NewNRefAlign(NetNode *node,int state,double like,
 }
 
 /* Remove and free align record from NO referenced list */
-static void UnlinkAlign(Align *align)
+static void UnlinkAlign(PRecInfo *pri,Align *align)
 {
    align->link->knil=align->knil;
    align->knil->link=align->link;
@@ -781,7 +824,7 @@ static void UnlinkAlign(Align *align)
    pri->nalign--;
 }
 
-static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
+static void StepHMM1(PRecInfo *pri,NetNode *node) /* Model internal propagation NBEST */
 {
    NetInst *inst;
    HMMDef *hmm;
@@ -822,10 +865,10 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
                res->tok=cmp.tok;
          }
          else
-            TokSetMerge(res,&cmp.tok,cur);
+            TokSetMerge(pri,res,&cmp.tok,cur);
       }
       if (res->tok.like>pri->genThresh) { /* State pruning */
-         outp=cPOutP(pri->psi,pri->obs,hmm->svec[j].info,pri->id);
+         outp=cPOutP(pri,pri->psi,pri->obs,hmm->svec[j].info,pri->id);
          res->tok.like+=outp;
    
          if (res->tok.like>max.like)
@@ -833,7 +876,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
          if (pri->states) {
             if (res->tok.align==NULL?TRUE:
                 res->tok.align->state!=j || res->tok.align->node!=node) {
-               align=NewNRefAlign(node,j,
+               align=NewNRefAlign(pri,node,j,
                                   res->tok.like-outp-res->tok.lm*pri->scale,
                                   pri->frame-1,res->tok.align);
                res->tok.align=align;
@@ -847,7 +890,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
 	      if (res->set[n].align==NULL?TRUE:
 		  (res->set[n].align->state!=j||
 		   res->set[n].align->node!=node)) {
-		align=NewNRefAlign(node,j,
+		align=NewNRefAlign(pri,node,j,
 				   res->tok.like-outp-res->tok.lm*pri->scale,
 				   pri->frame-1,res->set[n].align);
 		res->set[n].align=align;
@@ -898,7 +941,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
             res->tok=cmp.tok;
       }
       else 
-         TokSetMerge(res,&cmp.tok,cur);
+         TokSetMerge(pri,res,&cmp.tok,cur);
    }
    if (res->tok.like>LSMALL){
       tok.like=res->tok.like+inst->wdlk;
@@ -908,7 +951,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
          pri->wordMaxNode=node;
       }
       if (!node_tr0(node) && pri->models) {
-         align=NewNRefAlign(node,-1,
+         align=NewNRefAlign(pri,node,-1,
                             res->tok.like-res->tok.lm*pri->scale,
                             pri->frame,res->tok.align);
          res->tok.align=align;
@@ -916,7 +959,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
 	 if (pri->nToks>1)
            res->set[0].align=align;
          for (n=1;n<res->n;n++) {
-           align=NewNRefAlign(node,-1,
+           align=NewNRefAlign(pri,node,-1,
                               res->tok.like-res->tok.lm*pri->scale,
                               pri->frame,res->set[n].align);
            res->set[n].align=align;
@@ -930,7 +973,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
 }
 
 /* Tee transition propagation - may be repeated */
-static void StepHMM2(NetNode *node) 
+static void StepHMM2(PRecInfo *pri,NetNode *node) 
 {
    NetInst *inst;
    HMMDef *hmm;
@@ -957,10 +1000,10 @@ static void StepHMM2(NetNode *node)
          res->tok=cmp.tok;
    }
    else 
-      TokSetMerge(res,&cmp.tok,cur);
+      TokSetMerge(pri,res,&cmp.tok,cur);
 
    if (pri->models) {
-      align=NewNRefAlign(node,-1,
+      align=NewNRefAlign(pri,node,-1,
                          res->tok.like-res->tok.lm*pri->scale,
                          pri->frame,res->tok.align);
       res->tok.align=align;
@@ -968,7 +1011,7 @@ static void StepHMM2(NetNode *node)
       if (pri->nToks>1)
         res->set[0].align=align;
       for (n=1;n<res->n;n++) {
-        align=NewNRefAlign(node,-1,
+        align=NewNRefAlign(pri,node,-1,
                            res->tok.like-res->tok.lm*pri->scale,
                            pri->frame,res->set[n].align);
         res->set[n].align=align;
@@ -977,14 +1020,20 @@ static void StepHMM2(NetNode *node)
    }
 }
 
-static Path *NewNRefPath(void)
+static Path *NewNRefPath(PRecInfo *pri)
 {
    Path *path;
 
-   path=(Path*) New(&pri->pathHeap,0);
-   path->link=pri->pNoRef.link;
-   path->knil=&pri->pNoRef;
-   path->link->knil=path->knil->link=path;
+   if (pri->flat) {
+      path=(Path*) New(pri->arena+pri->curArena,sizeof(Path));
+      path->link=path->knil=NULL;
+   }
+   else {
+      path=(Path*) New(&pri->pathHeap,0);
+      path->link=pri->pNoRef.link;
+      path->knil=&pri->pNoRef;
+      path->link->knil=path->knil->link=path;
+   }
    path->chain=NULL;
    path->used=FALSE;
    pri->npth++;
@@ -994,7 +1043,14 @@ static Path *NewNRefPath(void)
    return(path);
 }
 
-static void MovePathYesRef(Path *path)
+static NxtPath *NewNxtPath(PRecInfo *pri)
+{
+   if (pri->flat)
+      return((NxtPath*) New(pri->arena+pri->curArena,sizeof(NxtPath)));
+   return((NxtPath*) New(&pri->rPthHeap,0));
+}
+
+static void MovePathYesRef(PRecInfo *pri,Path *path)
 {
    path->link->knil=path->knil;
    path->knil->link=path->link;
@@ -1003,10 +1059,11 @@ static void MovePathYesRef(Path *path)
    path->link->knil=path->knil->link=path;
 }
 
-static void RefPath(Path *path)
+static void RefPath(PRecInfo *pri,Path *path)
 {
+   if (pri->flat) return;  /* arena records are not ref'd */
    if (path->usage==0) {
-      MovePathYesRef(path);
+      MovePathYesRef(pri,path);
 #ifdef SANITY
       pri->pnlen--;pri->pylen++;
 #endif
@@ -1014,7 +1071,7 @@ static void RefPath(Path *path)
    path->usage++;
 }
    
-static void DeRefPathPrev(Path *path)
+static void DeRefPathPrev(PRecInfo *pri,Path *path)
 {
    Path *pth;
    NxtPath tmp,*cur;
@@ -1042,7 +1099,7 @@ static void DeRefPathPrev(Path *path)
    }
 }
    
-static void UnlinkPath(Path *path)
+static void UnlinkPath(PRecInfo *pri,Path *path)
 {
    NxtPath *pth,*nth;
 
@@ -1064,7 +1121,7 @@ static void UnlinkPath(Path *path)
    pri->npth--;
 }
 
-static void CollectPaths(void)
+static void CollectPaths(PRecInfo *pri)
 {
    NetInst *inst;
    TokenSet *cur;
@@ -1081,7 +1138,7 @@ static void CollectPaths(void)
          for (i=1,cur=inst->state;i<=n;i++,cur++) {
             path=cur->tok.path;
             if (path && !path->used) {
-               if (path->usage!=0) MovePathYesRef(path);
+               if (path->usage!=0) MovePathYesRef(pri,path);
                path->used=TRUE;
             }
 #ifdef SANITY
@@ -1091,26 +1148,26 @@ static void CollectPaths(void)
             for (k=1;k<cur->n;k++) {
                path=cur->set[k].path;
                if (path && !path->used) {
-                  if (path->usage!=0) MovePathYesRef(path);
+                  if (path->usage!=0) MovePathYesRef(pri,path);
                   path->used=TRUE;
                }
 #ifdef PHNALG
 	       align=cur->set[k].align;
                if (align && !align->used) {
-                 if (align->usage!=0) MoveAlignYesRef(align);
+                 if (align->usage!=0) MoveAlignYesRef(pri,align);
 		 align->used=TRUE;
                }
 #endif
             }
             align=cur->tok.align;
             if (align && !align->used) {
-               if (align->usage!=0) MoveAlignYesRef(align);
+               if (align->usage!=0) MoveAlignYesRef(pri,align);
                align->used=TRUE;
             }
          }
          path=inst->exit->tok.path;
          if (path && !path->used) {
-            if (path->usage!=0) MovePathYesRef(path);
+            if (path->usage!=0) MovePathYesRef(pri,path);
             path->used=TRUE;
          }
 #ifdef SANITY
@@ -1121,20 +1178,20 @@ static void CollectPaths(void)
          for (k=1;k<inst->exit->n;k++) {
             path=inst->exit->set[k].path;
             if (path && !path->used) {
-               if (path->usage!=0) MovePathYesRef(path);
+               if (path->usage!=0) MovePathYesRef(pri,path);
                path->used=TRUE;
             }
 #ifdef PHNALG
 	    align=inst->exit->set[k].align;
             if (align && !align->used) {
-	      if (align->usage!=0) MoveAlignYesRef(align);
+	      if (align->usage!=0) MoveAlignYesRef(pri,align);
 	      align->used=TRUE;
             }
 #endif
          }
          align=inst->exit->tok.align;
          if (align && !align->used) {
-            if (align->usage!=0) MoveAlignYesRef(align);
+            if (align->usage!=0) MoveAlignYesRef(pri,align);
             align->used=TRUE;
          }
       }
@@ -1142,10 +1199,10 @@ static void CollectPaths(void)
    for (path=pri->pNoRef.link;path->link!=NULL;path=plink) {
       if (!path->used) {
          if (path->align!=NULL)
-            DeRefAlign(path->align);
-         DeRefPathPrev(path);
+            DeRefAlign(pri,path->align);
+         DeRefPathPrev(pri,path);
          plink=path->link;
-         UnlinkPath(path);
+         UnlinkPath(pri,path);
       }
       else {
          path->used=FALSE;
@@ -1161,9 +1218,9 @@ static void CollectPaths(void)
    for (align=pri->aNoRef.link;align->link!=NULL;align=alink) {
       if (!align->used) {
          if (align->prev!=NULL)
-            DeRefAlign(align->prev);
+            DeRefAlign(pri,align->prev);
          alink=align->link;
-         UnlinkAlign(align);
+         UnlinkAlign(pri,align);
       }
       else {
          align->used=FALSE;
@@ -1177,7 +1234,99 @@ static void CollectPaths(void)
    pri->calign=pri->nalign;
 }
 
-static void StepWord1(NetNode *node) /* Just invalidate the tokens */
+/* Flat engine: copy path/align records reachable from the active */
+/*  instances into the other arena.  The used flag marks a record   */
+/*  that has already been copied and link points to the copy.       */
+static Align *CopyAlign(PRecInfo *pri,Align *align)
+{
+   Align *res,**pos,*cpy;
+
+   for (pos=&res;align!=NULL && !align->used;align=align->prev) {
+      cpy=(Align*) New(pri->arena+1-pri->curArena,sizeof(Align));
+      *cpy=*align;
+      align->used=TRUE; align->link=cpy;
+      *pos=cpy; pos=&cpy->prev;
+      pri->nalign++;
+   }
+   *pos=(align!=NULL)?align->link:NULL;
+   return(res);
+}
+
+static Path *CopyPath(PRecInfo *pri,Path *path)
+{
+   Path *cpy;
+   NxtPath *pth,**pos;
+
+   if (path==NULL) return(NULL);
+   if (path->used) return(path->link);
+
+   cpy=(Path*) New(pri->arena+1-pri->curArena,sizeof(Path));
+   *cpy=*path;
+   path->used=TRUE; path->link=cpy;
+   pri->npth++;
+
+   cpy->prev=CopyPath(pri,path->prev);
+   cpy->align=CopyAlign(pri,path->align);
+   for (pth=path->chain,pos=&cpy->chain;pth!=NULL;pth=pth->chain) {
+      *pos=(NxtPath*) New(pri->arena+1-pri->curArena,sizeof(NxtPath));
+      **pos=*pth;
+      (*pos)->prev=CopyPath(pri,pth->prev);
+#ifdef PHNALG
+      (*pos)->align=CopyAlign(pri,pth->align);
+#endif
+      pos=&(*pos)->chain;
+   }
+   return(cpy);
+}
+
+static void CopyTokenSet(PRecInfo *pri,TokenSet *ts)
+{
+   int k;
+
+   ts->tok.path=CopyPath(pri,ts->tok.path);
+   ts->tok.align=CopyAlign(pri,ts->tok.align);
+   for (k=0;k<ts->n;k++) {
+      ts->set[k].path=CopyPath(pri,ts->set[k].path);
+#ifdef PHNALG
+      ts->set[k].align=CopyAlign(pri,ts->set[k].align);
+#endif
+   }
+}
+
+/* Flat engine equivalent of CollectPaths */
+static void CollectArena(PRecInfo *pri)
+{
+   NetInst *inst;
+   TokenSet *cur;
+   int i,n,p;
+
+   pri->npth=pri->nalign=0;
+   for (p=0;p<pri->nfAct;p++) {
+      if ((inst=pri->fAct[p])==NULL) continue;
+      if (node_hmm(inst->node)) 
+         n=inst->node->info.hmm->numStates-1;
+      else
+         n=1;
+      for (i=1,cur=inst->state;i<=n;i++,cur++)
+         CopyTokenSet(pri,cur);
+      CopyTokenSet(pri,inst->exit);
+   }
+   pri->genMaxTok.path=CopyPath(pri,pri->genMaxTok.path);
+   pri->genMaxTok.align=CopyAlign(pri,pri->genMaxTok.align);
+   pri->wordMaxTok.path=CopyPath(pri,pri->wordMaxTok.path);
+   pri->wordMaxTok.align=CopyAlign(pri,pri->wordMaxTok.align);
+
+   if (trace&T_NGEN)
+      printf("CollectArena: frame %d, %d paths and %d aligns kept\n",
+             pri->frame,pri->npth,pri->nalign);
+
+   ResetHeap(pri->arena+pri->curArena);
+   pri->curArena=1-pri->curArena;
+   pri->cpth=pri->npth;
+   pri->calign=pri->nalign;
+}
+
+static void StepWord1(PRecInfo *pri,NetNode *node) /* Just invalidate the tokens */
 {
    node->inst->state->tok=null_token;
    node->inst->state->n=((pri->nToks>1)?1:0);
@@ -1186,7 +1335,7 @@ static void StepWord1(NetNode *node) /* Just invalidate the tokens */
    node->inst->max=LZERO;
 }
 
-static void StepWord2(NetNode *node) /* Update the path - may be repeated */
+static void StepWord2(PRecInfo *pri,NetNode *node) /* Update the path - may be repeated */
 {
    NetInst *inst;
    Path *newpth,*oldpth;
@@ -1208,21 +1357,21 @@ static void StepWord2(NetNode *node) /* Update the path - may be repeated */
          inst->exit->tok.like+=pri->wordpen;
          inst->exit->tok.like+=node->info.pron->prob*pri->pscale;
       }
-      newpth=NewNRefPath();
+      newpth=NewNRefPath(pri);
       newpth->node=node;
       newpth->usage=0;
       newpth->frame=pri->frame;
       newpth->like=inst->exit->tok.like;
       newpth->lm=inst->exit->tok.lm;
       if ((newpth->align=inst->exit->tok.align)!=NULL)
-         RefAlign(newpth->align);
+         RefAlign(pri,newpth->align);
       inst->exit->tok.path=newpth;
       inst->exit->tok.lm=0.0;
       inst->exit->tok.align=NULL;
       
       oldpth=inst->state->tok.path;
       if ((newpth->prev=oldpth)!=NULL)
-         RefPath(oldpth);
+         RefPath(pri,oldpth);
 
       if (pri->nToks>1) {
          inst->exit->n=1;
@@ -1230,28 +1379,28 @@ static void StepWord2(NetNode *node) /* Update the path - may be repeated */
 
          cur=inst->state->set+1;
          if (inst->state->n>1) {
-            rth=(NxtPath*) New(&pri->rPthHeap,0);
+            rth=NewNxtPath(pri);
             newpth->chain=rth;
             rth->chain=NULL;
             rth->like=newpth->like+cur->like;
             rth->lm=cur->lm;
             if ((rth->prev=cur->path)!=NULL)
-               RefPath(cur->path);
+               RefPath(pri,cur->path);
 #ifdef PHNALG
 	    if ((rth->align=cur->align)!=NULL)
-	      RefAlign(cur->align);
+	      RefAlign(pri,cur->align);
 #endif
             for (i=2,cur++;i<inst->state->n;i++,cur++) {
-               rth->chain=(NxtPath*) New(&pri->rPthHeap,0);
+               rth->chain=NewNxtPath(pri);
                rth=rth->chain;
                rth->chain=NULL;
                rth->like=newpth->like+cur->like;
                rth->lm=cur->lm;
                if ((rth->prev=cur->path)!=NULL)
-                  RefPath(cur->path);
+                  RefPath(pri,cur->path);
 #ifdef PHNALG
 	       if ((rth->align=cur->align)!=NULL)
-		 RefAlign(cur->align);
+		 RefAlign(pri,cur->align);
 #endif
             }
          }
@@ -1263,24 +1412,116 @@ static void StepWord2(NetNode *node) /* Update the path - may be repeated */
    }
 }
 
-static void MoveToRecent(NetInst *inst)
+/* Flat engine: find the instance slot of node */
+static NetInst *FlatNodeInst(PRecInfo *pri,NetNode *node)
 {
-   if (inst->node==NULL) return;
+   int h;
 
-   /* If we are about to move the instance that is used to determine the   */
-   /*  next instance to be stepped (to the most recent end of the list) we */
-   /*  must use the previous instance to determine the next one to step !! */
-   if (inst==pri->nxtInst)
-      pri->nxtInst=inst->knil;
+   h=(int)((((size_t)node>>4)*2654435761UL)&pri->fMask);
+   while (pri->fHash[h]->node!=node)
+      h=(h+1)&pri->fMask;
+   return(pri->fHash[h]);
+}
 
-   inst->link->knil=inst->knil;
-   inst->knil->link=inst->link;
+/* Flat engine: add inst to the (most recent) end of the active array */
+static void FlatAppend(PRecInfo *pri,NetInst *inst)
+{
+   NetInst **act;
+
+   if (pri->nfAct==pri->fActSize) {
+      act=(NetInst**) New(&pri->flatHeap,2*pri->fActSize*sizeof(NetInst*));
+      memcpy(act,pri->fAct,pri->nfAct*sizeof(NetInst*));
+      pri->fAct=act; pri->fActSize*=2;
+   }
+   inst->apos=pri->nfAct;
+   pri->fAct[pri->nfAct++]=inst;
+}
+
+/* Flat engine: remove entries of moved and detached insts */
+static void FlatCompact(PRecInfo *pri)
+{
+   NetInst *inst;
+   int i,j;
+
+   for (i=j=0;i<pri->nfAct;i++)
+      if ((inst=pri->fAct[i])!=NULL) {
+         inst->apos=j;
+         pri->fAct[j++]=inst;
+      }
+   pri->nfAct=j;
+}
+
+/* Flat engine: set up instance slots for all nodes of pri->net */
+static void FlatInitNet(PRecInfo *pri)
+{
+   NetNode *node,*last;
+   NetInst *inst;
+   TokenSet *ts;
+   RelToken *rt;
+   int i,h,n,nts;
+
+   ResetHeap(&pri->flatHeap);
+   pri->fnn=2; nts=4;
+   for (node=pri->net->chain;node!=NULL;node=node->chain) {
+      pri->fnn++;
+      nts+=(node_hmm(node)?node->info.hmm->numStates:2);
+   }
+   pri->fInst=(NetInst*) New(&pri->flatHeap,pri->fnn*sizeof(NetInst));
+   ts=(TokenSet*) New(&pri->flatHeap,nts*sizeof(TokenSet));
+   rt=NULL;
+   if (pri->nToks>1)
+      rt=(RelToken*) New(&pri->flatHeap,nts*pri->nToks*sizeof(RelToken));
+   for (h=1;h<2*pri->fnn;h*=2);
+   pri->fMask=h-1;
+   pri->fHash=(NetInst**) New(&pri->flatHeap,h*sizeof(NetInst*));
+   for (i=0;i<h;i++) pri->fHash[i]=NULL;
+
+   node=&pri->net->initial; last=&pri->net->final;
+   for (i=0,inst=pri->fInst;i<pri->fnn;i++,inst++) {
+      n=(node_hmm(node)?node->info.hmm->numStates-1:1);
+      inst->node=node;
+      inst->state=ts; inst->exit=ts+n;
+      if (rt!=NULL)
+         for (h=0;h<=n;h++,rt+=pri->nToks)
+            ts[h].set=rt;
+      ts+=n+1;
+      h=(int)((((size_t)node>>4)*2654435761UL)&pri->fMask);
+      while (pri->fHash[h]!=NULL)
+         h=(h+1)&pri->fMask;
+      pri->fHash[h]=inst;
+      if (node==&pri->net->initial) node=last;
+      else if (node==last) node=pri->net->chain;
+      else node=node->chain;
+   }
+   pri->fActSize=pri->fnn;
+   pri->fAct=(NetInst**) New(&pri->flatHeap,pri->fActSize*sizeof(NetInst*));
+   pri->nfAct=0;
+}
+
+static void MoveToRecent(PRecInfo *pri,NetInst *inst)
+{
+   if (pri->flat) {
+      pri->fAct[inst->apos]=NULL;
+      FlatAppend(pri,inst);
+   }
+   else {
+      if (inst->node==NULL) return;
+
+      /* If we are about to move the instance that is used to determine the   */
+      /*  next instance to be stepped (to the most recent end of the list) we */
+      /*  must use the previous instance to determine the next one to step !! */
+      if (inst==pri->nxtInst)
+         pri->nxtInst=inst->knil;
 
-   inst->link=&pri->tail;
-   inst->knil=pri->tail.knil;
+      inst->link->knil=inst->knil;
+      inst->knil->link=inst->link;
 
-   inst->link->knil=inst;
-   inst->knil->link=inst;
+      inst->link=&pri->tail;
+      inst->knil=pri->tail.knil;
+
+      inst->link->knil=inst;
+      inst->knil->link=inst;
+   }
 
    inst->pxd=FALSE;
    inst->ooo=TRUE;
@@ -1292,7 +1533,7 @@ static void MoveToRecent(NetInst *inst)
 #endif
 }
 
-static void ReOrderList(NetNode *node)
+static void ReOrderList(PRecInfo *pri,NetNode *node)
 {
    NetLink *dest;
    int i;
@@ -1302,16 +1543,16 @@ static void ReOrderList(NetNode *node)
    for (i=0,dest=node->links;i<node->nlinks;i++,dest++) {
       if (!node_tr0(dest->node)) break;
       if (dest->node->inst!=NULL) 
-         MoveToRecent(dest->node->inst);
+         MoveToRecent(pri,dest->node->inst);
    }
    for (i=0,dest=node->links;i<node->nlinks;i++,dest++) {
       if (!node_tr0(dest->node)) break;
       if (dest->node->inst!=NULL)
-         ReOrderList(dest->node);
+         ReOrderList(pri,dest->node);
    }
 }
 
-static LogFloat LikeToWord(NetNode *node)
+static LogFloat LikeToWord(PRecInfo *pri,NetNode *node)
 {
    NetLink *dest;
    HMMDef *hmm;
@@ -1333,36 +1574,41 @@ static LogFloat LikeToWord(NetNode *node)
          hmm=dest->node->info.hmm;
          N=hmm->numStates;
          like+=hmm->transP[1][N];
-         like+=LikeToWord(dest->node);
+         like+=LikeToWord(pri,dest->node);
          if (like>best) best=like;
       }
    }
    return(best);
 }   
 
-static void AttachInst(NetNode *node)
+static void AttachInst(PRecInfo *pri,NetNode *node)
 {
    TokenSet *cur;
    NetInst *inst;
    int i,n;
 
-   inst=(NetInst*) New(&pri->instHeap,0);
    if (node_hmm(node))
       n=node->info.hmm->numStates-1;
    else
       n=1;
 
+   if (pri->flat)
+      inst=FlatNodeInst(pri,node);
+   else {
+      inst=(NetInst*) New(&pri->instHeap,0);
 #ifdef SANITY
-   if (pri->psi->stHeapIdx[n]<0)
-      HError(8592,"AttachInst: State heap not created for %d states",n);
+      if (pri->psi->stHeapIdx[n]<0)
+         HError(8592,"AttachInst: State heap not created for %d states",n);
 #endif
-   inst->node=node;
-   inst->state=(TokenSet*) New(pri->stHeap+pri->psi->stHeapIdx[n],0);
-   inst->exit=(TokenSet*) New(pri->stHeap+pri->psi->stHeapIdx[1],0);
+      inst->node=node;
+      inst->state=(TokenSet*) New(pri->stHeap+pri->psi->stHeapIdx[n],0);
+      inst->exit=(TokenSet*) New(pri->stHeap+pri->psi->stHeapIdx[1],0);
+   }
 
    inst->exit->tok=null_token;
    if (pri->nToks>1) {
-      inst->exit->set=(RelToken*) New(&pri->rTokHeap,0);
+      if (!pri->flat)
+         inst->exit->set=(RelToken*) New(&pri->rTokHeap,0);
       inst->exit->n=1;
       inst->exit->set[0]=rmax;
    }
@@ -1373,7 +1619,8 @@ static void AttachInst(NetNode *node)
    for (i=1,cur=inst->state;i<=n;i++,cur++) {
       cur->tok=null_token;
       if (pri->nToks>1) {
-         cur->set=(RelToken*) New(&pri->rTokHeap,0);
+         if (!pri->flat)
+            cur->set=(RelToken*) New(&pri->rTokHeap,0);
          cur->n=1;
          cur->set[0]=rmax;
       }
@@ -1383,16 +1630,20 @@ static void AttachInst(NetNode *node)
    }
    inst->max=LZERO;
 
-   inst->link=&pri->tail;
-   inst->knil=pri->tail.knil;
+   if (pri->flat)
+      FlatAppend(pri,inst);
+   else {
+      inst->link=&pri->tail;
+      inst->knil=pri->tail.knil;
 
-   inst->link->knil=inst;
-   inst->knil->link=inst;
+      inst->link->knil=inst;
+      inst->knil->link=inst;
+   }
 
    node->inst=inst;
 
    if (node_wd0(node))
-      inst->wdlk=LikeToWord(inst->node);
+      inst->wdlk=LikeToWord(pri,inst->node);
    else
       inst->wdlk=LZERO;
 
@@ -1405,10 +1656,10 @@ static void AttachInst(NetNode *node)
    inst->ipos=pri->ipos++;
    pri->start_inst=inst;
 #endif
-   ReOrderList(node);
+   ReOrderList(pri,node);
 }
 
-static void DetachInst(NetNode *node)
+static void DetachInst(PRecInfo *pri,NetNode *node)
 {
    TokenSet *cur;
    NetInst *inst;
@@ -1420,6 +1671,11 @@ static void DetachInst(NetNode *node)
    if (inst->node!=node)
       HError(8591,"DetachInst: Node/Inst mismatch");
 #endif
+   if (pri->flat) {
+      pri->fAct[inst->apos]=NULL;
+      node->inst=0;
+      return;
+   }
    inst->link->knil=inst->knil;
    inst->knil->link=inst->link;
    
@@ -1443,7 +1699,7 @@ static void DetachInst(NetNode *node)
    node->inst=0;
 }
 
-static void SetEntryState(NetNode *node,TokenSet *src)
+static void SetEntryState(PRecInfo *pri,NetNode *node,TokenSet *src)
 {
    NetInst *inst;
    TokenSet *res;
@@ -1454,7 +1710,7 @@ static void SetEntryState(NetNode *node,TokenSet *src)
 #endif
 
    if (node->inst==NULL)
-      AttachInst(node);
+      AttachInst(pri,node);
 
    inst=node->inst;
    res=inst->state;
@@ -1481,7 +1737,7 @@ static void SetEntryState(NetNode *node,TokenSet *src)
          res->tok=src->tok;
    }
    else
-      TokSetMerge(res,&src->tok,src);
+      TokSetMerge(pri,res,&src->tok,src);
    if (res->tok.like>inst->max)
       inst->max=res->tok.like;
    if (node->type==n_word && (pri->wordMaxNode==NULL || 
@@ -1490,17 +1746,17 @@ static void SetEntryState(NetNode *node,TokenSet *src)
       pri->wordMaxNode=node;
 }
 
-static void StepInst1(NetNode *node) /* First pass of token propagation (Internal) */
+static void StepInst1(PRecInfo *pri,NetNode *node) /* First pass of token propagation (Internal) */
 {
    if (node_hmm(node))
-      StepHMM1(node);   /* Advance tokens within HMM instance t => t-1 */
+      StepHMM1(pri,node);   /* Advance tokens within HMM instance t => t-1 */
                         /* Entry tokens valid for t-1, do states 2..N */
    else
-      StepWord1(node);
+      StepWord1(pri,node);
    node->inst->pxd=FALSE;
 }
 
-static void StepInst2(NetNode *node) /* Second pass of token propagation (External) */
+static void StepInst2(PRecInfo *pri,NetNode *node) /* Second pass of token propagation (External) */
      /* Must be able to survive doing this twice !! */
 {
    Token tok;
@@ -1511,9 +1767,9 @@ static void StepInst2(NetNode *node) /* Second pass of token propagation (Extern
    int i,k;
 
    if (node_word(node))
-      StepWord2(node);  /* Merge tokens and update traceback */
+      StepWord2(pri,node);  /* Merge tokens and update traceback */
    else if (node_tr0(node) /* && node_hmm(node) */)
-      StepHMM2(node);   /* Advance tokens within HMM instance t => t-1 */
+      StepHMM2(pri,node);   /* Advance tokens within HMM instance t => t-1 */
                         /* Entry token valid for t, only do state N */
    tok=node->inst->exit->tok;
    xtok.tok=tok;
@@ -1534,7 +1790,7 @@ static void StepInst2(NetNode *node) /* Second pass of token propagation (Extern
          for (k=0;k<xtok.n;k++)
             xtok.set[k].lm=node->inst->exit->set[k].lm+lm;
          if (xtok.tok.like>pri->genThresh) {
-            SetEntryState(dest->node,&xtok);
+            SetEntryState(pri,dest->node,&xtok);
             /* Transfer set of tokens to node, activating when necessary */
             /* choosing N most likely after adding transition likelihood */
          }
@@ -1589,6 +1845,7 @@ PSetInfo *InitPSetInfo(HMMSet *hset)
 
    psi=(PSetInfo*) New(&gcheap,sizeof(PSetInfo));
    psi->hset=hset;
+   traceSet=hset;
    sprintf(name,"PRI-%d Heap",psid++);
    CreateHeap(&psi->heap,name,MSTAK,1,1.0,1000,8000);
 
@@ -1668,7 +1925,7 @@ void FreePSetInfo(PSetInfo *psi)
    Dispose(&gcheap,psi);
 }
 
-static void LatFromPaths(Path *path,int *ln,Lattice *lat)
+static void LatFromPaths(PRecInfo *pri,Path *path,int *ln,Lattice *lat)
 {
    LNode *ne,*ns;
    LArc *la;
@@ -1731,7 +1988,7 @@ static void LatFromPaths(Path *path,int *ln,Lattice *lat)
       ns->foll=ne->pred=la;
       
       if (pth->prev!=NULL && ns->word==NULL)
-         LatFromPaths(pth->prev,ln,lat);
+         LatFromPaths(pri,pth->prev,ln,lat);
 #ifdef PHNALG
       align=pth->align;
 #endif
@@ -1835,7 +2092,7 @@ static void MarkPaths(Path *path,int *nn,int *nl)
    }
 }
 
-static Lattice *CreateLattice(MemHeap *heap,TokenSet *res,HTime framedur)
+static Lattice *CreateLattice(PRecInfo *pri,MemHeap *heap,TokenSet *res,HTime framedur)
 {
    Lattice *lat;
    RelToken *cur;
@@ -1887,7 +2144,7 @@ static Lattice *CreateLattice(MemHeap *heap,TokenSet *res,HTime framedur)
    lat->lnodes[0].tag=NULL;
    lat->lnodes[0].score=0.0;
 
-   LatFromPaths(&path,&ln,lat);
+   LatFromPaths(pri,&path,&ln,lat);
 
 #ifdef SANITY
    if (ln!=nl)
@@ -1920,6 +2177,7 @@ static void qcksrtM(float *array,int l,int r,int M)
 VRecInfo *InitVRecInfo(PSetInfo *psi,int nToks,Boolean models,Boolean states)
 {
    VRecInfo *vri;
+   PRecInfo *pri;
    PreComp *pre;
    int i,n;
    char name[MAXSTRLEN];
@@ -1948,6 +2206,7 @@ VRecInfo *InitVRecInfo(PSetInfo *psi,int nToks,Boolean models,Boolean states)
    vri->tmBeam=LZERO;
    vri->pCollThresh=1024;
    vri->aCollThresh=1024;
+   vri->lcache=NULL;
 
    /* Set up private parameters */
    pri->qsn=0;pri->qsa=NULL;
@@ -1993,6 +2252,15 @@ VRecInfo *InitVRecInfo(PSetInfo *psi,int nToks,Boolean models,Boolean states)
               MHEAP,sizeof(Path),1.0,200,1600);
    CreateHeap(&pri->alignHeap,"Align Heap",
               MHEAP,sizeof(Align),1.0,200,3200);
+   pri->flat=flatEngine;
+   if (pri->flat) {
+      CreateHeap(&pri->flatHeap,"Flat Inst Heap",
+                 MSTAK,1,1.0,100000,1000000);
+      CreateHeap(pri->arena,"Path Arena 0",MSTAK,1,1.0,100000,1000000);
+      CreateHeap(pri->arena+1,"Path Arena 1",MSTAK,1,1.0,100000,1000000);
+      pri->curArena=0;
+      pri->nfAct=pri->fActSize=0;
+   }
 
 
    /* Now set up instances */
@@ -2036,14 +2304,37 @@ void DeleteVRecInfo(VRecInfo *vri)
    DeleteHeap(&pri->rPthHeap);
    DeleteHeap(&pri->pathHeap);
    DeleteHeap(&pri->alignHeap);
+   if (pri->flat) {
+      DeleteHeap(&pri->flatHeap);
+      DeleteHeap(pri->arena);
+      DeleteHeap(pri->arena+1);
+   }
    DeleteHeap(&vri->heap);
    Dispose(&gcheap,vri);
 }
 
+/* Flat engine: second pass of token propagation for all instances. */
+/*  Instances attached or moved during the pass are appended to the  */
+/*  active array and so are stepped later in the same pass.          */
+static void FlatStepInst2(PRecInfo *pri)
+{
+   NetInst *inst;
+   int p;
+
+   for (p=0;p<pri->nfAct;p++) {
+      if ((inst=pri->fAct[p])==NULL) continue;
+      if (inst->max<pri->genThresh)
+         DetachInst(pri,inst->node);
+      else
+         StepInst2(pri,inst->node);
+   }
+}
+
 /* EXPORT->BeginRecNet: initialise network ready for recognition */
 void StartRecognition(VRecInfo *vri,Network *net,
                       float scale,LogFloat wordpen,float pscale)
 {
+   PRecInfo *pri;
    NetNode *node;
    NetInst *inst,*next;
    PreComp *pre;
@@ -2063,12 +2354,14 @@ void StartRecognition(VRecInfo *vri,Network *net,
                        
    for (node=pri->net->chain;node!=NULL;node=node->chain) node->inst=NULL;
    pri->net->final.inst=pri->net->initial.inst=NULL;
+   if (pri->flat)
+      FlatInitNet(pri);
    for(i=1,pre=pri->psi->sPre+1;i<=pri->psi->nsp;i++,pre++) pre->id=-1;
    for(i=1,pre=pri->psi->mPre+1;i<=pri->psi->nmp;i++,pre++) pre->id=-1;
 
    pri->tact=pri->nact=pri->frame=0;
 
-   AttachInst(&pri->net->initial);
+   AttachInst(pri,&pri->net->initial);
    inst=pri->net->initial.inst;
    inst->state->tok.like=inst->max=0.0;
    inst->state->tok.lm=0.0;
@@ -2080,28 +2373,33 @@ void StartRecognition(VRecInfo *vri,Network *net,
    pri->wordThresh=pri->genThresh=pri->nThresh=LSMALL;
    pri->genMaxNode=pri->wordMaxNode=NULL;
    pri->genMaxTok=pri->wordMaxTok=null_token;
-   for (inst=pri->head.link;inst!=NULL && inst->node!=NULL;inst=next)
-      if (inst->max<pri->genThresh) {
-         next=inst->link;
-         DetachInst(inst->node);
-      }
-      else {
-         pri->nxtInst=inst;
-         StepInst2(inst->node);
-         next=pri->nxtInst->link;
-      }
+   if (pri->flat)
+      FlatStepInst2(pri);
+   else
+      for (inst=pri->head.link;inst!=NULL && inst->node!=NULL;inst=next)
+         if (inst->max<pri->genThresh) {
+            next=inst->link;
+            DetachInst(pri,inst->node);
+         }
+         else {
+            pri->nxtInst=inst;
+            StepInst2(pri,inst->node);
+            next=pri->nxtInst->link;
+         }
 }
 
 void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform)
 {
+   PRecInfo *pri;
    NetInst *inst,*next;
    int j;
    float thresh;
 
    pri=vri->pri;
-   inXForm = xform; /* sepcifies the transform to use for this observation */
    if (pri==NULL)
       HError(8570,"ProcessObservation: Visible recognition info not initialised");
+   pri->inXForm = xform; /* sepcifies the transform to use for this observation */
+   pri->lcache = vri->lcache;
    if (pri->net==NULL)
       HError(8570,"ProcessObservation: Recognition not started");
 
@@ -2119,10 +2417,14 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
          if (VectorSize(obs->fv[j])!=pri->psi->hset->swidth[j])
             HError(8571,"ProcessObservation: incompatible stream widths for %d (%d vs %d)",
                    j,VectorSize(obs->fv[j]),pri->psi->hset->swidth[j]);
+   if (pri->lcache!=NULL)
+      CheckLikeCacheObs(pri->lcache,pri->frame,obs);
 
 
    /* Max model pruning is done initially in a separate pass */
 
+   if (pri->flat)
+      FlatCompact(pri);
    if (vri->maxBeam>0 && pri->nact>vri->maxBeam) {
       if (pri->nact>pri->qsn) {
          if (pri->qsn>0)
@@ -2130,17 +2432,30 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
          pri->qsn=(pri->nact*3)/2;
          pri->qsa=(LogFloat*) New(&vri->heap,pri->qsn*sizeof(LogFloat));
       }
-      for (inst=pri->head.link,j=0;inst!=NULL;inst=inst->link,j++)
-         pri->qsa[j]=inst->max;
+      if (pri->flat) {
+         for (j=0;j<pri->nfAct;j++)
+            pri->qsa[j]=pri->fAct[j]->max;
+         pri->qsa[j++]=LZERO;   /* as for tail of classic list */
+      }
+      else
+         for (inst=pri->head.link,j=0;inst!=NULL;inst=inst->link,j++)
+            pri->qsa[j]=inst->max;
       if (j>=vri->maxBeam) {
          qcksrtM(pri->qsa,0,j-1,vri->maxBeam);
          thresh=pri->qsa[vri->maxBeam];
-         if (thresh>LSMALL) 
-            for (inst=pri->head.link;inst->link!=NULL;inst=next) {
-               next=inst->link;
-               if (inst->max<thresh) 
-                  DetachInst(inst->node);
+         if (thresh>LSMALL) {
+            if (pri->flat) {
+               for (j=0;j<pri->nfAct;j++)
+                  if (pri->fAct[j]->max<thresh)
+                     DetachInst(pri,pri->fAct[j]->node);
             }
+            else
+               for (inst=pri->head.link;inst->link!=NULL;inst=next) {
+                  next=inst->link;
+                  if (inst->max<thresh) 
+                     DetachInst(pri,inst->node);
+               }
+         }
       }
    }   
    if (pri->psi->hset->hsKind==TIEDHS)
@@ -2148,9 +2463,15 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
    /* Pass 1 must calculate top of all beams - inc word end !! */
    pri->genMaxTok=pri->wordMaxTok=null_token;
    pri->genMaxNode=pri->wordMaxNode=NULL;
-   for (inst=pri->head.link,j=0;inst!=NULL;inst=inst->link,j++)
-      if (inst->node)
-         StepInst1(inst->node);
+   if (pri->flat) {
+      for (j=0;j<pri->nfAct;j++)
+         if (pri->fAct[j]!=NULL)
+            StepInst1(pri,pri->fAct[j]->node);
+   }
+   else
+      for (inst=pri->head.link,j=0;inst!=NULL;inst=inst->link,j++)
+         if (inst->node)
+            StepInst1(pri,inst->node);
    
    /* Not changing beam width for max model pruning */
    
@@ -2164,20 +2485,30 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
    }
    
    /* Pass 2 Performs external token propagation and pruning */
-   for (inst=pri->head.link,j=0;inst!=NULL && inst->node!=NULL;inst=next,j++)
-      if (inst->max<pri->genThresh) {
-         next=inst->link;
-         DetachInst(inst->node);
-      }
-      else {
-         pri->nxtInst=inst;
-         StepInst2(inst->node);
-         next=pri->nxtInst->link;
-      }
+   if (pri->flat)
+      FlatStepInst2(pri);
+   else
+      for (inst=pri->head.link,j=0;inst!=NULL && inst->node!=NULL;inst=next,j++)
+         if (inst->max<pri->genThresh) {
+            next=inst->link;
+            DetachInst(pri,inst->node);
+         }
+         else {
+            pri->nxtInst=inst;
+            StepInst2(pri,inst->node);
+            next=pri->nxtInst->link;
+         }
    
-   if ((pri->npth-pri->cpth) > vri->pCollThresh || 
-       (pri->nalign-pri->calign) > vri->aCollThresh)
-      CollectPaths();
+   if (pri->flat) {
+      /* Copying costs the number of live records so wait until at */
+      /*  least that many new ones have been created */
+      if ((pri->npth-pri->cpth) > vri->pCollThresh+pri->cpth || 
+          (pri->nalign-pri->calign) > vri->aCollThresh+pri->calign)
+         CollectArena(pri);
+   }
+   else if ((pri->npth-pri->cpth) > vri->pCollThresh || 
+            (pri->nalign-pri->calign) > vri->aCollThresh)
+      CollectPaths(pri);
 
    pri->tact+=pri->nact;
 
@@ -2201,7 +2532,7 @@ void TracePath(FILE *file,Path *path)
    if (path->align!=NULL) {
       fprintf(file,"{");
       for (align=path->align;align!=NULL;align=align->prev) {
-         ml=FindMacroStruct(pri->psi->hset,'h',align->node->info.hmm);
+         ml=FindMacroStruct(traceSet,'h',align->node->info.hmm);
          if (ml==NULL) fprintf(file," !*!");
          else fprintf(file," %s",ml->id->name);
          if (align->state>0) fprintf(file,"[%d]",align->state);
@@ -2213,6 +2544,7 @@ void TracePath(FILE *file,Path *path)
 /* EXPORT->CompleteRecognition: Free unused data and return traceback */
 Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
 {
+   PRecInfo *pri;
    Lattice *lat = NULL;
    NetInst *inst;
    TokenSet dummy;
@@ -2234,7 +2566,7 @@ Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
       lat=NULL;vri->noTokenSurvived=TRUE;
       if (pri->net->final.inst!=NULL)
          if (pri->net->final.inst->exit->tok.path!=NULL)
-            lat=CreateLattice(heap,pri->net->final.inst->exit,vri->frameDur),
+            lat=CreateLattice(pri,heap,pri->net->final.inst->exit,vri->frameDur),
                vri->noTokenSurvived=FALSE;
      
       if (lat==NULL && forceOutput) {
@@ -2244,14 +2576,24 @@ Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
          dummy.set[0].like=0.0;
          dummy.set[0].path=dummy.tok.path;
          dummy.set[0].lm=dummy.tok.lm;
-         lat=CreateLattice(heap,&dummy,vri->frameDur);
+         lat=CreateLattice(pri,heap,&dummy,vri->frameDur);
       }
    }
 
    /* Now dispose of everything apart from the answer */
-   for (inst=pri->head.link;inst!=NULL;inst=inst->link)
-      if (inst->node)
-         inst->node->inst=NULL;
+   if (pri->flat) {
+      for (i=0;i<pri->nfAct;i++)
+         if (pri->fAct[i]!=NULL)
+            pri->fAct[i]->node->inst=NULL;
+      pri->nfAct=0;
+      ResetHeap(pri->arena);
+      ResetHeap(pri->arena+1);
+      pri->curArena=0;
+   }
+   else
+      for (inst=pri->head.link;inst!=NULL;inst=inst->link)
+         if (inst->node)
+            inst->node->inst=NULL;
 
    /* Remove everything from active lists */
 
@@ -2301,12 +2643,22 @@ void SetPruningLevels(VRecInfo *vri,int maxBeam,LogFloat genBeam,
 
 /* Lattice output routines.  Note lattices need to be sorted before output */
 
+/* The N-best lists are generated by an A* search in which the partial */
+/*  paths are held in a priority queue.  Partial paths with the same    */
+/*  word sequence ending at the same node can only produce duplicates  */
+/*  of the best of them, so only that one is kept.  Similarly a node   */
+/*  need not be expanded for more than N different word sequences.     */
+/*  Entries which are not needed any more are returned to a pool.      */
+
 typedef struct nbestentry NBestEntry;
+typedef struct nbesthist NBestHist;
+typedef struct nbestdom NBestDom;
 
 struct nbestentry {
-   NBestEntry *link;
-   NBestEntry *knil;
-   NBestEntry *prev;
+   NBestEntry *prev;        /* Entry for the preceding arc */
+   NBestHist *hist;         /* Word sequence up to end of larc */
+   int nref;                /* Number of entries with prev==this + answer */
+   int seq;                 /* Creation order, newest first on equal score */
 
    double score;
    double like;
@@ -2314,6 +2666,33 @@ struct nbestentry {
    LArc *larc;
 };
 
+struct nbesthist {
+   NBestHist *prev;         /* Word sequence without the last word */
+   Word word;               /* Last word (including !NULL) */
+   NBestHist *chain;        /* Next history in hash chain */
+   NBestDom *dom;           /* Best entry at each node reached */
+   Boolean done;            /* Already output as an answer */
+};
+
+struct nbestdom {
+   LNode *lnode;            /* Node reached by the word sequence */
+   double like;             /* Best like of the entries at lnode */
+   int seq;                 /* The entry with that like */
+   Boolean expanded;        /* Node already expanded for this sequence */
+   NBestDom *next;
+};
+
+typedef struct {
+   MemHeap stack;           /* Arrays, histories and dom records */
+   MemHeap pool;            /* NBestEntry records */
+   NBestEntry **q;          /* Priority queue array[1..nq] */
+   int nq;                  /* Entries in queue */
+   int qSize;               /* Size of q */
+   NBestHist **hTab;        /* History hash table */
+   unsigned int hMask;      /* Size of hTab - 1 */
+   int seq;                 /* Next entry sequence number */
+} NBestSearch;
+
 static void MarkBack(LNode *ln,int *nn)
 {
    LArc *la;
@@ -2324,34 +2703,138 @@ static void MarkBack(LNode *ln,int *nn)
    ln->n=(*nn)++;
 }
 
-static Boolean WordMatch(NBestEntry *cmp,NBestEntry *ans)
+/* NBestBefore: TRUE if e is popped before f */
+static Boolean NBestBefore(NBestEntry *e,NBestEntry *f)
+{
+   return (e->score>f->score || (e->score==f->score && e->seq>f->seq));
+}
+
+/* PushNBest: add e to the priority queue */
+static void PushNBest(NBestSearch *ns,NBestEntry *e)
+{
+   NBestEntry **q;
+   int i,j;
+
+   if (ns->nq==ns->qSize) {
+      q=(NBestEntry**) New(&ns->stack,sizeof(NBestEntry*)*ns->qSize*2);
+      memcpy(q,ns->q+1,sizeof(NBestEntry*)*ns->nq);
+      ns->q=q-1; ns->qSize*=2;
+   }
+   for (i=++ns->nq;i>1;i=j) {
+      j=i/2;
+      if (!NBestBefore(e,ns->q[j])) break;
+      ns->q[i]=ns->q[j];
+   }
+   ns->q[i]=e;
+}
+
+/* PopNBest: remove and return the best entry in the queue */
+static NBestEntry *PopNBest(NBestSearch *ns)
 {
-   if (cmp==ans) return(TRUE);
-   else if (cmp==NULL || ans==NULL) return(FALSE);
-   else if (cmp->larc->end->word!=ans->larc->end->word) return(FALSE);
-   else return(WordMatch(cmp->prev,ans->prev));
+   NBestEntry *best,*last;
+   int i,j;
+
+   best=ns->q[1]; last=ns->q[ns->nq--];
+   for (i=1;(j=2*i)<=ns->nq;i=j) {
+      if (j<ns->nq && NBestBefore(ns->q[j+1],ns->q[j])) j++;
+      if (!NBestBefore(ns->q[j],last)) break;
+      ns->q[i]=ns->q[j];
+   }
+   ns->q[i]=last;
+   return best;
+}
+
+/* FindNBestHist: return the history of word following prev */
+static NBestHist *FindNBestHist(NBestSearch *ns,NBestHist *prev,Word word)
+{
+   NBestHist *h;
+   unsigned int k;
+
+   k=((unsigned int)(((size_t)prev)>>3)*31u+
+      (unsigned int)(((size_t)word)>>3))&ns->hMask;
+   for (h=ns->hTab[k];h!=NULL;h=h->chain)
+      if (h->prev==prev && h->word==word) return h;
+   h=(NBestHist*) New(&ns->stack,sizeof(NBestHist));
+   h->prev=prev; h->word=word;
+   h->dom=NULL; h->done=FALSE;
+   h->chain=ns->hTab[k]; ns->hTab[k]=h;
+   return h;
+}
+
+/* FindNBestDom: return the record of the best entry for hist at ln */
+static NBestDom *FindNBestDom(NBestSearch *ns,NBestHist *hist,LNode *ln)
+{
+   NBestDom *d;
+
+   for (d=hist->dom;d!=NULL;d=d->next)
+      if (d->lnode==ln) return d;
+   d=(NBestDom*) New(&ns->stack,sizeof(NBestDom));
+   d->lnode=ln; d->like=LZERO; d->seq=-1; d->expanded=FALSE;
+   d->next=hist->dom; hist->dom=d;
+   return d;
+}
+
+/* NewNBestEntry: create entry for arc la after prev unless it is */
+/*  dominated by an existing entry                                */
+static NBestEntry *NewNBestEntry(NBestSearch *ns,NBestEntry *prev,LArc *la,
+                                 double like,double score)
+{
+   NBestEntry *e;
+   NBestHist *hist;
+   NBestDom *d;
+
+   hist=FindNBestHist(ns,(prev==NULL)?NULL:prev->hist,la->end->word);
+   d=FindNBestDom(ns,hist,la->end);
+   if (d->seq>=0 && like<=d->like) return NULL;
+   e=(NBestEntry*) New(&ns->pool,sizeof(NBestEntry));
+   e->prev=prev; e->hist=hist;
+   e->nref=0; e->seq=ns->seq++;
+   e->score=score; e->like=like;
+   e->lnode=la->end; e->larc=la;
+   d->like=like; d->seq=e->seq;
+   if (prev!=NULL) prev->nref++;
+   PushNBest(ns,e);
+   return e;
+}
+
+/* FreeNBestEntry: return e and any predecessors no longer needed */
+/*  to the pool                                                   */
+static void FreeNBestEntry(NBestSearch *ns,NBestEntry *e)
+{
+   NBestEntry *prev;
+
+   while (e!=NULL && e->nref==0) {
+      prev=e->prev;
+      Dispose(&ns->pool,e);
+      if (prev!=NULL) prev->nref--;
+      e=prev;
+   }
 }
 
 /* EXPORT->TranscriptionFromLattice: Generate NBest labels from lattice */
 Transcription *TranscriptionFromLattice(MemHeap *heap,Lattice *lat,int N)
 {
+   NBestSearch ns;
    Transcription *trans;
    LabList *ll;
    LLink lab,where;
    LabId model;
    Word word, nullWord;
    Pron pron;
-   NBestEntry head,tail,**ans,*best,*newNBE,*pos;
+   NBestEntry **ans,*best,*pos;
+   NBestDom *d;
    LArc *la;
    LNode *ln;
    LAlign *lal;
    LogFloat lm,modlk;
    double score,like,start,end;
    Boolean states,models;
-   int i,j,n,nAux,*order;
-   int nexp=0,nent=0;
+   int i,j,n,nAux,*order,*nodeExp;
+   int nexp=0;
 
-   ans=(NBestEntry**) New(&gstack,sizeof(NBestEntry*)*N);ans--;
+   CreateHeap(&ns.stack,"NBest stack",MSTAK,1,1.0,8000,80000);
+   CreateHeap(&ns.pool,"NBest pool",MHEAP,sizeof(NBestEntry),1.0,256,8192);
+   ans=(NBestEntry**) New(&ns.stack,sizeof(NBestEntry*)*N);ans--;
 
    for (i=0,ln=lat->lnodes;i<lat->nn;i++,ln++) {
       if (ln->foll==NULL) ln->score=0.0;
@@ -2362,7 +2845,7 @@ Transcription *TranscriptionFromLattice(MemHeap *heap,Lattice *lat,int N)
    for (i=0,ln=lat->lnodes;i<lat->nn;i++,ln++)
       if (ln->n==-1) MarkBack(ln,&n);
 
-   order=(int*) New(&gstack, sizeof(int)*lat->nn);
+   order=(int*) New(&ns.stack, sizeof(int)*lat->nn);
    for (i=0,ln=lat->lnodes;i<lat->nn;i++,ln++)
       order[ln->n]=i;
    for (i=0,la=lat->larcs;i<lat->na;i++,la++) 
@@ -2375,13 +2858,17 @@ Transcription *TranscriptionFromLattice(MemHeap *heap,Lattice *lat,int N)
          if (score>la->start->score) la->start->score=score;
       }
    }
-   Dispose(&gstack,order);
  
    /* Then do NBest AStar for real answers */
 
-   head.link=&tail;head.knil=NULL;
-   tail.link=NULL;tail.knil=&head;
-   tail.score=head.score=LZERO;
+   ns.qSize=64; ns.nq=0; ns.seq=0;
+   ns.q=(NBestEntry**) New(&ns.stack,sizeof(NBestEntry*)*ns.qSize);ns.q--;
+   for (i=1;i<2*lat->na && i<65536;i*=2);
+   ns.hMask=i-1;
+   ns.hTab=(NBestHist**) New(&ns.stack,sizeof(NBestHist*)*i);
+   for (j=0;j<i;j++) ns.hTab[j]=NULL;
+   nodeExp=(int*) New(&ns.stack,sizeof(int)*lat->nn);
+   for (i=0;i<lat->nn;i++) nodeExp[i]=0;
 
    for (i=0,ln=lat->lnodes;i<lat->nn;i++,ln++) {
       if (ln->pred!=NULL) continue;
@@ -2391,54 +2878,47 @@ Transcription *TranscriptionFromLattice(MemHeap *heap,Lattice *lat,int N)
          like=LArcTotLike(lat,la);
          score=like+la->end->score;
          if (score<LSMALL) continue;
-         newNBE=(NBestEntry*) New(&gstack,sizeof(NBestEntry));
-         newNBE->score=score;
-         newNBE->like=like;
-         newNBE->lnode=la->end;
-         newNBE->larc=la;
-         newNBE->prev=NULL;
-         for (pos=head.link;score<pos->score;pos=pos->link);
-         newNBE->knil=pos->knil;newNBE->link=pos;
-         newNBE->knil->link=newNBE->link->knil=newNBE;
-      }
-   }
-   for (n=0,best=head.link;n<N && best!=&tail;best=head.link) {
-      if (head.link==&tail) break;
-      best=head.link;
-      best->link->knil=best->knil;
-      best->knil->link=best->link;
-      nent--;
+         NewNBestEntry(&ns,NULL,la,like,score);
+      }
+   }
+   for (n=0;n<N && ns.nq>0;) {
+      best=PopNBest(&ns);
 
+      /* Skip entries superseded by a better one with the same words */
+      d=FindNBestDom(&ns,best->hist,best->lnode);
+      if (best->seq!=d->seq) {
+         FreeNBestEntry(&ns,best);
+         continue;
+      }
       if (best->lnode->foll!=NULL) {
+         if (!d->expanded) {
+            if (nodeExp[best->lnode-lat->lnodes]>=N) {
+               FreeNBestEntry(&ns,best);
+               continue;
+            }
+            nodeExp[best->lnode-lat->lnodes]++;
+            d->expanded=TRUE;
+         }
          nexp++;
          for (la=best->lnode->foll;la!=NULL;la=la->farc) {
             like=best->like+LArcTotLike(lat,la);
             score=like+la->end->score;
             if (score<LSMALL) continue;
-            newNBE=(NBestEntry*) New(&gstack,sizeof(NBestEntry));
-            newNBE->score=score;
-            newNBE->like=like;
-            newNBE->lnode=la->end;
-            newNBE->larc=la;
-            newNBE->prev=best;
-            for (pos=head.link;score<pos->score;pos=pos->link);
-            newNBE->knil=pos->knil;newNBE->link=pos;
-            newNBE->knil->link=newNBE->link->knil=newNBE;
-            nent++;
+            NewNBestEntry(&ns,best,la,like,score);
          }
+         FreeNBestEntry(&ns,best);
          continue;
       }
-      for (i=1;i<=n;i++)
-         if (WordMatch(best,ans[i])) {
-            best=NULL;
-            break;
-         }
-      if (best!=NULL) {
-         ans[++n]=best;
+      if (best->hist->done) {
+         FreeNBestEntry(&ns,best);
+         continue;
       }
+      best->hist->done=TRUE;
+      best->nref++;
+      ans[++n]=best;
    }
 
-   nullWord=GetWord(lat->voc, GetLabId("!NULL", FALSE), FALSE);
+   nullWord=lat->voc->nullWord;
    trans=CreateTranscription(heap);
    for (i=1;i<=n;i++) {
       states=models=FALSE;
@@ -2517,10 +2997,11 @@ Transcription *TranscriptionFromLattice(MemHeap *heap,Lattice *lat,int N)
       AddLabelList(ll,trans);
    }
 
-   ans++;Dispose(&gstack,ans);
+   DeleteHeap(&ns.pool);
+   DeleteHeap(&ns.stack);
 
    if (trace&T_NGEN)
-      printf("HLat:      %d NBest generation %d exp, %d ent\n",N,nexp,nent);
+      printf("HLat:      %d NBest generation %d exp, %d ent\n",N,nexp,ns.seq);
 
    return(trans);
 }
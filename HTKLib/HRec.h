@@ -148,6 +148,7 @@ struct vrecinfo
    LogFloat tmBeam;         /* Beam width for tied mixtures */
    int pCollThresh;         /* Max path records created before collection */
    int aCollThresh;         /* Max align records created before collection */
+   LikeCache *lcache;       /* Cross-utterance likelihood cache (or NULL) */
 
    /* Status information - readable every frame */
 
@@ -199,6 +200,11 @@ void FreePSetInfo(PSetInfo *psi);
    Functions specific to each recogniser started
    Each recogniser that needs to be run in parallel must be separately
    initialised
+   StartRecognition and ProcessObservation may be called from
+   different threads for recognisers with separate PSetInfo, since the
+   PSetInfo holds the output probability caches.  CompleteRecognition
+   adds the words to the label table so it must be called by one
+   thread at a time.
 */
 
 VRecInfo *InitVRecInfo(PSetInfo *psi,int nToks,Boolean models,Boolean states);
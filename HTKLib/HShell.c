@@ -97,6 +97,7 @@ char *hshell_vc_id = "$Id: HShell.c,v 1.16 2012/12/22 07:01:28 uratec Exp $";
 static int trace = 0;
 #define T_IOP   0002       /* i/o input via FOpen */
 #define T_EXF   0004       /* extended file name processing */
+#define T_ARC   0010       /* archive file access */
 
 /* --------------------- Global Variables ------------------- */
 
@@ -1023,6 +1024,272 @@ void FClose(FILE *f, Boolean isPipe)
       HError (5010, "FClose: closing file failed");
 }
 
+/* -------------------- Archive Files -------------------- */
+
+#define ARCSEP ".ark:"          /* separates archive name from key */
+#define ARCBUFSIZE 1048576      /* stdio buffer for archive reads */
+
+typedef struct {
+   char *key;                   /* name of entry */
+   long off;                    /* byte offset of entry in archive */
+} ArcEntry;
+
+typedef struct _ArcFile {
+   FILE *f;                     /* open archive file */
+   char *buf;                   /* stdio buffer for f */
+   Boolean busy;                /* f is in use by a caller */
+   struct _ArcFile *next;
+} ArcFile;
+
+typedef struct {
+   char name[MAXFNAMELEN];      /* name of archive (NULL string if none) */
+   ArcFile *files;              /* files open on this archive */
+   int nEntries;                /* number of entries in index */
+   ArcEntry *entry;             /* entries in archive order */
+   ArcEntry **sorted;           /* entries in key order */
+   int next;                    /* entry following last one opened */
+} ArcIn;
+
+typedef struct {
+   char name[MAXFNAMELEN];      /* name of archive (NULL string if none) */
+   FILE *f;                     /* archive file */
+   FILE *idx;                   /* index file */
+} ArcOut;
+
+typedef struct _ArcName {
+   char *name;                  /* archive created by this process */
+   struct _ArcName *next;
+} ArcName;
+
+static ArcIn arcIn;             /* archive currently open for reading */
+static ArcFile *arcOld = NULL;  /* busy files of archives since closed */
+static ArcOut arcOut;           /* archive currently open for writing */
+static ArcName *arcMade = NULL; /* archives already written to */
+
+/* SplitArchiveName: split fname into archive name and key */
+static Boolean SplitArchiveName(char *fname, char *arcfn, char *key)
+{
+   char *p;
+   int len;
+
+   if ((p=strstr(fname,ARCSEP)) == NULL) return FALSE;
+   len = p - fname + strlen(ARCSEP) - 1;
+   if (len >= MAXFNAMELEN-4 || strlen(p+strlen(ARCSEP)) >= MAXSTRLEN)
+      return FALSE;
+   strncpy(arcfn,fname,len); arcfn[len] = '\0';
+   strcpy(key,p+strlen(ARCSEP));
+   return (*key != '\0') ? TRUE : FALSE;
+}
+
+/* EXPORT->IsArchiveName: true if fname is of the form arc.ark:key */
+Boolean IsArchiveName(char *fname)
+{
+   char arcfn[MAXFNAMELEN],key[MAXSTRLEN];
+
+   return SplitArchiveName(fname,arcfn,key);
+}
+
+/* CmpArcEntry: qsort/bsearch comparison of entry keys */
+static int CmpArcEntry(const void *a, const void *b)
+{
+   return strcmp((*(ArcEntry **)a)->key,(*(ArcEntry **)b)->key);
+}
+
+/* FreeArcFile: close archive file a and free it */
+static void FreeArcFile(ArcFile *a)
+{
+   fclose(a->f); free(a->buf); free(a);
+}
+
+/* CloseArchive: release the archive currently open for reading.  Files
+   still in use are kept in arcOld until CloseArchiveEntry */
+static void CloseArchive(void)
+{
+   ArcFile *a,*next;
+   int i;
+
+   if (arcIn.name[0] == '\0') return;
+   for (a=arcIn.files; a!=NULL; a=next) {
+      next = a->next;
+      if (a->busy) {
+         a->next = arcOld; arcOld = a;
+      }
+      else
+         FreeArcFile(a);
+   }
+   for (i=0; i<arcIn.nEntries; i++) free(arcIn.entry[i].key);
+   free(arcIn.entry); free(arcIn.sorted);
+   arcIn.files = NULL; arcIn.name[0] = '\0';
+   arcIn.nEntries = arcIn.next = 0;
+   arcIn.entry = NULL; arcIn.sorted = NULL;
+}
+
+/* LoadArchive: open archive arcfn and load its index */
+static ReturnStatus LoadArchive(char *arcfn)
+{
+   FILE *idx;
+   char idxfn[MAXFNAMELEN],line[MAXSTRLEN+64],key[MAXSTRLEN+64];
+   long off;
+   int i,size = 0;
+
+   CloseArchive();
+   strcpy(idxfn,arcfn); strcat(idxfn,".idx");
+   if ((idx=fopen(idxfn,"r")) == NULL) {
+      HRError(5010,"LoadArchive: cannot open archive index %s",idxfn);
+      return(FAIL);
+   }
+   while (fgets(line,MAXSTRLEN+64,idx) != NULL) {
+      if (sscanf(line,"%s %ld",key,&off) != 2) continue;
+      if (arcIn.nEntries == size) {
+         size = (size==0) ? 1024 : 2*size;
+         arcIn.entry = (ArcEntry *) realloc(arcIn.entry,size*sizeof(ArcEntry));
+         if (arcIn.entry == NULL)
+            HError(5014,"LoadArchive: cannot allocate index for %s",arcfn);
+      }
+      arcIn.entry[arcIn.nEntries].key = (char *) malloc(strlen(key)+1);
+      strcpy(arcIn.entry[arcIn.nEntries].key,key);
+      arcIn.entry[arcIn.nEntries].off = off;
+      ++arcIn.nEntries;
+   }
+   fclose(idx);
+   arcIn.sorted = (ArcEntry **) malloc((arcIn.nEntries+1)*sizeof(ArcEntry *));
+   for (i=0; i<arcIn.nEntries; i++) arcIn.sorted[i] = arcIn.entry+i;
+   qsort(arcIn.sorted,arcIn.nEntries,sizeof(ArcEntry *),CmpArcEntry);
+   strcpy(arcIn.name,arcfn);
+   if (trace&T_ARC)
+      printf("HShell: Loaded index of %d entries for archive %s\n",
+             arcIn.nEntries,arcfn);
+   return(SUCCESS);
+}
+
+/* GetArcFile: return a file of the current archive not in use */
+static ArcFile *GetArcFile(void)
+{
+   ArcFile *a;
+
+   for (a=arcIn.files; a!=NULL; a=a->next)
+      if (!a->busy) return a;
+   a = (ArcFile *) malloc(sizeof(ArcFile));
+   if ((a->f=fopen(arcIn.name,"rb")) == NULL) {
+      free(a);
+      HRError(5010,"GetArcFile: cannot open archive %s",arcIn.name);
+      return NULL;
+   }
+   /* Large buffer so that sequential entries come from a few big reads */
+   if ((a->buf=(char *) malloc(ARCBUFSIZE)) != NULL)
+      setvbuf(a->f,a->buf,_IOFBF,ARCBUFSIZE);
+   a->busy = FALSE;
+   a->next = arcIn.files; arcIn.files = a;
+   return a;
+}
+
+/* EXPORT->OpenArchiveEntry: return archive positioned at entry fname */
+FILE *OpenArchiveEntry(char *fname)
+{
+   char arcfn[MAXFNAMELEN],key[MAXSTRLEN];
+   ArcEntry e,*ep,**found;
+   ArcFile *a;
+
+   if (!SplitArchiveName(fname,arcfn,key)) {
+      HRError(5010,"OpenArchiveEntry: %s is not an archive entry",fname);
+      return NULL;
+   }
+   if (strcmp(arcIn.name,arcfn) != 0)
+      if (LoadArchive(arcfn)<SUCCESS) return NULL;
+   /* Scripts normally follow archive order so try next entry first */
+   if (arcIn.next < arcIn.nEntries && 
+       strcmp(arcIn.entry[arcIn.next].key,key) == 0)
+      ep = arcIn.entry+arcIn.next;
+   else {
+      e.key = key; ep = &e;
+      found = (ArcEntry **) bsearch(&ep,arcIn.sorted,arcIn.nEntries,
+                                    sizeof(ArcEntry *),CmpArcEntry);
+      if (found == NULL) {
+         HRError(5010,"OpenArchiveEntry: no entry %s in archive %s",key,arcfn);
+         return NULL;
+      }
+      ep = *found;
+   }
+   arcIn.next = ep - arcIn.entry + 1;
+   if ((a = GetArcFile()) == NULL) return NULL;
+   if (fseek(a->f,ep->off,SEEK_SET) != 0) {
+      HRError(5010,"OpenArchiveEntry: cannot seek to %s in %s",key,arcfn);
+      return NULL;
+   }
+   a->busy = TRUE;
+   if (trace&T_ARC)
+      printf("HShell: Archive entry %s at %ld in %s\n",key,ep->off,arcfn);
+   return a->f;
+}
+
+/* EXPORT->CloseArchiveEntry: release file f returned by OpenArchiveEntry */
+void CloseArchiveEntry(FILE *f)
+{
+   ArcFile *a,**ap;
+
+   for (a=arcIn.files; a!=NULL; a=a->next)
+      if (a->f == f) {
+         a->busy = FALSE; return;
+      }
+   for (ap=&arcOld; *ap!=NULL; ap=&(*ap)->next)
+      if ((*ap)->f == f) {
+         a = *ap; *ap = a->next;
+         FreeArcFile(a); return;
+      }
+   HError(5010,"CloseArchiveEntry: file is not an open archive entry");
+}
+
+/* EXPORT->CreateArchiveEntry: return archive positioned for new entry fname */
+FILE *CreateArchiveEntry(char *fname)
+{
+   char arcfn[MAXFNAMELEN],idxfn[MAXFNAMELEN],key[MAXSTRLEN];
+   ArcName *a;
+
+   if (!SplitArchiveName(fname,arcfn,key)) {
+      HRError(5010,"CreateArchiveEntry: %s is not an archive entry",fname);
+      return NULL;
+   }
+   if (arcOut.f == NULL || strcmp(arcOut.name,arcfn) != 0) {
+      CloseArchiveOutput();
+      /* Archives are created afresh but appended to if revisited */
+      for (a=arcMade; a!=NULL; a=a->next)
+         if (strcmp(a->name,arcfn) == 0) break;
+      if (a == NULL) {
+         a = (ArcName *) malloc(sizeof(ArcName));
+         a->name = (char *) malloc(strlen(arcfn)+1);
+         strcpy(a->name,arcfn);
+         a->next = arcMade; arcMade = a;
+         a = NULL;
+      }
+      strcpy(idxfn,arcfn); strcat(idxfn,".idx");
+      if ((arcOut.f=fopen(arcfn,(a==NULL)?"wb":"ab")) == NULL) {
+         HRError(5010,"CreateArchiveEntry: cannot create archive %s",arcfn);
+         return NULL;
+      }
+      if ((arcOut.idx=fopen(idxfn,(a==NULL)?"w":"a")) == NULL) {
+         fclose(arcOut.f); arcOut.f = NULL;
+         HRError(5010,"CreateArchiveEntry: cannot create index %s",idxfn);
+         return NULL;
+      }
+      fseek(arcOut.f,0,SEEK_END);
+      strcpy(arcOut.name,arcfn);
+   }
+   fprintf(arcOut.idx,"%s %ld\n",key,ftell(arcOut.f));
+   if (trace&T_ARC)
+      printf("HShell: Archive entry %s at %ld in %s\n",
+             key,ftell(arcOut.f),arcfn);
+   return arcOut.f;
+}
+
+/* EXPORT->CloseArchiveOutput: close the archive being written, if any */
+void CloseArchiveOutput(void)
+{
+   if (arcOut.f == NULL) return;
+   if (fclose(arcOut.f) != 0 || fclose(arcOut.idx) != 0)
+      HError(5010,"CloseArchiveOutput: closing archive %s failed",arcOut.name);
+   arcOut.f = arcOut.idx = NULL; arcOut.name[0] = '\0';
+}
+
 
 
 /* EXPORT->InitSource: initialise a source */
@@ -1808,6 +2075,8 @@ char * NameOf(char *fn, char *s)
    char *t;
 
    CheckFn(fn);
+   if (IsArchiveName(fn))       /* name of an archive entry is its key */
+      fn = strstr(fn,ARCSEP) + strlen(ARCSEP);
    t = strrchr(fn,PATHCHAR);
    if (t == NULL) 
       t = fn;
@@ -1835,6 +2104,8 @@ char * PathOf(char *fn, char *s)
    
    CheckFn(fn);
    strcpy(s,fn);
+   if (IsArchiveName(s))        /* path of an archive entry is the archive's */
+      *(strstr(s,ARCSEP)) = '\0';
    t = strrchr(s,PATHCHAR);
    if (t == NULL) 
       *s='\0';
@@ -2118,6 +2389,8 @@ ReturnStatus InitShell(int argc, char *argv[], char *ver, char *sccs)
 void ResetShell (void)
 {
    free(arglist);
+   CloseArchive();
+   CloseArchiveOutput();
    
    return;
 }
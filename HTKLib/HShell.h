@@ -416,6 +416,43 @@ void FClose(FILE *f, Boolean isPipe);
    Close the given file or pipe
 */
 
+Boolean IsArchiveName(char *fname);
+/*
+   Return true if fname names an entry in an archive.  Archive
+   entries have the form
+             archive.ark:key
+   where archive.ark holds a sequence of files and archive.ark.idx
+   is a text index giving the key and byte offset of each one.
+*/
+
+FILE *OpenArchiveEntry(char *fname);
+/*
+   Return the archive holding entry fname positioned at the start
+   of the entry, or NULL if it cannot be found.  The index is kept
+   until an entry in another archive is requested.  Each entry open
+   at the same time gets its own file, and files are reused once
+   released, so the returned file must be released by
+   CloseArchiveEntry rather than closed.
+*/
+
+void CloseArchiveEntry(FILE *f);
+/*
+   Release the file f returned by OpenArchiveEntry.
+*/
+
+FILE *CreateArchiveEntry(char *fname);
+/*
+   Return the archive for fname positioned at the end, after adding
+   the key and offset of the new entry to the index.  An archive is 
+   truncated the first time it is written by a process.  The returned
+   file must not be closed by the caller.
+*/
+
+void CloseArchiveOutput(void);
+/*
+   Close the archive currently being written, if any.
+*/
+
 ReturnStatus InitSource(char *fname, Source *src, IOFilter filter);
 /*
    Initialise a text source using file fname and filter - returns
@@ -567,7 +604,8 @@ char * ExtnOf(char *fn, char *s);
    Given a filename of the general form "path/n.x" in fn, the above
    functions return "n.x", "n", "x" and "path/", respectively. In each case,
    the string is returned in s which must be large enough and s is returned
-   as the function result.
+   as the function result.  For an archive entry "path/a.ark:n.x" the
+   name is taken from the key, and the path is that of the archive.
 */
 
 char * MakeFN(char *fn, char *path, char *ext, char *s);
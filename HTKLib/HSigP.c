@@ -855,33 +855,33 @@ void UnWeightCepstrum(Vector c, int start, int count, int cepLiftering)
 /* EXPORT->FZeroMean: Zero mean the given data sequence */
 void FZeroMean(float *data, int vSize, int n, int step)
 {
-   double sum;
-   float *fp,mean;
+   double *sum;
+   float *fp,*mean;
    int i,j;
 
-   for (i=0; i<vSize; i++){
-      /* find mean over i'th component */
-      sum = 0.0;
-      fp = data+i;
-      for (j=0;j<n;j++){
-         sum += *fp; fp += step;
-      }
-      mean = sum / (double)n;
-      /* subtract mean from i'th components */
-      fp = data+i;
-      for (j=0;j<n;j++){
-         *fp -= mean; fp += step;
-      }
-   }
+   if (vSize<=0 || n<=0) return;
+   /* Work along rows so that the inner loops are contiguous */
+   sum = (double *)New(&gstack,vSize*sizeof(double));
+   mean = (float *)New(&gstack,vSize*sizeof(float));
+   for (i=0; i<vSize; i++) sum[i] = 0.0;
+   for (j=0,fp=data; j<n; j++,fp+=step)
+      for (i=0; i<vSize; i++) sum[i] += fp[i];
+   for (i=0; i<vSize; i++) mean[i] = sum[i] / (double)n;
+   /* subtract mean from each row */
+   for (j=0,fp=data; j<n; j++,fp+=step)
+      for (i=0; i<vSize; i++) fp[i] -= mean[i];
+   Dispose(&gstack,sum);
 }
 
 /* Regression: add regression vector at +offset from source vector.  If head
-   or tail is less than delwin then duplicate first/last vector to compensate */
+   or tail is less than delwin then duplicate first/last vector to compensate.
+   The frames used depend only on the row, so each row is computed with
+   contiguous inner loops over its vSize coefficients. */
 static void Regress(float *data, int vSize, int n, int step, int offset,
                     int delwin, int head, int tail, Boolean simpleDiffs)
 {
-   float *fp,*fp1,*fp2, *back, *forw;
-   float sum, sigmaT2;
+   float *fp,*fp2, *back, *forw;
+   float sigmaT2, tt;
    int i,t,j;
    
    sigmaT2 = 0.0;
@@ -890,20 +890,25 @@ static void Regress(float *data, int vSize, int n, int step, int offset,
    sigmaT2 *= 2.0;
    fp = data;
    for (i=1;i<=n;i++){
-      fp1 = fp; fp2 = fp+offset;
-      for (j=1;j<=vSize;j++){
-         back = forw = fp1; sum = 0.0;
-         for (t=1;t<=delwin;t++) {
-            if (head+i-t > 0)     back -= step;
-            if (tail+n-i+1-t > 0) forw += step;
-            if (!simpleDiffs) sum += t * (*forw - *back);
+      fp2 = fp+offset;
+      back = forw = fp;
+      if (!simpleDiffs)
+         for (j=0;j<vSize;j++) fp2[j] = 0.0;
+      for (t=1;t<=delwin;t++) {
+         if (head+i-t > 0)     back -= step;
+         if (tail+n-i+1-t > 0) forw += step;
+         if (!simpleDiffs) {
+            tt = t;
+            for (j=0;j<vSize;j++)
+               fp2[j] += tt * (forw[j] - back[j]);
          }
-         if (simpleDiffs)
-            *fp2 = (*forw - *back) / (2*delwin);
-         else
-            *fp2 = sum / sigmaT2;
-         ++fp1; ++fp2;
       }
+      if (simpleDiffs)
+         for (j=0;j<vSize;j++)
+            fp2[j] = (forw[j] - back[j]) / (2*delwin);
+      else
+         for (j=0;j<vSize;j++)
+            fp2[j] /= sigmaT2;
       fp += step;
    }
 }
@@ -0,0 +1,288 @@
+/* ----------------------------------------------------------------- */
+/*           The HMM-Based Speech Synthesis System (HTS)             */
+/*           developed by HTS Working Group                          */
+/*           http://hts.sp.nitech.ac.jp/                             */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/*  Copyright (c) 2012  Nagoya Institute of Technology               */
+/*                           Department of Computer Science          */
+/*                                                                   */
+/* All rights reserved.                                              */
+/*                                                                   */
+/* Redistribution and use in source and binary forms, with or        */
+/* without modification, are permitted provided that the following   */
+/* conditions are met:                                               */
+/*                                                                   */
+/* - Redistributions of source code must retain the above copyright  */
+/*   notice, this list of conditions and the following disclaimer.   */
+/* - Redistributions in binary form must reproduce the above         */
+/*   copyright notice, this list of conditions and the following     */
+/*   disclaimer in the documentation and/or other materials provided */
+/*   with the distribution.                                          */
+/* - Neither the name of the HTS working group nor the names of its  */
+/*   contributors may be used to endorse or promote products derived */
+/*   from this software without specific prior written permission.   */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND            */
+/* CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,       */
+/* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF          */
+/* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE          */
+/* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/* ----------------------------------------------------------------- */
+/*         File: HThreads.c:  Worker Thread Pool                     */
+/* ----------------------------------------------------------------- */
+
+char *hthreads_version = "!HVER!HThreads: 2.2 [NIT 07/07/11]";
+char *hthreads_vc_id = "$Id: HThreads.c,v 1.0 $";
+
+#include "HShell.h"
+#include "HMem.h"
+#include "HThreads.h"
+
+#if defined(WIN32) && !defined(NO_THREADS)
+#define NO_THREADS
+#endif
+
+#ifndef NO_THREADS
+#include <pthread.h>
+#endif
+
+/* ----------------------------- Trace Flags ------------------------- */
+
+#define T_TOP  0001       /* Top level tracing */
+
+static int trace = 0;
+
+/* -------------------- Configuration Parameters --------------------- */
+
+static ConfParam *cParm[MAXGLOBS];       /* config parameters */
+static int numParm = 0;
+static int numThreads = 1;               /* default size of thread pools */
+
+/* ---------------------- Thread Pool Structure ---------------------- */
+
+struct _ThreadPool {
+   int nThreads;           /* number of threads including caller */
+   ThreadTask task;        /* task function of current run */
+   Ptr arg;                /* argument of current run */
+   int nTasks;             /* number of tasks in current run */
+   int nextTask;           /* next task to hand out */
+#ifndef NO_THREADS
+   pthread_t *tid;         /* worker threads [1..nThreads-1] */
+   pthread_mutex_t lock;   /* protects all fields below */
+   pthread_cond_t start;   /* signalled when a new run starts */
+   pthread_cond_t done;    /* signalled when last worker finishes */
+   int run;                /* run counter */
+   int busy;               /* number of workers still in current run */
+   Boolean quit;           /* workers should terminate */
+#endif
+};
+
+#ifndef NO_THREADS
+typedef struct {           /* start up info for each worker */
+   ThreadPool *pool;
+   int thread;
+} WorkerInfo;
+#endif
+
+/* --------------------------- Initialisation ---------------------- */
+
+/* EXPORT->InitThreads: initialise configuration parameters */
+void InitThreads(void)
+{
+   int i;
+
+   Register(hthreads_version,hthreads_vc_id);
+   numParm = GetConfig("HTHREADS", TRUE, cParm, MAXGLOBS);
+   if (numParm>0){
+      if (GetConfInt(cParm,numParm,"TRACE",&i)) trace = i;
+      if (GetConfInt(cParm,numParm,"NUMTHREADS",&i)) {
+         if (i<1 || i>MAXTHREADS)
+            HError(5470,"InitThreads: NUMTHREADS must be in range 1..%d",
+                   MAXTHREADS);
+         numThreads = i;
+      }
+   }
+#ifdef NO_THREADS
+   if (numThreads>1) {
+      HError(-5470,"InitThreads: threads not supported, NUMTHREADS ignored");
+      numThreads = 1;
+   }
+#endif
+}
+
+/* EXPORT->ResetThreads: reset module */
+void ResetThreads(void)
+{
+   return;   /* do nothing */
+}
+
+/* EXPORT->NumThreads: return default number of threads */
+int NumThreads(void)
+{
+   return numThreads;
+}
+
+/* -------------------------- Task Dispatch ------------------------ */
+
+/* DoTasks: run tasks from current run until none are left */
+static void DoTasks(ThreadPool *pool, int thread)
+{
+   int t;
+
+   for (;;) {
+#ifndef NO_THREADS
+      if (pool->nThreads>1) pthread_mutex_lock(&pool->lock);
+#endif
+      t = pool->nextTask++;
+#ifndef NO_THREADS
+      if (pool->nThreads>1) pthread_mutex_unlock(&pool->lock);
+#endif
+      if (t>=pool->nTasks) break;
+      pool->task(thread,t,pool->arg);
+   }
+}
+
+#ifndef NO_THREADS
+/* Worker: main loop of each worker thread */
+static void *Worker(void *p)
+{
+   WorkerInfo *info = (WorkerInfo *)p;
+   ThreadPool *pool = info->pool;
+   int thread = info->thread, run = 0;
+
+   free(info);
+   pthread_mutex_lock(&pool->lock);
+   for (;;) {
+      while (pool->run==run && !pool->quit)
+         pthread_cond_wait(&pool->start,&pool->lock);
+      if (pool->quit) break;
+      run = pool->run;
+      pthread_mutex_unlock(&pool->lock);
+      DoTasks(pool,thread);
+      pthread_mutex_lock(&pool->lock);
+      if (--pool->busy == 0)
+         pthread_cond_signal(&pool->done);
+   }
+   pthread_mutex_unlock(&pool->lock);
+   return NULL;
+}
+#endif
+
+/* EXPORT->CreateThreadPool: create pool of nThreads threads */
+ThreadPool *CreateThreadPool(MemHeap *x, int nThreads)
+{
+   ThreadPool *pool;
+#ifndef NO_THREADS
+   WorkerInfo *info;
+   int i;
+#endif
+
+   if (nThreads<1 || nThreads>MAXTHREADS)
+      HError(5470,"CreateThreadPool: num threads %d out of range 1..%d",
+             nThreads,MAXTHREADS);
+#ifdef NO_THREADS
+   nThreads = 1;
+#endif
+   pool = (ThreadPool *)New(x,sizeof(ThreadPool));
+   pool->nThreads = nThreads;
+   pool->task = NULL; pool->arg = NULL;
+   pool->nTasks = pool->nextTask = 0;
+#ifndef NO_THREADS
+   pool->run = pool->busy = 0; pool->quit = FALSE;
+   pool->tid = NULL;
+   if (nThreads>1) {
+      pthread_mutex_init(&pool->lock,NULL);
+      pthread_cond_init(&pool->start,NULL);
+      pthread_cond_init(&pool->done,NULL);
+      pool->tid = (pthread_t *)New(x,nThreads*sizeof(pthread_t));
+      for (i=1; i<nThreads; i++) {
+         info = (WorkerInfo *)malloc(sizeof(WorkerInfo));
+         info->pool = pool; info->thread = i;
+         if (pthread_create(pool->tid+i,NULL,Worker,info)!=0)
+            HError(5420,"CreateThreadPool: cannot create thread %d",i);
+      }
+   }
+#endif
+   if (trace&T_TOP)
+      printf("HThreads: created pool of %d threads\n",nThreads);
+   return pool;
+}
+
+/* EXPORT->RunThreadTasks: run nTasks tasks and wait for completion */
+void RunThreadTasks(ThreadPool *pool, int nTasks, ThreadTask task, Ptr arg)
+{
+   int t;
+
+   if (pool->nThreads==1 || nTasks<=1) {
+      for (t=0; t<nTasks; t++)
+         task(0,t,arg);
+      return;
+   }
+#ifndef NO_THREADS
+   pthread_mutex_lock(&pool->lock);
+   pool->task = task; pool->arg = arg;
+   pool->nTasks = nTasks; pool->nextTask = 0;
+   pool->busy = pool->nThreads-1;
+   ++pool->run;
+   pthread_cond_broadcast(&pool->start);
+   pthread_mutex_unlock(&pool->lock);
+   DoTasks(pool,0);
+   pthread_mutex_lock(&pool->lock);
+   while (pool->busy>0)
+      pthread_cond_wait(&pool->done,&pool->lock);
+   pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+/* EXPORT->PoolSize: return number of threads in pool */
+int PoolSize(ThreadPool *pool)
+{
+   return pool->nThreads;
+}
+
+/* EXPORT->FreeThreadPool: stop all worker threads of pool */
+void FreeThreadPool(ThreadPool *pool)
+{
+#ifndef NO_THREADS
+   int i;
+
+   if (pool->nThreads>1) {
+      pthread_mutex_lock(&pool->lock);
+      pool->quit = TRUE;
+      pthread_cond_broadcast(&pool->start);
+      pthread_mutex_unlock(&pool->lock);
+      for (i=1; i<pool->nThreads; i++)
+         pthread_join(pool->tid[i],NULL);
+      pthread_cond_destroy(&pool->done);
+      pthread_cond_destroy(&pool->start);
+      pthread_mutex_destroy(&pool->lock);
+   }
+#endif
+   pool->nThreads = 0;
+}
+
+/* ----------------------------- Timing ---------------------------- */
+
+/* EXPORT->WallTime: return elapsed real time in seconds */
+double WallTime(void)
+{
+#ifdef WIN32
+   return (double)clock()/CLOCKS_PER_SEC;
+#else
+   struct timeval tv;
+
+   gettimeofday(&tv,NULL);
+   return tv.tv_sec + tv.tv_usec*1.0e-6;
+#endif
+}
+
+/* ------------------------- End of HThreads.c --------------------------- */
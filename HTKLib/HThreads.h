@@ -0,0 +1,130 @@
+/* ----------------------------------------------------------------- */
+/*           The HMM-Based Speech Synthesis System (HTS)             */
+/*           developed by HTS Working Group                          */
+/*           http://hts.sp.nitech.ac.jp/                             */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/*  Copyright (c) 2012  Nagoya Institute of Technology               */
+/*                           Department of Computer Science          */
+/*                                                                   */
+/* All rights reserved.                                              */
+/*                                                                   */
+/* Redistribution and use in source and binary forms, with or        */
+/* without modification, are permitted provided that the following   */
+/* conditions are met:                                               */
+/*                                                                   */
+/* - Redistributions of source code must retain the above copyright  */
+/*   notice, this list of conditions and the following disclaimer.   */
+/* - Redistributions in binary form must reproduce the above         */
+/*   copyright notice, this list of conditions and the following     */
+/*   disclaimer in the documentation and/or other materials provided */
+/*   with the distribution.                                          */
+/* - Neither the name of the HTS working group nor the names of its  */
+/*   contributors may be used to endorse or promote products derived */
+/*   from this software without specific prior written permission.   */
+/*                                                                   */
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND            */
+/* CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,       */
+/* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF          */
+/* MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE          */
+/* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS */
+/* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,          */
+/* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED   */
+/* TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,     */
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON */
+/* ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,   */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY    */
+/* OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                       */
+/* ----------------------------------------------------------------- */
+/*         File: HThreads.h:  Worker Thread Pool                     */
+/* ----------------------------------------------------------------- */
+
+/* !HVER!HThreads: 2.2 [NIT 07/07/11] */
+
+/*
+   This module provides a simple pool of worker threads which tools
+   can use to spread independent units of work (words, utterances,
+   files, ...) over several processors.  A task function is called
+   once for each task index 0..nTasks-1.  Tasks are handed out to the
+   threads on demand so the order in which they run is undefined, but
+   RunThreadTasks does not return until every task has completed.
+   The calling thread takes part in the work as thread 0.
+
+   The HTK library modules are not re-entrant, so a task may only
+   write to data which is private to that task or to the thread
+   running it.  In particular, each thread must allocate from its own
+   MHEAP and MSTAK heaps; only C heaps such as gcheap may be shared.
+   The thread argument passed to the task function (0..PoolSize()-1)
+   is provided for indexing such per-thread data.
+
+   The number of threads is set by the configuration variable
+   NUMTHREADS (default 1).  When compiled with NO_THREADS defined, or
+   on WIN32, the pool always runs its tasks serially in the calling
+   thread.
+*/
+
+#ifndef _HTHREADS_H_
+#define _HTHREADS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAXTHREADS 256      /* max num threads in a pool */
+
+typedef void (*ThreadTask)(int thread, int task, Ptr arg);
+
+typedef struct _ThreadPool ThreadPool;
+
+void InitThreads(void);
+/*
+   Initialise the module
+*/
+
+void ResetThreads(void);
+/*
+   Reset the module
+*/
+
+int NumThreads(void);
+/*
+   Return the default number of threads set by NUMTHREADS
+*/
+
+ThreadPool *CreateThreadPool(MemHeap *x, int nThreads);
+/*
+   Create a pool of nThreads threads (including the calling
+   thread) with its control structures allocated in x.  If nThreads
+   is 1 no threads are started and tasks are run serially.
+*/
+
+void RunThreadTasks(ThreadPool *pool, int nTasks, ThreadTask task, Ptr arg);
+/*
+   Call task(thread,i,arg) for i=0..nTasks-1 using the threads in
+   pool and wait until all of them have completed.
+*/
+
+int PoolSize(ThreadPool *pool);
+/*
+   Return the number of threads in pool
+*/
+
+void FreeThreadPool(ThreadPool *pool);
+/*
+   Stop the threads of pool.  The pool must not be used again.
+*/
+
+double WallTime(void);
+/*
+   Return the elapsed real time in seconds since an arbitrary
+   fixed point, for timing parallel sections.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _HTHREADS_H_ */
+
+/* ------------------------- End of HThreads.h --------------------------- */
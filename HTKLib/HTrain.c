@@ -332,28 +332,32 @@ int NumSegs(SegStore ss)
 
 /* EXPORT->GetSegObs: Return j'th observation from i'th segment */
 Observation GetSegObs(SegStore ss, int i, int j)
+{
+   FillSegObs(ss, i, j, &ss->o);
+   return ss->o;
+}
+
+/* EXPORT->FillSegObs: copy jth obs in ith segment into caller's obs */
+void FillSegObs(SegStore ss, int i, int j, Observation *obs)
 {
    Sequence vq;
    Sequence fv;
    int s,S = ss->o.swidth[0];
-   short *vqItem, *ovq;
-   Vector *fvItem, *ofv;
+   short *vqItem;
+   Vector *fvItem;
    
    if (ss->hasvq) {
       vq = (Sequence) GetItem(ss->vqSegs,i);
       vqItem = (short *) GetItem(vq,j);
-      ovq = ss->o.vq;
       for (s=1; s<=S; s++) 
-         ovq[s] = vqItem[s];
+         obs->vq[s] = vqItem[s];
    }     
    if (ss->hasfv) {
       fv = (Sequence) GetItem(ss->fvSegs,i);
       fvItem = (Vector *) GetItem(fv,j);
-      ofv = ss->o.fv;
       for (s=1; s<=S; s++) 
-         ofv[s] = fvItem[s];
+         obs->fv[s] = fvItem[s];
    }     
-   return ss->o;
 }
 
 
@@ -997,13 +1001,16 @@ static WtAcc *CreateWtAcc(MemHeap *x, int nMix, int nPara)
 }
 
 /* CreatePreComp: create a struct for precomputed probs */
-static PreComp *CreatePreComp(MemHeap *x)
+static PreComp *CreatePreComp(MemHeap *x, int nPara)
 {
    PreComp *p;
+   int count;
    
-   p = (PreComp *) New(x,sizeof(PreComp));
-   p->time = -1; p->prob = LZERO;
-   ++prC;
+   p = (PreComp *) New(x,sizeof(PreComp)*nPara);
+   for(count=0;count<nPara;count++){
+      p[count].time = -1; p[count].prob = LZERO;
+      ++prC;
+   }
    return p;
 }
 
@@ -1052,7 +1059,7 @@ void AttachAccsParallel(HMMSet *hset, MemHeap *x, UPDSet uFlags, int nPara)
                   if ((uFlags&UPSEMIT) && (strmProj)) size = hset->vecSize; /* handles multiple streams */
                   else size = VectorSize(hss.mp->mean);
                   if (DoPreComps(hset->hsKind))
-                     hss.mp->hook = CreatePreComp(x);
+                     hss.mp->hook = CreatePreComp(x,1);
 		  if (!IsSeenV(hss.mp->mean)) {
                      if (uFlags&UPMEANS) 
                         SetHook(hss.mp->mean,CreateMuAcc(x,size,nPara));
@@ -1206,6 +1213,99 @@ void ZeroAccsParallel(HMMSet *hset, UPDSet uFlags, int nPara)
       TMZeroAccs(hset,start,end);
 }
 
+/* AddMuVaAcc: add mean and variance accs src to dst */
+static void AddMuVaAcc(MixPDF *mp, UPDSet uFlags, Boolean doMu, Boolean doVa,
+                       int dst, int src)
+{
+   MuAcc *ma;
+   VaAcc *va;
+   int k,l,vSize;
+   CovKind ck;
+
+   if (doMu && (uFlags&(UPMEANS|UPSEMIT))) {
+      ma = (MuAcc *)GetHook(mp->mean);
+      vSize = VectorSize(ma[dst].mu);
+      for (k=1;k<=vSize;k++) ma[dst].mu[k] += ma[src].mu[k];
+      ma[dst].occ += ma[src].occ;
+   }
+   if (doVa && (uFlags&(UPVARS|UPSEMIT))) {
+      va = (VaAcc *)GetHook(mp->cov.var);
+      ck = (uFlags&UPSEMIT) ? FULLC : mp->ckind;
+      switch(ck){
+      case DIAGC:
+      case INVDIAGC:
+         vSize = VectorSize(va[dst].cov.var);
+         for (k=1;k<=vSize;k++) va[dst].cov.var[k] += va[src].cov.var[k];
+         break;
+      case FULLC:
+         vSize = TriMatSize(va[dst].cov.inv);
+         for (k=1;k<=vSize;k++)
+            for (l=1;l<=k;l++)
+               va[dst].cov.inv[k][l] += va[src].cov.inv[k][l];
+         break;
+      default:
+         HError(7170,"MergeAccsParallel: bad cov kind %d",ck);
+      }
+      va[dst].occ += va[src].occ;
+   }
+}
+
+/* EXPORT->MergeAccsParallel: add acc blocks 1..nCopy-1 into block 0 */
+void MergeAccsParallel(HMMSet *hset, UPDSet uFlags, int nPara, int nCopy)
+{
+   HMMScanState hss;
+   HLink hmm;
+   TrAcc *ta;
+   WtAcc *wa;
+   Boolean doMu,doVa;
+   int c,i,j,k,m,s,N,M,src;
+
+   for (c=1;c<nCopy;c++){
+      NewHMMScan(hset,&hss);
+      do {
+         hmm = hss.hmm;
+         while (GoNextState(&hss,TRUE)) {
+            while (GoNextStream(&hss,TRUE)) {
+               wa = (WtAcc *)hss.sti->hook;
+               M = VectorSize(wa[0].c);
+               for (i=0;i<nPara;i++){
+                  src = c*nPara+i;
+                  for (m=1;m<=M;m++) wa[i].c[m] += wa[src].c[m];
+                  wa[i].occ += wa[src].occ;
+               }
+               if (hss.isCont)
+                  while (GoNextMix(&hss,TRUE)) {
+                     doMu = !IsSeenV(hss.mp->mean);
+                     doVa = !IsSeenV(hss.mp->cov.var);
+                     for (i=0;i<nPara;i++)
+                        AddMuVaAcc(hss.mp,uFlags,doMu,doVa,i,c*nPara+i);
+                     if (doMu) TouchV(hss.mp->mean);
+                     if (doVa) TouchV(hss.mp->cov.var);
+                  }
+            }
+         }
+         if (!IsSeenV(hmm->transP)) {
+            ta = (TrAcc *)GetHook(hmm->transP);
+            N = hmm->numStates;
+            for (i=0;i<nPara;i++){
+               src = c*nPara+i;
+               for (j=1;j<=N;j++){
+                  for (k=1;k<=N;k++) ta[i].tran[j][k] += ta[src].tran[j][k];
+                  ta[i].occ[j] += ta[src].occ[j];
+               }
+            }
+            TouchV(hmm->transP);       
+         }
+      } while (GoNextHMM(&hss));
+      EndHMMScan(&hss);
+      if (hset->hsKind==TIEDHS)
+         for (s=1;s<=hset->swidth[0];s++)
+            for (m=1;m<=hset->tmRecs[s].nMix;m++)
+               for (i=0;i<nPara;i++)
+                  AddMuVaAcc(hset->tmRecs[s].mixes[m],uFlags,TRUE,TRUE,i,c*nPara+i);
+   }
+}
+
 /* TMShowAccs: show accs attached to tied mixes in hset */
 void TMShowAccs(HMMSet *hset, int index)
 {
@@ -1334,7 +1434,7 @@ void AttachPreComps(HMMSet *hset, MemHeap *x)
             if (hss.isCont)                     /* PLAINHS or SHAREDHS */
                while (GoNextMix(&hss,TRUE)) {
                   if (DoPreComps(hset->hsKind))
-                     hss.mp->hook = CreatePreComp(x);
+                     hss.mp->hook = CreatePreComp(x,1);
                }
          }
       }
@@ -1344,6 +1444,21 @@ void AttachPreComps(HMMSet *hset, MemHeap *x)
       printf("AttachPreComps:  %d wt, %d pr\n",wtC,prC);
 }
 
+/* EXPORT->AttachPreCompCopies: give each mixture nCopy PreComps */
+void AttachPreCompCopies(HMMSet *hset, MemHeap *x, int nCopy)
+{
+   HMMScanState hss;
+
+   if (!DoPreComps(hset->hsKind)) return;
+   prC=0;
+   NewHMMScan(hset,&hss);
+   while (GoNextMix(&hss,FALSE))
+      hss.mp->hook = CreatePreComp(x,nCopy);
+   EndHMMScan(&hss);
+   if (trace&T_NAC)
+      printf("AttachPreCompCopies:  %d pr\n",prC);
+}
+
 /* EXPORT->ResetPreComps: reset the precomputed prob fields in hset */
 void ResetPreComps(HMMSet *hset)
 {
@@ -203,6 +203,13 @@ Observation GetSegObs(SegStore ss, int i, int j);
    Return j'th observation from i'th segment.  All indices 1..N
 */
 
+void FillSegObs(SegStore ss, int i, int j, Observation *obs);
+/*
+   As GetSegObs but stores the observation in obs instead of the
+   shared record in ss, so that segments may be read from several 
+   threads at once.  The stream widths etc of obs must already be set.
+*/
+
 /* --------------------- Vector Clustering -------------------- */
 
 /* Clusters are represented by an array of Cluster records 
@@ -306,6 +313,13 @@ void ZeroAccs(HMMSet *hset, UPDSet uFlags);
    Zero all accumulators in given HMM set.
 */
 
+void MergeAccsParallel(HMMSet *hset, UPDSet uFlags, int nPara, int nCopy);
+/*
+   Add the accumulators in slots c*nPara..c*nPara+nPara-1 into
+   slots 0..nPara-1 for c=1..nCopy-1, in that order.  Used to
+   combine the copies accumulated by different threads.
+*/
+
 void ShowAccsParallel(HMMSet *hset, UPDSet uFlags, int index);
 void ShowAccs(HMMSet *hset, UPDSet uFlags);
 /*
@@ -317,6 +331,13 @@ void AttachPreComps(HMMSet *hset, MemHeap *x);
    Attach reset PreComps to given HMM set
 */
 
+void AttachPreCompCopies(HMMSet *hset, MemHeap *x, int nCopy);
+/*
+   Replace the PreComp of each mixture by an array of nCopy reset
+   PreComps, one for each thread computing likelihoods.  Only the
+   first copy is reset by ResetPreComps and ZeroAccs.
+*/
+
 void ResetPreComps(HMMSet *hset);
 /*
    Reset all the precomputed prob fields in the
@@ -0,0 +1,974 @@
+/* ----------------------------------------------------------- */
+/*                                                             */
+/*                          ___                                */
+/*                       |_| | |_/   SPEECH                    */
+/*                       | | | | \   RECOGNITION               */
+/*                       =========   SOFTWARE                  */
+/*                                                             */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/* developed at:                                               */
+/*                                                             */
+/*      Speech Vision and Robotics group                       */
+/*      Cambridge University Engineering Department            */
+/*      http://svr-www.eng.cam.ac.uk/                          */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*         Copyright:                                          */
+/*         2001-2002  Cambridge University                     */
+/*                    Engineering Department                   */
+/*                                                             */
+/*   Use of this software is governed by a License Agreement   */
+/*    ** See the file License for the Conditions of Use  **    */
+/*    **     This banner notice must not be removed      **    */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*         File: HCompNet.c: Static Search Network Compiler    */
+/* ----------------------------------------------------------- */
+
+char *hcompnet_version = "!HVER!HCompNet:   3.4.1 [CUED 12/03/09]";
+char *hcompnet_vc_id = "$Id: HCompNet.c,v 1.1 2012/12/22 07:01:31 uratec Exp $";
+
+/* HCompNet compiles a word network (SLF, e.g. from HParse or HBuild)
+   into the static search network that HDecode -g decodes with. The
+   network is treated as a weighted acceptor over words with the arc
+   LM likelihoods as weights:
+
+   a) !NULL nodes are removed (best scoring !NULL path is kept)
+   b) the acceptor is determinised in the max (Viterbi) semiring, so
+      that every state has at most one successor per word
+   c) the result is minimised by merging equivalent states
+
+   The output is a lattice (binary by default) with a single !NULL
+   start node followed by the start word and a single end node
+   labelled with the end word, i.e. the form of the lattices that
+   HDecode generates and CreateLMfromLat() expects.
+*/
+
+#include "HShell.h" /* HMM ToolKit Modules */
+#include "HMem.h"
+#include "HMath.h"
+#include "HSigP.h"
+#include "HAudio.h"
+#include "HWave.h"
+#include "HVQ.h"
+#include "HParm.h"
+#include "HLabel.h"
+#include "HModel.h"
+#include "HUtil.h"
+#include "HDict.h"
+#include "HNet.h"
+
+/* -------------------------- Trace Flags & Vars ------------------------ */
+
+#define T_TOP  0001     /* Basic progress reporting */
+#define T_DET  0002     /* Determinisation progress */
+#define T_MIN  0004     /* Minimisation iterations */
+
+static int trace = 0;
+
+/* ---------------- Configuration Parameters --------------------- */
+
+static ConfParam *cParm[MAXGLOBS];
+static int nParm = 0;            /* total num params */
+
+/* -------------------------- Global Variables etc ---------------------- */
+
+static char *startWord = "<s>";  /* word at start of compiled network */
+static char *endWord = "</s>";   /* word at end of compiled network */
+static Word startW, endW;        /* corresponding dictionary entries */
+static Boolean addStartEnd = FALSE; /* add start/end word around network */
+static int maxStates = 1000000;  /* limit on states created by determinisation */
+static Boolean saveLatBin = TRUE;/* write binary lattice */
+
+static Vocab voc;                /* dictionary */
+static MemHeap netHeap;          /* acceptors and output lattice */
+
+#define RESQUANT 0.001           /* quantisation of residual weights */
+#define NHASH 262147             /* size of subset hash table */
+
+/* -------------------------- Weighted acceptors ------------------------ */
+
+typedef struct _NetArc {         /* word transition */
+   Word word;
+   LogFloat like;                /* LM log likelihood */
+   int dest;                     /* destination state */
+} NetArc;
+
+typedef struct _NetState {
+   int nArcs;
+   NetArc *arc;                  /* sorted by word and dest */
+   LogFloat fin;                 /* final weight, LZERO if not final */
+} NetState;
+
+typedef struct _Acceptor {       /* epsilon-free weighted word acceptor */
+   int nStates;
+   int start;
+   NetState *state;
+} Acceptor;
+
+typedef struct _ArcBuf {         /* growable array of arcs */
+   int n;
+   int size;
+   NetArc *arc;
+} ArcBuf;
+
+typedef struct _DState {         /* subset of NFA states with residuals */
+   int n;
+   int *st;                      /* NFA states in ascending order */
+   int *res;                     /* quantised residual weights */
+   unsigned int hash;
+   struct _DState *next;         /* hash chain */
+} DState;
+
+/* ---------------- Process Command Line ------------------------- */
+
+/* SetConfParms: set conf parms relevant to this tool */
+void SetConfParms(void)
+{
+   int i;
+   char buf[MAXSTRLEN];
+
+   nParm = GetConfig("HCOMPNET", TRUE, cParm, MAXGLOBS);
+   if (nParm>0){
+      if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
+      if (GetConfStr (cParm, nParm, "STARTWORD", buf))
+         startWord = CopyString (&gstack, buf);
+      if (GetConfStr (cParm, nParm, "ENDWORD", buf))
+         endWord = CopyString (&gstack, buf);
+   }
+}
+
+void ReportUsage(void)
+{
+   printf("\nUSAGE: HCompNet [options] dictFile inNet outNet\n\n");
+   printf(" Option                                       Default\n\n");
+   printf(" -a      ASCII lattice output                 binary\n");
+   printf(" -n i    max states during determinisation    %d\n", maxStates);
+   printf(" -s s1 s2 add start/end words s1 s2           off\n");
+   PrintStdOpts("");
+   printf("\n\n");
+}
+
+/* --------------------------- Utilities -------------------------------- */
+
+/* AddArc: append arc to growable buffer */
+static void AddArc (ArcBuf *buf, Word word, LogFloat like, int dest)
+{
+   NetArc *arc;
+
+   if (buf->n == buf->size) {
+      buf->size = (buf->size > 0) ? 2 * buf->size : 64;
+      arc = (NetArc *) New (&gcheap, buf->size * sizeof (NetArc));
+      if (buf->n > 0) {
+         memcpy (arc, buf->arc, buf->n * sizeof (NetArc));
+         Dispose (&gcheap, buf->arc);
+      }
+      buf->arc = arc;
+   }
+   arc = &buf->arc[buf->n++];
+   arc->word = word;
+   arc->like = like;
+   arc->dest = dest;
+}
+
+/* ArcCmp: qsort comparison of arcs by word name and destination */
+static int ArcCmp (const void *v1, const void *v2)
+{
+   NetArc *a1 = (NetArc *) v1, *a2 = (NetArc *) v2;
+   int c;
+
+   if (a1->word != a2->word) {
+      c = strcmp (a1->word->wordName->name, a2->word->wordName->name);
+      if (c != 0)
+         return c;
+   }
+   return a1->dest - a2->dest;
+}
+
+/* SetStateArcs: sort arcs in buf, merge parallel arcs and store in st */
+static void SetStateArcs (NetState *st, ArcBuf *buf)
+{
+   int i, n;
+
+   qsort (buf->arc, buf->n, sizeof (NetArc), ArcCmp);
+   for (i = n = 0; i < buf->n; ++i) {
+      if (n > 0 && buf->arc[n-1].word == buf->arc[i].word &&
+          buf->arc[n-1].dest == buf->arc[i].dest) {
+         if (buf->arc[i].like > buf->arc[n-1].like)
+            buf->arc[n-1].like = buf->arc[i].like;
+      }
+      else
+         buf->arc[n++] = buf->arc[i];
+   }
+   st->nArcs = n;
+   st->arc = NULL;
+   if (n > 0) {
+      st->arc = (NetArc *) New (&netHeap, n * sizeof (NetArc));
+      memcpy (st->arc, buf->arc, n * sizeof (NetArc));
+   }
+   buf->n = 0;
+}
+
+/* CountArcs: total number of arcs in acceptor */
+static int CountArcs (Acceptor *acc)
+{
+   int i, n;
+
+   for (i = n = 0; i < acc->nStates; ++i)
+      n += acc->state[i].nArcs;
+   return n;
+}
+
+/* ------------------------ !NULL node removal --------------------------- */
+
+/* RemoveNulls: convert lattice into epsilon-free acceptor
+
+     State i corresponds to lattice node i (i.e. the point just after
+     its word) and state nn is an extra initial state before the start
+     node's word. !NULL nodes other than the start node are unused.
+*/
+static Acceptor *RemoveNulls (Lattice *lat)
+{
+   Acceptor *acc;
+   NetState *st;
+   LNode *ln, *lnStart = NULL, *lnEnd = NULL;
+   LArc *la;
+   LogFloat *best, s;
+   Boolean *inQ;
+   int *stack, *touched, nStack, nTouched, i, j, u, v;
+   long nPops;
+   ArcBuf buf;
+
+   for (i = 0, ln = lat->lnodes; i < lat->nn; ++i, ++ln) {
+      if (ln->word == voc.subLatWord)
+         HError (3520, "RemoveNulls: sub-lattices must be expanded first");
+      if (ln->pred == NARC) {
+         if (lnStart)
+            HError (3520, "RemoveNulls: network has multiple start nodes");
+         lnStart = ln;
+      }
+      if (ln->foll == NARC) {
+         if (lnEnd)
+            HError (3520, "RemoveNulls: network has multiple end nodes");
+         lnEnd = ln;
+      }
+   }
+   if (!lnStart || !lnEnd)
+      HError (3520, "RemoveNulls: network has no start or end node");
+
+   acc = (Acceptor *) New (&netHeap, sizeof (Acceptor));
+   acc->nStates = lat->nn + 1;
+   acc->state = (NetState *) New (&netHeap, acc->nStates * sizeof (NetState));
+   for (i = 0; i < acc->nStates; ++i) {
+      acc->state[i].nArcs = 0;
+      acc->state[i].arc = NULL;
+      acc->state[i].fin = LZERO;
+   }
+
+   best = (LogFloat *) New (&gstack, lat->nn * sizeof (LogFloat));
+   inQ = (Boolean *) New (&gstack, lat->nn * sizeof (Boolean));
+   stack = (int *) New (&gstack, lat->nn * sizeof (int));
+   touched = (int *) New (&gstack, lat->nn * sizeof (int));
+   for (i = 0; i < lat->nn; ++i) {
+      best[i] = LZERO;
+      inQ[i] = FALSE;
+   }
+   buf.n = buf.size = 0;
+   buf.arc = NULL;
+
+   for (i = 0, ln = lat->lnodes; i < lat->nn; ++i, ++ln) {
+      if (ln->word == voc.nullWord && ln != lnStart)
+         continue;
+
+      /* best !NULL path from node i to every reachable !NULL node */
+      best[i] = 0.0;
+      stack[0] = touched[0] = i;
+      nStack = nTouched = 1;
+      inQ[i] = TRUE;
+      nPops = 0;
+      while (nStack > 0) {
+         u = stack[--nStack];
+         inQ[u] = FALSE;
+         if (++nPops > (long) lat->nn * lat->nn)
+            HError (3521, "RemoveNulls: !NULL cycle with positive likelihood at node %d", i);
+         for (la = lat->lnodes[u].foll; la != NARC; la = la->farc) {
+            if (la->end->word != voc.nullWord)
+               continue;
+            v = la->end - lat->lnodes;
+            s = best[u] + la->lmlike;
+            if (s > best[v]) {
+               if (best[v] <= LSMALL)
+                  touched[nTouched++] = v;
+               best[v] = s;
+               if (!inQ[v]) {
+                  inQ[v] = TRUE;
+                  stack[nStack++] = v;
+               }
+            }
+         }
+      }
+
+      /* word transitions leaving the closure */
+      st = &acc->state[i];
+      for (j = 0; j < nTouched; ++j) {
+         u = touched[j];
+         for (la = lat->lnodes[u].foll; la != NARC; la = la->farc)
+            if (la->end->word != voc.nullWord)
+               AddArc (&buf, la->end->word, best[u] + la->lmlike,
+                       la->end - lat->lnodes);
+         if (&lat->lnodes[u] == lnEnd && best[u] > st->fin)
+            st->fin = best[u];
+      }
+      SetStateArcs (st, &buf);
+
+      for (j = 0; j < nTouched; ++j) {
+         best[touched[j]] = LZERO;
+         inQ[touched[j]] = FALSE;
+      }
+   }
+
+   /* initial state */
+   if (lnStart->word == voc.nullWord)
+      acc->start = lnStart - lat->lnodes;
+   else {
+      acc->start = lat->nn;
+      AddArc (&buf, lnStart->word, 0.0, lnStart - lat->lnodes);
+      SetStateArcs (&acc->state[lat->nn], &buf);
+   }
+
+   if (buf.arc)
+      Dispose (&gcheap, buf.arc);
+   Dispose (&gstack, best);
+
+   return acc;
+}
+
+/* Trim: remove arcs into states from which no final state is reachable */
+static void Trim (Acceptor *acc)
+{
+   int *nIn, *inStart, *src, *queue, i, j, k, n, nQ;
+   Boolean *live;
+   NetState *st;
+
+   /* reverse adjacency */
+   nIn = (int *) New (&gstack, (acc->nStates + 1) * sizeof (int));
+   inStart = (int *) New (&gstack, (acc->nStates + 1) * sizeof (int));
+   for (i = 0; i <= acc->nStates; ++i)
+      nIn[i] = 0;
+   for (i = 0; i < acc->nStates; ++i)
+      for (j = 0; j < acc->state[i].nArcs; ++j)
+         ++nIn[acc->state[i].arc[j].dest];
+   inStart[0] = 0;
+   for (i = 0; i < acc->nStates; ++i) {
+      inStart[i+1] = inStart[i] + nIn[i];
+      nIn[i] = 0;
+   }
+   src = (int *) New (&gstack, (inStart[acc->nStates] + 1) * sizeof (int));
+   for (i = 0; i < acc->nStates; ++i)
+      for (j = 0; j < acc->state[i].nArcs; ++j) {
+         k = acc->state[i].arc[j].dest;
+         src[inStart[k] + nIn[k]++] = i;
+      }
+
+   /* backwards search from final states */
+   live = (Boolean *) New (&gstack, acc->nStates * sizeof (Boolean));
+   queue = (int *) New (&gstack, acc->nStates * sizeof (int));
+   for (i = nQ = 0; i < acc->nStates; ++i) {
+      live[i] = (acc->state[i].fin > LSMALL) ? TRUE : FALSE;
+      if (live[i])
+         queue[nQ++] = i;
+   }
+   for (k = 0; k < nQ; ++k)
+      for (j = inStart[queue[k]]; j < inStart[queue[k]+1]; ++j)
+         if (!live[src[j]]) {
+            live[src[j]] = TRUE;
+            queue[nQ++] = src[j];
+         }
+   if (!live[acc->start])
+      HError (3522, "Trim: network does not accept any word sequence");
+
+   for (i = 0; i < acc->nStates; ++i) {
+      st = &acc->state[i];
+      for (j = n = 0; j < st->nArcs; ++j)
+         if (live[st->arc[j].dest])
+            st->arc[n++] = st->arc[j];
+      st->nArcs = n;
+   }
+   Dispose (&gstack, nIn);
+}
+
+/* AddStartEnd: wrap acceptor in start and end word
+
+     A new initial state leads to the old one via startWord and all
+     final weights are moved onto endWord arcs into a new final state.
+*/
+static Acceptor *AddStartEnd (Acceptor *acc)
+{
+   Acceptor *wrap;
+   NetState *st;
+   NetArc *arc;
+   int i, e;
+
+   wrap = (Acceptor *) New (&netHeap, sizeof (Acceptor));
+   wrap->nStates = acc->nStates + 2;
+   wrap->state = (NetState *) New (&netHeap, wrap->nStates * sizeof (NetState));
+   e = acc->nStates;
+   for (i = 0; i < acc->nStates; ++i) {
+      st = &wrap->state[i];
+      *st = acc->state[i];
+      if (st->fin > LSMALL) {      /* arrays are small, just copy */
+         arc = (NetArc *) New (&netHeap, (st->nArcs + 1) * sizeof (NetArc));
+         if (st->nArcs > 0)
+            memcpy (arc, st->arc, st->nArcs * sizeof (NetArc));
+         arc[st->nArcs].word = endW;
+         arc[st->nArcs].like = st->fin;
+         arc[st->nArcs].dest = e;
+         st->arc = arc;
+         ++st->nArcs;
+         st->fin = LZERO;
+         qsort (st->arc, st->nArcs, sizeof (NetArc), ArcCmp);
+      }
+   }
+   wrap->state[e].nArcs = 0;
+   wrap->state[e].arc = NULL;
+   wrap->state[e].fin = 0.0;
+
+   st = &wrap->state[e+1];
+   st->nArcs = 1;
+   st->arc = (NetArc *) New (&netHeap, sizeof (NetArc));
+   st->arc[0].word = startW;
+   st->arc[0].like = 0.0;
+   st->arc[0].dest = acc->start;
+   st->fin = LZERO;
+   wrap->start = e + 1;
+
+   return wrap;
+}
+
+/* FoldFinals: move final weights of dead end states onto incoming arcs */
+static void FoldFinals (Acceptor *acc)
+{
+   NetState *st;
+   int i, j;
+
+   for (i = 0; i < acc->nStates; ++i) {
+      st = &acc->state[i];
+      for (j = 0; j < st->nArcs; ++j)
+         if (acc->state[st->arc[j].dest].nArcs == 0 &&
+             acc->state[st->arc[j].dest].fin > LSMALL)
+            st->arc[j].like += acc->state[st->arc[j].dest].fin;
+   }
+   for (i = 0; i < acc->nStates; ++i)
+      if (acc->state[i].nArcs == 0 && acc->state[i].fin > LSMALL)
+         acc->state[i].fin = 0.0;
+}
+
+/* -------------------------- Determinisation ---------------------------- */
+
+/* QuantRes: quantise residual weight */
+static int QuantRes (LogFloat r)
+{
+   double q;
+
+   q = floor (r / RESQUANT + 0.5);
+   if (q < -2.0e9)
+      q = -2.0e9;
+   return (int) q;
+}
+
+/* FindDState: return id of subset, creating it if necessary */
+static int FindDState (DState **hashTab, DState ***dstate, int *nD, int *dSize,
+                       int n, int *st, int *res)
+{
+   DState *ds, **newTab;
+   unsigned int h;
+   int i;
+
+   h = n;
+   for (i = 0; i < n; ++i)
+      h = h * 31 + st[i] * 7 + res[i];
+   for (ds = hashTab[h % NHASH]; ds; ds = ds->next)
+      if (ds->hash == h && ds->n == n &&
+          memcmp (ds->st, st, n * sizeof (int)) == 0 &&
+          memcmp (ds->res, res, n * sizeof (int)) == 0)
+         return ((int *) ds->st)[-1];
+
+   if (*nD >= maxStates)
+      HError (3530, "Determinise: more than %d states, network may not be determinisable (use -n)",
+              maxStates);
+   if (*nD == *dSize) {
+      *dSize = (*dSize > 0) ? 2 * *dSize : 1024;
+      newTab = (DState **) New (&gcheap, *dSize * sizeof (DState *));
+      if (*nD > 0) {
+         memcpy (newTab, *dstate, *nD * sizeof (DState *));
+         Dispose (&gcheap, *dstate);
+      }
+      *dstate = newTab;
+   }
+
+   ds = (DState *) New (&netHeap, sizeof (DState));
+   ds->n = n;
+   ds->st = (int *) New (&netHeap, (2 * n + 1) * sizeof (int)) + 1;
+   ds->st[-1] = *nD;            /* id stored in front of subset */
+   ds->res = ds->st + n;
+   memcpy (ds->st, st, n * sizeof (int));
+   memcpy (ds->res, res, n * sizeof (int));
+   ds->hash = h;
+   ds->next = hashTab[h % NHASH];
+   hashTab[h % NHASH] = ds;
+   (*dstate)[*nD] = ds;
+   return (*nD)++;
+}
+
+/* Determinise: subset construction with residual weights
+
+     Each DFA state is a set of NFA states with residual weights
+     relative to the best path into the set. The arc weight is the
+     best weight over all NFA arcs with the same word.
+*/
+static Acceptor *Determinise (Acceptor *nfa)
+{
+   Acceptor *dfa;
+   DState **hashTab, **dstate = NULL, *ds;
+   NetState *dst, *nst, *newSt;
+   NetArc *a;
+   ArcBuf in, out;
+   LogFloat r, bestLike;
+   int *st, *res, nD = 0, dSize = 0, sSize = 0, d, g, h, i, k, n;
+
+   hashTab = (DState **) New (&gcheap, NHASH * sizeof (DState *));
+   for (i = 0; i < NHASH; ++i)
+      hashTab[i] = NULL;
+   in.n = in.size = out.n = out.size = 0;
+   in.arc = out.arc = NULL;
+
+   st = (int *) New (&gcheap, nfa->nStates * sizeof (int));
+   res = (int *) New (&gcheap, nfa->nStates * sizeof (int));
+   st[0] = nfa->start;
+   res[0] = 0;
+   FindDState (hashTab, &dstate, &nD, &dSize, 1, st, res);
+
+   dfa = (Acceptor *) New (&netHeap, sizeof (Acceptor));
+   dfa->start = 0;
+   dfa->state = NULL;
+
+   for (d = 0; d < nD; ++d) {
+      if (d >= sSize) {
+         sSize = dSize;
+         newSt = (NetState *) New (&gcheap, sSize * sizeof (NetState));
+         if (d > 0) {
+            memcpy (newSt, dfa->state, d * sizeof (NetState));
+            Dispose (&gcheap, dfa->state);
+         }
+         dfa->state = newSt;
+      }
+      ds = dstate[d];
+      dst = &dfa->state[d];
+      dst->fin = LZERO;
+
+      /* collect all arcs leaving the subset */
+      for (k = 0; k < ds->n; ++k) {
+         nst = &nfa->state[ds->st[k]];
+         r = ds->res[k] * RESQUANT;
+         for (i = 0, a = nst->arc; i < nst->nArcs; ++i, ++a)
+            AddArc (&in, a->word, r + a->like, a->dest);
+         if (nst->fin > LSMALL && r + nst->fin > dst->fin)
+            dst->fin = r + nst->fin;
+      }
+      qsort (in.arc, in.n, sizeof (NetArc), ArcCmp);
+
+      /* one DFA arc per word */
+      for (g = 0; g < in.n; g = h) {
+         bestLike = in.arc[g].like;
+         for (h = g + 1; h < in.n && in.arc[h].word == in.arc[g].word; ++h)
+            if (in.arc[h].like > bestLike)
+               bestLike = in.arc[h].like;
+         for (i = g, n = 0; i < h; ++i) {
+            if (n > 0 && st[n-1] == in.arc[i].dest) {
+               k = QuantRes (in.arc[i].like - bestLike);
+               if (k > res[n-1])
+                  res[n-1] = k;
+            }
+            else {
+               st[n] = in.arc[i].dest;
+               res[n++] = QuantRes (in.arc[i].like - bestLike);
+            }
+         }
+         k = FindDState (hashTab, &dstate, &nD, &dSize, n, st, res);
+         AddArc (&out, in.arc[g].word, bestLike, k);
+      }
+      in.n = 0;
+      /* DFA arcs are already sorted by word */
+      dst->nArcs = out.n;
+      dst->arc = NULL;
+      if (out.n > 0) {
+         dst->arc = (NetArc *) New (&netHeap, out.n * sizeof (NetArc));
+         memcpy (dst->arc, out.arc, out.n * sizeof (NetArc));
+      }
+      out.n = 0;
+
+      if ((trace & T_DET) && (d+1) % 10000 == 0)
+         printf ("Determinise: %d states expanded, %d created\n", d+1, nD);
+   }
+   dfa->nStates = nD;
+
+   /* move states onto netHeap */
+   newSt = (NetState *) New (&netHeap, nD * sizeof (NetState));
+   memcpy (newSt, dfa->state, nD * sizeof (NetState));
+   Dispose (&gcheap, dfa->state);
+   dfa->state = newSt;
+
+   if (in.arc) Dispose (&gcheap, in.arc);
+   if (out.arc) Dispose (&gcheap, out.arc);
+   Dispose (&gcheap, st);
+   Dispose (&gcheap, res);
+   Dispose (&gcheap, dstate);
+   Dispose (&gcheap, hashTab);
+
+   return dfa;
+}
+
+/* --------------------------- Minimisation ------------------------------ */
+
+/* SameSig: do states s and t have the same signature under cls? */
+static Boolean SameSig (Acceptor *acc, int *cls, int s, int t)
+{
+   NetState *ss = &acc->state[s], *ts = &acc->state[t];
+   int i;
+
+   if (cls[s] != cls[t] || ss->fin != ts->fin || ss->nArcs != ts->nArcs)
+      return FALSE;
+   for (i = 0; i < ss->nArcs; ++i)
+      if (ss->arc[i].word != ts->arc[i].word ||
+          ss->arc[i].like != ts->arc[i].like ||
+          cls[ss->arc[i].dest] != cls[ts->arc[i].dest])
+         return FALSE;
+   return TRUE;
+}
+
+/* SigHash: hash of signature of state s under cls */
+static unsigned int SigHash (Acceptor *acc, int *cls, int s)
+{
+   NetState *st = &acc->state[s];
+   unsigned int h;
+   int i;
+
+   h = cls[s] * 17 + st->nArcs;
+   for (i = 0; i < st->nArcs; ++i)
+      h = h * 31 + cls[st->arc[i].dest] * 7 + (unsigned int) (size_t) st->arc[i].word;
+   return h;
+}
+
+/* Minimise: merge equivalent states by iterative partition refinement
+
+     Two states are equivalent if they have the same final weight and
+     the same arcs (word, weight, class of destination). Classes are
+     refined until the number of classes does not change.
+*/
+static Acceptor *Minimise (Acceptor *dfa)
+{
+   Acceptor *min;
+   NetState *st;
+   int *cls, *newCls, *bucket, *chain, *rep, *tmp, *first;
+   int i, j, nCls, oldNCls, nBucket, iter = 0;
+   unsigned int h;
+
+   first = cls = (int *) New (&gstack, dfa->nStates * sizeof (int));
+   newCls = (int *) New (&gstack, dfa->nStates * sizeof (int));
+   nBucket = 2 * dfa->nStates + 1;
+   bucket = (int *) New (&gstack, nBucket * sizeof (int));
+   chain = (int *) New (&gstack, dfa->nStates * sizeof (int));
+   rep = (int *) New (&gstack, dfa->nStates * sizeof (int));
+
+   for (i = 0; i < dfa->nStates; ++i)
+      cls[i] = 0;
+   nCls = 1;
+   do {
+      oldNCls = nCls;
+      for (i = 0; i < nBucket; ++i)
+         bucket[i] = -1;
+      nCls = 0;
+      for (i = 0; i < dfa->nStates; ++i) {
+         h = SigHash (dfa, cls, i) % nBucket;
+         for (j = bucket[h]; j >= 0; j = chain[j])
+            if (SameSig (dfa, cls, rep[j], i))
+               break;
+         if (j < 0) {
+            j = nCls++;
+            rep[j] = i;
+            chain[j] = bucket[h];
+            bucket[h] = j;
+         }
+         newCls[i] = j;
+      }
+      tmp = cls; cls = newCls; newCls = tmp;
+      ++iter;
+      if (trace & T_MIN)
+         printf ("Minimise: iteration %d, %d classes\n", iter, nCls);
+   } while (nCls != oldNCls);
+
+   min = (Acceptor *) New (&netHeap, sizeof (Acceptor));
+   min->nStates = nCls;
+   min->start = cls[dfa->start];
+   min->state = (NetState *) New (&netHeap, nCls * sizeof (NetState));
+   for (j = 0; j < nCls; ++j) {
+      st = &min->state[j];
+      *st = dfa->state[rep[j]];
+      for (i = 0; i < st->nArcs; ++i)   /* arc arrays are not shared */
+         st->arc[i].dest = cls[st->arc[i].dest];
+   }
+   Dispose (&gstack, first);
+
+   return min;
+}
+
+/* --------------------------- Lattice output ---------------------------- */
+
+/* FindNode: return lattice node for (state, word), creating it if necessary */
+static int FindNode (int state, Word word, int *nodeSt, Word *nodeWd,
+                     int *hashTab, int *chain, int hashSize, int *nNodes)
+{
+   unsigned int h;
+   int k;
+
+   h = (state * 31 + (unsigned int) (size_t) word) % hashSize;
+   for (k = hashTab[h]; k >= 0; k = chain[k])
+      if (nodeSt[k] == state && nodeWd[k] == word)
+         return k;
+   k = (*nNodes)++;
+   nodeSt[k] = state;
+   nodeWd[k] = word;
+   chain[k] = hashTab[h];
+   hashTab[h] = k;
+   return k;
+}
+
+/* Acceptor2Lat: convert acceptor to node labelled lattice
+
+     One lattice node is created for every (state, incoming word) pair
+     plus the !NULL start node for the initial state. The network must
+     begin with a single startWord arc and end in a single final state
+     reached only via endWord.
+*/
+static Lattice *Acceptor2Lat (Acceptor *acc, char *name)
+{
+   Lattice *lat;
+   NetState *st, *ist;
+   LNode *ln;
+   LArc *la;
+   int *hashTab, *chain, *nodeSt;
+   Word *nodeWd;
+   int i, j, k, fin = -1, nNodes, nArcs, maxNodes;
+
+   ist = &acc->state[acc->start];
+   if (ist->nArcs != 1 || ist->arc[0].word != startW || ist->fin > LSMALL)
+      HError (3531, "Acceptor2Lat: network must start with single word %s (use -s)",
+              startWord);
+   for (i = 0; i < acc->nStates; ++i) {
+      st = &acc->state[i];
+      if (st->fin > LSMALL) {
+         if (fin >= 0 || st->nArcs > 0)
+            HError (3531, "Acceptor2Lat: network must end with single word %s (use -s)",
+                    endWord);
+         if (fabs (st->fin) > RESQUANT)
+            HError (-3531, "Acceptor2Lat: final weight %f ignored", st->fin);
+         fin = i;
+      }
+      for (j = 0; j < st->nArcs; ++j) {
+         if (st->arc[j].dest == acc->start)
+            HError (3531, "Acceptor2Lat: network returns to its initial state");
+         if ((st->arc[j].word == endW) != (acc->state[st->arc[j].dest].fin > LSMALL))
+            HError (3531, "Acceptor2Lat: %s must lead to the end of the network",
+                    endWord);
+      }
+   }
+
+   /* every acceptor arc creates at most one node */
+   maxNodes = CountArcs (acc) + 1;
+   nodeSt = (int *) New (&gstack, maxNodes * sizeof (int));
+   nodeWd = (Word *) New (&gstack, maxNodes * sizeof (Word));
+   chain = (int *) New (&gstack, maxNodes * sizeof (int));
+   hashTab = (int *) New (&gstack, maxNodes * sizeof (int));
+   for (i = 0; i < maxNodes; ++i)
+      hashTab[i] = -1;
+
+   /* start node, then breadth first over (state, word) pairs */
+   nodeSt[0] = acc->start;
+   nodeWd[0] = voc.nullWord;
+   nNodes = 1;
+   nArcs = 0;
+   for (i = 0; i < nNodes; ++i) {
+      st = &acc->state[nodeSt[i]];
+      for (j = 0; j < st->nArcs; ++j)
+         FindNode (st->arc[j].dest, st->arc[j].word, nodeSt, nodeWd,
+                   hashTab, chain, maxNodes, &nNodes);
+      nArcs += st->nArcs;
+   }
+
+   lat = NewLattice (&netHeap, nNodes, nArcs);
+   lat->voc = &voc;
+   lat->net = CopyString (&netHeap, name);
+   lat->format = HLAT_LMLIKE;
+   for (i = 0, ln = lat->lnodes; i < nNodes; ++i, ++ln) {
+      ln->word = nodeWd[i];
+      ln->n = i;
+      ln->v = -1;
+   }
+   /* link in reverse so that foll lists keep arc order */
+   k = nArcs;
+   for (i = nNodes - 1; i >= 0; --i) {
+      st = &acc->state[nodeSt[i]];
+      for (j = st->nArcs - 1; j >= 0; --j) {
+         la = NumbLArc (lat, --k);
+         la->start = &lat->lnodes[i];
+         la->end = &lat->lnodes[FindNode (st->arc[j].dest, st->arc[j].word, nodeSt, nodeWd,
+                                          hashTab, chain, maxNodes, &nNodes)];
+         la->lmlike = st->arc[j].like;
+         la->farc = la->start->foll;
+         la->start->foll = la;
+         la->parc = la->end->pred;
+         la->end->pred = la;
+      }
+   }
+   Dispose (&gstack, nodeSt);
+
+   return lat;
+}
+
+/* ------------------------------ Main ---------------------------------- */
+
+/* LoadNet: read (and expand) word network from file */
+static Lattice *LoadNet (char *fn)
+{
+   FILE *nf;
+   Boolean isPipe;
+   Lattice *lat;
+
+   if ((nf = FOpen (fn, NetFilter, &isPipe)) == NULL)
+      HError (3510, "LoadNet: Cannot open network file %s", fn);
+   if ((lat = ReadLattice (nf, &netHeap, &voc, FALSE, FALSE)) == NULL)
+      HError (3510, "LoadNet: ReadLattice failed");
+   FClose (nf, isPipe);
+   if (lat->subList != NULL) {
+      if (trace & T_TOP)
+         printf ("Expanding multi-level network\n");
+      lat = ExpandMultiLevelLattice (&netHeap, lat, &voc);
+   }
+   return lat;
+}
+
+/* SaveNet: write compiled network to file */
+static void SaveNet (Lattice *lat, char *fn)
+{
+   FILE *nf;
+   Boolean isPipe;
+   LatFormat format = HLAT_LMLIKE | HLAT_NOSORT;
+
+   if (saveLatBin)
+      format |= HLAT_LBIN;
+   if ((nf = FOpen (fn, NetOFilter, &isPipe)) == NULL)
+      HError (3511, "SaveNet: Cannot create network file %s", fn);
+   if (WriteLattice (lat, nf, format) < SUCCESS)
+      HError (3511, "SaveNet: Cannot write network file %s", fn);
+   FClose (nf, isPipe);
+}
+
+int main(int argc, char *argv[])
+{
+   char *dictFn, *inFn, *outFn, *s;
+   Lattice *lat;
+   Acceptor *acc;
+
+   if(InitShell(argc,argv,hcompnet_version,hcompnet_vc_id)<SUCCESS)
+      HError(3500,"HCompNet: InitShell failed");
+   InitMem();   InitLabel();
+   InitMath();
+   InitDict();  InitNet();
+
+   CreateHeap(&netHeap, "HCompNet Stack",  MSTAK, 1, 0.0, 100000, LONG_MAX );
+
+   if (!InfoPrinted() && NumArgs() == 0)
+      ReportUsage();
+   if (NumArgs() == 0) Exit(0);
+   SetConfParms();
+
+   while (NextArg() == SWITCHARG) {
+      s = GetSwtArg();
+      if (strlen(s)!=1)
+         HError(3519,"HCompNet: Bad switch %s; must be single letter",s);
+      switch(s[0]){
+      case 'a':
+         saveLatBin = FALSE; break;
+      case 'n':
+         maxStates = GetChkedInt (1, INT_MAX, s); break;
+      case 's':
+         if (NextArg() != STRINGARG)
+            HError(3519,"HCompNet: Start word expected");
+         startWord = GetStrArg();
+         if (NextArg() != STRINGARG)
+            HError(3519,"HCompNet: End word expected");
+         endWord = GetStrArg();
+         addStartEnd = TRUE;
+         break;
+      case 'T':
+         trace = GetChkedInt(0,511,s); break;
+      default:
+         HError(3519,"HCompNet: Unknown switch %s",s);
+      }
+   }
+   if (NextArg()!=STRINGARG)
+      HError(3519,"HCompNet: Dictionary file name expected");
+   dictFn = GetStrArg();
+   if (NextArg()!=STRINGARG)
+      HError(3519,"HCompNet: input network file name expected");
+   inFn = GetStrArg();
+   if (NextArg()!=STRINGARG)
+      HError(3519,"HCompNet: output network file name expected");
+   outFn = GetStrArg();
+
+   InitVocab(&voc);
+   if(ReadDict(dictFn, &voc)<SUCCESS)
+      HError(3513,"HCompNet: ReadDict failed");
+   startW = GetWord (&voc, GetLabId (startWord, TRUE), FALSE);
+   endW = GetWord (&voc, GetLabId (endWord, TRUE), FALSE);
+   if (!startW || !endW)
+      HError (3531, "HCompNet: start word %s and end word %s must be in dictionary",
+              startWord, endWord);
+
+   if (trace & T_TOP)
+      printf ("Reading network from %s\n", inFn);
+   lat = LoadNet (inFn);
+   if (trace & T_TOP)
+      printf ("Read %d nodes %d arcs\n", lat->nn, lat->na);
+
+   acc = RemoveNulls (lat);
+   Trim (acc);
+   if (addStartEnd)
+      acc = AddStartEnd (acc);
+   else
+      FoldFinals (acc);
+   if (trace & T_TOP)
+      printf ("Removed !NULL nodes: %d states %d arcs\n",
+              acc->nStates, CountArcs (acc));
+
+   acc = Determinise (acc);
+   if (trace & T_TOP)
+      printf ("Determinised: %d states %d arcs\n", acc->nStates, CountArcs (acc));
+
+   acc = Minimise (acc);
+   if (trace & T_TOP)
+      printf ("Minimised: %d states %d arcs\n", acc->nStates, CountArcs (acc));
+
+   lat = Acceptor2Lat (acc, inFn);
+   if (trace & T_TOP)
+      printf ("Saving %d nodes %d arcs to %s\n", lat->nn, lat->na, outFn);
+   SaveNet (lat, outFn);
+
+   Exit(0);
+   return (0);          /* never reached -- make compiler happy */
+}
+
+/* ----------------------------------------------------------- */
+/*                      END:  HCompNet.c                       */
+/* ----------------------------------------------------------- */
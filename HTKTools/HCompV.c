@@ -106,6 +106,7 @@ char *hcompv_vc_id = "$Id: HCompV.c,v 1.14 2012/12/22 07:01:31 uratec Exp $";
 #include "HLabel.h"
 #include "HModel.h"
 #include "HUtil.h"
+#include "HThreads.h"
 
 /* -------------------------- Trace Flags & Vars ------------------------ */
 
@@ -137,6 +138,7 @@ static Boolean saveBinary = FALSE;  /* save output in binary  */
 static float vFloorScale = 0.0;     /* if >0.0 then vFloor scaling */
 static Vector vFloorScaleStr = NULL; /* vFloorScale for each stream */
 static int nShowElem = 12;           /* # of elements to be shown */
+static int nThreads = 1;             /* number of accumulation threads */
 
 /* Major Data Structures */
 static MLink macroLink;             /* Link to specific HMM macro */
@@ -158,6 +160,15 @@ static Boolean fullcNeeded[SMAX];   /* true for each stream that needs full
                                        covariance calculated */
 static Observation obs;             /* storage for observations  */
 
+/* Frames buffered for accumulation by the thread pool */
+#define FRAMES_PER_THREAD 4096
+
+static ThreadPool *pool;            /* accumulation threads */
+static CovAcc *taccs[SMAX];         /* [0..nThreads-1] accs of each thread */
+static Vector *frames[SMAX];        /* [0..maxFrames-1] buffered frames */
+static int nFrames[SMAX];           /* number of buffered frames */
+static int maxFrames = 0;           /* frame buffer size for each stream */
+
 
 /* ------------ structures for cmn ------------ */
 
@@ -213,6 +224,7 @@ void ReportUsage(void)
    printf(" Option                                       Default\n\n");
    printf(" -c dir  Set output directiry for CMV         none\n");
    printf(" -f f    Output vFloor as f * global var      none\n");
+   printf(" -j n    Accumulate with n threads            %d\n",nThreads);
    printf(" -k s    spkr pattern for CMV                 none\n");
    printf(" -l s    Set segment label to s               none\n");
    printf(" -m      Update means                         off\n");
@@ -250,7 +262,7 @@ void CheckVarianceKind(void)
 /* Initialise: load HMMs and create accumulators */
 void Initialise(void)
 {
-   int s,V;
+   int s,V,t,i;
    Boolean eSep;
    char base[MAXSTRLEN];
    char path[MAXSTRLEN];
@@ -296,6 +308,33 @@ void Initialise(void)
       accs[s].totalCount = 0;
    }
 
+   /* Create per-thread accumulators and frame buffers */
+   if (nThreads>1) {
+      pool = CreateThreadPool(&gstack,nThreads);
+      maxFrames = FRAMES_PER_THREAD*nThreads;
+      for (s=1;s<=hset.swidth[0]; s++){
+         V = hset.swidth[s];
+         taccs[s] = (CovAcc *)New(&gstack,nThreads*sizeof(CovAcc));
+         for (t=0; t<nThreads; t++) {
+            taccs[s][t].meanSum=CreateDVector(&gstack,V);
+            ZeroDVector(taccs[s][t].meanSum);
+            if (fullcNeeded[s]) {
+               taccs[s][t].inv=CreateDMatrix(&gstack,V,V);
+               ZeroDMatrix(taccs[s][t].inv);
+            }
+            else {
+               taccs[s][t].var=CreateDVector(&gstack,V);
+               ZeroDVector(taccs[s][t].var);
+            }
+            taccs[s][t].totalCount = 0;
+         }
+         frames[s] = (Vector *)New(&gstack,maxFrames*sizeof(Vector));
+         for (i=0; i<maxFrames; i++)
+            frames[s][i] = CreateVector(&gstack,V);
+         nFrames[s] = 0;
+      }
+   }
+
    /* Create an object to hold the input parameters */
    SetStreamWidths(hset.pkind,hset.vecSize,hset.swidth,&eSep);
    obs=MakeObservation(&gstack,hset.swidth,hset.pkind,FALSE,eSep);
@@ -317,6 +356,8 @@ void Initialise(void)
       printf("  Num Streams  : %d\n",hset.swidth[0]);
       printf("  UpdatingMeans: %s\n",(meanUpdate)?"Yes":"No");
       printf("  Target Direct: %s\n",(outDir==NULL)?"Current":outDir);     
+      if (nThreads>1)
+         printf("  Threads      : %d\n",nThreads);
    }
 }
 
@@ -478,29 +519,92 @@ void PutVFloor(void)
 
 /* ---------------- Load Data and Accumulate Stats --------------- */
 
+/* AccStreamVec: update acc of stream s with vector v */
+void AccStreamVec(CovAcc *acc, int s, Vector v)
+{
+   int x,y,V;
+   double val;
+
+   V = hset.swidth[s];
+   for (x=1;x<=V;x++) { 
+      val=(double)v[x];            
+      acc->meanSum[x] += val;      /* accumulate mean */                             
+      if (fullcNeeded[s]) {        /* accumulate covar */ 
+         acc->inv[x][x] += val*val;
+         for (y=1;y<x;y++) 
+            acc->inv[x][y] += val*(double)v[y];
+      } else                       /* accumulate var */
+         acc->var[x] += val*val;
+   }
+   acc->totalCount++;   /* accumulate occ */
+}
+
+/* AccTask: accumulate the task'th block of the buffered frames */
+void AccTask(int thread, int task, Ptr arg)
+{
+   int s,i,st,en;
+
+   for (s=1; s<=hset.swidth[0]; s++){
+      st = (int)((long)nFrames[s]*task/nThreads);
+      en = (int)((long)nFrames[s]*(task+1)/nThreads);
+      for (i=st; i<en; i++)
+         AccStreamVec(taccs[s]+task,s,frames[s][i]);
+   }
+}
+
+/* FlushFrames: accumulate the buffered frames in parallel */
+void FlushFrames(void)
+{
+   int s;
+
+   RunThreadTasks(pool,nThreads,AccTask,NULL);
+   for (s=1; s<=hset.swidth[0]; s++)
+      nFrames[s] = 0;
+}
+
+/* MergeAccs: add the thread accumulators into accs in thread order */
+void MergeAccs(void)
+{
+   int s,t,x,y,V;
+   CovAcc *ta;
+
+   FlushFrames();
+   for (s=1; s<=hset.swidth[0]; s++){
+      V = hset.swidth[s];
+      for (t=0,ta=taccs[s]; t<nThreads; t++,ta++){
+         for (x=1;x<=V;x++) {
+            accs[s].meanSum[x] += ta->meanSum[x];
+            if (fullcNeeded[s])
+               for (y=1;y<=x;y++)
+                  accs[s].inv[x][y] += ta->inv[x][y];
+            else
+               accs[s].var[x] += ta->var[x];
+         }
+         accs[s].totalCount += ta->totalCount;
+      }
+   }
+}
+
 /* AccVar:  update global accumulators with given observation */
 void AccVar(Observation obs)
 {
-   int x,y,s,V;
-   double val;
+   int x,s,V;
+   Boolean full;
    Vector v;
 
+   full = FALSE;
    for (s=1; s<=hset.swidth[0]; s++){
       v = obs.fv[s]; V = hset.swidth[s];
       if (SpaceOrder(v)==V) {
-      for (x=1;x<=V;x++) { 
-            val=(double)v[x];            
-         accs[s].meanSum[x] += val;     /* accumulate mean */                             
-         if (fullcNeeded[s]) {          /* accumulate covar */ 
-               accs[s].inv[x][x] += val*val;
-            for (y=1;y<x;y++) 
-                  accs[s].inv[x][y] += val*(double)v[y];
-         } else                         /* accumulate var */
-               accs[s].var[x] += val*val;
-         }
-         accs[s].totalCount++;   /* accumulate occ */
+         if (nThreads>1) {        /* buffer for AccTask */
+            for (x=1;x<=V;x++)
+               frames[s][nFrames[s]][x] = v[x];
+            if (++nFrames[s] == maxFrames) full = TRUE;
+         } else
+            AccStreamVec(accs+s,s,v);
       }
    }
+   if (full) FlushFrames();
 }
 
 /* CheckData: check data file consistent with HMM definition */
@@ -851,6 +955,8 @@ int main(int argc, char *argv[])
    if(InitParm()<SUCCESS)  
       HError(2000,"HCompV: InitParm failed");
    InitUtil();
+   InitThreads();
+   nThreads = NumThreads();
 
    if (!InfoPrinted() && NumArgs() == 0)
       ReportUsage();
@@ -869,6 +975,9 @@ int main(int argc, char *argv[])
             HError(2019,"HCompV: Variance floor scale expected");
          vFloorScale = GetChkedFlt(0.0,100.0,s);
          break;
+      case 'j':
+         nThreads = GetChkedInt(1,MAXTHREADS,s);
+         break;
       case 'l':
          if (NextArg() != STRINGARG)
             HError(2019,"HCompV: Segment label expected");
@@ -972,6 +1081,7 @@ int main(int argc, char *argv[])
          datafn = GetStrArg();
          LoadFile(datafn);
       } while (NumArgs()>0);
+      if (nThreads>1) MergeAccs();
       SetCovs();
       FixGConsts(hmmLink);
       SaveModel(outfn);   
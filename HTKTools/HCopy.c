@@ -615,12 +615,15 @@ Boolean IsWave(char *srcFile)
    FILE *f;
    long nSamp,sampP, hdrS;
    short sampS,kind;
-   Boolean isPipe,bSwap,isWave;
+   Boolean isPipe,bSwap,isWave,inArc;
    
    isWave = (tgtPK == WAVEFORM) ? TRUE:FALSE;
    if (tgtPK == ANON){
       if ((srcFF == HTK || srcFF == ESIG) && srcFile != NULL){
-         if ((f=FOpen(srcFile,WaveFilter,&isPipe)) == NULL)
+         inArc = IsArchiveName(srcFile); isPipe = FALSE;
+         if (inArc) f = OpenArchiveEntry(srcFile);
+         else f = FOpen(srcFile,WaveFilter,&isPipe);
+         if (f == NULL)
             HError(1011,"IsWave: cannot open File %s",srcFile);
          switch (srcFF) {
          case HTK:
@@ -636,7 +639,8 @@ Boolean IsWave(char *srcFile)
             break;
          }
          isWave = (kind == WAVEFORM) ? TRUE:FALSE;
-         FClose(f,isPipe);
+         if (inArc) CloseArchiveEntry(f);
+         else FClose(f,isPipe);
       } else
          isWave = TRUE;
    }
@@ -115,6 +115,7 @@ char *herest_vc_id = "$Id: HERest.c,v 1.51 2012/12/22 07:01:31 uratec Exp $";
 #include "HAdapt.h"
 #include "HMap.h"
 #include "HFB.h"
+#include "HThreads.h"
 
 /* Trace Flags */
 #define T_TOP   0001    /* Top level tracing */
@@ -457,6 +458,7 @@ int main(int argc, char *argv[])
    InitTrain();
    InitUtil();   InitFB();
    InitAdapt(&xfInfo_hmm,&xfInfo_dur); InitMap();
+   InitThreads();
 
    if (!InfoPrinted() && NumArgs() == 0)
       ReportUsage();
@@ -946,6 +948,7 @@ void Initialise(FBInfo *fbInfo, MemHeap *x, HMMSet *hset, HMMSet *dset, char *hm
       xfInfo_hmm.useOutXForm = TRUE;
       /* This initialises things - temporary hack - THINK!! */
       CreateAdaptXForm(hset, &xfInfo_hmm, "tmp");
+      SetAdaptThreads(&xfInfo_hmm, NumThreads());
    } 
 
    if ((uFlags_hmm&UPXFORM) || (uFlags_hmm&UPSEMIT))
@@ -1006,6 +1009,7 @@ void Initialise(FBInfo *fbInfo, MemHeap *x, HMMSet *hset, HMMSet *dset, char *hm
          xfInfo_dur.useOutXForm = TRUE;
       /* This initialises things - temporary hack - THINK!! */
          CreateAdaptXForm(dset, &xfInfo_dur, "tmp");
+         SetAdaptThreads(&xfInfo_dur, NumThreads());
       }
       if ((uFlags_dur&UPXFORM) || (uFlags_dur&UPSEMIT))
          CheckAdaptSetUp(dset,&xfInfo_dur);
@@ -111,6 +111,7 @@ char *hinit_vc_id = "$Id: HInit.c,v 1.16 2012/12/22 07:01:31 uratec Exp $";
 #include "HModel.h"
 #include "HUtil.h"
 #include "HTrain.h"
+#include "HThreads.h"
 
 /* Global Settings */
 static char * segLab = NULL;        /* segment label if any */
@@ -135,6 +136,7 @@ static int trace = 0;               /* Trace level */
 static ConfParam *cParm[MAXGLOBS];   /* configuration parameters */
 static int nParm = 0;               /* total num params */
 static Vector vFloor[SMAX];         /* variance floor - default is all zero */
+static int nThreads = 1;            /* number of alignment threads */
 
 /* Major Data Structures plus related global vars*/
 static HMMSet hset;              /* The current unitary hmm set */
@@ -154,9 +156,18 @@ static MemHeap bufferStack;      /* For storage of buffer */
 static MemHeap msdinfoStack;     /* For storage of msdinfo */
 static ParmBuf pbuf;             /* Currently input parm buffer */
 
-/* Storage for Viterbi Decoding */
-static Vector   thisP,lastP;     /* Columns of log probabilities */
-static short   **traceBack;      /* array[1..segLen][2..numStates-1] */
+/* Storage for Viterbi Decoding, one record per alignment thread */
+typedef struct {
+   Vector   thisP,lastP;         /* Columns of log probabilities */
+   short    **traceBack;         /* array[1..segLen][2..numStates-1] */
+   MemHeap  *x;                  /* traceBack, states and mixes */
+   Observation obs;              /* current observation */
+   int      acc;                 /* index of accumulators to update */
+} AlignRec;
+
+static AlignRec *align;          /* array[0..nThreads-1] of AlignRec */
+static ThreadPool *pool;         /* alignment threads */
+static LogFloat *segP;           /* array[1..numSegs] of segment logP */
    
 /* Variable for Multi-Space probability Density */   
 static Boolean ignOutVec = TRUE;    /* ignore outlier vector */
@@ -182,6 +193,7 @@ void ReportUsage(void)
    printf(" -e f    Set convergence factor epsilon       1.0E-4\n");
    printf(" -g      Ignore outlier vector in MSD                      on\n");
    printf(" -i N    Set max iterations to N              20\n");
+   printf(" -j n    Align with n threads                 %d\n",nThreads);
    printf(" -l s    Set segment label to s               none\n");
    printf(" -m N    Set min segments needed              3\n");
    printf(" -n      Update hmm (suppress uniform seg)    off\n");
@@ -231,6 +243,8 @@ int main(int argc, char *argv[])
    if(InitParm()<SUCCESS)  
       HError(2100,"HInit: InitParm failed");
    InitTrain(); InitUtil();
+   InitThreads();
+   nThreads = NumThreads();
 
    if (!InfoPrinted() && NumArgs() == 0)
       ReportUsage();
@@ -249,6 +263,8 @@ int main(int argc, char *argv[])
          ignOutVec = FALSE; break;
       case 'i':
          maxIter = GetChkedInt(0,100,s); break;
+      case 'j':
+         nThreads = GetChkedInt(1,MAXTHREADS,s); break;
       case 'l':
          if (NextArg() != STRINGARG)
             HError(2119,"HInit: Segment label expected");
@@ -381,6 +397,8 @@ void PrintInitialInfo(void)
    if (uFlags&UPMIXES) printf("MixWeights/DProbs ");
    if (uFlags&UPTRANS) printf("TransProbs");
    printf("\n\n");
+   if (nThreads>1)
+      printf(" Threads  :  %d\n",nThreads);
    printf(" - system is ");
    switch (hset.hsKind){
    case PLAINHS:  printf("PLAIN\n");  break;
@@ -391,6 +409,23 @@ void PrintInitialInfo(void)
    fflush(stdout);
 }
 
+/* CanUseThreads: check that segments may be aligned in parallel */
+Boolean CanUseThreads(void)
+{
+   HMMScanState hss;
+   Boolean ok = TRUE;
+
+   if (hset.hsKind == TIEDHS || (trace&(T_VIT|T_ALN|T_MIX|T_CNT|T_OBP)))
+      return FALSE;
+   if (hset.hsKind == DISCRETEHS)
+      return TRUE;
+   NewHMMScan(&hset,&hss);
+   while (ok && GoNextMix(&hss,FALSE))
+      if (hss.mp->ckind != DIAGC) ok = FALSE;
+   EndHMMScan(&hss);
+   return ok;
+}
+
 /* Initialise: load hmm and initialise global data structures */
 void Initialise(void)
 {
@@ -398,7 +433,7 @@ void Initialise(void)
    char base[MAXSTRLEN];
    char path[MAXSTRLEN];
    char ext[MAXSTRLEN]; 
-   int s;  
+   int s,t;  
 
    /* Stacks for global structures requiring memory allocation */
    CreateHeap(&segmentStack,"SegStore", MSTAK, 1, 0.0, 100000, LONG_MAX);
@@ -417,7 +452,11 @@ void Initialise(void)
    SetParmHMMSet(&hset);
    if ((hset.hsKind==DISCRETEHS)||(hset.hsKind==TIEDHS))
       uFlags = (UPDSet) (uFlags & (~(UPMEANS|UPVARS)));
-   AttachAccs(&hset, &gstack, uFlags);
+   if (nThreads>1 && !CanUseThreads()) {
+      HError(-2130,"Initialise: aligning with 1 thread, need diagonal non-tied models and no per-segment tracing");
+      nThreads = 1;
+   }
+   AttachAccsParallel(&hset, &gstack, uFlags, nThreads);
 
    /* Get a pointer to the physical HMM and set related globals */
    hmmId = GetLabId(base,FALSE);   
@@ -436,8 +475,20 @@ void Initialise(void)
    if(trace>0)
       PrintInitialInfo();
 
-   thisP = CreateVector(&gstack,nStates);
-   lastP = CreateVector(&gstack,nStates);
+   align = (AlignRec *)New(&gstack,nThreads*sizeof(AlignRec));
+   for (t=0; t<nThreads; t++){
+      align[t].thisP = CreateVector(&gstack,nStates);
+      align[t].lastP = CreateVector(&gstack,nStates);
+      if (t==0)
+         align[t].x = &traceBackStack;
+      else {
+         align[t].x = (MemHeap *)New(&gstack,sizeof(MemHeap));
+         CreateHeap(align[t].x,"TraceBackStore", MSTAK, 1, 0.0, 1000, 1000);
+      }
+      align[t].acc = t;
+   }
+   if (nThreads>1)
+      pool = CreateThreadPool(&gstack,nThreads);
 }
 
 /* InitSegStore : Initialise segStore for particular observation */
@@ -824,39 +875,40 @@ void ShowAlignment(int segNum, int segLen, IntVec states, IntVec *mixes)
       }
 }
 
-/* MakeTraceBack: create the traceBack matrix */
-void MakeTraceBack(int segLen)
+/* MakeTraceBack: create the traceBack matrix of ar */
+void MakeTraceBack(AlignRec *ar, int segLen)
 {
    int segIdx;
    short *tmpPtr;
 
-   traceBack = (short **)New(&traceBackStack, segLen*sizeof(short *));
-   --traceBack;
+   ar->traceBack = (short **)New(ar->x, segLen*sizeof(short *));
+   --ar->traceBack;
    for (segIdx=1; segIdx<=segLen; segIdx++){
-      tmpPtr = (short *)New(&traceBackStack, (nStates-2)*sizeof(short));
-      traceBack[segIdx] = tmpPtr-2;
+      tmpPtr = (short *)New(ar->x, (nStates-2)*sizeof(short));
+      ar->traceBack[segIdx] = tmpPtr-2;
    }
 }
 
 /* DoTraceBack:  traceBack and set states array */
-void DoTraceBack(int segLen, IntVec states, int thisState)
+void DoTraceBack(AlignRec *ar, int segLen, IntVec states, int thisState)
 {
    int segIdx;
 
    for (segIdx=segLen; segIdx>0; segIdx--) {
       states[segIdx] = thisState;
-      thisState=traceBack[segIdx][thisState];
+      thisState=ar->traceBack[segIdx][thisState];
    }
 }
 
 /* FindBestMixes: for each state/obs pair find most likely mix component */
-void FindBestMixes(int segNum, int segLen, IntVec states, IntVec *mixes)
+void FindBestMixes(AlignRec *ar, int segNum, int segLen, IntVec states, 
+                   IntVec *mixes)
 {
    int i,s,m,bestm,M=0;
    StreamElem *ste;
    StreamInfo *sti;
    IntVec smix;
-   Observation obs;
+   Observation *obs = &ar->obs;
    Vector v;
    LogFloat bestP,p;
    MixtureElem *me;
@@ -866,9 +918,9 @@ void FindBestMixes(int segNum, int segLen, IntVec states, IntVec *mixes)
       printf(" Mixture component alignment\n");
    for (i=1; i<=segLen; i++){
       ste = hmmLink->svec[states[i]].info->pdf+1;
-      obs = GetSegObs(segStore, segNum, i);
+      FillSegObs(segStore, segNum, i, obs);
       if (hset.hsKind == TIEDHS)
-         PrecomputeTMix(&hset, &obs, 0.0, 1);
+         PrecomputeTMix(&hset, obs, 0.0, 1);
       for (s=1; s<=nStreams; s++,ste++){
          sti = ste->info;
          if (hset.hsKind != TIEDHS)
@@ -879,7 +931,7 @@ void FindBestMixes(int segNum, int segLen, IntVec states, IntVec *mixes)
          else if (M==1)
             bestm = 1;   
          else{
-            v = obs.fv[s];
+            v = obs->fv[s];
             bestP = LZERO; bestm=0;
             if (trace&T_MIX)
                printf("  seg %d, stream %d: ",i,s);
@@ -905,36 +957,40 @@ void FindBestMixes(int segNum, int segLen, IntVec states, IntVec *mixes)
 
 /* ViterbiAlign: align the segNum'th segment.  For each frame k, store aligned
    state in states and mostly likely mix comp in mixes.  Return logP. */
-LogFloat ViterbiAlign(int segNum,int segLen, IntVec states, IntVec *mixes)
+LogFloat ViterbiAlign(AlignRec *ar, int segNum, int segLen, IntVec states, 
+                      IntVec *mixes)
 {
    int currState,prevState,bestPrevState;
    int segIdx;
    LogFloat  bestP,currP,tranP,prevP;
-   Observation obs;
+   Observation *obs = &ar->obs;
+   Vector thisP = ar->thisP, lastP = ar->lastP;
+   short **traceBack;
 
    if (trace & T_VIT)
       printf(" Aligning Segment Number %d\n",segNum);
-   MakeTraceBack(segLen);
+   MakeTraceBack(ar,segLen);
+   traceBack = ar->traceBack;
    
    /* From entry state 1: Column 1 */
-   obs = GetSegObs(segStore, segNum, 1);
+   FillSegObs(segStore, segNum, 1, obs);
    if (hset.hsKind == TIEDHS)
-      PrecomputeTMix(&hset, &obs, 50.0, 0);
+      PrecomputeTMix(&hset, obs, 50.0, 0);
    for (currState=2;currState<nStates;currState++) {
       tranP = hmmLink->transP[1][currState];
       if (tranP<LSMALL) 
          lastP[currState] = LZERO;
       else
-         lastP[currState] = tranP + OutP(&obs,hmmLink,currState);
+         lastP[currState] = tranP + OutP(obs,hmmLink,currState);
       traceBack[1][currState] = 1;
    }
    if (trace & T_VIT) ShowP(1,lastP);  
    
    /* Columns[2] -> Columns[segLen] -- this is the general case */
    for (segIdx=2; segIdx<=segLen; segIdx++) {
-      obs = GetSegObs(segStore, segNum, segIdx);
+      FillSegObs(segStore, segNum, segIdx, obs);
       if (hset.hsKind == TIEDHS)
-         PrecomputeTMix(&hset, &obs, 50.0, 0);      
+         PrecomputeTMix(&hset, obs, 50.0, 0);      
       for (currState=2;currState<nStates;currState++) {
          bestPrevState=2;
          tranP = hmmLink->transP[2][currState]; prevP = lastP[2];
@@ -950,7 +1006,7 @@ LogFloat ViterbiAlign(int segNum,int segLen, IntVec states, IntVec *mixes)
          if (bestP<LSMALL)
             currP = thisP[currState] = LZERO;
          else {
-            currP = OutP(&obs,hmmLink,currState);
+            currP = OutP(obs,hmmLink,currState);
             thisP[currState] = bestP+currP;
          }
          if (trace&T_OBP)
@@ -981,17 +1037,18 @@ LogFloat ViterbiAlign(int segNum,int segLen, IntVec states, IntVec *mixes)
       printf(" bestP = %12.5f via state %d\n",bestP,bestPrevState);
       fflush(stdout);
    }
-   DoTraceBack(segLen,states,bestPrevState);
+   DoTraceBack(ar,segLen,states,bestPrevState);
    if (mixes!=NULL)  /* ie not DISCRETE */
-      FindBestMixes(segNum,segLen,states,mixes);
-   ResetHeap( &traceBackStack );
+      FindBestMixes(ar,segNum,segLen,states,mixes);
    return bestP;  
 }
 
 /* ----------------- Update Count Routines --------------------------- */
 
-/* UpdateCounts: using frames in seg i and alignment in states/mixes */
-void UpdateCounts(int segNum, int segLen, IntVec states,IntVec *mixes)
+/* UpdateCounts: using frames in seg i and alignment in states/mixes,
+   update the accumulators of ar */
+void UpdateCounts(AlignRec *ar, int segNum, int segLen, IntVec states,
+                  IntVec *mixes)
 {
    int M=0,i,j,k,s,m,size,state,last;
    StreamElem *ste;
@@ -1002,27 +1059,27 @@ void UpdateCounts(int segNum, int segLen, IntVec states,IntVec *mixes)
    VaAcc *va;
    TrAcc *ta;
    Vector v;
-   Observation obs;
+   Observation *obs = &ar->obs;
    TMixRec *tmRec = NULL;
    float x,y;
 
    last = 1;  /* last before 1st emitting state must be 1 */
-   ta = (TrAcc *)GetHook(hmmLink->transP); 
+   ta = (TrAcc *)GetHook(hmmLink->transP) + ar->acc;
    for (i=1; i<=segLen; i++){
       state = states[i];
       if (trace&T_CNT)
          printf("  Seg %d -> state %d\n",i,state);
       if (uFlags&(UPMEANS|UPVARS|UPMIXES)){
-         obs = GetSegObs(segStore, segNum, i);
+         FillSegObs(segStore, segNum, i, obs);
          if (hset.hsKind == TIEDHS)
-            PrecomputeTMix(&hset, &obs, 50.0, 0);         
+            PrecomputeTMix(&hset, obs, 50.0, 0);         
          ste = hmmLink->svec[state].info->pdf+1;
          for (s=1; s<=nStreams; s++,ste++){
             sti = ste->info;
             if (hset.hsKind==DISCRETEHS){
-               m = obs.vq[s]; v = NULL;
+               m = obs->vq[s]; v = NULL;
             } else {
-               v = obs.fv[s]; m = mixes[s][i];
+               v = obs->fv[s]; m = mixes[s][i];
             }
             switch(hset.hsKind){
             case TIEDHS:
@@ -1041,7 +1098,7 @@ void UpdateCounts(int segNum, int segLen, IntVec states,IntVec *mixes)
                printf("   stream %d -> mix %d[%d]\n",s,m,M); 
             /* update mixture weight */
             if (M>1 && (uFlags&UPMIXES)) {
-               wa = (WtAcc *)sti->hook;
+               wa = (WtAcc *)sti->hook + ar->acc;
                wa->occ += 1.0; wa->c[m] += 1.0;
                if (trace&T_CNT)
                   printf("   mix wt -> %.1f\n",wa->c[m]);
@@ -1058,8 +1115,8 @@ void UpdateCounts(int segNum, int segLen, IntVec states,IntVec *mixes)
                mp = tmRec->mixes[m];
                break;
             }
-            ma = (MuAcc *)GetHook(mp->mean);
-            va = (VaAcc *)GetHook(mp->cov.var);
+            ma = (MuAcc *)GetHook(mp->mean) + ar->acc;
+            va = (VaAcc *)GetHook(mp->cov.var) + ar->acc;
             ma->occ += 1.0; va->occ += 1.0;
             size = VectorSize(mp->mean);
             for (j=1; j<=size; j++) {
@@ -1374,33 +1431,63 @@ IntVec *CreateMixes(MemHeap *x,int segLen)
    return mixes;
 }
 
+/* AlignSegment: align segment i using ar, update counts and return logP */
+LogFloat AlignSegment(AlignRec *ar, int i)
+{
+   int segLen;
+   LogFloat segLogP;
+   IntVec states;  /* array[1..segLen] of State */
+   IntVec *mixes;  /* array[1..S][1..segLen] of MixComp */
+
+   segLen = SegLength(segStore,i);
+   states = CreateIntVec(ar->x,segLen);
+   mixes  = (hset.hsKind==DISCRETEHS)? NULL : CreateMixes(ar->x,segLen);
+   segLogP = ViterbiAlign(ar,i,segLen,states,mixes);
+   if (trace&T_ALN) ShowAlignment(i,segLen,states,mixes);
+   UpdateCounts(ar,i,segLen,states,mixes);
+   ResetHeap(ar->x);   /* disposes traceBack, states and mixes */
+   return segLogP;
+}
+
+/* AlignTask: align every nThreads'th segment starting at task+1 */
+void AlignTask(int thread, int task, Ptr arg)
+{
+   int i,numSegs;
+
+   numSegs = NumSegs(segStore);
+   for (i=task+1; i<=numSegs; i+=nThreads)
+      segP[i] = AlignSegment(align+task,i);
+}
+
 /* EstimateModel: top level of iterative estimation process */
 void EstimateModel(void)
 {
    LogFloat totalP,newP,delta;
    Boolean converged = FALSE;
-   int i,iter,numSegs,segLen;    
-   IntVec states;  /* array[1..numSegs] of State */
-   IntVec *mixes;  /* array[1..S][1..numSegs] of MixComp */
+   int i,t,iter,numSegs;    
 
    if (trace&T_TOP) printf("Starting Estimation Process\n");
    if (newModel){
       UniformSegment();
    }
+   numSegs = NumSegs(segStore);
+   for (t=0; t<nThreads; t++)
+      align[t].obs = segStore->o;
+   if (nThreads>1)
+      segP = CreateVector(&gstack,numSegs);
    totalP=LZERO;
    for (iter=1; !converged && iter<=maxIter; iter++){
-      ZeroAccs(&hset, uFlags);              /* Clear all accumulators */
-      numSegs = NumSegs(segStore);
+      ZeroAccsParallel(&hset, uFlags, nThreads);  /* Clear all accumulators */
       /* Align on each training segment and accumulate stats */
-      for (newP=0.0,i=1;i<=numSegs;i++) {
-         segLen = SegLength(segStore,i);
-         states = CreateIntVec(&gstack,segLen);
-         mixes  = (hset.hsKind==DISCRETEHS)? NULL : CreateMixes(&gstack,segLen);
-         newP += ViterbiAlign(i,segLen,states,mixes);
-         if (trace&T_ALN) ShowAlignment(i,segLen,states,mixes);
-         UpdateCounts(i,segLen,states,mixes);
-         FreeIntVec(&gstack,states); /* disposes mixes too */
+      if (nThreads>1) {
+         RunThreadTasks(pool,nThreads,AlignTask,NULL);
+         for (newP=0.0,i=1;i<=numSegs;i++)
+            newP += segP[i];
+         MergeAccsParallel(&hset, uFlags, 1, nThreads);
       }
+      else
+         for (newP=0.0,i=1;i<=numSegs;i++)
+            newP += AlignSegment(align,i);
       /* Update parameters or quit */
       newP /= (float)numSegs;
       delta = newP - totalP;
@@ -75,7 +75,6 @@
 /*#### todo:
 
      - implement lattice oracle WER calculation
-     - allow batch processing?
 */
 
 char *hlrescore_version = "!HVER!HLRescore:   3.4.1 [CUED 12/03/09]";
@@ -95,6 +94,7 @@ char *hlrescore_vc_id = "$Id: HLRescore.c,v 1.1.1.1 2006/10/11 09:55:01 jal58 Ex
 #include "HRec.h"
 #include "HLM.h"
 #include "HLat.h"
+#include "HThreads.h"
 
 /* -------------------------- Trace Flags & Vars ------------------------ */
 
@@ -161,10 +161,28 @@ static Boolean writeLat = FALSE;    /* -w */
 static Boolean expandLat = FALSE;   /* -n */
 static Boolean pruneOutLat = FALSE; /* -u */
 static Boolean findBest = FALSE;    /* -f */
+static int nBest = 1;               /* -f: transcriptions per lattice */
 static Boolean calcStats = FALSE;   /* -c */
 static Boolean lab2Lat = FALSE;     /* -I */
 static Boolean mergeLat = FALSE;    /* -m */
 
+/* -------------------------- Parallel Rescoring ------------------------ */
+
+#define JOBS_PER_THREAD 4   /* lattices in flight per thread */
+
+typedef struct {            /* a lattice being rescored */
+   char latfn[MAXFNAMELEN]; /* lattice name */
+   Lattice *lat;            /* current lattice */
+   Transcription *trans;    /* 1-best transcription */
+   MemHeap latHeap;         /* heap for lattices of this job */
+   MemHeap transHeap;       /* heap for transcription of this job */
+} LatJob;
+
+static int nThreads = 1;            /* number of threads (-j) */
+static ThreadPool *pool = NULL;     /* worker threads */
+static LatJob *jobs = NULL;         /* array [0..nJobs-1] of jobs */
+static int nJobs = 0;               /* max lattices in flight */
+
 /* -------------------------- Heaps ------------------------------------- */
 
 static MemHeap latHeap;
@@ -177,6 +195,7 @@ static MemHeap transHeap;
 void SetConfParms (void);
 void ReportUsage (void);
 void ProcessLattice (char *latfn);
+void ProcessLatticeBatch (void);
 void ProcessLabels (char *labfn);
 
 
@@ -211,6 +230,7 @@ void ReportUsage(void)
    printf("\nUSAGE: HLRescore [options] vocabFile Files...\n\n");
    printf(" Option                                   Default\n\n");
    printf(" -i s    Output transcriptions to MLF s       off\n"); 
+   printf(" -j n    rescore lattices with n threads      %d\n", nThreads);
    printf(" -l s    dir to store label/lattice files     current\n");
    printf(" -m s    merge nodes and arcs of lattice      off\n");
    printf(" -n s    load n-gram LM and expand lattice    off\n");
@@ -224,7 +244,7 @@ void ReportUsage(void)
    printf(" -r f    pronunciation scale factor           1.0\n");
    printf(" -d      get pronprobs from dict              off\n");
    printf(" -c      calculate statistics                 off\n");
-   printf(" -f      find 1-best transcription            off\n");
+   printf(" -f [n]  find n-best transcriptions           off\n");
    printf(" -w      write output lattices                off\n");
    printf(" -q s    output lattice format                tvaldmnr\n"); 
    printf(" -y s    output label file extension          rec\n");
@@ -234,6 +254,7 @@ void ReportUsage(void)
 
 int main(int argc, char *argv[])
 {
+   int i;
    char *s, *latfn, *labfn;
    FILE *nf;
    Boolean isPipe;
@@ -256,6 +277,8 @@ int main(int argc, char *argv[])
    InitRec();
    InitLM();
    InitLat();
+   InitThreads();
+   nThreads = NumThreads();
 
    if (!InfoPrinted() && NumArgs() == 0)
       ReportUsage();
@@ -297,6 +320,10 @@ int main(int argc, char *argv[])
             HError (4014, "HLRescore: Cannot write to MLF");
          break;
 
+      case 'j':
+         nThreads = GetChkedInt (1, MAXTHREADS, s);
+         break;
+
       case 'I':
          if (NextArg() != STRINGARG)
             HError (4019, "HLRescore: Input MLF file name expected");
@@ -387,6 +414,8 @@ int main(int argc, char *argv[])
 
       case 'f':
          findBest = TRUE;
+         if (NextArg()==INTARG)
+            nBest = GetChkedInt(1,100000,s);
          break;
          
       case 'w':
@@ -498,6 +527,24 @@ int main(int argc, char *argv[])
    if (!endLab)
       HError (9999, "HLRescore: cannot find ENDWORD '%s'\n", endWord);
    nullLab = vocab.nullWord->wordName;
+
+   /* per-job heaps and worker threads for parallel rescoring */
+   if (nThreads > 1 && lab2Lat) {
+      HError (-4019, "HLRescore: label files are processed with 1 thread");
+      nThreads = 1;
+   }
+   if (nThreads > 1) {
+      nJobs = nThreads * JOBS_PER_THREAD;
+      jobs = (LatJob *) New (&gstack, nJobs * sizeof (LatJob));
+      for (i = 0; i < nJobs; ++i) {
+         CreateHeap (&jobs[i].latHeap, "Lattice heap", MSTAK, 1, 0, 8000, 80000);
+         CreateHeap (&jobs[i].transHeap, "Transcription heap",MSTAK, 1, 0, 8000, 80000);
+      }
+      pool = CreateThreadPool (&gstack, nThreads);
+      if (trace & T_TOP)
+         printf ("Rescoring with %d threads\n", nThreads);
+      ProcessLatticeBatch ();
+   }
    
    while (NumArgs() > 0) {
       if (NextArg() != STRINGARG)
@@ -530,11 +577,11 @@ int main(int argc, char *argv[])
 }
 
 
-/* ProcessLattice
+/* ReadLatFile
 
-     apply all the requested operations on lattice
+     read lattice latfn into heap
 */
-void ProcessLattice (char *latfn)
+static Lattice *ReadLatFile (char *latfn, MemHeap *heap)
 {
    Lattice *lat;
    char lfn[MAXSTRLEN];
@@ -546,21 +593,48 @@ void ProcessLattice (char *latfn)
    if ((lf = FOpen(lfn,NetFilter,&isPipe)) == NULL)
       HError(4010,"HLRescore: Cannot open Lattice file %s", lfn);
   
-   lat = ReadLattice (lf, &latHeap, &vocab, FALSE, FALSE);
+   lat = ReadLattice (lf, heap, &vocab, FALSE, FALSE);
    FClose(lf, isPipe);
 
    if (!lat)
       HError (4013, "HLRescore: can't read lattice");
-   
+
+   if (trace & T_LAT)
+      printf ("lattice size: %d nodes/ %d arcs\n", lat->nn, lat->na);
+
+   return lat;
+}
+
+/* FindBest
+
+     find the nBest best transcriptions of lat.  The 1-best path is
+     found by HLat, the N-best lists by the A* search of HRec.
+*/
+static Transcription *FindBest (MemHeap *heap, Lattice *lat)
+{
+   if (nBest > 1)
+      return TranscriptionFromLattice (heap, lat, nBest);
+   return LatFindBest (heap, lat, 1);
+}
+
+/* RescoreLattice
+
+     apply the requested lattice operations to lat, storing new
+     lattices in heap and the 1-best transcription (if any) in transHeap.
+     Only touches data belonging to lat so may be run in a worker thread.
+*/
+static Lattice *RescoreLattice (Lattice *lat, MemHeap *heap, MemHeap *transHeap,
+                                Transcription **trans)
+{
+   int i;
+   LNode *ln;
+
    if (fixBadLats)
       FixBadLat (lat);
 
    if (fixPronprobs)
       FixPronProbs (lat, &vocab);
 
-   if (trace & T_LAT)
-      printf ("lattice size: %d nodes/ %d arcs\n", lat->nn, lat->na);
-
    lat->lmscale = lmScale;
    lat->wdpenalty = wordPen;
    lat->acscale = acScale;
@@ -568,13 +642,13 @@ void ProcessLattice (char *latfn)
 
    /* prune original lattice */
    if (pruneInLat) {
-      lat = LatPrune (&latHeap, lat, pruneInThresh, pruneInArcsPerSec);
+      lat = LatPrune (heap, lat, pruneInThresh, pruneInArcsPerSec);
    }
 
    /* expand lattice with new LM */
    if (expandLat) {
 #ifndef NO_LAT_LM
-      lat = LatExpand (&latHeap, lat, lm);
+      lat = LatExpand (heap, lat, lm);
 #else 
       HError (4090, "LatExpand not supported. Recompile without NO_LAT_LM");
 #endif
@@ -583,16 +657,45 @@ void ProcessLattice (char *latfn)
    /* merge lattice nodes and arcs */
    if (mergeLat) {
       if (*mergeDir == 'f') 
-         lat = MergeLatNodesArcs(lat, &latHeap, TRUE);      
+         lat = MergeLatNodesArcs(lat, heap, TRUE);      
       else 
-         lat = MergeLatNodesArcs(lat, &latHeap, FALSE);
+         lat = MergeLatNodesArcs(lat, heap, FALSE);
    }
 
-   /* find 1-best Transcription */
-   if (findBest) {
-      Transcription *trans;
+   /* find 1-best (or N-best) Transcription */
+   *trans = NULL;
+   if (findBest)
+      *trans = FindBest (transHeap, lat);
+
+   /* prune generated lattice */
+   if (pruneOutLat) {
+      lat = LatPrune (heap, lat, pruneOutThresh, pruneOutArcsPerSec);
+   }
+
+   /* set node scores for lattice output */
+   if (writeLat) {
+      if (sortLattice)
+         LatSetScores (lat);
+      else
+         for(i=0, ln=lat->lnodes; i<lat->nn; i++, ln++)
+            ln->score=0.0;
+   }
+
+   return lat;
+}
+
+/* OutputLattice
 
-      trans = LatFindBest (&transHeap, lat, 1);
+     write the transcription, statistics and lattice for latfn
+*/
+static void OutputLattice (char *latfn, Lattice *lat, Transcription *trans)
+{
+   char lfn[MAXSTRLEN];
+   FILE *lf;
+   Boolean isPipe;
+
+   /* write 1-best Transcription */
+   if (findBest) {
       if (trace & T_TRAN)
          PrintTranscription (trans, "1-best path");
 
@@ -611,12 +714,6 @@ void ProcessLattice (char *latfn)
       MakeFN (latfn, labOutDir, labOutExt, lfn);
       if (LSave (lfn, trans, ofmt) < SUCCESS)
          HError (4014, "ProcessLattice: Cannot save file %s", lfn);
-      ResetHeap (&transHeap);
-   }
-
-   /* prune generated lattice */
-   if (pruneOutLat) {
-      lat = LatPrune (&latHeap, lat, pruneOutThresh, pruneOutArcsPerSec);
    }
 
    /* calc lattice stats */
@@ -627,14 +724,6 @@ void ProcessLattice (char *latfn)
    /* write lattice */
    if (writeLat) {
       LatFormat form;
-      int i;
-      LNode *ln;
-
-      if (sortLattice)
-         LatSetScores (lat);
-      else
-         for(i=0, ln=lat->lnodes; i<lat->nn; i++, ln++)
-            ln->score=0.0;
 
       MakeFN (latfn, labOutDir, latInExt, lfn);
       lf = FOpen (lfn, NetOFilter, &isPipe);
@@ -664,14 +753,79 @@ void ProcessLattice (char *latfn)
       
       FClose (lf, isPipe);
    }
+}
+
+/* ProcessLattice
+
+     apply all the requested operations on lattice
+*/
+void ProcessLattice (char *latfn)
+{
+   Lattice *lat;
+   Transcription *trans;
+
+   lat = ReadLatFile (latfn, &latHeap);
+   lat = RescoreLattice (lat, &latHeap, &transHeap, &trans);
+   OutputLattice (latfn, lat, trans);
 
    if (trace & T_MEM) {
       printf("Memory State after processing lattice\n");
       PrintAllHeapStats();
    }
+   ResetHeap (&transHeap);
    ResetHeap (&latHeap);
 }
 
+/* RescoreTask
+
+     thread task to rescore the lattice of jobs[job]
+*/
+static void RescoreTask (int thread, int job, Ptr arg)
+{
+   LatJob *lj = jobs + job;
+
+   lj->lat = RescoreLattice (lj->lat, &lj->latHeap, &lj->transHeap, &lj->trans);
+}
+
+/* ProcessLatticeBatch
+
+     process all remaining lattices on the command line, reading
+     nJobs lattices at a time, rescoring them in parallel and then
+     writing the results in their original order
+*/
+void ProcessLatticeBatch (void)
+{
+   int i, n;
+   LatJob *lj;
+
+   while (NumArgs() > 0) {
+      /* read next batch of lattices */
+      for (n = 0; n < nJobs && NumArgs() > 0; ++n) {
+         if (NextArg() != STRINGARG)
+            HError (4019, "HLRescore: Transcription file name expected");
+         lj = jobs + n;
+         strcpy (lj->latfn, GetStrArg());
+         if (trace & T_TOP) {
+            printf ("File: %s\n", lj->latfn);  fflush(stdout);
+         }
+         lj->lat = ReadLatFile (lj->latfn, &lj->latHeap);
+      }
+
+      RunThreadTasks (pool, n, RescoreTask, NULL);
+
+      /* output results in order */
+      for (i = 0, lj = jobs; i < n; ++i, ++lj) {
+         OutputLattice (lj->latfn, lj->lat, lj->trans);
+         if (trace & T_MEM) {
+            printf("Memory State after processing lattice\n");
+            PrintAllHeapStats();
+         }
+         ResetHeap (&lj->transHeap);
+         ResetHeap (&lj->latHeap);
+      }
+   }
+}
+
 
 /* ProcessLabels
 
@@ -752,11 +906,11 @@ void ProcessLabels (char *labfn)
       }
    }
 
-   /* find 1-best Transcription */
+   /* find 1-best (or N-best) Transcription */
    if (findBest) {
       Transcription *trans;
 
-      trans = LatFindBest (&transHeap, lat, 1);
+      trans = FindBest (&transHeap, lat);
       if (trace & T_TRAN)
          PrintTranscription (trans, "1-best path");
 
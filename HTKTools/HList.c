@@ -349,7 +349,7 @@ Boolean IsWave(char *srcFile)
    FILE *f;
    long nSamp,sampP, hdrS;
    short sampS,kind;
-   Boolean isPipe,bSwap,isWave;
+   Boolean isPipe,bSwap,isWave,inArc;
    char buf[MAXSTRLEN];
    ParmKind tgtPK=ANON;
    FileFormat srcFF=HTK;
@@ -367,7 +367,10 @@ Boolean IsWave(char *srcFile)
          strncpy (actfname, srcFile, MAXFNAMELEN);
          isEXF = GetFileNameExt (srcFile, actfname, &stIndex, &enIndex);
          
-         if ((f = FOpen (actfname, WaveFilter, &isPipe)) == NULL)
+         inArc = IsArchiveName(actfname); isPipe = FALSE;
+         if (inArc) f = OpenArchiveEntry(actfname);
+         else f = FOpen (actfname, WaveFilter, &isPipe);
+         if (f == NULL)
             HError(1110,"IsWave: cannot open File %s",srcFile);
          switch (srcFF) {
          case HTK:
@@ -383,7 +386,8 @@ Boolean IsWave(char *srcFile)
             break;
          }
          isWave = (kind == WAVEFORM) ? TRUE:FALSE;
-         FClose(f,isPipe);
+         if (inArc) CloseArchiveEntry(f);
+         else FClose(f,isPipe);
       } else
          isWave = TRUE;
    }
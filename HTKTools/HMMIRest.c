@@ -100,6 +100,7 @@ char *hmmirest_vc_id = "$Id: HMMIRest.c,v 1.1.1.1 2006/10/11 09:55:01 jal58 Exp
 #include "HArc.h"
 #include "HFBLat.h"
 #include "HExactMPE.h"
+#include "HThreads.h"
 #include <math.h>
 
 
@@ -273,6 +274,25 @@ static XFInfo xfInfo;
 /* static prior */
 static Boolean STATICPRIOR = FALSE;
 
+/* -------------------------- Parallel Alignment ------------------------ */
+
+#define JOBS_PER_THREAD 4   /* utterances in flight per thread */
+
+typedef struct {            /* an utterance being aligned */
+   char datafn[MAXFNAMELEN];   /* data file name */
+   Boolean doNum;           /* align the numerator lattices */
+   Boolean doDen;           /* align the denominator lattices */
+   FBLatInfo num;           /* forward-backward for numerator */
+   FBLatInfo den;           /* forward-backward for denominator */
+} FBJob;
+
+static int nThreads = 1;            /* number of threads (-j) */
+static ThreadPool *pool = NULL;     /* worker threads */
+static FBLatWorker **workers;       /* array [0..nThreads-1] of worker states */
+static FBJob *jobs = NULL;          /* array [0..nJobs-1] of jobs */
+static int nJobs = 0;               /* max utterances in flight */
+static int nQueued = 0;             /* utterances prepared so far */
+
 /* ------------------ Process Command Line -------------------------- */
    
 /* SetConfParms: set conf parms relevant to HMMIRest  */
@@ -377,6 +397,7 @@ void ReportUsage(void)
    printf(" -g      MLE updates only.                   \n");
    printf(" -h s    set output speaker name pattern   *.%%%%%%\n");
    printf("         to s, optionally set input and parent patterns\n");
+   printf(" -j n    align with n threads               %d\n", nThreads);
    printf(" -l N    set max sentences (useful for debug) all\n"); 
    printf(" -m N    set min examples needed per model   3\n");
    printf(" -o s    extension for new hmm files        as src\n");
@@ -425,10 +446,206 @@ void PrintCriteria (void)
    if(!MPE || MPEStoreML) printf("\nML criterion per frame is: %f (%f/%d)\n", totalPr1/totalT,totalPr1, totalT);
 }
 
+/* LoadLattices: load the numerator and denominator lattices for datafn */
+static void LoadLattices(char *datafn, Lattice **numLats, Lattice **denLats)
+{
+   char latfn[MAXSTRLEN], datafn_lat[MAXFNAMELEN];
+   int latn;
+   FILE *f;
+   Boolean isPipe;
+
+   /* derive lattice base file name from segment name using LATFILEMASK 
+      this can be used to discard extra info (various cluster IDs, etc) */
+   if (latFileMask) {
+      if (!MaskMatch (latFileMask, datafn_lat, datafn))
+         HError(2319,"HERest: LATFILEMASK %s has no match with segemnt %s", latFileMask, datafn);
+   }
+   else
+      strcpy (datafn_lat, datafn);
+
+   if(nDenLats > 0){ /* Load denominator (recognition) lattices. */
+      char buf1[MAXFNAMELEN],buf2[MAXFNAMELEN],buf3[MAXFNAMELEN];
+      for(latn = 0; latn<nDenLats;latn++){
+         if ( denLatSubDirPat[0] ){
+            if ( !MaskMatch( denLatSubDirPat , buf1 , datafn_lat ) )
+               HError(2319,"HERest: mask %s has no match with segemnt %s" , denLatSubDirPat , datafn_lat );
+            MakeFN(buf1,denLatDir[latn],NULL,buf2);
+         }
+         else
+            strcpy(buf2,denLatDir[latn]);
+         if ( LatMask_Denominator != NULL ){
+            if ( !MaskMatch( LatMask_Denominator , buf1 , datafn_lat ) )
+               HError(2319,"HERest: mask %s has no match with segemnt %s" , LatMask_Denominator , datafn_lat );
+            MakeFN(buf1,buf2,NULL,buf3);
+            strcpy (buf2, buf3);
+         }
+         
+         if (useLLF) { 
+            denLats[latn] = GetLattice(datafn_lat,buf2, latExt,
+                                       &latStack, &vocab, FALSE/*shortArc*/, TRUE/*add2Dict*/);
+         }
+         else {
+            MakeFN(datafn_lat,buf2,latExt,latfn);
+            f = FOpen(latfn, NetFilter, &isPipe);
+            if(!f) HError(1, "Couldn't open file %s\n", latfn);
+            printf("Reading lattice from file: %s\n", latfn); fflush(stdout);
+            denLats[latn] = ReadLattice(f, &latStack, &vocab, FALSE/*shortArc*/, TRUE/*add2Dict*/);
+            FClose(f, isPipe);
+         }
+      }
+   }
+
+   if(nNumLats > 0){  /* Load numerator (correct transcription) lattices. */
+      char buf1[MAXFNAMELEN],buf2[MAXFNAMELEN],buf3[MAXFNAMELEN];
+      for(latn=0;latn<nNumLats;latn++){
+         if ( numLatSubDirPat[0] ){
+            if ( !MaskMatch( numLatSubDirPat , buf1 , datafn_lat ) )
+               HError(2319,"HERest: mask %s has no match with segemnt %s" , numLatSubDirPat , datafn_lat );
+            MakeFN(buf1,numLatDir[latn],NULL,buf2);
+         }
+         else
+            strcpy(buf2,numLatDir[latn]);
+         if ( LatMask_Numerator != NULL ){
+            if ( !MaskMatch( LatMask_Numerator , buf1 , datafn_lat ) )
+               HError(2319,"HERest: mask %s has no match with segemnt %s" , LatMask_Numerator , datafn_lat );
+            MakeFN(buf1,buf2,NULL,buf3);
+            strcpy (buf2, buf3);
+         }
+
+         if (useLLF) {
+            numLats[latn] = GetLattice(datafn_lat,buf2, latExt,
+                                       &latStack, &vocab, FALSE/*shortArc*/, TRUE/*add2Dict*/);
+         }
+         else {
+            MakeFN(datafn_lat,buf2,latExt,latfn);
+            f = FOpen(latfn, NetFilter, &isPipe);
+            if(!f)  HError(1, "Couldn't open file %s\n", latfn);
+            numLats[latn] = ReadLattice(f, &latStack, &vocab, FALSE/*shortArc*/, TRUE/*add2Dict*/);
+            FClose(f, isPipe);
+         }
+      }
+   }
+}
+
+/* FBTask: align every nThreads'th queued job starting at job task */
+static void FBTask(int thread, int task, Ptr arg)
+{
+   FBJob *job;
+   int j, CorrIndex, RecogIndex1, RecogIndex2;
+
+   CorrIndex = MPE&&!ML_MODE ? 2 : 0;   /* as in main() */
+   RecogIndex1 = MPE ? 0 : 1;
+   RecogIndex2 = MPE ? 1 : 999;
+   for (j=task; j<nQueued; j+=nThreads) {
+      job = jobs+j;
+      if (job->doNum)
+         FBLatCompute(&job->num, workers[task], CorrIndex, 999/*dont-care*/);
+      if (job->doDen)
+         FBLatCompute(&job->den, workers[task], RecogIndex1, RecogIndex2);
+   }
+}
+
+/* RunFBJobs: align the queued jobs and add their totals in input order */
+static void RunFBJobs(void)
+{
+   FBJob *job;
+   int j;
+
+   RunThreadTasks(pool, nThreads, FBTask, NULL);
+   for (j=0; j<nQueued; j++) {
+      job = jobs+j;
+      if (job->doNum) {
+         FBLatFinish(&job->num);
+         totalT += job->num.T;
+         totalPr1 += job->num.pr;
+      }
+      if (job->doDen) {
+         FBLatFinish(&job->den);
+         if(MMIPrior) totalPr3 += job->den.pr;
+         if(!job->doNum) totalT += job->den.T;
+         totalPr2 += job->den.pr;
+         if(MPE){  TotalNWords += job->den.MPEFileLength; TotalCorr += job->den.AvgCorr; }
+      }
+   }
+   nQueued = 0;
+   ResetHeap(&transStack);
+   ResetHeap(&latStack);
+}
+
+/* QueueFBJob: load the lattices and data of datafn ready for
+   alignment by a worker thread, aligning a batch when it is full */
+static void QueueFBJob(char *datafn)
+{
+   FBJob *job = jobs+nQueued;
+   Lattice *denLats[MAXLATS], *numLats[MAXLATS];
+   Boolean UseLat;
+   int i,j;
+
+   strcpy(job->datafn, datafn);
+   LoadLattices(datafn, numLats, denLats);
+   job->doNum = (!MPE || (MPE&&MPEStoreML)) ? TRUE:FALSE;
+   job->doDen = (!ML_MODE) ? TRUE:FALSE;
+   if(job->doNum && !nNumLats)  HError(-1, "No correct-transcription lattices specified so , use -q option.");
+   if(job->doDen && !nDenLats) HError(1, "No recognition lattices specified, use -r option.");
+
+   if(job->doNum){
+      for(i=0;i<nNumLats;i++) FBLatAddLattice(&job->num, numLats[i]);
+      FBLatPrepare(&job->num, dff, job->datafn, NULL, NULL/*MPE-related*/);
+   }
+   if(job->doDen){
+      for(i=0;i<nDenLats;i++) FBLatAddLattice(&job->den, denLats[i]);
+      for(i=0;i<nNumLats;i++){
+         UseLat = TRUE; 
+         for(j=0;j<nDenLats;j++) if (LatInLat(numLats[i],denLats[j])) UseLat=FALSE; /*  Don't add redundant num lattices. */
+         if(UseLat){ if(trace&T_TOP) printf("[+num]");  FBLatAddLattice(&job->den, numLats[i]); }
+      }
+      if(MMIPrior) SetDoingFourthAcc(TRUE,3);
+      FBLatPrepare(&job->den, dff, job->datafn, NULL, MPE ? numLats[0] : NULL);
+      if(MMIPrior) SetDoingFourthAcc(FALSE,999);
+   }
+   if (++nQueued == nJobs) RunFBJobs();
+}
+
+/* InitFBJobs: create the threads, worker states and jobs */
+static void InitFBJobs(void)
+{
+   int i;
+
+   pool = CreateThreadPool(&gstack, nThreads);
+   workers = (FBLatWorker **) New(&gstack, nThreads*sizeof(FBLatWorker *));
+   for (i=0; i<nThreads; i++)
+      workers[i] = CreateFBLatWorker(&gstack, i, i*NumAccs);
+   nJobs = nThreads * JOBS_PER_THREAD;
+   jobs = (FBJob *) New(&gstack, nJobs*sizeof(FBJob));
+   memset(jobs, 0, nJobs*sizeof(FBJob));
+   for (i=0; i<nJobs; i++) {
+      InitialiseFBInfo(&jobs[i].num, &hset, uFlagsAccs, twoDataFiles);
+      InitialiseFBInfo(&jobs[i].den, &hset, uFlagsAccs, twoDataFiles);
+   }
+   if (trace&T_TOP)
+      printf("Aligning with %d threads\n", nThreads);
+}
+
+/* CanUseThreads: check that the alignment may be run in parallel */
+static Boolean CanUseThreads(void)
+{
+   HMMScanState hss;
+   Boolean ok = TRUE;
+
+   if ((hset.hsKind != PLAINHS && hset.hsKind != SHAREDHS) || twoDataFiles ||
+       xfInfo.useInXForm || xfInfo.usePaXForm || (uFlags&UPXFORM))
+      return FALSE;
+   NewHMMScan(&hset,&hss);
+   while (ok && GoNextMix(&hss,FALSE))
+      if (hss.mp->ckind != DIAGC && hss.mp->ckind != INVDIAGC) ok = FALSE;
+   EndHMMScan(&hss);
+   return ok;
+}
+
 int main(int argc, char *argv[]) 
 {
-   char datafn1[MAXSTRLEN], *datafn, *datafn2, *s,  latfn[MAXSTRLEN], datafn_lat[MAXFNAMELEN];
-   Lattice *denLats[MAXLATS], *numLats[MAXLATS]; int latn;
+   char datafn1[MAXSTRLEN], *datafn, *datafn2, *s;
+   Lattice *denLats[MAXLATS], *numLats[MAXLATS];
    int maxSnt=0;
 
    void Initialise(char *hmmListFn);
@@ -460,6 +677,8 @@ int main(int argc, char *argv[])
    InitLat();
    InitNet();
    InitAdapt(&xfInfo,NULL); 
+   InitThreads();
+   nThreads = NumThreads();
 
    if (!InfoPrinted() && NumArgs() == 0)
       ReportUsage();
@@ -488,6 +707,8 @@ int main(int argc, char *argv[])
       case 'g': ML_MODE=TRUE; THREEACCS=FALSE;/*This is the option used during re-estimation when we are only using one set of accs.*/
          uFlagsMLE = (UPDSet)(UPMEANS|UPVARS|UPTRANS|UPMIXES); /*TODO, check if necessary. */
          break; 
+      case 'j':
+         nThreads = GetChkedInt(1,MAXTHREADS,s); break;
       case 'l':
          maxSnt = GetChkedInt(0,1000,s); break;
       case 'o':
@@ -726,7 +947,6 @@ int main(int argc, char *argv[])
          }
       } else {
          /*parMode not zero -> load data files & align..*/
-         Boolean isPipe;
        
          if(NextArg() != STRINGARG)
             HError(2319,"HERest: data file name expected");
@@ -745,82 +965,17 @@ int main(int argc, char *argv[])
 	    }
 	 
             if (UpdateSpkrStats(&hset,&xfInfo, datafn)) nSnt=0 ;
+            if (nThreads > 1) {  /* align in a worker thread */
+               QueueFBJob(datafn);
+               nSnt++;
+               continue;
+            }
             fbInfo.xfinfo  = &xfInfo;
             fbInfo.inXForm = xfInfo.inXForm;
             fbInfo.paXForm = xfInfo.paXForm;
 
-            /* derive lattice base file name from segment name using LATFILEMASK 
-               this can be used to discard extra info (various cluster IDs, etc) */
-            if (latFileMask) {
-               if (!MaskMatch (latFileMask, datafn_lat, datafn))
-                  HError(2319,"HERest: LATFILEMASK %s has no match with segemnt %s", latFileMask, datafn);
-            }
-            else
-               strcpy (datafn_lat, datafn);
-
-            if(nDenLats > 0){ /* Load denominator (recognition) lattices. */
-               char buf1[MAXFNAMELEN],buf2[MAXFNAMELEN],buf3[MAXFNAMELEN];
-               for(latn = 0; latn<nDenLats;latn++){
-                  if ( denLatSubDirPat[0] ){
-                     if ( !MaskMatch( denLatSubDirPat , buf1 , datafn_lat ) )
-                        HError(2319,"HERest: mask %s has no match with segemnt %s" , denLatSubDirPat , datafn_lat );
-                     MakeFN(buf1,denLatDir[latn],NULL,buf2);
-                  }
-                  else
-                     strcpy(buf2,denLatDir[latn]);
-                  if ( LatMask_Denominator != NULL ){
-                     if ( !MaskMatch( LatMask_Denominator , buf1 , datafn_lat ) )
-                        HError(2319,"HERest: mask %s has no match with segemnt %s" , LatMask_Denominator , datafn_lat );
-                     MakeFN(buf1,buf2,NULL,buf3);
-                     strcpy (buf2, buf3);
-                  }
-                  
-                  if (useLLF) { 
-                     denLats[latn] = GetLattice(datafn_lat,buf2, latExt,
-                                                &latStack, &vocab, FALSE/*shortArc*/, TRUE/*add2Dict*/);
-                  }
-                  else {
-                     MakeFN(datafn_lat,buf2,latExt,latfn);
-                     f = FOpen(latfn, NetFilter, &isPipe);
-                     if(!f) HError(1, "Couldn't open file %s\n", latfn);
-                     printf("Reading lattice from file: %s\n", latfn); fflush(stdout);
-                     denLats[latn] = ReadLattice(f, &latStack, &vocab, FALSE/*shortArc*/, TRUE/*add2Dict*/);
-                     FClose(f, isPipe);
-                  }
-               }
-            }
-
-            if(nNumLats > 0){  /* Load numerator (correct transcription) lattices. */
-               char buf1[MAXFNAMELEN],buf2[MAXFNAMELEN],buf3[MAXFNAMELEN];
-               for(latn=0;latn<nNumLats;latn++){
-                  if ( numLatSubDirPat[0] ){
-                     if ( !MaskMatch( numLatSubDirPat , buf1 , datafn_lat ) )
-                        HError(2319,"HERest: mask %s has no match with segemnt %s" , numLatSubDirPat , datafn_lat );
-                     MakeFN(buf1,numLatDir[latn],NULL,buf2);
-                  }
-                  else
-                     strcpy(buf2,numLatDir[latn]);
-                  if ( LatMask_Numerator != NULL ){
-                     if ( !MaskMatch( LatMask_Numerator , buf1 , datafn_lat ) )
-                        HError(2319,"HERest: mask %s has no match with segemnt %s" , LatMask_Numerator , datafn_lat );
-                     MakeFN(buf1,buf2,NULL,buf3);
-                     strcpy (buf2, buf3);
-                  }
+            LoadLattices(datafn, numLats, denLats);
 
-                  if (useLLF) {
-                     numLats[latn] = GetLattice(datafn_lat,buf2, latExt,
-                                                &latStack, &vocab, FALSE/*shortArc*/, TRUE/*add2Dict*/);
-                  }
-                  else {
-                     MakeFN(datafn_lat,buf2,latExt,latfn);
-                     f = FOpen(latfn, NetFilter, &isPipe);
-                     if(!f)  HError(1, "Couldn't open file %s\n", latfn);
-                     numLats[latn] = ReadLattice(f, &latStack, &vocab, FALSE/*shortArc*/, TRUE/*add2Dict*/);
-                     FClose(f, isPipe);
-                  }
-               }
-            }
-         
             { /*apply F-B*/
                Boolean DoCorrectSentence,DoRecogLattice;
                int CorrIndex,RecogIndex1, RecogIndex2;
@@ -876,6 +1031,11 @@ int main(int argc, char *argv[])
       } /*[parMode]*/
    } while (NumArgs()>0);
    
+   if (nThreads > 1) {  /* align the last batch and combine the thread accs */
+      if (nQueued > 0) RunFBJobs();
+      MergeAccsParallel(&hset, uFlagsAccs, NumAccs, nThreads);
+   }
+   if (trace&T_TOP) PrintFBLatStats();
    
    if (parMode>0 || (parMode==0 && (updateMode&UPMODE_DUMP))){
       MakeFN("HDR$.acc.1",newDir,NULL,newFn);
@@ -984,12 +1144,21 @@ void Initialise(char *hmmListFn)
    else if(ML_MODE) NumAccs=1;
    else if(THREEACCS/*MPE||MPEStoreML*/) NumAccs=3;
    else NumAccs=2;
+
+   /* Each thread accumulates into its own copy of the NumAccs accs */
+   if (parMode == 0) nThreads = 1;
+   if (nThreads > 1 && !CanUseThreads()) {
+      HError(-2319,"HMMIRest: aligning with 1 thread, need diagonal PLAINHS or SHAREDHS models and no transforms");
+      nThreads = 1;
+   }
    
    {
       uFlagsAccs = (UPDSet) (uFlags|(uFlags&UPMEANS||uFlags&UPVARS ? UPMEANS|UPVARS : 0));  
       /*That modification to uFlags means: if either mean or var is updated, accumulate both.*/
-      AttachAccsParallel(&hset, &accStack, uFlagsAccs, NumAccs);
-      ZeroAccsParallel(&hset, uFlagsAccs, NumAccs); 
+      AttachAccsParallel(&hset, &accStack, uFlagsAccs, NumAccs*nThreads);
+      ZeroAccsParallel(&hset, uFlagsAccs, NumAccs*nThreads); 
+      if (nThreads > 1)
+         AttachPreCompCopies(&hset, &accStack, nThreads);
    }
    
 
@@ -1014,6 +1183,8 @@ void Initialise(char *hmmListFn)
    /*Initialise those modules.*/
    InitialiseFBInfo(&fbInfo, &hset, (UPDSet)(uFlags|(uFlags&UPMEANS||uFlags&UPVARS ? UPMEANS|UPVARS : 0)), twoDataFiles);
    /*That modification to uFlags means: if either mean or var is updated, accumulate both.*/
+   if (nThreads > 1)
+      InitFBJobs();
  
 
    /* Set the variance floor */
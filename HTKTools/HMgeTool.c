@@ -66,6 +66,7 @@ char *hmgetool_vc_id = "$Id: HMgeTool.c,v 1.6 2012/12/22 07:01:31 uratec Exp $";
 #include "HFB.h"
 #include "HGen.h"
 #include "HMTrain.h"
+#include "HThreads.h"
 
 /* ----------------------- Trace Flags ----------------------- */
 #define T_TOP   0001            /* Top level tracing */
@@ -144,10 +145,13 @@ static Boolean dftGWFlag = FALSE;       /* default flag for gain weight */
 static int total_T[SMAX];
 static int total_unstab_T[SMAX];
 static int nSamples = 0;
+static int nBatch = 1;          /* mini-batch size, 1 = update after every utterance */
+static int nThreads = 1;        /* number of threads used for a mini-batch */
 
 static XFInfo xfInfo;
 
 #define MAX_SENT_NUM    50000
+#define MIN(a,b) ((a)<(b)?(a):(b))
 
 /* Data File list struct */
 typedef struct _TDataFile {
@@ -159,6 +163,18 @@ static PTDataFile g_pDataFileList[MAX_SENT_NUM];
 static PTDataFile g_pShufDFList[MAX_SENT_NUM];
 static int g_nDataFileNum, g_nValidDfNum;
 
+/* Mini-batch job struct */
+typedef struct _TMgeJob {
+   MgeTrnInfo *mtInfo;          /* deferred copy of mtInfo */
+   float stepSize;              /* step size for this utterance */
+   Boolean bOnlyAccErr;         /* accumulate generation error only */
+   Boolean bVFloor;             /* apply variance floor after this utterance */
+} TMgeJob, *PTMgeJob;
+
+static PTMgeJob g_pMgeJobs = NULL;      /* [0..nBatch-1] */
+static int g_nQueued = 0;               /* # of jobs in current mini-batch */
+static ThreadPool *g_pPool = NULL;      /* threads for mini-batch */
+
 /* ------------------ Process Command Line -------------------------- */
 static void Initialise();
 static void PerformMgeTrain();
@@ -180,6 +196,8 @@ static void SetConfParms(void)
          trace = i;
       if (GetConfBool(cParm, nParm, "SAVEBINARY", &b))
          inBinary = b;
+      if (GetConfInt(cParm, nParm, "BATCHSIZE", &i))
+         nBatch = i;
 
       if (GetConfStr(cParm, nParm, "PDFSTRSIZE", buf))
          nPdfStr = ParseConfIntVec(&gstack, buf, TRUE);
@@ -526,6 +544,7 @@ static void ReportUsage(void)
    printf(" -i i j  start/end iteration index of MGE training         0 0\n");
    printf(" -j flg  0: eval 1: train 2: adapt                         1\n");
    printf(" -l dir  output label directory                            none\n");
+   printf(" -n n    utterances per mini-batch                         1\n");
    printf(" -o ext  HMM def file extension                            none\n");
    printf(" -p a b  parameter for step size: 1/(a + b*n)              1000.0 1.0\n");
    printf(" -r file load HMM for reference                            none\n");
@@ -560,6 +579,7 @@ int main(int argc, char *argv[])
    InitGen();
    InitAdapt(&xfInfo, NULL);
    InitMTrain();
+   InitThreads();
 
    /* process argument */
    if (NumArgs() == 0)
@@ -634,6 +654,9 @@ int main(int argc, char *argv[])
             HError(6601, "HMgeTool: Label file output directory expected");
          outLabDir = GetStrArg();
          break;
+      case 'n':
+         nBatch = GetChkedInt(1, MAX_SENT_NUM, s);
+         break;
       case 'o':
          if (NextArg() != STRINGARG)
             HError(6601, "HMgeTool: HMM file extension expected");
@@ -1185,12 +1208,61 @@ static void PerformMgeEval()
    PrintFinalResult(nSent, nIter);
 }
 
+/* MgeTask: compute every nThreads'th job of the mini-batch starting at task */
+static void MgeTask(int thread, int task, Ptr arg)
+{
+   PTMgeJob job;
+   int i;
+
+   for (i = task; i < g_nQueued; i += nThreads) {
+      job = g_pMgeJobs + i;
+      ComputeMgeUtt(job->mtInfo, job->stepSize, job->bOnlyAccErr);
+   }
+}
+
+/* RunMgeBatch: compute the queued utterances in parallel and apply their updates in order */
+static void RunMgeBatch(void)
+{
+   PTMgeJob job;
+   int i, p;
+
+   RunThreadTasks(g_pPool, MIN(nThreads, g_nQueued), MgeTask, NULL);
+   for (i = 0; i < g_nQueued; i++) {
+      job = g_pMgeJobs + i;
+      ApplyMgeUpdate(job->mtInfo);
+      for (p = 1; p <= genInfo->nPdfStream[0]; p++) {
+         total_T[p] += job->mtInfo->genInfo->pst[p].T;
+      }
+      /* fix variance floor */
+      if (job->bVFloor)
+         ApplyVFloor(&hset);
+   }
+   g_nQueued = 0;
+}
+
+/* QueueMgeJob: prepare one utterance and run the mini-batch once it is full */
+static void QueueMgeJob(char *labfn, char *datafn, float stepSize, Boolean bOnlyAccErr, Boolean bVFloor)
+{
+   PTMgeJob job;
+
+   job = g_pMgeJobs + g_nQueued;
+   if (job->mtInfo == NULL)
+      job->mtInfo = CloneMgeTrnInfo(&gstack, mtInfo);
+   PrepareMgeUtt(job->mtInfo, labfn, datafn);
+   job->stepSize = stepSize;
+   job->bOnlyAccErr = bOnlyAccErr;
+   job->bVFloor = bVFloor;
+   if (++g_nQueued == nBatch)
+      RunMgeBatch();
+}
+
 /* OneIterMgeTrain: */
 static int OneIterMgeTrain(int nIter)
 {
    char *datafn, labfn[256], basefn[255];
    int nSent, nAdjNum, p, nTotalAdj;
    float stepSize;
+   Boolean bOnlyAccErr;
 
    /* set all stat info to zero */
    ResetAllStatInfo(nIter);
@@ -1237,8 +1309,17 @@ static int OneIterMgeTrain(int nIter)
          fprintf(stdout, "Prcessing %4d %s ... \n", nSent, basefn);
          fflush(stdout);
       }
+      bOnlyAccErr = (nIter == 0 || nIter == startIter - 1);
+      /* mini-batch: models are updated when the batch is applied */
+      if (nBatch > 1 && (bOnlyAccErr || bMgeUpdate)) {
+         QueueMgeJob(labfn, datafn, stepSize, bOnlyAccErr, (uFlags & UPVARS) && nSent % 100 == 0);
+         if (!bOnlyAccErr)
+            nSamples++;
+         stepSize = 1 / (A_STEP + B_STEP * nSamples);
+         continue;
+      }
       /* accumulation of generation error only */
-      if (nIter == 0 || nIter == startIter - 1) {
+      if (bOnlyAccErr) {
          OneSentGenErrAcc(mtInfo, labfn, datafn);
       } else if (bMgeUpdate) {
          OneSentMgeTrain(mtInfo, labfn, datafn, stepSize);
@@ -1254,6 +1335,8 @@ static int OneIterMgeTrain(int nIter)
       if ((uFlags & UPVARS) && nSent % 100 == 0)
          ApplyVFloor(&hset);
    }
+   if (g_nQueued > 0)
+      RunMgeBatch();
 
    if (nIter > 0 && bBoundAdj) {
       if (trace & T_TOP) {
@@ -1299,6 +1382,18 @@ static void PerformMgeTrain()
          ApplyHMMSetXForm(&orighset, orighset.curXForm, FALSE);
    }
 
+   /* jobs for mini-batch training, cloned from mtInfo when first used */
+   if (nBatch > 1) {
+      nThreads = MIN(NumThreads(), nBatch);
+      g_pPool = CreateThreadPool(&gstack, nThreads);
+      g_pMgeJobs = (PTMgeJob) New(&gstack, nBatch * sizeof(TMgeJob));
+      memset(g_pMgeJobs, 0, nBatch * sizeof(TMgeJob));
+      if (trace & T_TOP) {
+         fprintf(stdout, "Mini-batch of %d utterances using %d threads\n", nBatch, nThreads);
+         fflush(stdout);
+      }
+   }
+
    /* iteration from startIter ~ endIter */
    for (nIter = startIter; nIter <= endIter; nIter++) {
       /* shuffle data file list */
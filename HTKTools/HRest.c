@@ -119,6 +119,7 @@ char *hrest_vc_id = "$Id: HRest.c,v 1.15 2012/12/22 07:01:31 uratec Exp $";
 #include "HModel.h"
 #include "HTrain.h"
 #include "HUtil.h"
+#include "HThreads.h"
 
 
 /* Global Settings */
@@ -146,6 +147,7 @@ static int  trace    = 0;        /* Trace level */
 static ConfParam *cParm[MAXGLOBS];   /* configuration parameters */
 static int nParm = 0;               /* total num params */
 static Boolean segReject = TRUE; /* Enable short train segment rejection */
+static int nThreads = 1;         /* number of alpha-beta threads */
 
 
 /* Global Data Structures */
@@ -158,20 +160,36 @@ static int maxMixes;       /* max num mixtures across all streams */
 static int maxMixInS[SMAX];/* array[1..swidth[0]] of max mixes */
 static int nSeg;           /* num training segments */
 static int nTokUsed;       /* actual number of tokens used */
-static int maxT,minT,T;    /* max,min and current segment lengths */
-static DMatrix alpha;      /* array[1..nStates][1..maxT] of forward prob */
-static DMatrix beta;       /* array[1..nStates][1..maxT] of backward prob */
+static int maxT,minT;      /* max and min segment lengths */
 static DVector durOcc;     /* array[1..nStates] of duration counter (occ) */
 static DVector durSum;     /* array[1..nStates] of duration counter (sum) */
 static DVector durSqr;     /* array[1..nStates] of duration counter (sqr) */
-static Matrix outprob;     /* array[2..nStates-1][1..maxT] of output prob */
-static Vector **stroutp;   /* array[1..maxT][2..nStates-1][1..nStreams] ...*/
+static Vector vFloor[SMAX];      /* variance floor - default is all zero */
+
+/* Alpha-beta storage, one record per thread */
+typedef struct {
+   int T;                  /* current segment length */
+   DMatrix alpha;          /* array[1..nStates][1..maxT] of forward prob */
+   DMatrix beta;           /* array[1..nStates][1..maxT] of backward prob */
+   Matrix outprob;         /* array[2..nStates-1][1..maxT] of output prob */
+   Vector **stroutp;       /* array[1..maxT][2..nStates-1][1..nStreams] ...*/
                            /* ... of streamprob */
-static Matrix **mixoutp;   /* array[2..nStates-1][1..maxT][1..nStreams]
+   Matrix **mixoutp;       /* array[2..nStates-1][1..maxT][1..nStreams]
                               [1..maxMixes] of mixprob */
-static Vector occr;        /* array[1..nStates-1] of occ count for cur time */
-static Vector zot;         /* temp storage for zero mean obs vector */
-static Vector vFloor[SMAX];      /* variance floor - default is all zero */
+   Vector occr;            /* array[1..nStates-1] of occ count for cur time */
+   Vector zot;             /* temp storage for zero mean obs vector */
+   DVector durOcc;         /* duration counters of this thread ... */
+   DVector durSum;         /* ... durOcc etc for the first one */
+   DVector durSqr;
+   Observation obs;        /* current observation */
+   int acc;                /* index of accumulators to update */
+} FBRec;
+
+static FBRec *fbr;         /* array[0..nThreads-1] of FBRec */
+static ThreadPool *pool;   /* alpha-beta threads */
+static Boolean durPass;    /* threads update durations rather than counts */
+static DVector segAP;      /* array[1..nSeg] of alpha logP of each segment */
+static DVector segBP;      /* array[1..nSeg] of beta logP of each segment */
 static float vDefunct=0.0;       /* variance below which mixture defunct */
 
 static SegStore segStore;        /* Storage for data segments */
@@ -208,6 +226,7 @@ void ReportUsage(void)
    printf(" -e f    Set convergence factor epsilon       1.0E-4\n");
    printf(" -g s    output duration model to file s                   none\n");
    printf(" -i N    Set max iterations to N              20\n");
+   printf(" -j n    Run alpha-beta with n threads        %d\n",nThreads);
    printf(" -l s    Set segment label to s               none\n");
    printf(" -m N    Set min segments needed              3\n");
    printf(" -o fn   Store new hmm def in fn (name only)               outDir/srcfn\n");
@@ -257,6 +276,8 @@ int main(int argc, char *argv[])
       HError(2200,"HRest: InitParm failed");
 
    InitTrain(); InitUtil();
+   InitThreads();
+   nThreads = NumThreads();
 
    if (!InfoPrinted() && NumArgs() == 0)
       ReportUsage();
@@ -277,6 +298,8 @@ int main(int argc, char *argv[])
          durFN = GetStrArg(); break;
       case 'i':
          maxIter = GetChkedInt(1,100,s); break;
+      case 'j':
+         nThreads = GetChkedInt(1,MAXTHREADS,s); break;
       case 'l':
          if (NextArg() != STRINGARG)
             HError(2219,"HRest: Segment label expected");
@@ -402,6 +425,8 @@ void PrintInitialInfo(void)
    if (uFlags&UPVARS)  printf("Variances "); 
    if (uFlags&UPMIXES && maxMixes>1)  printf("MixWeights"); 
    printf("\n\n");
+   if (nThreads>1)
+      printf(" Threads  :  %d\n",nThreads);
    printf(" - system is ");
    switch (hset.hsKind){
    case PLAINHS:  printf("PLAIN\n");  break;
@@ -412,6 +437,25 @@ void PrintInitialInfo(void)
    fflush(stdout);
 }
    
+/* CanUseThreads: check that segments may be processed in parallel */
+Boolean CanUseThreads(void)
+{
+   HMMScanState hss;
+   Boolean ok = TRUE;
+
+   if (trace&(T_OTP|T_ALF|T_BET|T_OCC|T_TAC|T_MAC|T_VAC|T_WAC))
+      return FALSE;
+   if (hset.hsKind == DISCRETEHS)
+      return TRUE;
+   if (hset.hsKind != PLAINHS)   /* SHAREDHS caches mix probs in the hmm */
+      return FALSE;
+   NewHMMScan(&hset,&hss);
+   while (ok && GoNextMix(&hss,FALSE))
+      if (hss.mp->ckind != DIAGC) ok = FALSE;
+   EndHMMScan(&hss);
+   return ok;
+}
+
 /* Initialise1: 1st phase of init prior to loading dbase */
 void Initialise1(void)
 {
@@ -445,7 +489,11 @@ void Initialise1(void)
    CreateHeap(&accsStack,"AccsStore", MSTAK, 1, 0.0, 1000, 1000);
    CreateHeap(&transStack,"TransStore", MSTAK, 1, 0.0, 1000, 1000);
    CreateHeap(&bufferStack,"BufferStore", MSTAK, 1, 0.0, 1000, 1000);
-   AttachAccs(&hset, &accsStack, uFlags);
+   if (nThreads>1 && !CanUseThreads()) {
+      HError(-2230,"Initialise1: using 1 thread, need diagonal PLAINHS or DISCRETEHS models and no per-segment tracing");
+      nThreads = 1;
+   }
+   AttachAccsParallel(&hset, &accsStack, uFlags, nThreads);
 
    SetVFloor( &hset, vFloor, minVar);
 
@@ -457,50 +505,65 @@ void Initialise1(void)
    maxMixes = MaxMixtures(hmm);
    for(s=1; s<=nStreams; s++)
       maxMixInS[s] = MaxMixInS(hmm, s);
-   T = maxT = 0; minT = 100000;
+   maxT = 0; minT = 100000;
 }
 
 /* Initialise2: 2nd phase of init after loading dbase */
 void Initialise2(void)
 {
-   int t,j,m,s;
-
-   alpha = CreateDMatrix(&alphaBetaStack,nStates,maxT);
-   beta = CreateDMatrix(&alphaBetaStack,nStates,maxT);
-   outprob = CreateMatrix(&alphaBetaStack,nStates-1,maxT); /* row 1 not used */
-   ZeroMatrix(outprob);
-   if (maxMixes>1){
-      mixoutp = (Matrix**)New(&alphaBetaStack, (nStates-2)*sizeof(Matrix*));
-      mixoutp -= 2;
-      for (j=2;j<nStates;j++){
-         mixoutp[j] = (Matrix*)New(&alphaBetaStack, maxT*sizeof(Matrix));
-         --mixoutp[j];
-         for (t=1;t<=maxT;t++){
-            mixoutp[j][t] = CreateMatrix(&alphaBetaStack,nStreams,maxMixes);
-            for (s=1;s<=nStreams;s++){
-               for (m=1;m<=maxMixes;m++)
-                  mixoutp[j][t][s][m]=LZERO;
+   int t,j,m,s,n;
+   FBRec *fb;
+
+   fbr = (FBRec *)New(&gstack,nThreads*sizeof(FBRec));
+   for (n=0,fb=fbr; n<nThreads; n++,fb++) {
+      fb->T = 0;
+      fb->alpha = CreateDMatrix(&alphaBetaStack,nStates,maxT);
+      fb->beta = CreateDMatrix(&alphaBetaStack,nStates,maxT);
+      fb->outprob = CreateMatrix(&alphaBetaStack,nStates-1,maxT); /* row 1 not used */
+      ZeroMatrix(fb->outprob);
+      if (maxMixes>1){
+         fb->mixoutp = (Matrix**)New(&alphaBetaStack, (nStates-2)*sizeof(Matrix*));
+         fb->mixoutp -= 2;
+         for (j=2;j<nStates;j++){
+            fb->mixoutp[j] = (Matrix*)New(&alphaBetaStack, maxT*sizeof(Matrix));
+            --fb->mixoutp[j];
+            for (t=1;t<=maxT;t++){
+               fb->mixoutp[j][t] = CreateMatrix(&alphaBetaStack,nStreams,maxMixes);
+               for (s=1;s<=nStreams;s++){
+                  for (m=1;m<=maxMixes;m++)
+                     fb->mixoutp[j][t][s][m]=LZERO;
+               }
             }
          }
       }
-   }
-   if (nStreams>1){
-      stroutp = (Vector**)New(&alphaBetaStack, maxT*sizeof(Vector*));
-      --stroutp;
-      for (t=1;t<=maxT;t++){
-         stroutp[t] = (Vector*)New(&alphaBetaStack,(nStates-2)*sizeof(Vector));
-         stroutp[t] -= 2;
-         for (j=2;j<nStates;j++)
-            stroutp[t][j] = CreateVector(&alphaBetaStack,nStreams);
+      if (nStreams>1){
+         fb->stroutp = (Vector**)New(&alphaBetaStack, maxT*sizeof(Vector*));
+         --fb->stroutp;
+         for (t=1;t<=maxT;t++){
+            fb->stroutp[t] = (Vector*)New(&alphaBetaStack,(nStates-2)*sizeof(Vector));
+            fb->stroutp[t] -= 2;
+            for (j=2;j<nStates;j++)
+               fb->stroutp[t][j] = CreateVector(&alphaBetaStack,nStreams);
+         }
       }
-   }
-   occr = CreateVector(&gstack,nStates-1);
-   zot = CreateVector(&gstack,hset.vecSize);
+      fb->occr = CreateVector(&gstack,nStates-1);
+      fb->zot = CreateVector(&gstack,hset.vecSize);
+      fb->obs = segStore->o;
+      fb->acc = n;
    
+      if (calcDuration) {
+         fb->durOcc = CreateDVector(&accsStack, nStates);
+         fb->durSum = CreateDVector(&accsStack, nStates);
+         fb->durSqr = CreateDVector(&accsStack, nStates);
+      }
+   }
    if (calcDuration) {
-      durOcc = CreateDVector(&accsStack, nStates);
-      durSum = CreateDVector(&accsStack, nStates);
-      durSqr = CreateDVector(&accsStack, nStates);
+      durOcc = fbr->durOcc; durSum = fbr->durSum; durSqr = fbr->durSqr;
+   }
+   if (nThreads>1) {
+      pool = CreateThreadPool(&gstack,nThreads);
+      segAP = CreateDVector(&gstack,nSeg);
+      segBP = CreateDVector(&gstack,nSeg);
    }
 }
 
@@ -621,7 +684,7 @@ void LoadFile(char *fn)
 /* ------------------------ Trace Functions -------------------- */
 
 /* ShowSegNum: if not already printed, print seg number */
-void ShowSegNum(const int seg)
+void ShowSegNum(const int seg, const int T)
 {
    static int lastseg = -1;
    
@@ -634,8 +697,13 @@ void ShowSegNum(const int seg)
 /* ------------------------- Alpha-Beta ------------------------ */
 
 /* SetOutP: Set the output and mix prob matrices */                        
-void SetOutP(const int seg)
+void SetOutP(FBRec *fb, const int seg)
 {
+   const int T = fb->T;
+   Matrix outprob = fb->outprob;
+   Vector **stroutp = fb->stroutp;
+   Matrix **mixoutp = fb->mixoutp;
+   Observation *obs = &fb->obs;
    int i,t,m,mx,s,nMix=0;
    StreamElem *ste;
    StreamInfo *sti;
@@ -644,16 +712,15 @@ void SetOutP(const int seg)
    Matrix mixp;
    LogFloat x,prob,streamP;
    Vector strp = NULL;
-   Observation obs;
    TMixRec *tmRec = NULL;
    float wght=0.0,tmp;
    MixPDF *mpdf=NULL;
    PreComp *pMix;
    
    for (t=1;t<=T;t++) {
-      obs = GetSegObs(segStore, seg, t);
+      FillSegObs(segStore, seg, t, obs);
       if (hsKind == TIEDHS)
-         PrecomputeTMix(&hset,&obs,tMPruneThresh,0);         
+         PrecomputeTMix(&hset,obs,tMPruneThresh,0);         
       if ((maxMixes>1) && (hsKind!=DISCRETEHS)){ /* Multiple Mix Case */
          for (i=2;i<nStates;i++) {
             prob = 0.0;
@@ -699,12 +766,12 @@ void SetOutP(const int seg)
                         if (pMix->time==t)
                            x = pMix->prob;
                         else {
-                           x = MOutP(obs.fv[s],mpdf);
+                           x = MOutP(obs->fv[s],mpdf);
                            pMix->prob = x; pMix->time = t;
                         }
                         break;
                      case PLAINHS : 
-                        x=MOutP(obs.fv[s],mpdf);
+                        x=MOutP(obs->fv[s],mpdf);
                         break;
                      default:
                         x=LZERO;
@@ -734,7 +801,7 @@ void SetOutP(const int seg)
                strp = stroutp[t][i];
                for (s=1;s<=nStreams;s++,ste++){
                   sti = ste->info;
-                  streamP = SOutP(&hset,s,&obs,sti);
+                  streamP = SOutP(&hset,s,obs,sti);
                   strp[s] = si->weights[s]*streamP;
                   prob += si->weights[s]*streamP; /* note stream weights ignored */
                }
@@ -745,20 +812,23 @@ void SetOutP(const int seg)
                si = hmm->svec[i].info;
                ste = si->pdf+1;
                if (hsKind==DISCRETEHS)
-                  outprob[i][t]=SOutP(&hset,1,&obs,ste->info);
+                  outprob[i][t]=SOutP(&hset,1,obs,ste->info);
                else
-                  outprob[i][t]=OutP(&obs,hmm,i);
+                  outprob[i][t]=OutP(obs,hmm,i);
             }
    }
    if (trace  & T_OTP) {
-      ShowSegNum(seg);
+      ShowSegNum(seg,T);
       ShowMatrix("OutProb",outprob,10,12);
    }
 }
 
 /* SetAlpha: compute alpha matrix and return prob of given sequence */
-LogDouble SetAlpha(const int seg)
+LogDouble SetAlpha(FBRec *fb, const int seg)
 {
+   const int T = fb->T;
+   DMatrix alpha = fb->alpha;
+   Matrix outprob = fb->outprob;
    int i,j,t;
    LogDouble x,a;
 
@@ -793,7 +863,7 @@ LogDouble SetAlpha(const int seg)
    alpha[nStates][T] = x;
    
    if (trace  & T_ALF) {
-      ShowSegNum(seg);
+      ShowSegNum(seg,T);
       ShowDMatrix("Alpha",alpha,10,12); 
       printf("LogP= %10.3f\n\n",x);
    }
@@ -801,8 +871,11 @@ LogDouble SetAlpha(const int seg)
 }
 
 /* SetBeta: compute beta matrix */
-LogDouble SetBeta(const int seg)
+LogDouble SetBeta(FBRec *fb, const int seg)
 {
+   const int T = fb->T;
+   DMatrix beta = fb->beta;
+   Matrix outprob = fb->outprob;
    int i,j,t;
    LogDouble x,a;
 
@@ -830,7 +903,7 @@ LogDouble SetBeta(const int seg)
    }
    beta[1][1] = x;
    if (trace & T_BET) {
-      ShowSegNum(seg);
+      ShowSegNum(seg,T);
       ShowDMatrix("Beta",beta,10,12); 
       printf("LogP=%10.3f\n\n",beta[1][1]);
    }
@@ -839,9 +912,12 @@ LogDouble SetBeta(const int seg)
 
 /* --------------------- Record Statistics ---------------- */
 
-/* SetOccr: set the global occupation counters occr for current seg */
-void SetOccr(const LogDouble pr, const int seg)
+/* SetOccr: set the occupation counters occr of fb for current seg */
+void SetOccr(FBRec *fb, const LogDouble pr, const int seg)
 {
+   const int T = fb->T;
+   DMatrix alpha = fb->alpha, beta = fb->beta;
+   Vector occr = fb->occr;
    int i,t;
    DVector alpha_i,beta_i;
    Vector a_i;
@@ -861,14 +937,18 @@ void SetOccr(const LogDouble pr, const int seg)
          occr[i] = 0.0;
    }
    if (trace & T_OCC){
-      ShowSegNum(seg);
+      ShowSegNum(seg,T);
       ShowVector("OCC: ",occr,20);
    }
 }
 
 /* UpTranCounts: update the transition counters in ta */
-void UpTranCounts(const LogDouble pr, const int seg)
+void UpTranCounts(FBRec *fb, const LogDouble pr, const int seg)
 {
+   const int T = fb->T;
+   DMatrix alpha = fb->alpha, beta = fb->beta;
+   Matrix outprob = fb->outprob;
+   Vector occr = fb->occr;
    int i,j,t;
    Matrix tran;
    Vector tran_i,outprob_j,a_i,occ;
@@ -877,7 +957,7 @@ void UpTranCounts(const LogDouble pr, const int seg)
    double y;
    TrAcc *ta;
    
-   ta = (TrAcc *) GetHook(hmm->transP);
+   ta = (TrAcc *) GetHook(hmm->transP) + fb->acc;
    tran = ta->tran; occ = ta->occ;
    for (i=2; i<nStates; i++)
       occ[i] += occr[i];
@@ -918,7 +998,7 @@ void UpTranCounts(const LogDouble pr, const int seg)
       }     
    }
    if (trace & T_TAC){
-      ShowSegNum(seg);
+      ShowSegNum(seg,T);
       ShowMatrix("TRAN: ",tran,10,10);
       ShowVector("TOCC: ",occ,10);
       fflush(stdout);
@@ -926,10 +1006,15 @@ void UpTranCounts(const LogDouble pr, const int seg)
 }
 
 /* UpStreamCounts: update mean, cov & mixweight counts for given stream */
-void UpStreamCounts(const int j, const int s, StreamInfo *sti, 
+void UpStreamCounts(FBRec *fb, const int j, const int s, StreamInfo *sti, 
                     int vSize, const LogDouble pr, const int seg,
                     DVector alphj, DVector betaj)
 {
+   const int T = fb->T;
+   DMatrix alpha = fb->alpha;
+   Vector **stroutp = fb->stroutp;
+   Vector zot = fb->zot;
+   Observation *obs = &fb->obs;
    int i,m,nMix=0,k,l,t,ss,idx;
    MixtureElem *me;
    MixPDF *mpdf=NULL;
@@ -941,11 +1026,10 @@ void UpStreamCounts(const int j, const int s, StreamInfo *sti,
    LogFloat a_ij,w;
    LogDouble Lr;
    double y;
-   Observation obs;
    TMixRec *tmRec = NULL;
    float wght=0.0;
    
-   wa = (WtAcc *)sti->hook;
+   wa = (WtAcc *)sti->hook + fb->acc;
    switch (hsKind){       /* Get nMix */
    case TIEDHS:
       tmRec = &(hset.tmRecs[s]);
@@ -959,7 +1043,7 @@ void UpStreamCounts(const int j, const int s, StreamInfo *sti,
       nMix = 1;                /* Only one code selected per observation */
       break;
    }
-   mixp_j = (maxMixes>1) ? mixoutp[j] : NULL;
+   mixp_j = (maxMixes>1) ? fb->mixoutp[j] : NULL;
    for (m=1; m<=nMix; m++) {
       switch (hsKind){            /* Get mpdf, wght */
       case TIEDHS:               
@@ -979,16 +1063,16 @@ void UpStreamCounts(const int j, const int s, StreamInfo *sti,
          break;
       }
       if (hsKind!=DISCRETEHS){
-         ma = (MuAcc *)GetHook(mpdf->mean);
-         va = (VaAcc *)GetHook(mpdf->cov.var);
+         ma = (MuAcc *)GetHook(mpdf->mean) + fb->acc;
+         va = (VaAcc *)GetHook(mpdf->cov.var) + fb->acc;
       }
       if (wght > MINMIX) {
          w = log(wght);
          for (t=1; t<=T; t++) {
          
             /* Get observation vec ot and zero mean zot */
-            obs = GetSegObs(segStore, seg, t);
-            ot = obs.fv[s];
+            FillSegObs(segStore, seg, t, obs);
+            ot = obs->fv[s];
             if (hsKind!=DISCRETEHS)
                for (k=1; k<=vSize; k++)
                   zot[k] = ot[k] - mpdf->mean[k];
@@ -1021,7 +1105,7 @@ void UpStreamCounts(const int j, const int s, StreamInfo *sti,
                   
                /* Update Weight Counter */
                if (uFlags&UPMIXES) {   
-                  idx = (hsKind==DISCRETEHS) ? obs.vq[s] : m;
+                  idx = (hsKind==DISCRETEHS) ? obs->vq[s] : m;
                   wa->occ += y; wa->c[idx] += y;
                }
                
@@ -1048,7 +1132,7 @@ void UpStreamCounts(const int j, const int s, StreamInfo *sti,
          }
       }
       if ((trace&(T_MAC|T_VAC))&&(hsKind!=DISCRETEHS)) {
-         ShowSegNum(seg);
+         ShowSegNum(seg,T);
          printf("State %d, Stream %d, Mixture %d\n",j,s,m);
          if (trace&T_MAC){
             printf("MEAN OCC: %.2f\n",ma->occ);
@@ -1066,7 +1150,7 @@ void UpStreamCounts(const int j, const int s, StreamInfo *sti,
       }
    }
    if (trace&T_WAC){
-      ShowSegNum(seg);
+      ShowSegNum(seg,T);
       printf("State %d, Stream %d\n",j,s);
       printf("WT OCC: %.2f\n",wa->occ);
       ShowVector("WT ACC: ",wa->c,10);
@@ -1074,7 +1158,7 @@ void UpStreamCounts(const int j, const int s, StreamInfo *sti,
 }
    
 /* UpPDFCounts: update output PDF counts for each stream of each state */
-void UpPDFCounts(const LogDouble pr, const int seg)
+void UpPDFCounts(FBRec *fb, const LogDouble pr, const int seg)
 {
    int j,s;
    StateInfo *si;
@@ -1083,15 +1167,19 @@ void UpPDFCounts(const LogDouble pr, const int seg)
 
    for (j=2; j<nStates; j++) {
       si = hmm->svec[j].info;
-      alj = alpha[j]; betj = beta[j];
+      alj = fb->alpha[j]; betj = fb->beta[j];
       for (s=1,ste = si->pdf+1; s<=nStreams; s++,ste++)
-         UpStreamCounts(j,s,ste->info,hset.swidth[s],pr,seg,alj,betj);
+         UpStreamCounts(fb,j,s,ste->info,hset.swidth[s],pr,seg,alj,betj);
    }
 }
 
 /* UpDurCounts: update duration counts */
-void UpDurCounts(const LogDouble pr, const int seq)
+void UpDurCounts(FBRec *fb, const LogDouble pr, const int seq)
 {
+   const int T = fb->T;
+   DMatrix alpha = fb->alpha, beta = fb->beta;
+   Matrix outprob = fb->outprob;
+   DVector durOcc = fb->durOcc, durSum = fb->durSum, durSqr = fb->durSqr;
    int j,k,t0,t1;
    LogDouble x,x0,Sumx;
    
@@ -1143,13 +1231,13 @@ void UpDurCounts(const LogDouble pr, const int seq)
  
 
 /* UpdateCounters: update the various counters */
-void UpdateCounters(const LogDouble pr, const int seg)
+void UpdateCounters(FBRec *fb, const LogDouble pr, const int seg)
 {
-   SetOccr(pr,seg);
+   SetOccr(fb,pr,seg);
    if (uFlags&UPTRANS) 
-      UpTranCounts(pr,seg);
+      UpTranCounts(fb,pr,seg);
    if (uFlags&(UPMEANS|UPVARS|UPMIXES))
-      UpPDFCounts(pr,seg);
+      UpPDFCounts(fb,pr,seg);
 }
 
 /* ------------------------- Model Update ----------------------- */
@@ -1512,38 +1600,109 @@ void SaveDuration(void)
 /* ------------------------- Top Level Control ----------------------- */
 
 
+/* FBSegment: compute alpha and beta of segment seg using fb, and if 
+   usable update either the counters or the duration counters */
+void FBSegment(FBRec *fb, const int seg, LogDouble *ap, LogDouble *bp)
+{
+   LogDouble segProb;
+
+   fb->T=SegLength(segStore,seg);
+   SetOutP(fb,seg);
+   *bp = LZERO;
+   if ((*ap=SetAlpha(fb,seg)) > LSMALL){
+      *bp = SetBeta(fb,seg);
+      segProb = (LogFloat) ((*ap + *bp) / 2.0);  /* reduce numeric error */
+      if (durPass)
+         UpDurCounts(fb,segProb,seg);
+      else
+         UpdateCounters(fb,segProb,seg);
+   }
+}
+
+/* FBTask: process every nThreads'th segment starting at task+1 */
+void FBTask(int thread, int task, Ptr arg)
+{
+   int seg;
+
+   for (seg=task+1; seg<=nSeg; seg+=nThreads)
+      FBSegment(fbr+task,seg,segAP+seg,segBP+seg);
+}
+
+/* ZeroDurCounts: clear the duration counters of all threads */
+void ZeroDurCounts(void)
+{
+   int i,n;
+   FBRec *fb;
+
+   for (n=0,fb=fbr; n<nThreads; n++,fb++)
+      for (i=1;i<DVectorSize(fb->durOcc);i++) 
+         fb->durOcc[i] = fb->durSum[i] = fb->durSqr[i] = LZERO;
+}
+
+/* MergeDurCounts: add duration counters of threads 1.. into durOcc etc */
+void MergeDurCounts(void)
+{
+   int i,n;
+   FBRec *fb;
+
+   for (n=1,fb=fbr+1; n<nThreads; n++,fb++)
+      for (i=1;i<DVectorSize(durOcc);i++) {
+         durOcc[i] = LAdd(durOcc[i],fb->durOcc[i]);
+         durSum[i] = LAdd(durSum[i],fb->durSum[i]);
+         durSqr[i] = LAdd(durSqr[i],fb->durSqr[i]);
+      }
+}
+
+/* FBAllSegs: process all segments and return the total logP of those 
+   usable, in segment order whatever the number of threads */
+LogFloat FBAllSegs(void)
+{
+   LogFloat segProb,newP = 0.0;
+   LogDouble ap,bp;
+   int seg;
+
+   nTokUsed = 0;
+   if (nThreads>1)
+      RunThreadTasks(pool,nThreads,FBTask,NULL);
+   for (seg=1;seg<=nSeg;seg++) {
+      if (nThreads>1) {
+         ap = segAP[seg]; bp = segBP[seg];
+      } else
+         FBSegment(fbr,seg,&ap,&bp);
+      if (ap > LSMALL){
+         if (trace & T_LGP)
+            printf("%d.  Pa = %e, Pb = %e, Diff = %e\n",seg,ap,bp,ap-bp);
+         segProb = (ap + bp) / 2.0;  /* reduce numeric error */
+         newP += segProb; ++nTokUsed;
+      } else
+         if (trace&T_TOP) 
+            printf("Example %d skipped\n",seg);
+   }
+   if (nTokUsed==0)
+      HError(2226,"ReEstimateModel: No Usable Training Examples");
+   if (nThreads>1) {
+      if (durPass)
+         MergeDurCounts();
+      else
+         MergeAccsParallel(&hset, uFlags, 1, nThreads);
+   }
+   return newP;
+}
+
 /* ReEstimateModel: top level of algorithm */
 void ReEstimateModel(void)
 {
-   LogFloat segProb,oldP,newP,delta;
-   LogDouble ap,bp;
-   int i,converged,iteration,seg;
+   LogFloat oldP,newP,delta;
+   int converged,iteration;
 
    iteration=0; 
    oldP=LZERO;
    do {        /*main re-est loop*/   
-      ZeroAccs(&hset, uFlags); newP = 0.0; ++iteration;
-      nTokUsed = 0;
+      ZeroAccsParallel(&hset, uFlags, nThreads); ++iteration;
       if (calcDuration)
-         for (i=1;i<DVectorSize(durOcc);i++) 
-            durOcc[i] = durSum[i] = durSqr[i] = LZERO;
-      
-      for (seg=1;seg<=nSeg;seg++) {
-         T=SegLength(segStore,seg);
-         SetOutP(seg);
-         if ((ap=SetAlpha(seg)) > LSMALL){
-            bp = SetBeta(seg);
-            if (trace & T_LGP)
-               printf("%d.  Pa = %e, Pb = %e, Diff = %e\n",seg,ap,bp,ap-bp);
-            segProb = (ap + bp) / 2.0;  /* reduce numeric error */
-            newP += segProb; ++nTokUsed;
-            UpdateCounters(segProb,seg);
-         } else
-            if (trace&T_TOP) 
-               printf("Example %d skipped\n",seg);
-      }
-      if (nTokUsed==0)
-         HError(2226,"ReEstimateModel: No Usable Training Examples");
+         ZeroDurCounts();
+      durPass = FALSE;
+      newP = FBAllSegs();
       UpdateTheModel();
       newP /= nTokUsed;
       delta=newP-oldP; oldP=newP;
@@ -1559,27 +1718,9 @@ void ReEstimateModel(void)
    } while ((iteration < maxIter) && !converged);
    
    if (calcDuration) {
-      nTokUsed = 0;
-      for (i=1;i<DVectorSize(durOcc);i++) 
-         durOcc[i] = durSum[i] = durSqr[i] = LZERO;
-      
-      for (seg=1;seg<=nSeg;seg++) {
-         T=SegLength(segStore,seg);
-         SetOutP(seg);
-         if ((ap=SetAlpha(seg)) > LSMALL){
-            bp = SetBeta(seg);
-            if (trace & T_LGP)
-               printf("%d.  Pa = %e, Pb = %e, Diff = %e\n",seg,ap,bp,ap-bp);
-            segProb = (ap + bp) / 2.0;  /* reduce numeric error */
-            ++nTokUsed;
-            UpDurCounts(segProb,seg);
-         } else
-            if (trace&T_TOP) 
-               printf("Example %d skipped\n",seg);
-      }
-      if (nTokUsed==0)
-         HError(2226,"ReEstimateModel: No Usable Training Examples");
-
+      ZeroDurCounts();
+      durPass = TRUE;
+      FBAllSegs();
       SaveDuration();
    }
    
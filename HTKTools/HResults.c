@@ -72,6 +72,7 @@ char *hresults_vc_id = "$Id: HResults.c,v 1.14 2012/12/22 07:01:31 uratec Exp $"
 #include "HMath.h"
 #include "HWave.h"
 #include "HLabel.h"
+#include "HThreads.h"
 
 
 /*
@@ -102,6 +103,7 @@ static Boolean wSpot      = FALSE;    /* true if word spotting */
 
 /* General options */
 static int fileLimit = INT_MAX;       /* max num of label files to process */
+static int nThreads = 1;              /* number of scoring threads */
 static char * labDir    = NULL;       /* label file directory */
 static char * labExt    = "lab";      /* label file extension */
 static FileFormat rff   = UNDEFF;     /* ff of reference transcription files */
@@ -210,6 +212,7 @@ int main(int argc, char *argv[])
 
    void Initialise(char * listfn);
    void MatchFiles(void);
+   void FlushJobs(void);
    void OutputStats(void);
    void AddEquiv(char * cl, char * eq);
    
@@ -218,6 +221,7 @@ int main(int argc, char *argv[])
 
    InitMem();   InitMath();
    InitWave();  InitLabel();
+   InitThreads();
 
    if (!InfoPrinted() && NumArgs() == 0)
       ReportUsage();
@@ -363,6 +367,8 @@ int main(int argc, char *argv[])
          ++count;
       }
    }
+   if (nThreads>1)
+      FlushJobs();
    if (count>=fileLimit)
       printf("\n** HResults terminated after %d files **\n\n",count);
    if (trace&T_MEM)
@@ -455,7 +461,6 @@ typedef enum _Direction Direction;
 typedef struct _Cell{           /* used in DP routines below */
    int ins,del,sub,hit;
    int score;
-   Direction dir;
 } Cell;
 
 typedef struct _Spkr{           /* list of spkr records */
@@ -845,230 +850,363 @@ static const int subPenNIST = 4;  /* NIST error penalties */
 static const int delPenNIST = 3;
 static const int insPenNIST = 3;
 
-static CellPtr *grid;     /* matrix of cells */
-static LabId *lRef,*lTest;
-static int nRef,nTest;
+/* 
+   Each cell carries the error counts along its best path so the final
+   scores only need the previous and current rows of the grid.  When
+   the path itself is required for aligned transcriptions or phoneme
+   statistics it is recovered by TraceRows, which splits the rows in
+   half and carries forward, for each cell below the split, the column
+   at which its best path crosses the middle row.  Only blocks of at
+   most TRACECELLS cells ever have their directions stored, so memory
+   grows with the length of the lists rather than their product.
+*/
 
-/* DumpGrid: for debugging */
-void DumpGrid(void)
-{
-   int i,j;
+#define TRACECELLS 1048576      /* max directions in a block traced directly */
 
-   printf("Grid -\n");
-   for (j=0; j<=nRef; j++)
-      if (j==0) 
-         printf("%10s","");
-      else
-         printf("%5.4s",lRef[j]->name);
-   printf("\n");
-   
-   for (i=0; i<=nTest; i++) {
-      if (0==i) 
-         printf("%5s","");
-      else
-         printf("%5.4s",lTest[i]->name);
-      for (j=0; j<=nRef; j++) {
-         printf("%4d",grid[i][j].score);
-         if (grid[i][j].dir==DIAG)
-            printf("d");
-         else if (grid[i][j].dir==HOR)
-            printf("h");
-         else if (grid[i][j].dir==VERT)
-            printf("v");
-         else 
-            printf("n");
+typedef struct _Grid{           /* DP grid for one test/ref pair */
+   int nRef,nTest;              /* number of labels in ref and test */
+   LabId *lRef,*lTest;          /* arrays [1..nRef] and [1..nTest] */
+   Cell *prev,*cur;             /* two rows [0..nRef] of cells */
+   unsigned char *dir;          /* directions of the current row */
+   int nPath;                   /* number of steps in path */
+   unsigned char *path;         /* best path, last step first, or NULL */
+} Grid;
+
+static Grid grid;               /* grid used by serial matching */
+
+/* DumpPath: for debugging */
+void DumpPath(Grid *g)
+{
+   int i,j,k;
+
+   if (g->path==NULL) return;
+   printf("Path -\n");
+   for (i=j=0,k=g->nPath-1; k>=0; k--) {
+      switch (g->path[k]) {
+      case DIAG:
+         ++i; ++j;
+         printf("    d %s %s\n",g->lTest[i]->name,g->lRef[j]->name);
+         break;
+      case HOR:
+         ++i;
+         printf("    h %s\n",g->lTest[i]->name);
+         break;
+      case VERT:
+         ++j;
+         printf("    v %s\n",g->lRef[j]->name);
+         break;
       }
-      printf("\n");
    }
    fflush(stdout);
 }
 
-/* CreateGrid: Create a grid of cells of the given dimensions */
-void CreateGrid(void)
+/* LabArray: return array [1..n] of the lev labels in ll */
+static LabId *LabArray(MemHeap *x, LabList *ll, int lev, int *n)
 {
+   LabId *lab;
    LLink l;
-   LabId labid;
    int i;
-   
-   nRef = CountAuxLabs(ref,rlev);
-   nTest = CountAuxLabs(test,tlev);
-   grid=(CellPtr *)New(&tempHeap,(nTest+1)*sizeof(CellPtr));
-   for (i=0; i<=nTest;i++)
-      grid[i]=(CellPtr) New(&tempHeap,(nRef+1)*sizeof(Cell));
-   lRef = (LabId*) New(&tempHeap,sizeof(LabId)*nRef);lRef--;
-   lTest = (LabId*) New(&tempHeap,sizeof(LabId)*nTest);lTest--;
-
-   grid[0][0].score = grid[0][0].ins = grid[0][0].del = 0;
-   grid[0][0].sub = grid[0][0].hit = 0;
-   grid[0][0].dir = NIL;
-   for (i=1;i<=nTest;i++) {
-      l=GetAuxLabN(test,i,tlev);
-      labid = ((tlev==0) ? l->labid : l->auxLab[tlev]);
-      lTest[i]=labid;
-      grid[i][0] = grid[i-1][0];
-      grid[i][0].dir = HOR;
-      if (labid != nulClass) {
-         grid[i][0].score += nistAlign ? insPenNIST : insPen;
-         ++grid[i][0].ins;
-      }
-   }
-   for (i=1;i<=nRef;i++) {
-      l=GetAuxLabN(ref,i,rlev);
-      labid = ((rlev==0) ? l->labid : l->auxLab[rlev]);
-      lRef[i]=labid;
-      grid[0][i] = grid[0][i-1];
-      grid[0][i].dir = VERT;
-      if (labid != nulClass) {
-         grid[0][i].score += nistAlign ? delPenNIST : delPen;
-         ++grid[0][i].del;
+
+   *n = CountAuxLabs(ll,lev);
+   lab = (LabId*) New(x,sizeof(LabId)*(*n+1));
+   for (l=ll->head->succ,i=0; l->succ!=NULL; l=l->succ)
+      if (lev==0)
+         lab[++i] = l->labid;
+      else if (l->auxLab[lev]!=NULL)
+         lab[++i] = l->auxLab[lev];
+   return lab;
+}
+
+/* InitRow: set columns 0..jEnd of row to row 0 of the grid */
+static void InitRow(Grid *g, Cell *row, int jEnd)
+{
+   int j;
+
+   row[0].score = row[0].ins = row[0].del = 0;
+   row[0].sub = row[0].hit = 0;
+   for (j=1;j<=jEnd;j++) {
+      row[j] = row[j-1];
+      if (g->lRef[j] != nulClass) {
+         row[j].score += nistAlign ? delPenNIST : delPen;
+         ++row[j].del;
       }
    }
 }
 
-/* FreeGrid: free storage allocated to grid and label arrays */
-void FreeGrid(void)
+/* CreateGrid: Create a grid for ref vs test in heap x */
+void CreateGrid(MemHeap *x, Grid *g, LabList *ref, LabList *test)
 {
-   Dispose(&tempHeap,grid);
+   g->lRef = LabArray(x,ref,rlev,&g->nRef);
+   g->lTest = LabArray(x,test,tlev,&g->nTest);
+   g->prev = (Cell*) New(x,(g->nRef+1)*sizeof(Cell));
+   g->cur = (Cell*) New(x,(g->nRef+1)*sizeof(Cell));
+   g->dir = (unsigned char*) New(x,g->nRef+1);
+   g->nPath = 0; g->path = NULL;
+   InitRow(g,g->prev,g->nRef);
 }
 
-/* DoCompare: fill the grid */
-void DoCompare(void)
+/* CompareRow: set columns 0..jEnd of row i in cur and their
+   directions in dir from row i-1 in prev */
+static void CompareRow(Grid *g, int i, int jEnd,
+                       Cell *prev, Cell *cur, unsigned char *dir)
 {
-   CellPtr gridi,gridi1;
-   int h,d,v,i,j;
+   int h,d,v,j;
+   LabId *lRef,*lTest;
    Boolean refnull,testnull;
 
-   for (i=1;i<=nTest;i++){
-      gridi = grid[i]; gridi1 = grid[i-1];
-      testnull = (lTest[i] == nulClass) ? TRUE:FALSE;
-      for (j=1;j<=nRef;j++) {
-         refnull = (lRef[j] == nulClass) ? TRUE:FALSE;
-         if (refnull && testnull) { /* both ref and test are null */
-            h = gridi1[j].score; 
-            d = gridi1[j-1].score; 
-            v = gridi[j-1].score;
-            if (d<=v && d<=h) {
-               gridi[j] = gridi1[j-1]; 
-               gridi[j].dir = DIAG;
-            }
-            else if (h<v) {
-               gridi[j] = gridi1[j]; 
-               gridi[j].dir = HOR;
-            }
-            else {
-               gridi[j] = gridi[j-1];
-               gridi[j].dir = VERT;
-            }
+   lRef = g->lRef; lTest = g->lTest;
+   testnull = (lTest[i] == nulClass) ? TRUE:FALSE;
+   cur[0] = prev[0]; dir[0] = HOR;
+   if (!testnull) {
+      cur[0].score += insPen;
+      ++cur[0].ins;
+   }
+   for (j=1;j<=jEnd;j++) {
+      refnull = (lRef[j] == nulClass) ? TRUE:FALSE;
+      if (refnull && testnull) { /* both ref and test are null */
+         h = prev[j].score; 
+         d = prev[j-1].score; 
+         v = cur[j-1].score;
+         if (d<=v && d<=h) {
+            cur[j] = prev[j-1]; 
+            dir[j] = DIAG;
+         }
+         else if (h<v) {
+            cur[j] = prev[j]; 
+            dir[j] = HOR;
          }
-         else if (refnull) {    /* ref is null */
-            gridi[j] = gridi[j-1]; 
-            gridi[j].dir = VERT;
+         else {
+            cur[j] = cur[j-1];
+            dir[j] = VERT;
          }
-         else if (testnull) {   /* test is null */
-            gridi[j] = gridi1[j];
-            gridi[j].dir = HOR;
+      }
+      else if (refnull) {       /* ref is null */
+         cur[j] = cur[j-1]; 
+         dir[j] = VERT;
+      }
+      else if (testnull) {      /* test is null */
+         cur[j] = prev[j];
+         dir[j] = HOR;
+      }
+      else {                    /* normal case */
+         h = prev[j].score +insPen;
+         d = prev[j-1].score;
+         if (lRef[j] != lTest[i])
+            d += subPen;
+         v = cur[j-1].score + delPen;
+         if (d<=h && d<=v) {    /* DIAG = hit or sub */
+            cur[j] = prev[j-1];
+            cur[j].score = d;
+            dir[j] = DIAG;
+            if (lRef[j] == lTest[i])
+               ++cur[j].hit;
+            else
+               ++cur[j].sub;
          }
-         else {                 /* normal case */
-            h = gridi1[j].score +insPen;
-            d = gridi1[j-1].score;
-            if (lRef[j] != lTest[i])
-               d += subPen;
-            v = gridi[j-1].score + delPen;
-            if (d<=h && d<=v) { /* DIAG = hit or sub */
-               gridi[j] = gridi1[j-1];
-               gridi[j].score = d;
-               gridi[j].dir = DIAG;
-               if (lRef[j] == lTest[i])
-                  ++gridi[j].hit;
-               else
-                  ++gridi[j].sub;
-            }
-            else if (h<v) {     /* HOR = ins */
-               gridi[j] = gridi1[j];
-               gridi[j].score = h;
-               gridi[j].dir = HOR;
-               ++ gridi[j].ins;
-            }
-            else {              /* VERT = del */
-               gridi[j] = gridi[j-1];
-               gridi[j].score = v;
-               gridi[j].dir = VERT;
-               ++gridi[j].del;
-            }
+         else if (h<v) {        /* HOR = ins */
+            cur[j] = prev[j];
+            cur[j].score = h;
+            dir[j] = HOR;
+            ++ cur[j].ins;
          }
-      } /* for j */
-   } /* for i */
-   grid[0][0].dir = NIL;
+         else {                 /* VERT = del */
+            cur[j] = cur[j-1];
+            cur[j].score = v;
+            dir[j] = VERT;
+            ++cur[j].del;
+         }
+      }
+   }
 }
 
-/* DoCompareNIST: fill the grid using NIST alignment rules*/
-void DoCompareNIST(void)
+/* CompareRowNIST: as CompareRow but using NIST alignment rules */
+static void CompareRowNIST(Grid *g, int i, int jEnd,
+                           Cell *prev, Cell *cur, unsigned char *dir)
 {
-   CellPtr gridi,gridi1;
-   int h,d,v,i,j;
+   int h,d,v,j;
+   LabId *lRef,*lTest;
    Boolean refnull,testnull;
 
-   for (i=1;i<=nTest;i++){
-      gridi = grid[i]; gridi1 = grid[i-1];
-      testnull = (lTest[i] == nulClass) ? TRUE:FALSE;
-      for (j=1;j<=nRef;j++) {
-         refnull = (lRef[j] == nulClass) ? TRUE:FALSE;
-         if (refnull && testnull) { /* both ref and test are null */
-            h = gridi1[j].score; 
-            d = gridi1[j-1].score; 
-            v = gridi[j-1].score;
-            if (v <= d && v <= h) {    
-               gridi[j] = gridi[j-1];
-               gridi[j].dir = VERT;
-            }
-            else if (d <= h) {
-               gridi[j] = gridi1[j-1]; 
-               gridi[j].dir = DIAG;
-            }
-            else {
-               gridi[j] = gridi1[j]; 
-               gridi[j].dir = HOR;
-            }
+   lRef = g->lRef; lTest = g->lTest;
+   testnull = (lTest[i] == nulClass) ? TRUE:FALSE;
+   cur[0] = prev[0]; dir[0] = HOR;
+   if (!testnull) {
+      cur[0].score += insPenNIST;
+      ++cur[0].ins;
+   }
+   for (j=1;j<=jEnd;j++) {
+      refnull = (lRef[j] == nulClass) ? TRUE:FALSE;
+      if (refnull && testnull) { /* both ref and test are null */
+         h = prev[j].score; 
+         d = prev[j-1].score; 
+         v = cur[j-1].score;
+         if (v <= d && v <= h) {    
+            cur[j] = cur[j-1];
+            dir[j] = VERT;
          }
-         else if (refnull) {    /* ref is null */
-            gridi[j] = gridi[j-1]; 
-            gridi[j].dir = VERT;
+         else if (d <= h) {
+            cur[j] = prev[j-1]; 
+            dir[j] = DIAG;
          }
-         else if (testnull) {   /* test is null */
-            gridi[j] = gridi1[j];
-            gridi[j].dir = HOR;
+         else {
+            cur[j] = prev[j]; 
+            dir[j] = HOR;
          }
-         else {                 /* normal case */
-            h = gridi1[j].score +insPenNIST;
-            d = gridi1[j-1].score;
-            if (lRef[j] != lTest[i])
-               d += subPenNIST;
-            v = gridi[j-1].score + delPenNIST;
-            if (v <= d && v <= h) { /* VERT = del */
-               gridi[j] = gridi[j-1];
-               gridi[j].score = v;
-               gridi[j].dir = VERT;
-               ++gridi[j].del;
-            }
-            else if (d <= h) {  /* DIAG = hit or sub */
-               gridi[j] = gridi1[j-1];
-               gridi[j].score = d;
-               gridi[j].dir = DIAG;
-               if (lRef[j] == lTest[i])
-                  ++gridi[j].hit;
-               else
-                  ++gridi[j].sub;
-            }
-            else {              /* HOR = ins */
-               gridi[j] = gridi1[j];
-               gridi[j].score = h;
-               gridi[j].dir = HOR;
-               ++ gridi[j].ins;
-            }
+      }
+      else if (refnull) {       /* ref is null */
+         cur[j] = cur[j-1]; 
+         dir[j] = VERT;
+      }
+      else if (testnull) {      /* test is null */
+         cur[j] = prev[j];
+         dir[j] = HOR;
+      }
+      else {                    /* normal case */
+         h = prev[j].score +insPenNIST;
+         d = prev[j-1].score;
+         if (lRef[j] != lTest[i])
+            d += subPenNIST;
+         v = cur[j-1].score + delPenNIST;
+         if (v <= d && v <= h) { /* VERT = del */
+            cur[j] = cur[j-1];
+            cur[j].score = v;
+            dir[j] = VERT;
+            ++cur[j].del;
+         }
+         else if (d <= h) {     /* DIAG = hit or sub */
+            cur[j] = prev[j-1];
+            cur[j].score = d;
+            dir[j] = DIAG;
+            if (lRef[j] == lTest[i])
+               ++cur[j].hit;
+            else
+               ++cur[j].sub;
+         }
+         else {                 /* HOR = ins */
+            cur[j] = prev[j];
+            cur[j].score = h;
+            dir[j] = HOR;
+            ++ cur[j].ins;
          }
-      } /* for j */
-   } /* for i */
-   grid[0][0].dir = NIL;
+      }
+   }
+}
+
+/* FillRow: compute row i using the selected alignment rules */
+static void FillRow(Grid *g, int i, int jEnd,
+                    Cell *prev, Cell *cur, unsigned char *dir)
+{
+   if (nistAlign)
+      CompareRowNIST(g,i,jEnd,prev,cur,dir);
+   else
+      CompareRow(g,i,jEnd,prev,cur,dir);
+}
+
+/* DoCompare: fill the grid and return the final cell */
+Cell DoCompare(Grid *g)
+{
+   Cell *row;
+   int i;
+
+   for (i=1;i<=g->nTest;i++){
+      FillRow(g,i,g->nRef,g->prev,g->cur,g->dir);
+      row = g->prev; g->prev = g->cur; g->cur = row;
+   }
+   return g->prev[g->nRef];
+}
+
+/* TraceRows: given row lo of the grid in r, append to g->path the
+   steps of the best path from cell (hi,jEnd) back to row lo and
+   return the column at which it reaches row lo */
+static int TraceRows(MemHeap *x, Grid *g, int lo, int hi, int jEnd, Cell *r)
+{
+   Cell *a,*b,*src,*cur,*mid;
+   unsigned char **dirs,*dir;
+   int *px,*cx,*t,i,j,m,c;
+
+   if (hi-lo <= 1 || (double)(hi-lo)*(jEnd+1) <= TRACECELLS) {
+      /* small block: keep all directions */
+      a = (Cell*) New(x,(jEnd+1)*sizeof(Cell));
+      b = (Cell*) New(x,(jEnd+1)*sizeof(Cell));
+      dirs = (unsigned char**) New(x,(hi-lo+1)*sizeof(unsigned char*));
+      for (i=lo+1,src=r; i<=hi; i++,src=cur) {
+         cur = (src==a) ? b : a;
+         dirs[i-lo] = (unsigned char*) New(x,jEnd+1);
+         FillRow(g,i,jEnd,src,cur,dirs[i-lo]);
+      }
+      for (i=hi,j=jEnd; i>lo; ) {
+         g->path[g->nPath++] = dirs[i-lo][j];
+         switch (dirs[i-lo][j]) {
+         case DIAG: --i; --j; break;
+         case HOR:  --i; break;
+         case VERT: --j; break;
+         }
+      }
+      Dispose(x,a);
+      return j;
+   }
+   m = (lo+hi)/2;
+   mid = (Cell*) New(x,(jEnd+1)*sizeof(Cell));
+   a = (Cell*) New(x,(jEnd+1)*sizeof(Cell));
+   b = (Cell*) New(x,(jEnd+1)*sizeof(Cell));
+   dir = (unsigned char*) New(x,jEnd+1);
+   px = (int*) New(x,(jEnd+1)*sizeof(int));
+   cx = (int*) New(x,(jEnd+1)*sizeof(int));
+   /* px[j] is the column at which the best path to cell j of the 
+      previous row crosses row m */
+   for (i=lo+1,src=r; i<=hi; i++,src=cur) {
+      cur = (src==a) ? b : a;
+      FillRow(g,i,jEnd,src,cur,dir);
+      if (i==m) {
+         for (j=0; j<=jEnd; j++) {
+            mid[j] = cur[j]; px[j] = j;
+         }
+      }
+      else if (i>m) {
+         for (j=0; j<=jEnd; j++)
+            switch (dir[j]) {
+            case DIAG: cx[j] = px[j-1]; break;
+            case HOR:  cx[j] = px[j]; break;
+            case VERT: cx[j] = cx[j-1]; break;
+            }
+         t = px; px = cx; cx = t;
+      }
+   }
+   c = px[jEnd];
+   Dispose(x,a);
+   if (TraceRows(x,g,m,hi,jEnd,mid) != c)
+      HError(3391,"TraceRows: Trace back failure");
+   Dispose(x,mid);
+   return TraceRows(x,g,lo,m,c,r);
+}
+
+/* TraceBack: store the best path through the grid in g->path */
+static void TraceBack(MemHeap *x, Grid *g)
+{
+   Cell *row;
+   int j;
+
+   g->path = (unsigned char*) New(x,g->nTest+g->nRef+1);
+   g->nPath = 0;
+   row = (Cell*) New(x,(g->nRef+1)*sizeof(Cell));
+   InitRow(g,row,g->nRef);
+   j = TraceRows(x,g,0,g->nTest,g->nRef,row);
+   while (j-- > 0)
+      g->path[g->nPath++] = VERT;
+   Dispose(x,row);
+}
+
+/* AlignLists: align test against ref in heap x and return final cell,
+   the best path is only traced back if traceBack is set */
+Cell AlignLists(MemHeap *x, Grid *g, LabList *ref, LabList *test,
+                Boolean traceBack)
+{
+   Cell c;
+
+   CreateGrid(x,g,ref,test);
+   c = DoCompare(g);
+   if (traceBack) TraceBack(x,g);
+   return c;
 }
 
 /* ------------------- Aligned Transcriptions --------------- */
@@ -1098,49 +1236,56 @@ void AppendPair(char *linea, char *a, char *lineb, char *b)
    AppendItem(lineb,b,lenb,width);
 }
 
-/* AppendCell: path upto grid[i][j] to tb and rb (recursive) */
-void AppendCell(int i, int j, char *tb, char *rb)
+/* AppendPath: append the best path in grid to tb and rb */
+void AppendPath(char *tb, char *rb)
 {
    char *rlab,*tlab;
    LabId rid=NULL,tid=NULL;
    char empty[1];
-
-   if (i<0 || j<0) 
-      HError(3391,"AppendCell: Trace back failure");
-   empty[0] = '\0'; rlab = tlab = empty;
-   switch (grid[i][j].dir) {
-   case DIAG:
-      tid  = lTest[i]; tlab = tid->name;
-      rid  = lRef[j]; rlab = rid->name;
-      AppendCell(i-1,j-1,tb,rb); break;
-   case HOR:
-      tid  = lTest[i]; tlab = tid->name;
-      rid = NULL; rlab = empty;
-      AppendCell(i-1,j,tb,rb); break;
-   case VERT:
-      tid = NULL; tlab = empty;
-      rid  = lRef[j]; rlab = rid->name;
-      AppendCell(i,j-1,tb,rb); break;
-   case NIL:
-      return;
+   int i,j,k;
+
+   empty[0] = '\0';
+   for (i=j=0,k=grid.nPath-1; k>=0; k--) {
+      rlab = tlab = empty;
+      switch (grid.path[k]) {
+      case DIAG:
+         tid  = grid.lTest[++i]; tlab = tid->name;
+         rid  = grid.lRef[++j]; rlab = rid->name;
+         break;
+      case HOR:
+         tid  = grid.lTest[++i]; tlab = tid->name;
+         rid = NULL; rlab = empty;
+         break;
+      case VERT:
+         tid = NULL; tlab = empty;
+         rid  = grid.lRef[++j]; rlab = rid->name;
+         break;
+      }
+      if (tid != nulClass && rid != nulClass)
+         AppendPair(rb,rlab,tb,tlab);
    }
-   if (tid != nulClass && rid != nulClass)
-      AppendPair(rb,rlab,tb,tlab);
 }
 
 /* OutTrans: output aligned transcriptions using best path in grid */
 void OutTrans(void)
 {
-   char refBuf[4096];           /* no checking of output length so */
-   char testBuf[4096];          /* these are generous sizes */
+   char *refBuf,*testBuf;
+   int i,size;
    
+   /* each aligned pair is no wider than both labels plus a space */
+   size = 8;
+   for (i=1; i<=grid.nRef; i++) size += strlen(grid.lRef[i]->name)+1;
+   for (i=1; i<=grid.nTest; i++) size += strlen(grid.lTest[i]->name)+1;
+   refBuf = (char*) New(&tempHeap,size);
+   testBuf = (char*) New(&tempHeap,size);
    strcpy(refBuf," LAB: ");
    strcpy(testBuf," REC: ");
-   AppendCell(nTest,nRef,testBuf,refBuf);
+   AppendPath(testBuf,refBuf);
    printf("Aligned transcription: %s vs %s\n", labfn, recfn);
    printf("%s\n",refBuf);
    printf("%s\n",testBuf);
    fflush(stdout);
+   Dispose(&tempHeap,refBuf);
 }
 
 /* ----------------- HMMList handling ----------- */
@@ -1307,19 +1452,17 @@ void OutConMat(void)
    Dispose(&tempHeap,seen);
 }     
 
-/* CollectStats: trace back from grid[i][j] collecting phoneme stats */
-void CollectStats(int i,int j)
+/* CollectStats: collect phoneme stats along the best path in grid */
+void CollectStats(void)
 {
-   int ri,ti;
+   int i,j,k,ri,ti;
    LabId rlab,tlab;
 
-   do {
-      switch(grid[i][j].dir) {
-      case NIL:   
-         return;
+   for (i=j=0,k=grid.nPath-1; k>=0; k--) {
+      switch(grid.path[k]) {
       case DIAG:  
-         rlab = lRef[j--];
-         tlab = lTest[i--];
+         rlab = grid.lRef[++j];
+         tlab = grid.lTest[++i];
          if (rlab==nulClass || tlab==nulClass) 
             break;
          ri=Index(rlab);
@@ -1327,34 +1470,32 @@ void CollectStats(int i,int j)
          ++conMat[ri][ti];
          break;
       case VERT:
-         rlab = lRef[j--];
+         rlab = grid.lRef[++j];
          if (rlab==nulClass) 
             break;
          ri=Index(rlab);
          ++conDel[ri];
          break;
       case HOR:
-         tlab = lTest[i--];
+         tlab = grid.lTest[++i];
          if (tlab==nulClass)  
             break;
          ti=Index(tlab);
          ++conIns[ti];
          break;
       }
-   } while (!(i==0 && j==0));
+   }
 }
 
 /* ----------------  Recognition Match Routines ---------------- */
 
-/* MatchRecFiles: match sequence in test vs sequence in ref */
-void MatchRecFiles(void)
+/* PrepareLists: normalise the test lists in ans and return the
+   number to be scored */
+int PrepareLists(void)
 {
-   Cell bp,*p;
-   int i,n,err,berr,best;
-   char buf[MAXSTRLEN];
+   int i,n;
    
    n=(ans->numLists>maxNDepth)?maxNDepth:ans->numLists;
-   best=0;berr=INT_MAX;
    for (i=1;i<=n;i++) {
       test=GetLabelList(ans,i);
       if (test->head->succ == test->tail) {
@@ -1362,44 +1503,166 @@ void MatchRecFiles(void)
          break;
       }
       NormaliseName(test,tlev);
-      CreateGrid();
-      if (nistAlign)
-         DoCompareNIST();
-      else 
-         DoCompare();
-      p = &grid[nTest][nRef];
-      err = p->del+p->sub+p->ins;
-      if (best==0 || err < berr) {
-         berr = err; best=i;
-         bp = *p;
+   }
+   return i-1;
+}
+
+/* ScoreLists: align test lists 1..n of tr against rl using heap x,
+   storing the error counts in err[1..n] and the best final cell in 
+   bp.  Returns the index of the best list */
+int ScoreLists(MemHeap *x, LabList *rl, Transcription *tr, int n,
+               int *err, Cell *bp)
+{
+   Grid g;
+   Cell c;
+   int i,berr,best;
+   
+   best=0;berr=INT_MAX;
+   for (i=1;i<=n;i++) {
+      c = AlignLists(x,&g,rl,GetLabelList(tr,i),FALSE);
+      err[i] = c.del+c.sub+c.ins;
+      if (best==0 || err[i] < berr) {
+         berr = err[i]; best=i;
+         *bp = c;
       }
-      FreeGrid();  /* Actually frees much more */
-      if (trace & T_EVN) {
+      Dispose(x,g.lRef);
+   }
+   return best;
+}
+
+/* RecordMatch: record the scores of the current file */
+void RecordMatch(int n, int *errs, int best, Cell *bp)
+{
+   int i,err;
+   char buf[MAXSTRLEN];
+
+   if (trace & T_EVN)
+      for (i=1;i<=n;i++) {
          if (i == 1) printf("%s:",NameOf(recfn,buf));
-         printf(" %2d",err);fflush(stdout);
+         printf(" %2d",errs[i]);fflush(stdout);
       }
-   }
    if (best==0) return; /* Empty test labels */
 
    if (trace & T_EVN) printf("\n"),fflush(stdout);
 
-   err = RecordFileStats(&bp);
+   err = RecordFileStats(bp);
    if (fullResults) 
-      PrintFileStats(NameOf(recfn,buf),bp.hit,bp.del,bp.sub,bp.ins);
+      PrintFileStats(NameOf(recfn,buf),bp->hit,bp->del,bp->sub,bp->ins);
 
    if ((outTrans && err) || outPStats) {
       test=GetLabelList(ans,best);
-      CreateGrid();
-      if (nistAlign)
-         DoCompareNIST();
-      else 
-         DoCompare();
+      AlignLists(&tempHeap,&grid,ref,test,TRUE);
       if (outTrans && err) 
          OutTrans();
       if  (outPStats) 
-         CollectStats(nTest,nRef);
-      FreeGrid();  /* Actually frees much more */
+         CollectStats();
+      Dispose(&tempHeap,grid.lRef);
+   }
+}
+
+/* MatchRecFiles: match sequence in test vs sequence in ref */
+void MatchRecFiles(void)
+{
+   Cell bp;
+   int n,best,*errs;
+   
+   n = PrepareLists();
+   errs = (int*) New(&tempHeap,(n+1)*sizeof(int));
+   best = ScoreLists(&tempHeap,ref,ans,n,errs,&bp);
+   RecordMatch(n,errs,best,&bp);
+   Dispose(&tempHeap,errs);
+}
+
+/* ------------------ Parallel Recognition Match ------------------- */
+
+/*
+   With NUMTHREADS>1 rec files are read and normalised serially and
+   queued.  When the queue is full the alignments are computed in
+   parallel and then the statistics are recorded and printed for each
+   file in the original order, so the output is unchanged.
+*/
+
+#define JOBS_PER_THREAD 16   /* rec files queued per thread */
+
+typedef struct _ScoreJob{    /* a rec file queued for scoring */
+   char recfn[MAXSTRLEN];    /* rec file name (test) */
+   char labfn[MAXSTRLEN];    /* lab file name (reference) */
+   Transcription *ans;       /* the test transcription */
+   LabList *ref;             /* the reference labels */
+   int nLists;               /* num test lists to score */
+   int *errs;                /* array[1..nLists] of errors per list */
+   int best;                 /* index of best list (0 if none) */
+   Cell bp;                  /* final cell of best list */
+} ScoreJob;
+
+static ThreadPool *pool = NULL;    /* worker threads */
+static MemHeap *thHeap;            /* array[0..nThreads-1] of DP heaps */
+static ScoreJob *jobs;             /* array [0..maxJobs-1] of queued files */
+static int maxJobs = 0;
+static int nJobs = 0;
+
+/* InitParallel: create the thread pool and job queue */
+void InitParallel(void)
+{
+   char buf[MAXSTRLEN];
+   int i;
+
+   nThreads = NumThreads();
+   if (nThreads<=1) return;
+   if (wSpot) {
+      HError(-3319,"HResults: Word spotting mode is not multi-threaded");
+      nThreads = 1;
+      return;
+   }
+   pool = CreateThreadPool(&permHeap,nThreads);
+   thHeap = (MemHeap*) New(&permHeap,nThreads*sizeof(MemHeap));
+   for (i=0; i<nThreads; i++) {
+      sprintf(buf,"DP heap %d",i);
+      CreateHeap(thHeap+i,buf,MSTAK,1,1.0,8000,40000);
+   }
+   maxJobs = nThreads*JOBS_PER_THREAD;
+   jobs = (ScoreJob*) New(&permHeap,maxJobs*sizeof(ScoreJob));
+   if (trace&T_BAS)
+      printf("Scoring with %d threads\n",nThreads);
+}
+
+/* ScoreTask: thread task to align the lists of one queued file */
+void ScoreTask(int thread, int job, Ptr arg)
+{
+   ScoreJob *sj = jobs+job;
+
+   sj->best = ScoreLists(thHeap+thread,sj->ref,sj->ans,sj->nLists,
+                         sj->errs,&sj->bp);
+}
+
+/* FlushJobs: score the queued files and record them in order */
+void FlushJobs(void)
+{
+   ScoreJob *sj;
+   int i;
+
+   if (nJobs==0) return;
+   RunThreadTasks(pool,nJobs,ScoreTask,NULL);
+   for (i=0,sj=jobs; i<nJobs; i++,sj++) {
+      recfn = sj->recfn; strcpy(labfn,sj->labfn);
+      ans = sj->ans; ref = sj->ref;
+      RecordMatch(sj->nLists,sj->errs,sj->best,&sj->bp);
    }
+   Dispose(&tempHeap,jobs[0].ans);
+   nJobs = 0;
+}
+
+/* QueueRecFiles: queue the current file for parallel scoring */
+void QueueRecFiles(void)
+{
+   ScoreJob *sj;
+
+   sj = jobs+nJobs++;
+   strcpy(sj->recfn,recfn); strcpy(sj->labfn,labfn);
+   sj->ans = ans; sj->ref = ref;
+   sj->nLists = PrepareLists();
+   sj->errs = (int*) New(&tempHeap,(sj->nLists+1)*sizeof(int));
+   if (nJobs==maxJobs) FlushJobs();
 }
 
 /* ------------------ Word Spot Recording --------------------- */
@@ -1766,6 +2029,7 @@ void Initialise(char * listfn)
    if (fullResults && !wSpot && !nistFormat)
       PrintBar(0,htkWidth,'-',"Sentence Scores");
    if (!nistFormat && spkrMask!=NULL) htkWidth += 11;
+   InitParallel();
 }
 
 /* MatchFiles: match recfn (test) against labfn (ref) */
@@ -1784,6 +2048,10 @@ void MatchFiles(void)
    NormaliseName(ref,rlev);
    if (wSpot)
       MatchSpotFiles();
+   else if (nThreads>1) {
+      QueueRecFiles();
+      return;
+   }
    else
       MatchRecFiles();
    Dispose(&tempHeap,ans);
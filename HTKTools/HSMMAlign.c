@@ -76,6 +76,9 @@ static UttInfo *utt;            /* utterance information storage */
 static XFInfo xfInfo_hmm;
 static XFInfo xfInfo_dur;
 
+/* Likelihoods cached across runs (LIKECACHE) */
+static LikeCache *lcache = NULL;
+
 /* Label */
 static char *outLabDir = NULL;  /* directory to save label files */
 static char *outLabExt = "lab"; /* output label file extension */
@@ -635,6 +638,7 @@ void Initialise(void)
    if (hset.hsKind == DISCRETEHS)
       HError(9999, "HSMMAlign: Only continuous model is surpported");
    ConvDiagC(&hset, TRUE);
+   lcache = CreateLikeCache(&hmmStack, &hset);
 
    /* load duration mmf */
    if (MakeHMMSet(&dset, GetStrArg()) < SUCCESS)
@@ -664,6 +668,34 @@ void Initialise(void)
 
 /* ---------------------------- Viterbi ---------------------------- */
 
+/* StreamLike: unweighted log likelihood of stream s of sti at frame t */
+static LogFloat StreamLike(UttInfo * utt, int s, StreamInfo * sti, int t)
+{
+   int m;
+   float *like = NULL;
+   LogFloat x, mixp, wt;
+   LogFloat det_in, det_pa;
+   MixtureElem *me;
+   MixPDF *mp;
+   Vector v;
+
+   if (lcache != NULL && (like = CachedLike(lcache, s, sti, t)) != NULL && *like < LIKEUNSET)
+      return *like;
+   v = utt->o[t].fv[s];
+   me = sti->spdf.cpdf + 1;
+   x = LZERO;
+   for (m = 1; m <= sti->nMix; m++, me++) {
+      mp = me->mpdf;
+      mixp = MOutP(ApplyCompFXForm(mp, ApplyCompFXForm(mp, v, xfInfo_hmm.paXForm, &det_pa, t), xfInfo_hmm.inXForm, &det_in, t), mp);
+      mixp += det_pa + det_in;
+      wt = MixLogWeight(&hset, me->weight);
+      x = LAdd(x, wt + mixp);
+   }
+   if (like != NULL)
+      *like = x;
+   return x;
+}
+
 Boolean HSMMAlign(UttInfo * utt, char *datafn, char *outLabDir, int beam, int *maxMixInS)
 {
    int i, j, l, t;
@@ -680,7 +712,7 @@ Boolean HSMMAlign(UttInfo * utt, char *datafn, char *outLabDir, int beam, int *m
    HLink hlink_dset;
    MixPDF *pdf;
    LogFloat p = LZERO;
-   LogFloat mixp, wt, x;
+   LogFloat x;
    Boolean isPipe;
 
    /* alignment */
@@ -707,11 +739,6 @@ Boolean HSMMAlign(UttInfo * utt, char *datafn, char *outLabDir, int beam, int *m
    StateInfo *si;
    StreamElem *ste;
    int s, S;
-   StreamInfo *sti;
-   Vector v;
-   int m, M;
-   MixtureElem *me;
-   MixPDF *mp;
    LogFloat det_in;
    LogFloat det_pa;
    Vector dur;
@@ -738,6 +765,11 @@ Boolean HSMMAlign(UttInfo * utt, char *datafn, char *outLabDir, int beam, int *m
    LoadData(&hset, utt, dff, datafn, NULL);
    InitUttObservations(utt, &hset, datafn, maxMixInS);
    BaseOf(datafn, basefn);
+   if (lcache != NULL) {
+      OpenLikeCache(lcache, datafn, xfInfo_hmm.inXForm, xfInfo_hmm.paXForm);
+      for (t = 1; t <= utt->T; t++)
+         CheckLikeCacheObs(lcache, t, utt->o + t);
+   }
 
    if (trace & T_TOP) {
       printf(" Processing Data: %s ;", NameOf(datafn, namefn));
@@ -821,18 +853,7 @@ Boolean HSMMAlign(UttInfo * utt, char *datafn, char *outLabDir, int beam, int *m
          p = 0;
          next_h->sprob = CreateDVector(&tmpStack, S);
          for (s = 1; s <= S; s++, ste++) {
-            sti = ste->info;
-            v = utt->o[t].fv[s];
-            M = sti->nMix;
-            me = sti->spdf.cpdf + 1;
-            x = LZERO;
-            for (m = 1; m <= M; m++, me++) {
-               mp = me->mpdf;
-               mixp = MOutP(ApplyCompFXForm(mp, ApplyCompFXForm(mp, v, xfInfo_hmm.paXForm, &det_pa, t), xfInfo_hmm.inXForm, &det_in, t), mp);
-               mixp += det_pa + det_in;
-               wt = MixLogWeight(&hset, me->weight);
-               x = LAdd(x, wt + mixp);
-            }
+            x = StreamLike(utt, s, ste->info, t);
             if (si->weights)
                next_h->sprob[s] = si->weights[s] * x;
             else
@@ -930,18 +951,7 @@ Boolean HSMMAlign(UttInfo * utt, char *datafn, char *outLabDir, int beam, int *m
             p = 0;
             next_h->sprob = CreateDVector(&tmpStack, S);
             for (s = 1; s <= S; s++, ste++) {
-               sti = ste->info;
-               v = utt->o[t].fv[s];
-               M = sti->nMix;
-               me = sti->spdf.cpdf + 1;
-               x = LZERO;
-               for (m = 1; m <= M; m++, me++) {
-                  mp = me->mpdf;
-                  mixp = MOutP(ApplyCompFXForm(mp, ApplyCompFXForm(mp, v, xfInfo_hmm.paXForm, &det_pa, t), xfInfo_hmm.inXForm, &det_in, t), mp);
-                  mixp += det_pa + det_in;
-                  wt = MixLogWeight(&hset, me->weight);
-                  x = LAdd(x, wt + mixp);
-               }
+               x = StreamLike(utt, s, ste->info, t);
                if (si->weights)
                   next_h->sprob[s] = si->weights[s] * x;
                else
@@ -1097,6 +1107,9 @@ Boolean HSMMAlign(UttInfo * utt, char *datafn, char *outLabDir, int beam, int *m
    /* free state sequence */
    HSMMAlignStateSequenceClear(&sseq);
 
+   if (lcache != NULL)
+      CloseLikeCache(lcache);
+
    /* reset utterance */
    ResetUttObservations(utt, &hset);
 
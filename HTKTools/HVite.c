@@ -98,6 +98,7 @@ char *hvite_vc_id = "$Id: HVite.c,v 1.21 2012/12/22 07:01:31 uratec Exp $";
 #include "HDict.h"
 #include "HNet.h"
 #include "HRec.h"
+#include "HThreads.h"
 
 /* -------------------------- Trace Flags & Vars ------------------------ */
 
@@ -122,6 +123,8 @@ static Boolean models = FALSE;    /* Keep track of model alignment */
 static char *datFN;               /* Speech file */
 static char *dictFn;              /* Dictionary */
 static char *wdNetFn = NULL;      /* Word level lattice */
+static char *saveNetFn = NULL;    /* Write expanded network to this file */
+static char *loadNetFn = NULL;    /* Read expanded network from this file */
 static char *hmmListFn;           /* HMMs */
 static char * hmmDir = NULL;      /* directory to look for hmm def files */
 static char * hmmExt = NULL;      /* hmm def file extension */
@@ -191,6 +194,30 @@ static MemHeap regHeap;
 /* information about transforms */
 static XFInfo xfInfo;
 
+/* -------------------------- Parallel Alignment ------------------------ */
+
+#define JOBS_PER_THREAD 4   /* utterances in flight per thread */
+
+typedef struct {            /* an utterance being aligned */
+   char fn[MAXFNAMELEN];    /* data file name */
+   int n;                   /* utterance number */
+   MemHeap heap;            /* network and input buffer */
+   Network *net;            /* expanded network for this utterance */
+   ParmBuf pbuf;            /* input buffer holding the whole file */
+   BufferInfo info;         /* information about pbuf */
+   int nFrames;             /* number of frames in pbuf */
+   int tact;                /* total active models over all frames */
+   VRecInfo *vri;           /* recogniser state for this utterance */
+} AlignJob;
+
+static int nThreads = 1;            /* number of threads (NUMTHREADS) */
+static ThreadPool *pool = NULL;     /* worker threads */
+static PSetInfo **tpsi;             /* array [0..nThreads-1] of HRec info */
+static Observation *tobs;           /* array [0..nThreads-1] of observations */
+static AlignJob *jobs = NULL;       /* array [0..nJobs-1] of jobs */
+static int nJobs = 0;               /* max utterances in flight */
+static int nQueued = 0;             /* utterances prepared so far */
+
 /* ---------------- Configuration Parameters --------------------- */
 
 static ConfParam *cParm[MAXGLOBS];
@@ -217,6 +244,10 @@ void SetConfParms(void)
       if (GetConfStr(cParm,nParm,"LABFILEMASK",buf)) {
          labFileMask = CopyString(&gstack, buf);
       }
+      if (GetConfStr(cParm,nParm,"SAVENETWORK",buf))
+         saveNetFn = CopyString(&gstack,buf);
+      if (GetConfStr(cParm,nParm,"LOADNETWORK",buf))
+         loadNetFn = CopyString(&gstack,buf);
    }
 }
 
@@ -277,7 +308,7 @@ int main(int argc, char *argv[])
 
    InitDict();
    InitNet();   InitRec();
-   InitUtil(); 
+   InitUtil();  InitThreads();
    InitAdapt(&xfInfo,NULL); InitMap();
 
    if (!InfoPrinted() && NumArgs() == 0)
@@ -285,6 +316,7 @@ int main(int argc, char *argv[])
    if (NumArgs() == 0) Exit(0);
 
    SetConfParms();
+   nThreads = NumThreads();
    CreateHeap(&modelHeap, "Model heap",  MSTAK, 1, 0.0, 100000, 800000 );
    CreateHMMSet(&hset,&modelHeap,TRUE); 
 
@@ -496,8 +528,10 @@ int main(int argc, char *argv[])
    if ((states || models) && nToks>1)
       HError(3230,"HVite: Alignment using multiple tokens is not supported");
 #endif
-   if (NumArgs()==0 && wdNetFn==NULL)
+   if (NumArgs()==0 && wdNetFn==NULL && loadNetFn==NULL)
       HError(3230,"HVite: Network must be specified for recognition from audio");
+   if (loadNetFn!=NULL && (loadNetworks || loadLabels))
+      HError(3230,"HVite: LOADNETWORK cannot be used for alignment");
    if (loadNetworks && loadLabels)
       HError(3230,"HVite: Must choose either alignment from network or labels");
    if (nToks>1 && latExt==NULL && nTrans==1)
@@ -512,7 +546,7 @@ int main(int argc, char *argv[])
 
 
    /* Process the data */
-   if (wdNetFn==NULL)
+   if (wdNetFn==NULL && loadNetFn==NULL)
       DoAlignment();
    else
       DoRecognition();
@@ -612,6 +646,9 @@ void Initialise(void)
    if (nToks>1) nBeam=genBeam;
    psi=InitPSetInfo(&hset);
    vri=InitVRecInfo(psi,nToks,models,states);
+   /* Cached likelihoods are only valid while the models are unchanged */
+   if (!xfInfo.useOutXForm && update==0)
+      vri->lcache=CreateLikeCache(&gstack,&hset);
 
    /* Read dictionary and create storage for lattice */
    InitVocab(&vocab);   
@@ -706,22 +743,39 @@ int DoOnlineAdaptation(Lattice *lat, ParmBuf pbuf, int nFrames)
    return nFrames;
 } 
 
-/* ProcessFile: process given file. If fn=NULL then direct audio */
-Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam, Boolean restartable)
+/* OpenDataBuffer: open input buffer for fn in heap x and get its info */
+ParmBuf OpenDataBuffer(MemHeap *x, char *fn, BufferInfo *pbinfo)
 {
-   FILE *file;
    ParmBuf pbuf;
-   BufferInfo pbinfo;
-   NetNode *d;
+   char buf1[MAXSTRLEN],buf2[MAXSTRLEN];
+
+   if((pbuf = OpenBuffer(x,fn,50,dfmt,TRI_UNDEF,TRI_UNDEF))==NULL)
+      HError(3250,"ProcessFile: Config parameters invalid");   
+
+   /* Check pbuf same as hset */
+   GetBufferInfo(pbuf,pbinfo);
+   if (pbinfo->tgtPK!=hset.pkind)
+      HError(3231,"ProcessFile: Incompatible sample kind %s vs %s",
+             ParmKind2Str(pbinfo->tgtPK,buf1),
+             ParmKind2Str(hset.pkind,buf2));
+   return pbuf;
+}
+
+/* CompleteFile: trace back the recognition of fn by v and output
+   the result.  If fn=NULL then direct audio */
+Boolean CompleteFile(char *fn, VRecInfo *v, ParmBuf pbuf, BufferInfo *pbinfo,
+                     int nFrames, int tact, int utterNum,
+                     LogDouble currGenBeam, Boolean restartable)
+{
+   FILE *file;
    Lattice *lat;
    LArc *arc,*cur;
    LNode *node;
    Transcription *trans;
-   MLink m;
    LogFloat lmlk,aclk;
-   int s,j,tact,nFrames;
+   int j;
    LatFormat form;
-   char *p,lfn[MAXSTRLEN],buf1[MAXSTRLEN],buf2[MAXSTRLEN],thisFN[MAXSTRLEN];
+   char *p,lfn[MAXSTRLEN],thisFN[MAXSTRLEN];
    Boolean enableOutput = TRUE, isPipe;
 
    if (fn!=NULL)
@@ -730,54 +784,8 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
       CounterFN(roPrefix,roSuffix,++roCounter,4,thisFN);
    else 
       enableOutput = FALSE;
-      
-   if((pbuf = OpenBuffer(&bufHeap,fn,50,dfmt,TRI_UNDEF,TRI_UNDEF))==NULL)
-      HError(3250,"ProcessFile: Config parameters invalid");   
-
-   /* Check pbuf same as hset */
-   GetBufferInfo(pbuf,&pbinfo);
-   if (pbinfo.tgtPK!=hset.pkind)
-      HError(3231,"ProcessFile: Incompatible sample kind %s vs %s",
-             ParmKind2Str(pbinfo.tgtPK,buf1),
-             ParmKind2Str(hset.pkind,buf2));
-   if (pbinfo.a != NULL && replay)  AttachReplayBuf(pbinfo.a, (int) (3*(1.0E+07/pbinfo.srcSampRate)));
-
-   StartRecognition(vri,net,lmScale,wordPen,prScale);
-   SetPruningLevels(vri,maxActive,currGenBeam,wordBeam,nBeam,tmBeam);
- 
-   tact=0;nFrames=0;
-   StartBuffer(pbuf);
-   while(BufferStatus(pbuf)!=PB_CLEARED) {
-      ReadAsBuffer(pbuf,&obs);
-      if (trace&T_OBS) PrintObservation(nFrames,&obs,13);      
-
-      if (hset.hsKind==DISCRETEHS){
-         for (s=1; s<=hset.swidth[0]; s++){
-            if( (obs.vq[s] < 1) || (obs.vq[s] > maxMixInS[s]))
-               HError(3250,"ProcessFile: Discrete data value [ %d ] out of range in stream [ %d ] in file %s",obs.vq[s],s,fn);
-         }
-      }
 
-      ProcessObservation(vri,&obs,-1,xfInfo.inXForm);
-      
-      if (trace & T_FRS) {
-         for (d=vri->genMaxNode,j=0;j<30;d=d->links[0].node,j++)
-            if (d->type==n_word) break;
-         if (d->type==n_word){
-            if (d->info.pron==NULL) p=":bound:";
-            else p=d->info.pron->word->wordName->name;
-         }
-         else p=":external:";
-         m=FindMacroStruct(&hset,'h',vri->genMaxNode->info.hmm);
-         printf("Optimum @%-4d HMM: %s (%s)  %d %5.3f\n",
-                vri->frame,m->id->name,p,
-                vri->nact,vri->genMaxTok.like/vri->frame);
-         fflush(stdout);
-      }
-      nFrames++;
-      tact+=vri->nact;
-   }
-   lat=CompleteRecognition(vri,pbinfo.tgtSampRate/10000000.0,&ansHeap);
+   lat=CompleteRecognition(v,pbinfo->tgtSampRate/10000000.0,&ansHeap);
    
    if (lat==NULL) {
       if ((trace & T_TOP) && fn != NULL){
@@ -789,15 +797,17 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
       } else if (fn==NULL){
          printf("Sorry [%d frames]?\n",nFrames);fflush(stdout);
       }      
-      if (pbinfo.a != NULL && replay)  ReplayAudio(pbinfo);
+      if (pbinfo->a != NULL && replay)  ReplayAudio(*pbinfo);
       CloseBuffer(pbuf);
       return FALSE;
    }
    
-   if (vri->noTokenSurvived && restartable)
+   if (v->noTokenSurvived && restartable) {
+      CloseBuffer(pbuf);
       return FALSE;
+   }
 
-   if (vri->noTokenSurvived && trace & T_TOP) {
+   if (v->noTokenSurvived && trace & T_TOP) {
       printf("No tokens survived to final node of network\n");
       printf("  Output most likely partial hypothesis within network\n");
       fflush(stdout);
@@ -828,11 +838,11 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
              (aclk+lmlk)/nFrames, aclk,lmlk,(float)tact/nFrames);
       fflush(stdout);
    }
-   if (pbinfo.a != NULL && replay)  ReplayAudio(pbinfo);
+   if (pbinfo->a != NULL && replay)  ReplayAudio(*pbinfo);
    
    /* accumulate stats for online unsupervised adaptation 
       only if a token survived */
-   if ((lat != NULL) &&  (!vri->noTokenSurvived) && ((update > 0) || (xfInfo.useOutXForm)))
+   if ((lat != NULL) &&  (!v->noTokenSurvived) && ((update > 0) || (xfInfo.useOutXForm)))
       DoOnlineAdaptation(lat, pbuf, nFrames);
 
    if (enableOutput){
@@ -872,7 +882,7 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
       trans=TranscriptionFromLattice(&ansHeap,lat,nTrans);
       
       if (labForm!=NULL)
-         FormatTranscription(trans,pbinfo.tgtSampRate,states,models,
+         FormatTranscription(trans,pbinfo->tgtSampRate,states,models,
                              ((strchr(labForm,'X')!=NULL) ? TRUE:FALSE),
                              ((strchr(labForm,'N')!=NULL) ? TRUE:FALSE),
                              ((strchr(labForm,'S')!=NULL) ? TRUE:FALSE),
@@ -894,21 +904,239 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
       PrintAllHeapStats();
    }
 
-   return ((!vri->noTokenSurvived) ? TRUE:FALSE);
+   return ((!v->noTokenSurvived) ? TRUE:FALSE);
+}
+
+/* ProcessFile: process given file. If fn=NULL then direct audio */
+Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam, Boolean restartable)
+{
+   ParmBuf pbuf;
+   BufferInfo pbinfo;
+   NetNode *d;
+   MLink m;
+   int s,j,tact,nFrames;
+   char *p;
+
+   pbuf = OpenDataBuffer(&bufHeap,fn,&pbinfo);
+   if (pbinfo.a != NULL && replay)  AttachReplayBuf(pbinfo.a, (int) (3*(1.0E+07/pbinfo.srcSampRate)));
+   if (vri->lcache!=NULL && fn!=NULL)
+      OpenLikeCache(vri->lcache,fn,xfInfo.inXForm,NULL);
+
+   StartRecognition(vri,net,lmScale,wordPen,prScale);
+   SetPruningLevels(vri,maxActive,currGenBeam,wordBeam,nBeam,tmBeam);
+ 
+   tact=0;nFrames=0;
+   StartBuffer(pbuf);
+   while(BufferStatus(pbuf)!=PB_CLEARED) {
+      ReadAsBuffer(pbuf,&obs);
+      if (trace&T_OBS) PrintObservation(nFrames,&obs,13);      
+
+      if (hset.hsKind==DISCRETEHS){
+         for (s=1; s<=hset.swidth[0]; s++){
+            if( (obs.vq[s] < 1) || (obs.vq[s] > maxMixInS[s]))
+               HError(3250,"ProcessFile: Discrete data value [ %d ] out of range in stream [ %d ] in file %s",obs.vq[s],s,fn);
+         }
+      }
+
+      ProcessObservation(vri,&obs,-1,xfInfo.inXForm);
+      
+      if (trace & T_FRS) {
+         for (d=vri->genMaxNode,j=0;j<30;d=d->links[0].node,j++)
+            if (d->type==n_word) break;
+         if (d->type==n_word){
+            if (d->info.pron==NULL) p=":bound:";
+            else p=d->info.pron->word->wordName->name;
+         }
+         else p=":external:";
+         m=FindMacroStruct(&hset,'h',vri->genMaxNode->info.hmm);
+         printf("Optimum @%-4d HMM: %s (%s)  %d %5.3f\n",
+                vri->frame,m->id->name,p,
+                vri->nact,vri->genMaxTok.like/vri->frame);
+         fflush(stdout);
+      }
+      nFrames++;
+      tact+=vri->nact;
+   }
+   if (vri->lcache!=NULL && fn!=NULL)
+      CloseLikeCache(vri->lcache);
+   return CompleteFile(fn,vri,pbuf,&pbinfo,nFrames,tact,utterNum,
+                       currGenBeam,restartable);
 }
 
 /* --------------------- Top Level Processing --------------------- */
 
-/* DoAlignment: by creating network from transcriptions or lattices */
-void DoAlignment(void)
+/* LoadAlignNet: create network in heap x from the transcription or
+   lattice of data file fn */
+Network *LoadAlignNet(MemHeap *x, char *fn)
 {
    FILE *nf;
    char lfn[MAXSTRLEN], buf[MAXSTRLEN];
    Transcription *trans;
-   Network *net;
    Boolean isPipe;
-   int n=0;
+
+   if (labFileMask != NULL ) { /* support for rescoring lattice masks */
+      if (!MaskMatch(labFileMask,buf,fn))
+         HError(2319,"DoAlignment: mask %s has no match with segemnt %s",labFileMask,fn);
+      MakeFN(buf,labInDir,labInExt,lfn);
+   } else {
+      MakeFN(fn,labInDir,labInExt,lfn);
+   }
+   if (loadNetworks) {
+      if ( (nf = FOpen(lfn,NetFilter,&isPipe)) == NULL)
+         HError(3210,"DoAlignment: Cannot open Word Net file %s",lfn);
+      if((wdNet = ReadLattice(nf,x,&vocab,TRUE,FALSE))==NULL)
+         HError(3210,"DoAlignment: ReadLattice failed");
+      FClose(nf,isPipe);
+      if (trace&T_TOP) {
+         printf("Read lattice with %d nodes / %d arcs\n",
+                wdNet->nn,wdNet->na);
+         fflush(stdout);
+      }
+   }
+   else {
+      LabList *ll = NULL;
+
+      trans=LOpen(x,lfn,ifmt);
+      if (trans->numLists >= 1)
+         ll = GetLabelList(trans,1);
+      if (!ll && !bndId)
+         HError(3233, "DoAlignment: cannot align empty transcription");
+
+      wdNet=LatticeFromLabels(ll, bndId, &vocab,x);
+      if (trace&T_TOP) {
+         printf("Created lattice with %d nodes / %d arcs from label file\n",
+                wdNet->nn,wdNet->na);
+         fflush(stdout);
+      }
+   }
+   return ExpandWordNet(x,wdNet,&vocab,&hset);
+}
+
+/* RealignFile: repeat the alignment of fn with wider beams after the
+   first pass at genBeam has failed */
+void RealignFile(char *fn, Network *net, int n)
+{
    LogDouble currGenBeam;
+   Boolean completed = FALSE;
+
+   currGenBeam = genBeam + genBeamInc;
+   while (!completed && (currGenBeam <= genBeamLim - genBeamInc)) {
+      completed = ProcessFile (fn, net, n, currGenBeam, TRUE);
+      currGenBeam += genBeamInc;
+   }
+   if (!completed)
+      ProcessFile (fn, net, n, currGenBeam, FALSE);
+}
+
+/* AlignTask: run the recognition pass of every nThreads'th queued job
+   starting at job task */
+static void AlignTask(int thread, int task, Ptr arg)
+{
+   AlignJob *job;
+   int j,t;
+
+   for (j=task; j<nQueued; j+=nThreads) {
+      job = jobs+j;
+      StartRecognition(job->vri,job->net,lmScale,wordPen,prScale);
+      SetPruningLevels(job->vri,maxActive,genBeam,wordBeam,nBeam,tmBeam);
+      job->tact = 0;
+      for (t=0; t<job->nFrames; t++) {
+         ReadAsTable(job->pbuf,t,tobs+task);
+         ProcessObservation(job->vri,tobs+task,-1,NULL);
+         job->tact += job->vri->nact;
+      }
+   }
+}
+
+/* RunAlignJobs: align the queued jobs and output them in input order */
+static void RunAlignJobs(void)
+{
+   AlignJob *job;
+   int j;
+
+   RunThreadTasks(pool, nThreads, AlignTask, NULL);
+   for (j=0; j<nQueued; j++) {
+      job = jobs+j;
+      if (job->vri->lcache!=NULL)
+         CloseLikeCache(job->vri->lcache);
+      if (!CompleteFile(job->fn,job->vri,job->pbuf,&job->info,job->nFrames,
+                        job->tact,job->n,genBeam,genBeamInc!=0.0) &&
+          genBeamInc != 0.0)
+         RealignFile(job->fn,job->net,job->n);
+      ResetHeap(&job->heap);
+   }
+   nQueued = 0;
+}
+
+/* QueueAlignJob: read the data of the job with network net ready
+   for alignment by a worker thread, aligning a batch when it is full */
+static void QueueAlignJob(char *fn, Network *net, int n)
+{
+   AlignJob *job = jobs+nQueued;
+
+   strcpy(job->fn, fn); job->n = n; job->net = net;
+   job->pbuf = OpenDataBuffer(&job->heap,fn,&job->info);
+   if (job->vri->lcache!=NULL)
+      OpenLikeCache(job->vri->lcache,fn,NULL,NULL);
+   /* Read the file here so the workers only access pbuf as a table */
+   job->nFrames = 0;
+   StartBuffer(job->pbuf);
+   while(BufferStatus(job->pbuf)!=PB_CLEARED) {
+      ReadAsBuffer(job->pbuf,&obs);
+      job->nFrames++;
+   }
+   if (++nQueued == nJobs) RunAlignJobs();
+}
+
+/* InitAlignJobs: create the threads, their recogniser info and jobs */
+static void InitAlignJobs(void)
+{
+   char name[MAXSTRLEN];
+   int i;
+
+   pool = CreateThreadPool(&gstack, nThreads);
+   tpsi = (PSetInfo **) New(&gstack, nThreads*sizeof(PSetInfo *));
+   tobs = (Observation *) New(&gstack, nThreads*sizeof(Observation));
+   for (i=0; i<nThreads; i++) {
+      tpsi[i] = InitPSetInfo(&hset);
+      tobs[i] = MakeObservation(&gstack,hset.swidth,hset.pkind,FALSE,eSep);
+   }
+   nJobs = nThreads * JOBS_PER_THREAD;
+   jobs = (AlignJob *) New(&gstack, nJobs*sizeof(AlignJob));
+   for (i=0; i<nJobs; i++) {
+      sprintf(name,"Job %d heap",i);
+      CreateHeap(&jobs[i].heap,name,MSTAK,1,0,8000,80000);
+      /* jobs i, i+nThreads, ... are run in turn by the same task */
+      jobs[i].vri = InitVRecInfo(tpsi[i%nThreads],nToks,models,states);
+      if (vri->lcache!=NULL)
+         jobs[i].vri->lcache = CreateLikeCache(&gstack,&hset);
+   }
+   if (trace&T_TOP)
+      printf("Aligning with %d threads\n", nThreads);
+}
+
+/* CanUseThreads: check that the alignment may be run in parallel */
+static Boolean CanUseThreads(void)
+{
+   HMMScanState hss;
+   Boolean ok = TRUE;
+
+   if ((hset.hsKind != PLAINHS && hset.hsKind != SHAREDHS) ||
+       xfInfo.useInXForm || xfInfo.usePaXForm || xfInfo.useOutXForm ||
+       update > 0 || hset.semiTied != NULL || (trace&(T_OBS|T_FRS)))
+      return FALSE;
+   NewHMMScan(&hset,&hss);
+   while (ok && GoNextMix(&hss,FALSE))
+      if (hss.mp->ckind != DIAGC && hss.mp->ckind != INVDIAGC) ok = FALSE;
+   EndHMMScan(&hss);
+   return ok;
+}
+
+/* DoAlignment: by creating network from transcriptions or lattices */
+void DoAlignment(void)
+{
+   Network *net;
+   int n=0;
    AdaptXForm *incXForm;
 
    if (trace&T_TOP) {
@@ -918,6 +1146,11 @@ void DoAlignment(void)
          printf("Label file will be used to align each file\n");
       fflush(stdout);
    }
+   if (nThreads > 1 && !CanUseThreads()) {
+      HError(-3230,"DoAlignment: aligning with 1 thread, need diagonal PLAINHS or SHAREDHS models, no transforms and no frame tracing");
+      nThreads = 1;
+   }
+   if (nThreads > 1) InitAlignJobs();
    CreateHeap(&netHeap,"Net heap",MSTAK,1,0,8000,80000);
    while (NumArgs()>0) {
       if (NextArg() != STRINGARG)
@@ -926,64 +1159,22 @@ void DoAlignment(void)
       if (trace&T_TOP) {
          printf("Aligning File: %s\n",datFN);  fflush(stdout);
       }
-      if (labFileMask != NULL ) { /* support for rescoring lattice masks */
-         if (!MaskMatch(labFileMask,buf,datFN))
-            HError(2319,"DoAlignment: mask %s has no match with segemnt %s",labFileMask,datFN);
-         MakeFN(buf,labInDir,labInExt,lfn);
-      } else {
-         MakeFN(datFN,labInDir,labInExt,lfn);
-      }
-      if (loadNetworks) {
-         if ( (nf = FOpen(lfn,NetFilter,&isPipe)) == NULL)
-            HError(3210,"DoAlignment: Cannot open Word Net file %s",lfn);
-         if((wdNet = ReadLattice(nf,&netHeap,&vocab,TRUE,FALSE))==NULL)
-            HError(3210,"DoAlignment: ReadLattice failed");
-         FClose(nf,isPipe);
-         if (trace&T_TOP) {
-            printf("Read lattice with %d nodes / %d arcs\n",
-                   wdNet->nn,wdNet->na);
-            fflush(stdout);
-         }
-      }
-      else {
-         LabList *ll = NULL;
-
-         trans=LOpen(&netHeap,lfn,ifmt);
-         if (trans->numLists >= 1)
-            ll = GetLabelList(trans,1);
-         if (!ll && !bndId)
-            HError(3233, "DoAlignment: cannot align empty transcription");
-
-         wdNet=LatticeFromLabels(ll, bndId, &vocab,&netHeap);
-         if (trace&T_TOP) {
-            printf("Created lattice with %d nodes / %d arcs from label file\n",
-                   wdNet->nn,wdNet->na);
-            fflush(stdout);
-         }
-      }
-      net=ExpandWordNet(&netHeap,wdNet,&vocab,&hset);
+      net=LoadAlignNet((nThreads>1) ? &jobs[nQueued].heap : &netHeap,datFN);
 
       ++n;
-      currGenBeam = genBeam;
       /* This handles the initial input transform, parent transform setting
 	 and output transform creation */
       if (UpdateSpkrStats(&hset, &xfInfo, datFN) && (!(xfInfo.useInXForm)) && (hset.semiTied == NULL)) {
          xfInfo.inXForm = NULL;
       }
-      if (genBeamInc == 0.0)
-         ProcessFile (datFN, net, n, currGenBeam, FALSE);
-      else {
-         Boolean completed;
-
-         completed = ProcessFile (datFN, net, n, currGenBeam, TRUE);
-         currGenBeam += genBeamInc;
-         while (!completed && (currGenBeam <= genBeamLim - genBeamInc)) {
-            completed = ProcessFile (datFN, net, n, currGenBeam, TRUE);
-            currGenBeam += genBeamInc;
-         }
-         if (!completed)
-            ProcessFile (datFN, net, n, currGenBeam, FALSE);
+      if (nThreads > 1) {
+         QueueAlignJob(datFN, net, n);
+         continue;
       }
+      if (genBeamInc == 0.0)
+         ProcessFile (datFN, net, n, genBeam, FALSE);
+      else if (!ProcessFile (datFN, net, n, genBeam, TRUE))
+         RealignFile (datFN, net, n);
 
       if (update > 0 && n%update == 0) {
          if (trace&T_TOP) {
@@ -1004,6 +1195,7 @@ void DoAlignment(void)
       }
       ResetHeap(&netHeap);
    }
+   if (nQueued > 0) RunAlignJobs();
 }
 
 /* DoRecognition:  use single network to recognise each input utterance */
@@ -1015,20 +1207,31 @@ void DoRecognition(void)
    int n=0;
    AdaptXForm *incXForm;
 
-   if ( (nf = FOpen(wdNetFn,NetFilter,&isPipe)) == NULL)
-      HError(3210,"DoRecognition: Cannot open Word Net file %s",wdNetFn);
-   if((wdNet = ReadLattice(nf,&ansHeap,&vocab,TRUE,FALSE))==NULL)
-      HError(3210,"DoAlignment: ReadLattice failed");
-   FClose(nf,isPipe);
-
-   if (trace&T_TOP) {
-      printf("Read lattice with %d nodes / %d arcs\n",wdNet->nn,wdNet->na);
-      fflush(stdout);
+   if (loadNetFn!=NULL) {
+      CreateHeap(&netHeap,"Net heap",MSTAK,1,0,100000,800000);
+      net = ReadNetwork(&netHeap,loadNetFn,&vocab,&hset);
+      if (trace&T_TOP) {
+         printf("Loaded network from %s\n",loadNetFn); fflush(stdout);
+      }
    }
-   CreateHeap(&netHeap,"Net heap",MSTAK,1,0,
-              wdNet->na*sizeof(NetLink),wdNet->na*sizeof(NetLink));
+   else {
+      if ( (nf = FOpen(wdNetFn,NetFilter,&isPipe)) == NULL)
+         HError(3210,"DoRecognition: Cannot open Word Net file %s",wdNetFn);
+      if((wdNet = ReadLattice(nf,&ansHeap,&vocab,TRUE,FALSE))==NULL)
+         HError(3210,"DoAlignment: ReadLattice failed");
+      FClose(nf,isPipe);
 
-   net = ExpandWordNet(&netHeap,wdNet,&vocab,&hset);
+      if (trace&T_TOP) {
+         printf("Read lattice with %d nodes / %d arcs\n",wdNet->nn,wdNet->na);
+         fflush(stdout);
+      }
+      CreateHeap(&netHeap,"Net heap",MSTAK,1,0,
+                 wdNet->na*sizeof(NetLink),wdNet->na*sizeof(NetLink));
+
+      net = ExpandWordNet(&netHeap,wdNet,&vocab,&hset);
+      if (saveNetFn!=NULL && WriteNetwork(net,saveNetFn,&hset)<SUCCESS)
+         HError(3214,"DoRecognition: Cannot save network to %s",saveNetFn);
+   }
    ResetHeap(&ansHeap);
    if (trace&T_TOP) {
       printf("Created network with %d nodes / %d links\n",